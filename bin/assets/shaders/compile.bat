@@ -2,6 +2,11 @@ C:/VulkanSDK/1.1.101.0/Bin32/glslangValidator.exe -o vert.spv        -V shader.v
 C:/VulkanSDK/1.1.101.0/Bin32/glslangValidator.exe -o frag.spv        -V shader.frag
 C:/VulkanSDK/1.1.101.0/Bin32/glslangValidator.exe -o deferred_vs.spv -V deferred.vert
 C:/VulkanSDK/1.1.101.0/Bin32/glslangValidator.exe -o deferred_fs.spv -V deferred.frag
+C:/VulkanSDK/1.1.101.0/Bin32/glslangValidator.exe -DSUBPASS_INPUTS -o deferred_subpass_fs.spv -V deferred.frag
 C:/VulkanSDK/1.1.101.0/Bin32/glslangValidator.exe -o mrt_vs.spv -V mrt.vert
 C:/VulkanSDK/1.1.101.0/Bin32/glslangValidator.exe -o mrt_fs.spv -V mrt.frag
+C:/VulkanSDK/1.1.101.0/Bin32/glslangValidator.exe -o tiled_cull_cs.spv -V tiled_cull.comp
+C:/VulkanSDK/1.1.101.0/Bin32/glslangValidator.exe -o light_volume_vs.spv -V light_volume.vert
+C:/VulkanSDK/1.1.101.0/Bin32/glslangValidator.exe -o depth_vs.spv -V depth.vert
+C:/VulkanSDK/1.1.101.0/Bin32/glslangValidator.exe -o upscale_fs.spv -V upscale.frag
 pause
\ No newline at end of file
@@ -1,11 +1,38 @@
 #version 450
 
+#define TILE_SIZE 16
+#define MAX_LIGHTS_PER_TILE 256
+#define CLUSTER_COUNT_X 16
+#define CLUSTER_COUNT_Y 9
+#define CLUSTER_COUNT_Z 24
+
+layout (constant_id = 0) const bool TiledLighting = false;
+layout (constant_id = 1) const bool ClusteredLighting = false;
+layout (constant_id = 2) const bool LightVolumes = false;
+// Binding 1 holds depth instead of position and normals are octahedral encoded
+layout (constant_id = 3) const bool CompactGBuffer = false;
+
+// Built with -DSUBPASS_INPUTS for the merged render pass, where lighting reads the G-buffer as input attachments of the same pixel
+#ifdef SUBPASS_INPUTS
+layout (input_attachment_index = 0, set = 1, binding = 0) uniform subpassInput samplerposition;
+layout (input_attachment_index = 1, set = 1, binding = 1) uniform subpassInput samplerNormal;
+layout (input_attachment_index = 2, set = 1, binding = 2) uniform subpassInput samplerAlbedo;
+layout (input_attachment_index = 3, set = 1, binding = 3) uniform subpassInput samplerMaterial;
+#define LoadGBuffer(target, uv) subpassLoad(target)
+#define GBufferSize() ubo.gBufferSize.xy
+#else
 layout (binding = 1) uniform sampler2D samplerposition;
 layout (binding = 2) uniform sampler2D samplerNormal;
 layout (binding = 3) uniform sampler2D samplerAlbedo;
 layout (binding = 4) uniform sampler2D samplerMaterial;
+#define LoadGBuffer(target, uv) texture(target, uv)
+#define GBufferSize() vec2(textureSize(samplerposition, 0))
+#endif
+// With dynamic resolution only the top left RenderSize() pixels of the G-buffer hold this frame
+#define RenderSize() ubo.gBufferSize.zw
 
 layout (location = 0) in vec2 inUV;
+layout (location = 1) flat in int inLightIndex;
 
 layout (location = 0) out vec4 outFragcolor;
 
@@ -18,14 +45,58 @@ struct Light {
 layout (binding = 5) uniform UBO 
 {
 	vec4 viewPos;
+	mat4 view;
+	mat4 invViewProjection;
+	vec4 clusterParams; // x = slice scale, y = slice bias
+	vec4 gBufferSize; // xy = attachment size, zw = the part of it rendered this frame
 } ubo;
 
-layout(push_constant) uniform PushConstants {
-	Light light;
-} push;
+layout (std430, binding = 6) readonly buffer Lights
+{
+	Light lights[];
+};
+
+struct Tile {
+	uint count;
+	uint indices[MAX_LIGHTS_PER_TILE];
+};
+
+layout (std430, binding = 7) readonly buffer Tiles
+{
+	Tile tiles[];
+};
+
+struct Cluster {
+	uint offset;
+	uint count;
+};
+
+layout (std430, binding = 8) readonly buffer Clusters
+{
+	Cluster clusters[];
+};
+
+layout (std430, binding = 9) readonly buffer ClusterIndices
+{
+	uint clusterIndices[];
+};
 
 float PI = 3.1415;
 
+vec3 OctDecode(vec2 e)
+{
+	vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	float t = clamp(-n.z, 0.0, 1.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+vec3 ReconstructPosition(vec2 uv, float depth)
+{
+	vec4 position = ubo.invViewProjection * vec4(uv * 2.0 - 1.0, depth, 1.0);
+	return position.xyz / position.w;
+}
+
 vec3 Diffuse(vec3 pAlbedo)
 {
     return pAlbedo/ PI;
@@ -97,28 +168,65 @@ vec3 ComputeLight(vec3 albedoColor,vec3 specularColor, vec3 normal, float roughn
     return lightColor * NdL * (cDiff * (1.0 - cSpec) + cSpec);
 }
 
-void main() 
+vec3 ShadeLight(Light light, vec3 fragPos, vec3 normal, vec3 albedo, vec4 material, vec3 toEye)
 {
-	vec3 fragPos = texture(samplerposition, inUV).rgb;
-	vec3 normal = texture(samplerNormal, inUV).rgb;
-	vec4 albedoEmissive = texture(samplerAlbedo, inUV);
-	vec4 material = texture(samplerMaterial, inUV);
-	vec3 emissive = albedoEmissive.rgb * albedoEmissive.a;
-	vec3 albedo = albedoEmissive.rgb;
-
-	vec3 toEye = normalize(ubo.viewPos.xyz - fragPos);
-	vec3 tl = push.light.position.xyz - fragPos;
+	vec3 tl = light.position.xyz - fragPos;
 	float toLightDistance = length(tl);
-	float distanceSqr = dot(tl, tl);
 	tl = normalize(tl);
 
-	float falloff = ((pow(clamp(1.0 - pow(toLightDistance / push.light.radius, 4),0.0,1.0), 2)) / (toLightDistance * toLightDistance + 1)) * 8;
+	float falloff = ((pow(clamp(1.0 - pow(toLightDistance / light.radius, 4),0.0,1.0), 2)) / (toLightDistance * toLightDistance + 1)) * 8;
 
 	vec3 spec = mix(vec3(0.04), albedo, vec3(material.g));
-	vec3 fragColor = ComputeLight(albedo, spec, normal, material.r, push.light.color, tl, toEye) * falloff;
+	return ComputeLight(albedo, spec, normal, material.r, light.color, tl, toEye) * falloff;
+}
+
+void main() 
+{
+	// Light volumes rasterize a sphere, so the screen UV comes from the pixel position instead of the quad.
+	// The G-buffer UV only covers the rendered part of the attachments
+	vec2 screenUV = LightVolumes ? gl_FragCoord.xy / RenderSize() : inUV;
+	vec2 uv = screenUV * RenderSize() / GBufferSize();
+
+	vec3 fragPos = CompactGBuffer ? ReconstructPosition(screenUV, LoadGBuffer(samplerposition, uv).r) : LoadGBuffer(samplerposition, uv).rgb;
+	vec3 normal = CompactGBuffer ? OctDecode(LoadGBuffer(samplerNormal, uv).rg) : LoadGBuffer(samplerNormal, uv).rgb;
+	vec4 albedoEmissive = LoadGBuffer(samplerAlbedo, uv);
+	vec4 material = LoadGBuffer(samplerMaterial, uv);
+	vec3 emissive = albedoEmissive.rgb * albedoEmissive.a;
+	vec3 albedo = albedoEmissive.rgb;
+
+	vec3 toEye = normalize(ubo.viewPos.xyz - fragPos);
 
 	vec3 color = vec3(0.0);//albedo * material.b * 0.05; //ambient
-	color += fragColor;
+
+	if (TiledLighting)
+	{
+		// Light culling only dispatches over the rendered extent, so rows are that many tiles wide
+		uint tilesX = (uint(RenderSize().x) + TILE_SIZE - 1) / TILE_SIZE;
+		uvec2 tile = uvec2(gl_FragCoord.xy) / TILE_SIZE;
+		uint tileIndex = tile.y * tilesX + tile.x;
+
+		for (uint i = 0; i < tiles[tileIndex].count; ++i)
+		{
+			color += ShadeLight(lights[tiles[tileIndex].indices[i]], fragPos, normal, albedo, material, toEye);
+		}
+	}
+	else if (ClusteredLighting)
+	{
+		// Same froxel layout as LightClusterer: screen tiles by exponential view depth slices
+		float viewZ = max((ubo.view * vec4(fragPos, 1.0)).z, 0.0001);
+		uint slice = uint(clamp(log(viewZ) * ubo.clusterParams.x + ubo.clusterParams.y, 0.0, float(CLUSTER_COUNT_Z - 1)));
+		uvec2 tile = min(uvec2(screenUV * vec2(CLUSTER_COUNT_X, CLUSTER_COUNT_Y)), uvec2(CLUSTER_COUNT_X - 1, CLUSTER_COUNT_Y - 1));
+		Cluster cluster = clusters[tile.x + tile.y * CLUSTER_COUNT_X + slice * CLUSTER_COUNT_X * CLUSTER_COUNT_Y];
+
+		for (uint i = 0; i < cluster.count; ++i)
+		{
+			color += ShadeLight(lights[clusterIndices[cluster.offset + i]], fragPos, normal, albedo, material, toEye);
+		}
+	}
+	else
+	{
+		color += ShadeLight(lights[inLightIndex], fragPos, normal, albedo, material, toEye);
+	}
 
     outFragcolor = vec4(color, 1.0);
-}
\ No newline at end of file
+}
@@ -1,6 +1,7 @@
 #version 450
 
 layout (location = 0) out vec2 outUV;
+layout (location = 1) flat out int outLightIndex;
 
 out gl_PerVertex
 {
@@ -11,4 +12,5 @@ void main()
 {
 	outUV = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
 	gl_Position = vec4(outUV * 2.0f - 1.0f, 0.0f, 1.0f);
+	outLightIndex = gl_InstanceIndex;
 }
@@ -0,0 +1,18 @@
+#version 450
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 4) in mat4 inModel;
+
+layout(binding = 0) uniform UniformBufferObject
+{
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+// Must match mrt.vert bit for bit, the G-buffer pass depth tests EQUAL against what this writes
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = ubo.proj * ubo.view * inModel * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,39 @@
+#version 450
+
+layout (location = 0) in vec3 inPosition;
+
+layout (binding = 0) uniform UBO
+{
+	mat4 view;
+	mat4 proj;
+} ubo;
+
+struct Light {
+	vec4 position;
+	vec3 color;
+	float radius;
+};
+
+layout (std430, binding = 6) readonly buffer Lights
+{
+	Light lights[];
+};
+
+layout (location = 0) out vec2 outUV;
+layout (location = 1) flat out int outLightIndex;
+
+out gl_PerVertex
+{
+	vec4 gl_Position;
+};
+
+void main()
+{
+	Light light = lights[gl_InstanceIndex];
+	vec3 worldPos = light.position.xyz + inPosition * light.radius;
+	gl_Position = ubo.proj * ubo.view * vec4(worldPos, 1.0);
+
+	// The fragment shader rebuilds the G-buffer UV from gl_FragCoord
+	outUV = vec2(0.0);
+	outLightIndex = gl_InstanceIndex;
+}
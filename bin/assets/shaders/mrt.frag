@@ -1,5 +1,8 @@
 #version 450
 
+// Compact packs the G-buffer into RG16F normal, RGBA8 albedo and RGBA8 material, position comes from depth
+layout (constant_id = 0) const bool CompactGBuffer = false;
+
 layout (binding = 1) uniform sampler2D samplerColor;
 layout (binding = 2) uniform sampler2D samplerNormalMap;
 layout (binding = 3) uniform sampler2D samplerMaterial;
@@ -9,10 +12,24 @@ layout (location = 1) in vec2 inUV;
 layout (location = 2) in vec3 inWorldPos;
 layout (location = 3) in vec3 inTangent;
 
-layout (location = 0) out vec4 outPosition;
-layout (location = 1) out vec4 outNormal;
-layout (location = 2) out vec4 outAlbedo;
-layout (location = 3) out vec4 outMaterial;
+// Standard: position, normal, albedo, material. Compact: normal, albedo, material
+layout (location = 0) out vec4 outTarget0;
+layout (location = 1) out vec4 outTarget1;
+layout (location = 2) out vec4 outTarget2;
+layout (location = 3) out vec4 outTarget3;
+
+// Octahedral normal encoding, keeps precision spread evenly over the sphere in two channels
+vec2 OctWrap(vec2 v)
+{
+	return (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+vec2 OctEncode(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	n.xy = n.z >= 0.0 ? n.xy : OctWrap(n.xy);
+	return n.xy;
+}
 
 void main() 
 {
@@ -24,8 +41,6 @@ void main()
 	float roughness = material.g;
 	float ambient = norm.a;
 
-	outPosition = vec4(inWorldPos, 1.0);
-
 	// Calculate normal in tangent space
 	vec3 N = normalize(inNormal);
 	N.y = -N.y;
@@ -34,7 +49,17 @@ void main()
 	mat3 TBN = mat3(T, B, N);
 	vec3 tnorm = TBN * normalize(norm.xyz * 2.0 - vec3(1.0));
 
-	outNormal = vec4(tnorm, 1.0);
-	outAlbedo = vec4(albedo.rgb, material.b);
-	outMaterial = vec4(roughness, metalness, ambient, 1.0);
+	if (CompactGBuffer)
+	{
+		outTarget0 = vec4(OctEncode(normalize(tnorm)), 0.0, 0.0);
+		outTarget1 = vec4(albedo.rgb, material.b);
+		outTarget2 = vec4(roughness, metalness, ambient, 1.0);
+	}
+	else
+	{
+		outTarget0 = vec4(inWorldPos, 1.0);
+		outTarget1 = vec4(tnorm, 1.0);
+		outTarget2 = vec4(albedo.rgb, material.b);
+		outTarget3 = vec4(roughness, metalness, ambient, 1.0);
+	}
 }
\ No newline at end of file
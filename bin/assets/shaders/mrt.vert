@@ -4,6 +4,7 @@ layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec2 inUV;
 layout(location = 2) in vec3 inNormal;
 layout(location = 3) in vec3 inTangent;
+layout(location = 4) in mat4 inModel;
 
 layout(binding = 0) uniform UniformBufferObject
 {
@@ -11,29 +12,28 @@ layout(binding = 0) uniform UniformBufferObject
     mat4 proj;
 } ubo;
 
-layout(push_constant) uniform PushConstants {
-	mat4 model;
-} push;
-
 layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec2 outUV;
 layout (location = 2) out vec3 outWorldPos;
 layout (location = 3) out vec3 outTangent;
 
+// Shared with depth.vert so the depth pre-pass and the EQUAL tested G-buffer pass produce the same depth
+invariant gl_Position;
+
 void main()
 {
-    gl_Position = ubo.proj * ubo.view * push.model * vec4(inPosition, 1.0);
+    gl_Position = ubo.proj * ubo.view * inModel * vec4(inPosition, 1.0);
 	
 	outUV = inUV;
 	outUV.t = 1.0 - outUV.t;
 
 	// Vertex position in world space
-	outWorldPos = vec3(push.model * vec4(inPosition,1.0));
+	outWorldPos = vec3(inModel * vec4(inPosition,1.0));
 	// GL to Vulkan coord space
 	// outWorldPos.y = -outWorldPos.y;
 	
 	// Normal in world space
-	mat3 mNormal = transpose(inverse(mat3(push.model)));
+	mat3 mNormal = transpose(inverse(mat3(inModel)));
 	outNormal = mNormal * normalize(inNormal);	
 	outTangent = mNormal * normalize(inTangent);
 }
@@ -0,0 +1,42 @@
+#version 450
+
+// Stretches the rendered part of the scene color target over the swapchain image, see Renderer::RecordUpscale
+layout (constant_id = 0) const float Sharpness = 0.0;
+
+layout (binding = 0) uniform sampler2D samplerScene;
+
+layout (push_constant) uniform PushConstants
+{
+	vec2 uvScale;	// rendered extent over the target size
+	vec2 texelSize;
+} push;
+
+layout (location = 0) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragcolor;
+
+void main()
+{
+	// Bilinear taps stay half a texel inside the rendered area, past it are pixels from an earlier, larger frame
+	vec2 minUV = push.texelSize * 0.5;
+	vec2 maxUV = push.uvScale - push.texelSize * 0.5;
+	vec2 uv = clamp(inUV * push.uvScale, minUV, maxUV);
+
+	vec3 color = texture(samplerScene, uv).rgb;
+
+	if (Sharpness > 0.0)
+	{
+		// Unsharp mask against the four neighbours, clamped to their range so edges don't ring
+		vec3 north = texture(samplerScene, clamp(uv - vec2(0.0, push.texelSize.y), minUV, maxUV)).rgb;
+		vec3 south = texture(samplerScene, clamp(uv + vec2(0.0, push.texelSize.y), minUV, maxUV)).rgb;
+		vec3 west = texture(samplerScene, clamp(uv - vec2(push.texelSize.x, 0.0), minUV, maxUV)).rgb;
+		vec3 east = texture(samplerScene, clamp(uv + vec2(push.texelSize.x, 0.0), minUV, maxUV)).rgb;
+
+		vec3 low = min(color, min(min(north, south), min(west, east)));
+		vec3 high = max(color, max(max(north, south), max(west, east)));
+		vec3 sharpened = color + (color * 4.0 - north - south - west - east) * Sharpness;
+		color = clamp(sharpened, low, high);
+	}
+
+	outFragcolor = vec4(color, 1.0);
+}
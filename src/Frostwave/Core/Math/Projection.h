@@ -0,0 +1,65 @@
+#pragma once
+#include "Vector.h"
+#include "Matrix4x4.h"
+
+#include <cmath>
+
+namespace frostwave
+{
+	// Screen-space bounds of a view space sphere, for projections built by Matrix4x4::CreatePerspectiveProjection.
+	// aMin/aMax are in normalized device coordinates, clamped to [-1, 1].
+	// Returns false when the sphere is entirely outside the view, so nothing it touches is on screen.
+	template<class T>
+	inline bool ProjectSphere(const Vector3<T>& aCenter, T aRadius, const Matrix4x4<T>& aProjection, Vector2<T>& aMin, Vector2<T>& aMax)
+	{
+		// x' = A * x, y' = -B * y, z' = C * z + E, w' = z
+		const T A = aProjection[0];
+		const T B = -aProjection[5];
+		const T C = aProjection[10];
+		const T E = aProjection[14];
+		const T nearZ = -E / C;
+		const T farZ = E / ((T)1 - C);
+
+		if (aCenter.z + aRadius < nearZ || aCenter.z - aRadius > farZ)
+		{
+			return false;
+		}
+
+		// Crossing the near plane the silhouette is unbounded, so fall back to the whole screen
+		if (aCenter.z - aRadius < nearZ)
+		{
+			aMin = Vector2<T>((T)-1, (T)-1);
+			aMax = Vector2<T>((T)1, (T)1);
+			return true;
+		}
+
+		// Slopes of the two lines through the eye tangent to the circle in the (a, z) plane:
+		// m = (a * z +- r * sqrt(a^2 + z^2 - r^2)) / (z^2 - r^2)
+		auto tangentSlopes = [&](T aAxis, T& aLow, T& aHigh)
+		{
+			const T radiusSq = aRadius * aRadius;
+			const T root = aRadius * std::sqrt(aAxis * aAxis + aCenter.z * aCenter.z - radiusSq);
+			const T denominator = aCenter.z * aCenter.z - radiusSq;
+			aLow = (aAxis * aCenter.z - root) / denominator;
+			aHigh = (aAxis * aCenter.z + root) / denominator;
+		};
+
+		T lowX, highX, lowY, highY;
+		tangentSlopes(aCenter.x, lowX, highX);
+		tangentSlopes(aCenter.y, lowY, highY);
+
+		// The projection flips y, so the low slope maps to the high NDC value
+		aMin = Vector2<T>(A * lowX, -B * highY);
+		aMax = Vector2<T>(A * highX, -B * lowY);
+
+		if (aMax.x < (T)-1 || aMin.x > (T)1 || aMax.y < (T)-1 || aMin.y > (T)1)
+		{
+			return false;
+		}
+
+		aMin = Vector2<T>(std::fmax(aMin.x, (T)-1), std::fmax(aMin.y, (T)-1));
+		aMax = Vector2<T>(std::fmin(aMax.x, (T)1), std::fmin(aMax.y, (T)1));
+		return true;
+	}
+}
+namespace fw = frostwave;
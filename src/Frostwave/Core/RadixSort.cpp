@@ -0,0 +1,123 @@
+#include "stdafx.h"
+#include "RadixSort.h"
+
+#include <Frostwave/Core/Common.h>
+
+#include <functional>
+
+namespace
+{
+	constexpr u32 RadixBits = 8;
+	constexpr u32 BucketCount = 1 << RadixBits;
+	constexpr u32 PassCount = 64 / RadixBits;
+	// Below this, handing chunks to the workers costs more than sorting them
+	constexpr u32 ParallelThreshold = 4096;
+}
+
+void frostwave::RadixSort(std::vector<SortItem>& aItems, std::vector<SortItem>& aScratch, ThreadPool* aThreadPool)
+{
+	const u32 count = (u32)aItems.size();
+	aScratch.resize(count);
+	if (count < 2)
+	{
+		return;
+	}
+
+	const u32 workerCount = aThreadPool && count >= ParallelThreshold ? fw::Max(aThreadPool->GetThreadCount(), 1u) : 1u;
+	const u32 chunkSize = (count + workerCount - 1) / workerCount;
+
+	// Every worker owns the same chunk in each step, which is what keeps the scatter stable
+	auto forEachChunk = [&](const std::function<void(u32, u32, u32)>& aJob)
+	{
+		if (workerCount == 1)
+		{
+			aJob(0, 0, count);
+			return;
+		}
+
+		for (u32 w = 0; w < workerCount; ++w)
+		{
+			u32 begin = fw::Min(w * chunkSize, count);
+			u32 end = fw::Min(begin + chunkSize, count);
+			aThreadPool->GetThreads()[w]->AddJob([&aJob, w, begin, end]()
+			{
+				aJob(w, begin, end);
+			});
+		}
+		aThreadPool->Wait();
+	};
+
+	// Bits that differ between any two keys, bytes without any are already sorted
+	std::vector<u64> anyBits(workerCount, 0);
+	std::vector<u64> allBits(workerCount, ~0ull);
+	forEachChunk([&](u32 aWorker, u32 aBegin, u32 aEnd)
+	{
+		u64 any = 0, all = ~0ull;
+		for (u32 i = aBegin; i < aEnd; ++i)
+		{
+			any |= aItems[i].key;
+			all &= aItems[i].key;
+		}
+		anyBits[aWorker] = any;
+		allBits[aWorker] = all;
+	});
+
+	u64 varyingBits = 0, commonBits = ~0ull;
+	for (u32 w = 0; w < workerCount; ++w)
+	{
+		varyingBits |= anyBits[w];
+		commonBits &= allBits[w];
+	}
+	varyingBits &= ~commonBits;
+
+	std::vector<u32> histograms(workerCount * BucketCount);
+	SortItem* source = aItems.data();
+	SortItem* destination = aScratch.data();
+
+	for (u32 pass = 0; pass < PassCount; ++pass)
+	{
+		const u32 shift = pass * RadixBits;
+		if (((varyingBits >> shift) & (BucketCount - 1)) == 0)
+		{
+			continue;
+		}
+
+		forEachChunk([&](u32 aWorker, u32 aBegin, u32 aEnd)
+		{
+			u32* histogram = &histograms[aWorker * BucketCount];
+			std::fill(histogram, histogram + BucketCount, 0u);
+			for (u32 i = aBegin; i < aEnd; ++i)
+			{
+				++histogram[(source[i].key >> shift) & (BucketCount - 1)];
+			}
+		});
+
+		// Bucket major, worker minor, so earlier chunks land first within each bucket
+		u32 offset = 0;
+		for (u32 b = 0; b < BucketCount; ++b)
+		{
+			for (u32 w = 0; w < workerCount; ++w)
+			{
+				u32 bucketCount = histograms[w * BucketCount + b];
+				histograms[w * BucketCount + b] = offset;
+				offset += bucketCount;
+			}
+		}
+
+		forEachChunk([&](u32 aWorker, u32 aBegin, u32 aEnd)
+		{
+			u32* offsets = &histograms[aWorker * BucketCount];
+			for (u32 i = aBegin; i < aEnd; ++i)
+			{
+				destination[offsets[(source[i].key >> shift) & (BucketCount - 1)]++] = source[i];
+			}
+		});
+
+		std::swap(source, destination);
+	}
+
+	if (source != aItems.data())
+	{
+		aItems.swap(aScratch);
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <Frostwave/Core/Types.h>
+#include <Frostwave/ThreadPool.h>
+
+#include <vector>
+
+namespace frostwave
+{
+	struct SortItem
+	{
+		u64 key;
+		u32 value;
+	};
+
+	// Stable LSD radix sort on SortItem::key, 8 bits per pass. Passes where every key shares the same byte are skipped,
+	// so unused high bits cost nothing. With a thread pool every pass histograms and scatters one chunk per worker.
+	// aScratch is resized to match and can be kept around between calls to avoid reallocating.
+	void RadixSort(std::vector<SortItem>& aItems, std::vector<SortItem>& aScratch, ThreadPool* aThreadPool = nullptr);
+}
+namespace fw = frostwave;
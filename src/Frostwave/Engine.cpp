@@ -3,14 +3,17 @@
 #include "GLFWExtras.h"
 #include <thread>
 
-frostwave::Engine::Engine() : myShouldRun(true), myShouldRenderModel(true)
+frostwave::Engine::Engine() : myWindow(nullptr), myShouldRun(true), myShouldRenderModel(true)
 {
 }
 
 frostwave::Engine::~Engine()
 {
-	glfwDestroyWindow(myWindow);
-	glfwTerminate();
+	if (myWindow)
+	{
+		glfwDestroyWindow(myWindow);
+		glfwTerminate();
+	}
 }
 
 void frostwave::Engine::RenderFrame()
@@ -25,6 +28,12 @@ void KeyCallback(GLFWwindow* aWindow, i32 aKey, i32 aScancode, i32 aAction, i32
 		auto* engine = (frostwave::Engine*)(glfwGetWindowUserPointer(aWindow));
 		engine->SetShouldRenderModel(!engine->GetShouldRenderModel());
 	}
+
+	if (aKey == GLFW_KEY_P && aAction == GLFW_PRESS)
+	{
+		auto* engine = (frostwave::Engine*)(glfwGetWindowUserPointer(aWindow));
+		engine->GetScene().SetDepthPrepass(!engine->GetScene().GetDepthPrepass());
+	}
 }
 
 void frostwave::Engine::FramebufferResizeCallback(GLFWwindow* aWindow, i32 aWidth, i32 aHeight)
@@ -99,8 +108,15 @@ const string MATERIAL_PATH = "assets/textures/chest_MRE.png";
 void frostwave::Engine::Init(Settings aSettings)
 {
 	mySettings = aSettings;
-	InitWindow();
-	myVKFramework.Init(myWindow, aSettings.graphics);
+	if (mySettings.window.headless)
+	{
+		myVKFramework.InitHeadless(mySettings.window.width, mySettings.window.height, aSettings.graphics);
+	}
+	else
+	{
+		InitWindow();
+		myVKFramework.Init(myWindow, aSettings.graphics);
+	}
 	myRenderer.Init(&myVKFramework);
 
 	ImageCreateInfo iinfo = {};
@@ -130,17 +146,53 @@ void frostwave::Engine::Init(Settings aSettings)
 
 	myFloorInstance = new fw::ModelInstance(&myFloor);
 
+	// Starts the level's uploads now instead of at the first frame
+	myVKFramework.GetUploadContext().Submit();
+
 	myCamera.Init(90.0f, mySettings.window.width / (f32)mySettings.window.height, 0.01f, 100.0f);
 	myCamera.SetPosition({ 8,8,8 });
 }
 
+void frostwave::Engine::UpdateScene()
+{
+	myScene.Submit(PointLight{ {tanf((f32)myTimer.GetTotalTime() * -0.1f) * 4.0f,10.0f,tanf((f32)myTimer.GetTotalTime() * -0.1f) * 4.0f,0}, fw::Vec3f{1.5f,1.5f,0.0f} * 16.0f, 20.0f });
+	myScene.Submit(PointLight{ {-4.0f * cosf((f32)myTimer.GetTotalTime() * -1.5f),3.0f,-4.0f * sinf((f32)myTimer.GetTotalTime() * -1.5f),0}, {0.0f,1.0f,1.0f}, 10.5f });
+	myScene.Submit(PointLight{ {2.0f * cosf((f32)myTimer.GetTotalTime()),2.0f,2.0f * sinf((f32)myTimer.GetTotalTime()),0}, {1.0f,0.0f,1.0f}, 5.0f });
+	myScene.Submit(PointLight{ {0,4.0f,0,0}, {2.0f,2.0f,2.0f}, 50.0f });
+
+	myFloorInstance->SetPosition({ -100.0f,-1,-100.0f });
+	myScene.Submit(myFloorInstance);
+
+	for (i32 i = 0; i < 10; ++i)
+	{
+		if (myShouldRenderModel)
+		{
+			myScene.Submit(myInstances[i]);
+		}
+
+		myInstances[i]->SetPosition({ cosf((f32)myTimer.GetTotalTime() + (i * 4)) * (i * 4), 0, sinf((f32)myTimer.GetTotalTime() + (i * 4)) * (i * 4) });
+		myInstances[i]->SetRotation(fw::Quatf({ 0,1,0 }, (f32)myTimer.GetTotalTime() * (-i)));
+		//	fw::Quatf({ 1,0,1 }, (f32)myTimer.GetTotalTime() * (i)) *
+		//	fw::Quatf({ 0,1,1 }, (f32)myTimer.GetTotalTime() * (i)));
+	}
+
+	myCamera.SetRotation(fw::Mat4f::CreateLookAt(0, myCamera.GetPosition(), { 0,1,0 }));
+	myCamera.Update();
+}
+
 void frostwave::Engine::Run()
 {
 	while (!glfwWindowShouldClose(myWindow) && myShouldRun)
 	{
 		glfwPollEvents();
 		myTimer.Update();
-		glfwSetWindowTitle(myWindow, (mySettings.window.title + " | " + fw::ToString(myTimer.GetDeltaTime() * 1000.0f) + "ms").c_str());
+		const fw::Scene::SortStats& sortStats = myScene.GetSortStats();
+		glfwSetWindowTitle(myWindow, (mySettings.window.title + " | " + fw::ToString(myTimer.GetDeltaTime() * 1000.0f) + "ms"
+			+ " | gpu " + fw::ToString(myRenderer.GetGpuTimer().GetAverageTime(fw::GpuTimer::Frame)) + "ms"
+			+ " | draws " + fw::ToString(myRenderer.GetFrameCounters().draws)
+			+ " | scale " + fw::ToString(myRenderer.GetRenderScale())
+			+ " | binds " + fw::ToString(sortStats.unsortedBinds) + " -> " + fw::ToString(sortStats.sortedBinds)
+			+ " | fragmentation " + fw::ToString(myVKFramework.GetDefragmenter().GetMetrics().fragmentation)).c_str());
 
 		if (mySettings.window.focusFreeze && !glfwGetWindowAttrib(myWindow, GLFW_FOCUSED))
 		{
@@ -148,33 +200,70 @@ void frostwave::Engine::Run()
 			continue;
 		}
 
-		myScene.Submit(PointLight{ {tanf((f32)myTimer.GetTotalTime() * -0.1f) * 4.0f,10.0f,tanf((f32)myTimer.GetTotalTime() * -0.1f) * 4.0f,0}, fw::Vec3f{1.5f,1.5f,0.0f} * 16.0f, 20.0f });
-		myScene.Submit(PointLight{ {-4.0f * cosf((f32)myTimer.GetTotalTime() * -1.5f),3.0f,-4.0f * sinf((f32)myTimer.GetTotalTime() * -1.5f),0}, {0.0f,1.0f,1.0f}, 10.5f });
-		myScene.Submit(PointLight{ {2.0f * cosf((f32)myTimer.GetTotalTime()),2.0f,2.0f * sinf((f32)myTimer.GetTotalTime()),0}, {1.0f,0.0f,1.0f}, 5.0f });
-		myScene.Submit(PointLight{ {0,4.0f,0,0}, {2.0f,2.0f,2.0f}, 50.0f });
+		UpdateScene();
+		RenderFrame();
+	}
 
-		myFloorInstance->SetPosition({ -100.0f,-1,-100.0f });
-		myScene.Submit(myFloorInstance);
+	//shutdown has happened
+	Destroy();
+}
+
+void frostwave::Engine::RunFrames(u32 aFrameCount)
+{
+	// The first frames include pipeline warm up and the timer's start, so they are rendered but not counted
+	const u32 warmupFrames = fw::Clamp(aFrameCount / 10, 1u, 16u);
 
-		for (i32 i = 0; i < 10; ++i)
+	std::vector<f32> frameTimes;
+	frameTimes.reserve(aFrameCount);
+
+	for (u32 i = 0; i < aFrameCount + warmupFrames && myShouldRun; ++i)
+	{
+		myTimer.Update();
+		if (i >= warmupFrames)
 		{
-			if (myShouldRenderModel)
-			{
-				myScene.Submit(myInstances[i]);
-			}
-
-			myInstances[i]->SetPosition({ cosf((f32)myTimer.GetTotalTime() + (i * 4)) * (i * 4), 0, sinf((f32)myTimer.GetTotalTime() + (i * 4)) * (i * 4) });
-			myInstances[i]->SetRotation(fw::Quatf({ 0,1,0 }, (f32)myTimer.GetTotalTime() * (-i)));
-			//	fw::Quatf({ 1,0,1 }, (f32)myTimer.GetTotalTime() * (i)) *
-			//	fw::Quatf({ 0,1,1 }, (f32)myTimer.GetTotalTime() * (i)));
+			frameTimes.push_back(myTimer.GetDeltaTime() * 1000.0f);
 		}
 
-		myCamera.SetRotation(fw::Mat4f::CreateLookAt(0, myCamera.GetPosition(), { 0,1,0 }));
-		myCamera.Update();
-
+		UpdateScene();
 		RenderFrame();
 	}
+	myVKFramework.WaitIdle();
+	const FrameCounters& counters = myRenderer.GetFrameCounters();
+
+	if (frameTimes.empty())
+	{
+		WARNING_LOG("Headless run rendered no timed frames");
+		Destroy();
+		return;
+	}
+
+	std::sort(frameTimes.begin(), frameTimes.end());
+	f32 total = 0.0f;
+	for (f32 time : frameTimes)
+	{
+		total += time;
+	}
+	const f32 average = total / (f32)frameTimes.size();
+
+	INFO_LOG("Headless run: %u frames at %ux%u | cpu avg %.3fms, min %.3fms, median %.3fms, 95th %.3fms, max %.3fms | %.1f fps",
+		(u32)frameTimes.size(), myVKFramework.GetSwapchainExtent().width, myVKFramework.GetSwapchainExtent().height,
+		average, frameTimes.front(), frameTimes[frameTimes.size() / 2], frameTimes[(frameTimes.size() * 95) / 100], frameTimes.back(), 1000.0f / average);
+
+	const GpuTimer& gpuTimer = myRenderer.GetGpuTimer();
+	if (gpuTimer.IsSupported())
+	{
+		for (u32 scope = 0; scope < GpuTimer::ScopeCount; ++scope)
+		{
+			INFO_LOG("  gpu %-16s avg %.3fms over the last %u frames", GpuTimer::GetScopeName((GpuTimer::Scope)scope), gpuTimer.GetAverageTime((GpuTimer::Scope)scope), GpuTimer::AverageWindow);
+		}
+	}
+
+	INFO_LOG("  last frame: %u submits, %u draws, %u dispatches, %llu indices, %u command buffers recorded",
+		counters.submits, counters.draws, counters.dispatches, counters.indices, counters.commandBuffersRecorded);
+
+	myVKFramework.GetAllocator().LogStats();
+	myVKFramework.GetAllocator().LogBudget();
+	myVKFramework.GetDefragmenter().LogMetrics();
 
-	//shutdown has happened
 	Destroy();
-}
\ No newline at end of file
+}
@@ -21,6 +21,8 @@ namespace frostwave
 		~Engine();
 		void Init(Settings aSettings = {});
 		void Run();
+		// Renders a fixed number of frames without presenting and logs CPU and GPU timings, for headless runs
+		void RunFrames(u32 aFrameCount);
 		void Shutdown();
 		void Destroy();
 
@@ -28,11 +30,13 @@ namespace frostwave
 
 		bool GetShouldRenderModel() const { return myShouldRenderModel; }
 		void SetShouldRenderModel(bool aShouldRenderModel) { myShouldRenderModel = aShouldRenderModel; }
+		Scene& GetScene() { return myScene; }
 
 		static void FramebufferResizeCallback(GLFWwindow* aWindow, i32 aWidth, i32 aHeight);
 
 	private:
 		void RenderFrame();
+		void UpdateScene();
 		void InitWindow();
 		GLFWwindow* myWindow;
 		Settings mySettings;
@@ -49,3 +49,13 @@ fw::Mat4f& frostwave::Camera::GetProjection()
 {
 	return myProjection;
 }
+
+f32 frostwave::Camera::GetNearZ() const
+{
+	return myNearZ;
+}
+
+f32 frostwave::Camera::GetFarZ() const
+{
+	return myFarZ;
+}
@@ -24,6 +24,9 @@ namespace frostwave
 
 		fw::Mat4f& GetView();
 		fw::Mat4f& GetProjection();
+
+		f32 GetNearZ() const;
+		f32 GetFarZ() const;
 	private:
 		fw::Mat4f myView, myProjection;
 		fw::Vec3f myPosition;
@@ -0,0 +1,194 @@
+#include "stdafx.h"
+#include "CommandRecorder.h"
+
+#include <algorithm>
+#include <cstring>
+
+frostwave::CommandRecorder::CommandRecorder() : myCommandBuffer(VK_NULL_HANDLE)
+{
+	Invalidate();
+}
+
+frostwave::CommandRecorder::~CommandRecorder()
+{
+}
+
+void frostwave::CommandRecorder::Begin(VkCommandBuffer aCommandBuffer)
+{
+	myCommandBuffer = aCommandBuffer;
+	myStats = { };
+	Invalidate();
+}
+
+void frostwave::CommandRecorder::Invalidate()
+{
+	myPipelines.fill(VK_NULL_HANDLE);
+	for (auto& binding : myDescriptorSets)
+	{
+		binding.layout = VK_NULL_HANDLE;
+		binding.setCount = 0;
+	}
+	myVertexBuffers.fill({ VK_NULL_HANDLE, 0 });
+	myIndexBuffer = VK_NULL_HANDLE;
+	myIndexOffset = 0;
+	myIndexType = VK_INDEX_TYPE_UINT32;
+	myHasViewport = false;
+	myHasScissor = false;
+}
+
+void frostwave::CommandRecorder::BindPipeline(VkPipelineBindPoint aBindPoint, VkPipeline aPipeline)
+{
+	bool tracked = (u32)aBindPoint < BindPointCount;
+	if (Issue(tracked && myPipelines[aBindPoint] == aPipeline))
+	{
+		++myStats.binds;
+		vkCmdBindPipeline(myCommandBuffer, aBindPoint, aPipeline);
+		if (tracked)
+		{
+			myPipelines[aBindPoint] = aPipeline;
+		}
+	}
+}
+
+void frostwave::CommandRecorder::SetViewport(const VkViewport& aViewport)
+{
+	if (Issue(myHasViewport && memcmp(&myViewport, &aViewport, sizeof(VkViewport)) == 0))
+	{
+		vkCmdSetViewport(myCommandBuffer, 0, 1, &aViewport);
+		myViewport = aViewport;
+		myHasViewport = true;
+	}
+}
+
+void frostwave::CommandRecorder::SetScissor(const VkRect2D& aScissor)
+{
+	if (Issue(myHasScissor && memcmp(&myScissor, &aScissor, sizeof(VkRect2D)) == 0))
+	{
+		vkCmdSetScissor(myCommandBuffer, 0, 1, &aScissor);
+		myScissor = aScissor;
+		myHasScissor = true;
+	}
+}
+
+void frostwave::CommandRecorder::BindVertexBuffer(u32 aBinding, VkBuffer aBuffer, VkDeviceSize aOffset)
+{
+	bool tracked = aBinding < MaxVertexBindings;
+	if (Issue(tracked && myVertexBuffers[aBinding].buffer == aBuffer && myVertexBuffers[aBinding].offset == aOffset))
+	{
+		++myStats.binds;
+		vkCmdBindVertexBuffers(myCommandBuffer, aBinding, 1, &aBuffer, &aOffset);
+		if (tracked)
+		{
+			myVertexBuffers[aBinding] = { aBuffer, aOffset };
+		}
+	}
+}
+
+void frostwave::CommandRecorder::BindIndexBuffer(VkBuffer aBuffer, VkDeviceSize aOffset, VkIndexType aIndexType)
+{
+	if (Issue(myIndexBuffer == aBuffer && myIndexOffset == aOffset && myIndexType == aIndexType))
+	{
+		++myStats.binds;
+		vkCmdBindIndexBuffer(myCommandBuffer, aBuffer, aOffset, aIndexType);
+		myIndexBuffer = aBuffer;
+		myIndexOffset = aOffset;
+		myIndexType = aIndexType;
+	}
+}
+
+void frostwave::CommandRecorder::BindDescriptorSets(VkPipelineBindPoint aBindPoint, VkPipelineLayout aLayout, u32 aFirstSet, u32 aSetCount, const VkDescriptorSet* aSets, u32 aDynamicOffsetCount, const u32* aDynamicOffsets)
+{
+	// Calls too big to remember are always issued and forget what was there
+	bool tracked = (u32)aBindPoint < BindPointCount && aSetCount <= MaxDescriptorSets && aDynamicOffsetCount <= MaxDynamicOffsets;
+
+	bool redundant = false;
+	if (tracked)
+	{
+		const DescriptorBinding& bound = myDescriptorSets[aBindPoint];
+		redundant = bound.layout == aLayout && bound.firstSet == aFirstSet && bound.setCount == aSetCount && bound.dynamicOffsetCount == aDynamicOffsetCount
+			&& std::equal(aSets, aSets + aSetCount, bound.sets.begin())
+			&& std::equal(aDynamicOffsets, aDynamicOffsets + aDynamicOffsetCount, bound.dynamicOffsets.begin());
+	}
+
+	if (Issue(redundant))
+	{
+		++myStats.binds;
+		vkCmdBindDescriptorSets(myCommandBuffer, aBindPoint, aLayout, aFirstSet, aSetCount, aSets, aDynamicOffsetCount, aDynamicOffsets);
+		if (tracked)
+		{
+			DescriptorBinding& bound = myDescriptorSets[aBindPoint];
+			bound.layout = aLayout;
+			bound.firstSet = aFirstSet;
+			bound.setCount = aSetCount;
+			bound.dynamicOffsetCount = aDynamicOffsetCount;
+			std::copy(aSets, aSets + aSetCount, bound.sets.begin());
+			std::copy(aDynamicOffsets, aDynamicOffsets + aDynamicOffsetCount, bound.dynamicOffsets.begin());
+		}
+		else if ((u32)aBindPoint < BindPointCount)
+		{
+			myDescriptorSets[aBindPoint].layout = VK_NULL_HANDLE;
+			myDescriptorSets[aBindPoint].setCount = 0;
+		}
+	}
+}
+
+void frostwave::CommandRecorder::PushConstants(VkPipelineLayout aLayout, VkShaderStageFlags aStages, u32 aOffset, u32 aSize, const void* aValues)
+{
+	Issue(false);
+	vkCmdPushConstants(myCommandBuffer, aLayout, aStages, aOffset, aSize, aValues);
+}
+
+void frostwave::CommandRecorder::DrawIndexed(u32 aIndexCount, u32 aInstanceCount, u32 aFirstIndex, i32 aVertexOffset, u32 aFirstInstance)
+{
+	Issue(false);
+	++myStats.draws;
+	myStats.indices += (u64)aIndexCount * aInstanceCount;
+	vkCmdDrawIndexed(myCommandBuffer, aIndexCount, aInstanceCount, aFirstIndex, aVertexOffset, aFirstInstance);
+}
+
+void frostwave::CommandRecorder::DrawIndexedIndirect(VkBuffer aBuffer, VkDeviceSize aOffset, u32 aDrawCount, u32 aStride, u64 aIndexCount)
+{
+	Issue(false);
+	myStats.draws += aDrawCount;
+	myStats.indices += aIndexCount;
+	vkCmdDrawIndexedIndirect(myCommandBuffer, aBuffer, aOffset, aDrawCount, aStride);
+}
+
+void frostwave::CommandRecorder::Dispatch(u32 aGroupCountX, u32 aGroupCountY, u32 aGroupCountZ)
+{
+	Issue(false);
+	++myStats.dispatches;
+	vkCmdDispatch(myCommandBuffer, aGroupCountX, aGroupCountY, aGroupCountZ);
+}
+
+void frostwave::CommandRecorder::PipelineBarrier(VkPipelineStageFlags aSrcStages, VkPipelineStageFlags aDstStages, VkDependencyFlags aDependencies,
+	u32 aMemoryBarrierCount, const VkMemoryBarrier* aMemoryBarriers,
+	u32 aBufferBarrierCount, const VkBufferMemoryBarrier* aBufferBarriers,
+	u32 aImageBarrierCount, const VkImageMemoryBarrier* aImageBarriers)
+{
+	Issue(false);
+	myStats.barriers += aMemoryBarrierCount + aBufferBarrierCount + aImageBarrierCount;
+	vkCmdPipelineBarrier(myCommandBuffer, aSrcStages, aDstStages, aDependencies, aMemoryBarrierCount, aMemoryBarriers, aBufferBarrierCount, aBufferBarriers, aImageBarrierCount, aImageBarriers);
+}
+
+VkCommandBuffer frostwave::CommandRecorder::GetCommandBuffer() const
+{
+	return myCommandBuffer;
+}
+
+const frostwave::CommandRecorder::Stats& frostwave::CommandRecorder::GetStats() const
+{
+	return myStats;
+}
+
+bool frostwave::CommandRecorder::Issue(bool aRedundant)
+{
+	if (aRedundant)
+	{
+		++myStats.elided;
+		return false;
+	}
+
+	++myStats.issued;
+	return true;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <Frostwave/Core/Types.h>
+
+#include <vulkan/vulkan.h>
+#include <array>
+
+namespace frostwave
+{
+	// Thin wrapper over a VkCommandBuffer that remembers what is bound and drops calls that would not change anything.
+	// State is tracked from Begin, which is correct for secondaries and anything recorded with a fresh command buffer.
+	// After vkCmdExecuteCommands or any raw vkCmd* that changes bound state, call Invalidate.
+	class CommandRecorder
+	{
+	public:
+		struct Stats
+		{
+			u64 issued = 0;
+			u64 elided = 0;
+			// Breakdown of the issued work, indirect draws count once per draw in the buffer
+			u64 binds = 0; // pipeline, descriptor set, vertex and index buffer
+			u64 draws = 0;
+			u64 dispatches = 0;
+			u64 indices = 0;
+			u64 barriers = 0;
+
+			f32 ElisionRate() const { return issued + elided > 0 ? (f32)elided / (f32)(issued + elided) : 0.0f; }
+			Stats& operator+=(const Stats& aOther)
+			{
+				issued += aOther.issued;
+				elided += aOther.elided;
+				binds += aOther.binds;
+				draws += aOther.draws;
+				dispatches += aOther.dispatches;
+				indices += aOther.indices;
+				barriers += aOther.barriers;
+				return *this;
+			}
+		};
+
+		CommandRecorder();
+		~CommandRecorder();
+
+		// Starts tracking aCommandBuffer from a clean slate, the command buffer itself must already be recording
+		void Begin(VkCommandBuffer aCommandBuffer);
+		// Forgets all bound state, so the next bind of every kind is issued
+		void Invalidate();
+
+		void BindPipeline(VkPipelineBindPoint aBindPoint, VkPipeline aPipeline);
+		void SetViewport(const VkViewport& aViewport);
+		void SetScissor(const VkRect2D& aScissor);
+		void BindVertexBuffer(u32 aBinding, VkBuffer aBuffer, VkDeviceSize aOffset = 0);
+		void BindIndexBuffer(VkBuffer aBuffer, VkDeviceSize aOffset = 0, VkIndexType aIndexType = VK_INDEX_TYPE_UINT32);
+		void BindDescriptorSets(VkPipelineBindPoint aBindPoint, VkPipelineLayout aLayout, u32 aFirstSet, u32 aSetCount, const VkDescriptorSet* aSets, u32 aDynamicOffsetCount = 0, const u32* aDynamicOffsets = nullptr);
+
+		// Pass-throughs, counted as issued
+		void PushConstants(VkPipelineLayout aLayout, VkShaderStageFlags aStages, u32 aOffset, u32 aSize, const void* aValues);
+		void DrawIndexed(u32 aIndexCount, u32 aInstanceCount, u32 aFirstIndex, i32 aVertexOffset, u32 aFirstInstance);
+		// The GPU reads the index counts, so aIndexCount is only what the caller expects them to sum to, for the stats
+		void DrawIndexedIndirect(VkBuffer aBuffer, VkDeviceSize aOffset, u32 aDrawCount, u32 aStride, u64 aIndexCount = 0);
+		void Dispatch(u32 aGroupCountX, u32 aGroupCountY, u32 aGroupCountZ);
+		void PipelineBarrier(VkPipelineStageFlags aSrcStages, VkPipelineStageFlags aDstStages, VkDependencyFlags aDependencies,
+			u32 aMemoryBarrierCount, const VkMemoryBarrier* aMemoryBarriers,
+			u32 aBufferBarrierCount, const VkBufferMemoryBarrier* aBufferBarriers,
+			u32 aImageBarrierCount, const VkImageMemoryBarrier* aImageBarriers);
+
+		VkCommandBuffer GetCommandBuffer() const;
+		// Calls since the last Begin
+		const Stats& GetStats() const;
+
+	private:
+		static constexpr u32 MaxVertexBindings = 4;
+		static constexpr u32 MaxDescriptorSets = 4;
+		static constexpr u32 MaxDynamicOffsets = 8;
+		// Graphics and compute, indexed by VkPipelineBindPoint
+		static constexpr u32 BindPointCount = 2;
+
+		struct VertexBinding
+		{
+			VkBuffer buffer;
+			VkDeviceSize offset;
+		};
+
+		// Sets are compared as a whole call, since the dynamic offsets can't be split per set without the layouts
+		struct DescriptorBinding
+		{
+			VkPipelineLayout layout;
+			u32 firstSet;
+			u32 setCount;
+			u32 dynamicOffsetCount;
+			std::array<VkDescriptorSet, MaxDescriptorSets> sets;
+			std::array<u32, MaxDynamicOffsets> dynamicOffsets;
+		};
+
+		bool Issue(bool aRedundant);
+
+		VkCommandBuffer myCommandBuffer;
+		Stats myStats;
+
+		std::array<VkPipeline, BindPointCount> myPipelines;
+		std::array<DescriptorBinding, BindPointCount> myDescriptorSets;
+		std::array<VertexBinding, MaxVertexBindings> myVertexBuffers;
+		VkBuffer myIndexBuffer;
+		VkDeviceSize myIndexOffset;
+		VkIndexType myIndexType;
+		VkViewport myViewport;
+		VkRect2D myScissor;
+		bool myHasViewport;
+		bool myHasScissor;
+	};
+}
+namespace fw = frostwave;
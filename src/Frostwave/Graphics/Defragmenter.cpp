@@ -0,0 +1,207 @@
+#include "stdafx.h"
+#include "Defragmenter.h"
+
+#include "VkFramework.h"
+
+frostwave::Defragmenter::Defragmenter() : myFramework(nullptr), myMoveCount(0), myMovedBytes(0), myLastFrameBytes(0)
+{
+}
+
+void frostwave::Defragmenter::Init(const VkFramework* aFramework)
+{
+	myFramework = aFramework;
+}
+
+void frostwave::Defragmenter::Register(Buffer* aBuffer, UploadTicket aTicket, std::function<void()> aOnMoved)
+{
+	if (aBuffer->size == 0)
+	{
+		return;
+	}
+
+	const VkBufferUsageFlags transfer = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	if (!aBuffer->allocation || aBuffer->allocation->mapped || (aBuffer->usageFlags & transfer) != transfer)
+	{
+		WARNING_LOG("Only device local buffers with transfer usage can be moved");
+		return;
+	}
+
+	Entry& entry = myEntries[aBuffer->allocation];
+	entry.buffer = aBuffer;
+	entry.ticket = aTicket;
+	entry.onMoved = std::move(aOnMoved);
+}
+
+void frostwave::Defragmenter::Register(VulkanImage* aImage, std::function<void()> aOnMoved)
+{
+	if (!aImage->GetAllocation())
+	{
+		return;
+	}
+
+	Entry& entry = myEntries[aImage->GetAllocation()];
+	entry.image = aImage;
+	entry.ticket = aImage->GetUploadTicket();
+	entry.onMoved = std::move(aOnMoved);
+}
+
+void frostwave::Defragmenter::Unregister(const MemoryAllocation* aAllocation)
+{
+	if (aAllocation)
+	{
+		myEntries.erase(aAllocation);
+	}
+}
+
+void frostwave::Defragmenter::Update(VkDeviceSize aByteBudget)
+{
+	myLastFrameBytes = 0;
+	if (aByteBudget == 0 || myEntries.empty())
+	{
+		return;
+	}
+
+	const u32 source = FindSourceBlock();
+	if (source == ~0u)
+	{
+		return;
+	}
+
+	std::vector<const MemoryAllocation*> candidates;
+	for (const auto& entry : myEntries)
+	{
+		if (entry.first->block == source)
+		{
+			candidates.push_back(entry.first);
+		}
+	}
+
+	UploadContext& uploadContext = myFramework->GetUploadContext();
+	std::vector<std::function<void()>> movedCallbacks;
+	for (const MemoryAllocation* allocation : candidates)
+	{
+		if (myLastFrameBytes >= aByteBudget)
+		{
+			break;
+		}
+
+		auto it = myEntries.find(allocation);
+		if (!uploadContext.IsComplete(it->second.ticket))
+		{
+			continue;
+		}
+
+		const VkDeviceSize size = allocation->size;
+		VkCommandBuffer commandBuffer = uploadContext.GetCommandBuffer();
+		Entry entry = std::move(it->second);
+		const bool moved = entry.buffer ? entry.buffer->Relocate(commandBuffer) : entry.image->Relocate(commandBuffer);
+		if (!moved)
+		{
+			// The other blocks are out of room, try again once something was freed
+			it->second = std::move(entry);
+			break;
+		}
+
+		// The old allocation was retired, the entry follows the resource to the new one
+		myEntries.erase(it);
+		const MemoryAllocation* newAllocation = entry.buffer ? entry.buffer->allocation : entry.image->GetAllocation();
+		Entry& newEntry = myEntries[newAllocation];
+		newEntry = std::move(entry);
+		if (newEntry.onMoved)
+		{
+			movedCallbacks.push_back(newEntry.onMoved);
+		}
+
+		++myMoveCount;
+		myMovedBytes += size;
+		myLastFrameBytes += size;
+	}
+
+	// After the moves, so an owner with several moved resources sees all of their new handles from the first call
+	for (auto& onMoved : movedCallbacks)
+	{
+		onMoved();
+	}
+
+	if (myLastFrameBytes > 0)
+	{
+		VERBOSE_LOG("Moved %.2f MB out of device memory block %u", myLastFrameBytes / (1024.0 * 1024.0), source);
+	}
+}
+
+frostwave::Defragmenter::Metrics frostwave::Defragmenter::GetMetrics() const
+{
+	Metrics metrics;
+	for (const MemoryAllocator::BlockInfo& block : myFramework->GetAllocator().GetBlocks())
+	{
+		++metrics.blockCount;
+		metrics.freeBytes += block.capacity - block.usedBytes;
+		metrics.largestFreeRegion = fw::Max(metrics.largestFreeRegion, block.largestFreeRegion);
+		metrics.freeRegionCount += block.freeRegionCount;
+	}
+	metrics.fragmentation = metrics.freeBytes > 0 ? 1.0f - (f32)((f64)metrics.largestFreeRegion / (f64)metrics.freeBytes) : 0.0f;
+	metrics.movableCount = (u32)myEntries.size();
+	metrics.moveCount = myMoveCount;
+	metrics.movedBytes = myMovedBytes;
+	metrics.lastFrameBytes = myLastFrameBytes;
+	return metrics;
+}
+
+u64 frostwave::Defragmenter::GetMoveCount() const
+{
+	return myMoveCount;
+}
+
+void frostwave::Defragmenter::LogMetrics() const
+{
+	const Metrics metrics = GetMetrics();
+	INFO_LOG("Device memory fragmentation %.1f%%: %.1f MB free in %u regions over %u blocks, largest %.1f MB | %u movable, %llu moves, %.1f MB moved",
+		metrics.fragmentation * 100.0f, metrics.freeBytes / (1024.0 * 1024.0), metrics.freeRegionCount, metrics.blockCount, metrics.largestFreeRegion / (1024.0 * 1024.0),
+		metrics.movableCount, metrics.moveCount, metrics.movedBytes / (1024.0 * 1024.0));
+
+	for (const MemoryAllocator::BlockInfo& block : myFramework->GetAllocator().GetBlocks())
+	{
+		VERBOSE_LOG("  block %u, memory type %u%s: %u allocations, %.1f of %.1f MB used, %u free regions, largest %.1f MB",
+			block.index, block.memoryType, block.linear ? " linear" : "", block.allocationCount, block.usedBytes / (1024.0 * 1024.0),
+			block.capacity / (1024.0 * 1024.0), block.freeRegionCount, block.largestFreeRegion / (1024.0 * 1024.0));
+	}
+}
+
+u32 frostwave::Defragmenter::FindSourceBlock() const
+{
+	const std::vector<MemoryAllocator::BlockInfo> blocks = myFramework->GetAllocator().GetBlocks();
+
+	// Allocations that aren't registered, or were retired and not yet freed, keep a block from emptying
+	std::unordered_map<u32, u32> movable;
+	for (const auto& entry : myEntries)
+	{
+		++movable[entry.first->block];
+	}
+
+	u32 source = ~0u;
+	VkDeviceSize sourceUsed = ~0ull;
+	for (const MemoryAllocator::BlockInfo& block : blocks)
+	{
+		if (block.allocationCount == 0 || movable[block.index] != block.allocationCount || block.usedBytes >= sourceUsed)
+		{
+			continue;
+		}
+
+		// The free space of the other blocks is fragmented too, asking for twice the need keeps moves from failing halfway
+		VkDeviceSize room = 0;
+		for (const MemoryAllocator::BlockInfo& other : blocks)
+		{
+			if (other.index != block.index && other.memoryType == block.memoryType && other.linear == block.linear)
+			{
+				room += other.capacity - other.usedBytes;
+			}
+		}
+
+		if (block.usedBytes * 2 <= room)
+		{
+			source = block.index;
+			sourceUsed = block.usedBytes;
+		}
+	}
+	return source;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Frostwave/Core/Types.h>
+
+#include "UploadContext.h"
+
+#include <vulkan/vulkan.h>
+#include <functional>
+#include <unordered_map>
+
+namespace frostwave
+{
+	class VkFramework;
+	class VulkanImage;
+	struct Buffer;
+	struct MemoryAllocation;
+
+	// Empties the sparsest memory block of a kind into the other blocks of that kind, a bounded number of bytes per frame,
+	// so the allocator can release it. Fragmentation only costs memory once it makes the allocator open another block,
+	// and that is what this undoes. Only registered resources move, anything else pins its block.
+	//
+	// Copies are recorded into the upload batch, which is submitted ahead of the frame's own work, and the owner's handles
+	// are swapped right away. The old ones are retired, so frames in flight keep using them, but command buffers recorded
+	// before a move have to be recorded again, see GetMoveCount.
+	class Defragmenter
+	{
+	public:
+		struct Metrics
+		{
+			u32 blockCount = 0;
+			VkDeviceSize freeBytes = 0;			// free space inside blocks
+			VkDeviceSize largestFreeRegion = 0;
+			u32 freeRegionCount = 0;
+			f32 fragmentation = 0.0f;			// 1 - largest free region / free bytes, 0 while the free space is in one piece
+			u32 movableCount = 0;
+			u64 moveCount = 0;
+			u64 movedBytes = 0;
+			VkDeviceSize lastFrameBytes = 0;
+		};
+
+		Defragmenter();
+
+		void Init(const VkFramework* aFramework);
+
+		// Device local buffers with transfer source and destination usage, movable once aTicket is complete.
+		// aOnMoved runs once the update's moves are done, for whatever has the buffer in a descriptor set. Several
+		// resources of one owner can move in the same update, so it runs for each of them
+		void Register(Buffer* aBuffer, UploadTicket aTicket, std::function<void()> aOnMoved = nullptr);
+		// Textures only, movable once their upload is complete
+		void Register(VulkanImage* aImage, std::function<void()> aOnMoved = nullptr);
+		// Buffer and VulkanImage call this when destroyed
+		void Unregister(const MemoryAllocation* aAllocation);
+
+		// Once per frame, ahead of the frame's submits. Stops once aByteBudget is used up, a single resource larger than
+		// the whole budget still moves on its own
+		void Update(VkDeviceSize aByteBudget);
+
+		Metrics GetMetrics() const;
+		// Changes with every move, anything caching recorded handles compares it
+		u64 GetMoveCount() const;
+		void LogMetrics() const;
+
+	private:
+		struct Entry
+		{
+			Buffer* buffer = nullptr;
+			VulkanImage* image = nullptr;
+			UploadTicket ticket = 0;
+			std::function<void()> onMoved;
+		};
+
+		// Block to empty, ~0u when none can be
+		u32 FindSourceBlock() const;
+
+		const VkFramework* myFramework;
+		std::unordered_map<const MemoryAllocation*, Entry> myEntries;
+
+		u64 myMoveCount;
+		u64 myMovedBytes;
+		VkDeviceSize myLastFrameBytes;
+	};
+}
+namespace fw = frostwave;
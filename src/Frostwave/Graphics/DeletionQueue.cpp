@@ -0,0 +1,163 @@
+#include "stdafx.h"
+#include "DeletionQueue.h"
+#include "MemoryAllocator.h"
+
+frostwave::DeletionQueue::DeletionQueue() : myDevice(VK_NULL_HANDLE), myAllocator(nullptr), myFrame(0)
+{
+}
+
+frostwave::DeletionQueue::~DeletionQueue()
+{
+	assert(myEntries.empty() && "Deletion queue has to be flushed before the device is destroyed");
+}
+
+void frostwave::DeletionQueue::Init(VkDevice aDevice, MemoryAllocator* aAllocator)
+{
+	myDevice = aDevice;
+	myAllocator = aAllocator;
+}
+
+void frostwave::DeletionQueue::SetFrame(u64 aFrame)
+{
+	assert(aFrame >= myFrame);
+	myFrame = aFrame;
+}
+
+u64 frostwave::DeletionQueue::GetFrame() const
+{
+	return myFrame;
+}
+
+void frostwave::DeletionQueue::Retire(VkBuffer aBuffer)
+{
+	Push(Type::Buffer, (u64)aBuffer);
+}
+
+void frostwave::DeletionQueue::Retire(VkDeviceMemory aMemory)
+{
+	Push(Type::Memory, (u64)aMemory);
+}
+
+void frostwave::DeletionQueue::Retire(MemoryAllocation* aAllocation)
+{
+	Push(Type::Allocation, (u64)aAllocation);
+}
+
+void frostwave::DeletionQueue::Retire(VkImage aImage)
+{
+	Push(Type::Image, (u64)aImage);
+}
+
+void frostwave::DeletionQueue::Retire(VkImageView aImageView)
+{
+	Push(Type::ImageView, (u64)aImageView);
+}
+
+void frostwave::DeletionQueue::Retire(VkSampler aSampler)
+{
+	Push(Type::Sampler, (u64)aSampler);
+}
+
+void frostwave::DeletionQueue::Retire(VkFramebuffer aFramebuffer)
+{
+	Push(Type::Framebuffer, (u64)aFramebuffer);
+}
+
+void frostwave::DeletionQueue::Retire(VkRenderPass aRenderPass)
+{
+	Push(Type::RenderPass, (u64)aRenderPass);
+}
+
+void frostwave::DeletionQueue::Retire(VkPipeline aPipeline)
+{
+	Push(Type::Pipeline, (u64)aPipeline);
+}
+
+void frostwave::DeletionQueue::Retire(VkPipelineLayout aPipelineLayout)
+{
+	Push(Type::PipelineLayout, (u64)aPipelineLayout);
+}
+
+void frostwave::DeletionQueue::Retire(VkDescriptorSetLayout aDescriptorSetLayout)
+{
+	Push(Type::DescriptorSetLayout, (u64)aDescriptorSetLayout);
+}
+
+void frostwave::DeletionQueue::Retire(VkSwapchainKHR aSwapchain)
+{
+	Push(Type::Swapchain, (u64)aSwapchain);
+}
+
+void frostwave::DeletionQueue::Retire(VkCommandPool aPool, VkCommandBuffer aCommandBuffer)
+{
+	Push(Type::CommandBuffer, (u64)aCommandBuffer, (u64)aPool);
+}
+
+void frostwave::DeletionQueue::Retire(VkDescriptorPool aPool, VkDescriptorSet aDescriptorSet)
+{
+	Push(Type::DescriptorSet, (u64)aDescriptorSet, (u64)aPool);
+}
+
+void frostwave::DeletionQueue::Collect(u64 aCompletedFrame)
+{
+	while (!myEntries.empty() && myEntries.front().frame <= aCompletedFrame)
+	{
+		Destroy(myEntries.front());
+		myEntries.pop_front();
+	}
+}
+
+void frostwave::DeletionQueue::Flush()
+{
+	for (const Entry& entry : myEntries)
+	{
+		Destroy(entry);
+	}
+	myEntries.clear();
+}
+
+u32 frostwave::DeletionQueue::GetPendingCount() const
+{
+	return (u32)myEntries.size();
+}
+
+void frostwave::DeletionQueue::Push(Type aType, u64 aHandle, u64 aOwner)
+{
+	if (aHandle == 0)
+	{
+		return;
+	}
+	myEntries.push_back({ myFrame, aHandle, aOwner, aType });
+}
+
+void frostwave::DeletionQueue::Destroy(const Entry& aEntry)
+{
+	switch (aEntry.type)
+	{
+	case Type::Buffer: vkDestroyBuffer(myDevice, (VkBuffer)aEntry.handle, nullptr); break;
+	case Type::Memory: vkFreeMemory(myDevice, (VkDeviceMemory)aEntry.handle, nullptr); break;
+	case Type::Allocation: myAllocator->Free((MemoryAllocation*)aEntry.handle); break;
+	case Type::Image: vkDestroyImage(myDevice, (VkImage)aEntry.handle, nullptr); break;
+	case Type::ImageView: vkDestroyImageView(myDevice, (VkImageView)aEntry.handle, nullptr); break;
+	case Type::Sampler: vkDestroySampler(myDevice, (VkSampler)aEntry.handle, nullptr); break;
+	case Type::Framebuffer: vkDestroyFramebuffer(myDevice, (VkFramebuffer)aEntry.handle, nullptr); break;
+	case Type::RenderPass: vkDestroyRenderPass(myDevice, (VkRenderPass)aEntry.handle, nullptr); break;
+	case Type::Pipeline: vkDestroyPipeline(myDevice, (VkPipeline)aEntry.handle, nullptr); break;
+	case Type::PipelineLayout: vkDestroyPipelineLayout(myDevice, (VkPipelineLayout)aEntry.handle, nullptr); break;
+	case Type::DescriptorSetLayout: vkDestroyDescriptorSetLayout(myDevice, (VkDescriptorSetLayout)aEntry.handle, nullptr); break;
+	case Type::Swapchain: vkDestroySwapchainKHR(myDevice, (VkSwapchainKHR)aEntry.handle, nullptr); break;
+	case Type::CommandBuffer:
+	{
+		VkCommandBuffer commandBuffer = (VkCommandBuffer)aEntry.handle;
+		vkFreeCommandBuffers(myDevice, (VkCommandPool)aEntry.owner, 1, &commandBuffer);
+		break;
+	}
+	case Type::DescriptorSet:
+	{
+		VkDescriptorSet descriptorSet = (VkDescriptorSet)aEntry.handle;
+		vkFreeDescriptorSets(myDevice, (VkDescriptorPool)aEntry.owner, 1, &descriptorSet);
+		break;
+	}
+	default: break;
+	}
+}
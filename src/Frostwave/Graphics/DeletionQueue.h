@@ -0,0 +1,89 @@
+#pragma once
+
+#include <Frostwave/Core/Types.h>
+
+#include <vulkan/vulkan.h>
+#include <deque>
+
+namespace frostwave
+{
+	class MemoryAllocator;
+	struct MemoryAllocation;
+
+	// Vulkan objects released while frames that may use them are still in flight. Each is tagged with the frame
+	// it was retired in and destroyed once that frame's fence has signalled, so releasing never drains the GPU.
+	// Submissions go to one queue in order, so a signalled frame also covers every frame before it.
+	class DeletionQueue
+	{
+	public:
+		DeletionQueue();
+		~DeletionQueue();
+
+		void Init(VkDevice aDevice, MemoryAllocator* aAllocator);
+
+		// Frame being recorded, the last one that can still reference anything retired from now on
+		void SetFrame(u64 aFrame);
+		u64 GetFrame() const;
+
+		void Retire(VkBuffer aBuffer);
+		void Retire(VkDeviceMemory aMemory);
+		// Handed back to the allocator, retire it after the buffer or image bound to it
+		void Retire(MemoryAllocation* aAllocation);
+		void Retire(VkImage aImage);
+		void Retire(VkImageView aImageView);
+		void Retire(VkSampler aSampler);
+		void Retire(VkFramebuffer aFramebuffer);
+		void Retire(VkRenderPass aRenderPass);
+		void Retire(VkPipeline aPipeline);
+		void Retire(VkPipelineLayout aPipelineLayout);
+		void Retire(VkDescriptorSetLayout aDescriptorSetLayout);
+		void Retire(VkSwapchainKHR aSwapchain);
+		void Retire(VkCommandPool aPool, VkCommandBuffer aCommandBuffer);
+		// The pool has to be created with VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT
+		void Retire(VkDescriptorPool aPool, VkDescriptorSet aDescriptorSet);
+
+		// Destroys everything retired up to and including aCompletedFrame
+		void Collect(u64 aCompletedFrame);
+		// Destroys everything, only once the device is idle
+		void Flush();
+
+		u32 GetPendingCount() const;
+
+	private:
+		enum class Type : u8
+		{
+			Buffer,
+			Memory,
+			Allocation,
+			Image,
+			ImageView,
+			Sampler,
+			Framebuffer,
+			RenderPass,
+			Pipeline,
+			PipelineLayout,
+			DescriptorSetLayout,
+			Swapchain,
+			CommandBuffer,
+			DescriptorSet
+		};
+
+		struct Entry
+		{
+			u64 frame;
+			u64 handle;
+			u64 owner; // command pool of a command buffer, descriptor pool of a descriptor set
+			Type type;
+		};
+
+		void Push(Type aType, u64 aHandle, u64 aOwner = 0);
+		void Destroy(const Entry& aEntry);
+
+		VkDevice myDevice;
+		MemoryAllocator* myAllocator;
+		u64 myFrame;
+		// Retire frames never decrease, so the oldest entries are always in front
+		std::deque<Entry> myEntries;
+	};
+}
+namespace fw = frostwave;
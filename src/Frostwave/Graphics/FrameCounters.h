@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Frostwave/Core/Types.h>
+
+namespace frostwave
+{
+	// Work issued for one frame, from BeginFrame to present. Commands replayed from cached command buffers count every frame they execute
+	struct FrameCounters
+	{
+		u32 submits = 0;
+		u32 presents = 0;
+		u32 commandBuffersRecorded = 0;
+		u32 draws = 0;
+		u32 dispatches = 0;
+		u64 indices = 0;
+		u32 binds = 0;
+		u32 bindsElided = 0;
+		u32 descriptorUpdates = 0;
+		u32 barriers = 0;
+
+		// VK_QUERY_TYPE_PIPELINE_STATISTICS, from the last frame that finished in this frame's slot, so frames in flight behind.
+		// All zero when the device lacks pipelineStatisticsQuery or inheritedQueries
+		bool hasPipelineStatistics = false;
+		u64 inputAssemblyVertices = 0;
+		u64 inputAssemblyPrimitives = 0;
+		u64 vertexShaderInvocations = 0;
+		u64 clippingPrimitives = 0;
+		u64 fragmentShaderInvocations = 0;
+		u64 computeShaderInvocations = 0;
+	};
+}
+namespace fw = frostwave;
@@ -0,0 +1,183 @@
+#include "stdafx.h"
+#include "GpuTimer.h"
+#include "VkFramework.h"
+
+#include <Frostwave/Core/Common.h>
+#include <Frostwave/Debug/Logger.h>
+
+frostwave::GpuTimer::GpuTimer() : myFramework(nullptr), myQueryPool(VK_NULL_HANDLE), myFramesInFlight(0), myTimestampPeriod(0.0f), myTimestampMask(0), myIsSupported(false), myHistoryCursor(0), myHistoryCount(0)
+{
+	myTimes.fill(0.0f);
+	myAverages.fill(0.0f);
+}
+
+frostwave::GpuTimer::~GpuTimer()
+{
+}
+
+void frostwave::GpuTimer::Init(VkFramework* aFramework, u32 aFramesInFlight)
+{
+	myFramework = aFramework;
+	myFramesInFlight = aFramesInFlight;
+
+	u32 familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(myFramework->GetPhysicalDevice(), &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(myFramework->GetPhysicalDevice(), &familyCount, families.data());
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(myFramework->GetPhysicalDevice(), &properties);
+
+	// Only the graphics queue's own support matters, timestampComputeAndGraphics covers every queue and is stricter than needed
+	const u32 validBits = families[myFramework->GetQueueFamilyIndices().graphicsFamily].timestampValidBits;
+	if (validBits == 0 || properties.limits.timestampPeriod <= 0.0f)
+	{
+		WARNING_LOG("Graphics queue does not support timestamps, GPU pass timings are disabled");
+		myIsSupported = false;
+		return;
+	}
+
+	myTimestampPeriod = properties.limits.timestampPeriod;
+	myTimestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+	VkQueryPoolCreateInfo info = { };
+	info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	info.queryCount = myFramesInFlight * ScopeCount * 2;
+
+	VkResult result = vkCreateQueryPool(myFramework->GetDevice(), &info, nullptr, &myQueryPool);
+	if (result != VK_SUCCESS)
+	{
+		WARNING_LOG("Failed to create timestamp query pool, GPU pass timings are disabled");
+		myIsSupported = false;
+		return;
+	}
+
+	myIsSupported = true;
+	myPending.assign(myFramesInFlight, false);
+	// Value and availability per query
+	myResults.resize(ScopeCount * 2 * 2);
+
+	VERBOSE_LOG("Created timestamp queries for %u scopes, %u valid bits at %.2fns per tick", (u32)ScopeCount, validBits, myTimestampPeriod);
+}
+
+void frostwave::GpuTimer::Destroy()
+{
+	if (myQueryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(myFramework->GetDevice(), myQueryPool, nullptr);
+		myQueryPool = VK_NULL_HANDLE;
+	}
+	myIsSupported = false;
+}
+
+void frostwave::GpuTimer::RecordReset(VkCommandBuffer aCommandBuffer, u32 aFrameIndex)
+{
+	if (!myIsSupported)
+	{
+		return;
+	}
+	vkCmdResetQueryPool(aCommandBuffer, myQueryPool, GetQuery(aFrameIndex, Frame, false), ScopeCount * 2);
+}
+
+void frostwave::GpuTimer::WriteBegin(VkCommandBuffer aCommandBuffer, u32 aFrameIndex, Scope aScope)
+{
+	if (!myIsSupported)
+	{
+		return;
+	}
+	vkCmdWriteTimestamp(aCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, myQueryPool, GetQuery(aFrameIndex, aScope, false));
+}
+
+void frostwave::GpuTimer::WriteEnd(VkCommandBuffer aCommandBuffer, u32 aFrameIndex, Scope aScope)
+{
+	if (!myIsSupported)
+	{
+		return;
+	}
+	vkCmdWriteTimestamp(aCommandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, myQueryPool, GetQuery(aFrameIndex, aScope, true));
+}
+
+void frostwave::GpuTimer::MarkSubmitted(u32 aFrameIndex)
+{
+	if (myIsSupported)
+	{
+		myPending[aFrameIndex] = true;
+	}
+}
+
+void frostwave::GpuTimer::Collect(u32 aFrameIndex)
+{
+	if (!myIsSupported || !myPending[aFrameIndex])
+	{
+		return;
+	}
+	myPending[aFrameIndex] = false;
+
+	// No wait flag: the fence has signalled, and a scope the frame never wrote just reports unavailable (VK_NOT_READY)
+	vkGetQueryPoolResults(myFramework->GetDevice(), myQueryPool, GetQuery(aFrameIndex, Frame, false), ScopeCount * 2,
+		myResults.size() * sizeof(u64), myResults.data(), sizeof(u64) * 2, VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	for (u32 scope = 0; scope < ScopeCount; ++scope)
+	{
+		const u64* begin = &myResults[scope * 4];
+		const u64* end = &myResults[scope * 4 + 2];
+
+		f32 time = 0.0f;
+		if (begin[1] != 0 && end[1] != 0)
+		{
+			u64 ticks = ((end[0] & myTimestampMask) - (begin[0] & myTimestampMask)) & myTimestampMask;
+			time = (f32)((f64)ticks * myTimestampPeriod / 1000000.0);
+		}
+
+		myTimes[scope] = time;
+		myHistory[scope][myHistoryCursor] = time;
+	}
+
+	myHistoryCursor = (myHistoryCursor + 1) % AverageWindow;
+	myHistoryCount = fw::Min(myHistoryCount + 1, AverageWindow);
+
+	for (u32 scope = 0; scope < ScopeCount; ++scope)
+	{
+		f32 sum = 0.0f;
+		for (u32 i = 0; i < myHistoryCount; ++i)
+		{
+			sum += myHistory[scope][i];
+		}
+		myAverages[scope] = sum / (f32)myHistoryCount;
+	}
+}
+
+bool frostwave::GpuTimer::IsSupported() const
+{
+	return myIsSupported;
+}
+
+f32 frostwave::GpuTimer::GetTime(Scope aScope) const
+{
+	return myTimes[aScope];
+}
+
+f32 frostwave::GpuTimer::GetAverageTime(Scope aScope) const
+{
+	return myAverages[aScope];
+}
+
+const char* frostwave::GpuTimer::GetScopeName(Scope aScope)
+{
+	switch (aScope)
+	{
+	case Frame: return "Frame";
+	case DepthPrepass: return "Depth pre-pass";
+	case GBuffer: return "G-buffer";
+	case LightCulling: return "Light culling";
+	case Lighting: return "Lighting";
+	case Upscale: return "Upscale";
+	default: return "Unknown";
+	}
+}
+
+u32 frostwave::GpuTimer::GetQuery(u32 aFrameIndex, Scope aScope, bool aEnd) const
+{
+	return (aFrameIndex * ScopeCount + aScope) * 2 + (aEnd ? 1 : 0);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <Frostwave/Core/Types.h>
+
+#include <vulkan/vulkan.h>
+#include <array>
+#include <vector>
+
+namespace frostwave
+{
+	class VkFramework;
+
+	// Timestamp queries around each pass, one set per frame in flight.
+	// A frame's results are read once its fence has signalled, so readback never waits on the GPU
+	// and lags the frame being recorded by the number of frames in flight.
+	class GpuTimer
+	{
+	public:
+		enum Scope
+		{
+			Frame,			// first command of the frame to the last one before present
+			DepthPrepass,
+			GBuffer,
+			LightCulling,
+			Lighting,
+			Upscale,
+			ScopeCount
+		};
+
+		GpuTimer();
+		~GpuTimer();
+
+		void Init(VkFramework* aFramework, u32 aFramesInFlight);
+		void Destroy();
+
+		// Has to be recorded outside a render pass before any timestamp of the frame
+		void RecordReset(VkCommandBuffer aCommandBuffer, u32 aFrameIndex);
+		void WriteBegin(VkCommandBuffer aCommandBuffer, u32 aFrameIndex, Scope aScope);
+		void WriteEnd(VkCommandBuffer aCommandBuffer, u32 aFrameIndex, Scope aScope);
+
+		// Call after the frame's queries were submitted, and Collect only once its fence has signalled
+		void MarkSubmitted(u32 aFrameIndex);
+		void Collect(u32 aFrameIndex);
+
+		// False when the graphics queue can't write timestamps, every time then reads zero
+		bool IsSupported() const;
+		// Milliseconds of the latest collected frame, zero for scopes that frame didn't run
+		f32 GetTime(Scope aScope) const;
+		// Milliseconds averaged over the last AverageWindow collected frames
+		f32 GetAverageTime(Scope aScope) const;
+		static const char* GetScopeName(Scope aScope);
+
+		static constexpr u32 AverageWindow = 64;
+
+	private:
+		u32 GetQuery(u32 aFrameIndex, Scope aScope, bool aEnd) const;
+
+		VkFramework* myFramework;
+		VkQueryPool myQueryPool;
+		u32 myFramesInFlight;
+		f32 myTimestampPeriod; // nanoseconds per tick
+		u64 myTimestampMask;
+		bool myIsSupported;
+
+		std::vector<bool> myPending;
+		std::vector<u64> myResults;
+
+		std::array<f32, ScopeCount> myTimes;
+		std::array<f32, ScopeCount> myAverages;
+		std::array<std::array<f32, AverageWindow>, ScopeCount> myHistory;
+		u32 myHistoryCursor;
+		u32 myHistoryCount;
+	};
+}
+namespace fw = frostwave;
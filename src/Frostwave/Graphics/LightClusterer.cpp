@@ -0,0 +1,284 @@
+#include "stdafx.h"
+#include "LightClusterer.h"
+
+#include <Frostwave/Core/Common.h>
+
+#include <chrono>
+#include <cfloat>
+
+frostwave::LightClusterer::LightClusterer() : myCountX(0), myCountY(0), myCountZ(0), mySliceScale(0.0f), mySliceBias(0.0f), myBuildTime(0.0f), myThreadPool(nullptr)
+{
+}
+
+frostwave::LightClusterer::~LightClusterer()
+{
+}
+
+void frostwave::LightClusterer::Init(u32 aCountX, u32 aCountY, u32 aCountZ, ThreadPool* aThreadPool)
+{
+	myCountX = fw::Max(aCountX, 1u);
+	myCountY = fw::Max(aCountY, 1u);
+	myCountZ = fw::Max(aCountZ, 1u);
+	myThreadPool = aThreadPool;
+
+	myBounds.resize(GetClusterCount());
+	myClusters.resize(GetClusterCount());
+	mySliceDepths.resize(myCountZ + 1);
+
+	// Work is split by depth slice, so there is no point in more workers than slices
+	u32 workerCount = myThreadPool ? fw::Clamp(myThreadPool->GetThreadCount(), 1u, myCountZ) : 1u;
+	myScratch.resize(workerCount);
+
+	// Forces the bounds to be built on the first Build
+	myProjection = fw::Mat4f();
+	myProjection[0] = 0.0f;
+}
+
+void frostwave::LightClusterer::Build(const std::vector<PointLight>& aLights, const fw::Mat4f& aView, const fw::Mat4f& aProjection)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	UpdateClusterBounds(aProjection);
+
+	// Lights go to view space once up front, with the same y flip the renderer applies before upload
+	const u32 lightCount = (u32)aLights.size();
+	myLightX.resize(lightCount);
+	myLightY.resize(lightCount);
+	myLightZ.resize(lightCount);
+	myLightRadius.resize(lightCount);
+	for (u32 i = 0; i < lightCount; ++i)
+	{
+		const PointLight& light = aLights[i];
+		fw::Vec4f position = fw::Vec4f(light.position.x, -light.position.y, light.position.z, 1.0f) * aView;
+		myLightX[i] = position.x;
+		myLightY[i] = position.y;
+		myLightZ[i] = position.z;
+		myLightRadius[i] = light.radius;
+	}
+
+	const u32 workerCount = (u32)myScratch.size();
+	const u32 slicesPerWorker = (myCountZ + workerCount - 1) / workerCount;
+
+	if (workerCount > 1)
+	{
+		for (u32 w = 0; w < workerCount; ++w)
+		{
+			u32 begin = w * slicesPerWorker;
+			u32 end = fw::Min(begin + slicesPerWorker, myCountZ);
+			myThreadPool->GetThreads()[w]->AddJob([this, begin, end, w]()
+			{
+				AssignSlices(begin, end, myScratch[w]);
+			});
+		}
+		myThreadPool->Wait();
+	}
+	else
+	{
+		AssignSlices(0, myCountZ, myScratch[0]);
+	}
+
+	// Workers wrote offsets local to their own index list, stitch them together into one compact list
+	u32 total = 0;
+	for (u32 w = 0; w < workerCount; ++w)
+	{
+		total += (u32)myScratch[w].indices.size();
+	}
+	myLightIndices.resize(total);
+
+	const u32 clustersPerSlice = myCountX * myCountY;
+	u32 base = 0;
+	for (u32 w = 0; w < workerCount; ++w)
+	{
+		const std::vector<u32>& indices = myScratch[w].indices;
+		if (!indices.empty())
+		{
+			memcpy(myLightIndices.data() + base, indices.data(), indices.size() * sizeof(u32));
+		}
+
+		u32 begin = fw::Min(w * slicesPerWorker, myCountZ) * clustersPerSlice;
+		u32 end = fw::Min((w + 1) * slicesPerWorker, myCountZ) * clustersPerSlice;
+		for (u32 c = begin; c < end; ++c)
+		{
+			myClusters[c].offset += base;
+		}
+		base += (u32)indices.size();
+	}
+
+	myBuildTime = std::chrono::duration<f32, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void frostwave::LightClusterer::UpdateClusterBounds(const fw::Mat4f& aProjection)
+{
+	bool changed = false;
+	for (u32 i = 0; i < 16; ++i)
+	{
+		changed |= myProjection[i] != aProjection[i];
+	}
+	if (!changed)
+	{
+		return;
+	}
+	myProjection = aProjection;
+
+	// Undo Mat4f::CreatePerspectiveProjection: x' = A * x, y' = -B * y, z' = C * z + E, w' = z
+	const f32 A = aProjection[0];
+	const f32 B = -aProjection[5];
+	const f32 C = aProjection[10];
+	const f32 E = aProjection[14];
+	const f32 nearZ = -E / C;
+	const f32 farZ = E / (1.0f - C);
+
+	const f32 logRatio = std::log(farZ / nearZ);
+	mySliceScale = (f32)myCountZ / logRatio;
+	mySliceBias = -(f32)myCountZ * std::log(nearZ) / logRatio;
+
+	for (u32 z = 0; z <= myCountZ; ++z)
+	{
+		mySliceDepths[z] = nearZ * std::pow(farZ / nearZ, (f32)z / (f32)myCountZ);
+	}
+
+	for (u32 z = 0; z < myCountZ; ++z)
+	{
+		const f32 depths[2] = { mySliceDepths[z], mySliceDepths[z + 1] };
+		for (u32 y = 0; y < myCountY; ++y)
+		{
+			const f32 ndcY[2] = { -1.0f + 2.0f * y / myCountY, -1.0f + 2.0f * (y + 1) / myCountY };
+			for (u32 x = 0; x < myCountX; ++x)
+			{
+				const f32 ndcX[2] = { -1.0f + 2.0f * x / myCountX, -1.0f + 2.0f * (x + 1) / myCountX };
+
+				Bounds& bounds = myBounds[x + y * myCountX + z * myCountX * myCountY];
+				bounds = { FLT_MAX, FLT_MAX, depths[0], -FLT_MAX, -FLT_MAX, depths[1] };
+
+				// The tile's four corner rays at both slice depths
+				for (f32 depth : depths)
+				{
+					for (u32 i = 0; i < 2; ++i)
+					{
+						f32 viewX = ndcX[i] * depth / A;
+						f32 viewY = -ndcY[i] * depth / B;
+						bounds.minX = fw::Min(bounds.minX, viewX);
+						bounds.maxX = fw::Max(bounds.maxX, viewX);
+						bounds.minY = fw::Min(bounds.minY, viewY);
+						bounds.maxY = fw::Max(bounds.maxY, viewY);
+					}
+				}
+			}
+		}
+	}
+}
+
+void frostwave::LightClusterer::AssignSlices(u32 aBeginSlice, u32 aEndSlice, WorkerScratch& aScratch)
+{
+	aScratch.indices.clear();
+
+	const __m128 zero = _mm_setzero_ps();
+	const u32 lightCount = (u32)myLightX.size();
+	const u32 clustersPerSlice = myCountX * myCountY;
+
+	for (u32 z = aBeginSlice; z < aEndSlice; ++z)
+	{
+		// Only lights whose depth range touches this slice are tested against its clusters
+		aScratch.x.clear();
+		aScratch.y.clear();
+		aScratch.z.clear();
+		aScratch.radiusSq.clear();
+		aScratch.lights.clear();
+		for (u32 i = 0; i < lightCount; ++i)
+		{
+			if (myLightZ[i] + myLightRadius[i] < mySliceDepths[z] || myLightZ[i] - myLightRadius[i] > mySliceDepths[z + 1])
+			{
+				continue;
+			}
+			aScratch.x.push_back(myLightX[i]);
+			aScratch.y.push_back(myLightY[i]);
+			aScratch.z.push_back(myLightZ[i]);
+			aScratch.radiusSq.push_back(myLightRadius[i] * myLightRadius[i]);
+			aScratch.lights.push_back(i);
+		}
+
+		const u32 candidates = (u32)aScratch.lights.size();
+
+		// Padding lanes get a negative radius so they never pass the distance test
+		while (aScratch.x.size() % 4 != 0)
+		{
+			aScratch.x.push_back(0.0f);
+			aScratch.y.push_back(0.0f);
+			aScratch.z.push_back(0.0f);
+			aScratch.radiusSq.push_back(-1.0f);
+		}
+		const u32 padded = (u32)aScratch.x.size();
+
+		for (u32 c = z * clustersPerSlice; c < (z + 1) * clustersPerSlice; ++c)
+		{
+			Cluster& cluster = myClusters[c];
+			cluster.offset = (u32)aScratch.indices.size();
+
+			if (candidates > 0)
+			{
+				const Bounds& bounds = myBounds[c];
+				const __m128 minX = _mm_set1_ps(bounds.minX);
+				const __m128 minY = _mm_set1_ps(bounds.minY);
+				const __m128 minZ = _mm_set1_ps(bounds.minZ);
+				const __m128 maxX = _mm_set1_ps(bounds.maxX);
+				const __m128 maxY = _mm_set1_ps(bounds.maxY);
+				const __m128 maxZ = _mm_set1_ps(bounds.maxZ);
+
+				// Sphere vs AABB for four lights at a time: squared distance from the center to the closest point in the box
+				for (u32 i = 0; i < padded; i += 4)
+				{
+					__m128 x = _mm_loadu_ps(&aScratch.x[i]);
+					__m128 y = _mm_loadu_ps(&aScratch.y[i]);
+					__m128 z4 = _mm_loadu_ps(&aScratch.z[i]);
+
+					__m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minX, x), zero), _mm_max_ps(_mm_sub_ps(x, maxX), zero));
+					__m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minY, y), zero), _mm_max_ps(_mm_sub_ps(y, maxY), zero));
+					__m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minZ, z4), zero), _mm_max_ps(_mm_sub_ps(z4, maxZ), zero));
+
+					__m128 distSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+					i32 mask = _mm_movemask_ps(_mm_cmple_ps(distSq, _mm_loadu_ps(&aScratch.radiusSq[i])));
+
+					for (u32 lane = 0; mask != 0; ++lane, mask >>= 1)
+					{
+						if (mask & 1)
+						{
+							aScratch.indices.push_back(aScratch.lights[i + lane]);
+						}
+					}
+				}
+			}
+
+			cluster.count = (u32)aScratch.indices.size() - cluster.offset;
+		}
+	}
+}
+
+const std::vector<frostwave::LightClusterer::Cluster>& frostwave::LightClusterer::GetClusters() const
+{
+	return myClusters;
+}
+
+const std::vector<u32>& frostwave::LightClusterer::GetLightIndices() const
+{
+	return myLightIndices;
+}
+
+u32 frostwave::LightClusterer::GetClusterCount() const
+{
+	return myCountX * myCountY * myCountZ;
+}
+
+f32 frostwave::LightClusterer::GetSliceScale() const
+{
+	return mySliceScale;
+}
+
+f32 frostwave::LightClusterer::GetSliceBias() const
+{
+	return mySliceBias;
+}
+
+f32 frostwave::LightClusterer::GetBuildTime() const
+{
+	return myBuildTime;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <Frostwave/Core/Math/Matrix.h>
+#include <Frostwave/Graphics/Lights.h>
+#include <Frostwave/ThreadPool.h>
+
+#include <vector>
+
+namespace frostwave
+{
+	// Assigns point lights to a view space froxel grid on the CPU: X by Y screen tiles times exponentially spaced depth slices.
+	// Has no Vulkan dependency so it can be profiled without a device.
+	class LightClusterer
+	{
+	public:
+		// Range into GetLightIndices(), laid out the same way in the shader's cluster buffer
+		struct Cluster
+		{
+			u32 offset;
+			u32 count;
+		};
+
+		LightClusterer();
+		~LightClusterer();
+
+		void Init(u32 aCountX, u32 aCountY, u32 aCountZ, ThreadPool* aThreadPool = nullptr);
+		void Build(const std::vector<PointLight>& aLights, const fw::Mat4f& aView, const fw::Mat4f& aProjection);
+
+		const std::vector<Cluster>& GetClusters() const;
+		const std::vector<u32>& GetLightIndices() const;
+
+		u32 GetClusterCount() const;
+		// slice = log(viewZ) * scale + bias
+		f32 GetSliceScale() const;
+		f32 GetSliceBias() const;
+		// Time spent in the last Build, in milliseconds
+		f32 GetBuildTime() const;
+
+	private:
+		struct Bounds
+		{
+			f32 minX, minY, minZ;
+			f32 maxX, maxY, maxZ;
+		};
+
+		// Candidate lights for one depth slice in SoA form, padded to a multiple of four for the SSE loop
+		struct WorkerScratch
+		{
+			std::vector<f32> x, y, z, radiusSq;
+			std::vector<u32> lights;
+			std::vector<u32> indices;
+		};
+
+		void UpdateClusterBounds(const fw::Mat4f& aProjection);
+		void AssignSlices(u32 aBeginSlice, u32 aEndSlice, WorkerScratch& aScratch);
+
+		u32 myCountX, myCountY, myCountZ;
+		f32 mySliceScale, mySliceBias;
+		f32 myBuildTime;
+		fw::Mat4f myProjection;
+		ThreadPool* myThreadPool;
+
+		std::vector<Bounds> myBounds;
+		std::vector<f32> mySliceDepths;
+		std::vector<WorkerScratch> myScratch;
+
+		std::vector<f32> myLightX, myLightY, myLightZ, myLightRadius;
+
+		std::vector<Cluster> myClusters;
+		std::vector<u32> myLightIndices;
+	};
+}
+namespace fw = frostwave;
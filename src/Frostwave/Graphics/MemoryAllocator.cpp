@@ -0,0 +1,896 @@
+#include "stdafx.h"
+#include "MemoryAllocator.h"
+
+#include <Frostwave/Core/Common.h>
+#include <Frostwave/Debug/Logger.h>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+	// Index of the highest set bit, aValue must not be zero
+	u32 HighestBit(u64 aValue)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanReverse64(&index, aValue);
+		return (u32)index;
+#else
+		return 63 - (u32)__builtin_clzll(aValue);
+#endif
+	}
+
+	// Index of the lowest set bit, aValue must not be zero
+	u32 LowestBit(u64 aValue)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, aValue);
+		return (u32)index;
+#else
+		return (u32)__builtin_ctzll(aValue);
+#endif
+	}
+
+	u64 AlignUp(u64 aValue, u64 aAlignment)
+	{
+		return (aValue + aAlignment - 1) / aAlignment * aAlignment;
+	}
+
+	constexpr u32 DedicatedBlock = ~0u;
+	// Leftovers smaller than this stay part of the allocation instead of becoming a free region
+	constexpr u64 MinimumRegionSize = 64;
+}
+
+frostwave::TlsfHeap::TlsfHeap() : myFirstLevel(0), myCapacity(0), myFreeSize(0), myFreeRegionCount(0)
+{
+	memset(mySecondLevel, 0, sizeof(mySecondLevel));
+	std::fill(&myHeads[0][0], &myHeads[0][0] + FirstLevelCount * SecondLevelCount, InvalidRegion);
+}
+
+void frostwave::TlsfHeap::Init(u64 aSize)
+{
+	myRegions.clear();
+	myUnusedRegions.clear();
+	myFirstLevel = 0;
+	memset(mySecondLevel, 0, sizeof(mySecondLevel));
+	std::fill(&myHeads[0][0], &myHeads[0][0] + FirstLevelCount * SecondLevelCount, InvalidRegion);
+
+	myCapacity = aSize;
+	myFreeSize = 0;
+	myFreeRegionCount = 0;
+
+	const u32 region = NewRegion();
+	myRegions[region] = { 0, aSize, InvalidRegion, InvalidRegion, InvalidRegion, InvalidRegion, false };
+	InsertFree(region);
+}
+
+u32 frostwave::TlsfHeap::Allocate(u64 aSize, u64 aAlignment)
+{
+	aSize = fw::Max(aSize, (u64)1);
+	aAlignment = fw::Max(aAlignment, (u64)1);
+
+	// Any region this large fits the size wherever the alignment lands
+	const u32 region = FindFree(aSize + aAlignment - 1);
+	if (region == InvalidRegion)
+	{
+		return InvalidRegion;
+	}
+	RemoveFree(region);
+
+	// Free regions never border each other, so the padding in front and the rest behind can't merge with anything
+	const u64 offset = myRegions[region].offset;
+	const u64 aligned = AlignUp(offset, aAlignment);
+	if (aligned > offset)
+	{
+		const u32 padding = NewRegion();
+		Region& current = myRegions[region];
+		myRegions[padding] = { offset, aligned - offset, current.prevPhysical, region, InvalidRegion, InvalidRegion, false };
+		if (current.prevPhysical != InvalidRegion)
+		{
+			myRegions[current.prevPhysical].nextPhysical = padding;
+		}
+		current.prevPhysical = padding;
+		current.offset = aligned;
+		current.size -= aligned - offset;
+		InsertFree(padding);
+	}
+
+	const u64 remainder = myRegions[region].size - aSize;
+	if (remainder >= MinimumRegionSize)
+	{
+		const u32 rest = NewRegion();
+		Region& current = myRegions[region];
+		myRegions[rest] = { current.offset + aSize, remainder, region, current.nextPhysical, InvalidRegion, InvalidRegion, false };
+		if (current.nextPhysical != InvalidRegion)
+		{
+			myRegions[current.nextPhysical].prevPhysical = rest;
+		}
+		current.nextPhysical = rest;
+		current.size = aSize;
+		InsertFree(rest);
+	}
+
+	return region;
+}
+
+void frostwave::TlsfHeap::Free(u32 aRegion)
+{
+	assert(aRegion < myRegions.size() && !myRegions[aRegion].free);
+	u32 region = aRegion;
+
+	const u32 prev = myRegions[region].prevPhysical;
+	if (prev != InvalidRegion && myRegions[prev].free)
+	{
+		RemoveFree(prev);
+		const u32 next = myRegions[region].nextPhysical;
+		myRegions[prev].size += myRegions[region].size;
+		myRegions[prev].nextPhysical = next;
+		if (next != InvalidRegion)
+		{
+			myRegions[next].prevPhysical = prev;
+		}
+		myUnusedRegions.push_back(region);
+		region = prev;
+	}
+
+	const u32 next = myRegions[region].nextPhysical;
+	if (next != InvalidRegion && myRegions[next].free)
+	{
+		RemoveFree(next);
+		const u32 after = myRegions[next].nextPhysical;
+		myRegions[region].size += myRegions[next].size;
+		myRegions[region].nextPhysical = after;
+		if (after != InvalidRegion)
+		{
+			myRegions[after].prevPhysical = region;
+		}
+		myUnusedRegions.push_back(next);
+	}
+
+	InsertFree(region);
+}
+
+u64 frostwave::TlsfHeap::GetOffset(u32 aRegion) const
+{
+	return myRegions[aRegion].offset;
+}
+
+u64 frostwave::TlsfHeap::GetSize(u32 aRegion) const
+{
+	return myRegions[aRegion].size;
+}
+
+u64 frostwave::TlsfHeap::GetCapacity() const
+{
+	return myCapacity;
+}
+
+u64 frostwave::TlsfHeap::GetFreeSize() const
+{
+	return myFreeSize;
+}
+
+u64 frostwave::TlsfHeap::GetLargestFreeRegion() const
+{
+	if (myFirstLevel == 0)
+	{
+		return 0;
+	}
+
+	// Only the highest non empty list can hold the largest region, its sizes still differ though
+	const u32 first = HighestBit(myFirstLevel);
+	const u32 second = HighestBit(mySecondLevel[first]);
+	u64 largest = 0;
+	for (u32 region = myHeads[first][second]; region != InvalidRegion; region = myRegions[region].nextFree)
+	{
+		largest = fw::Max(largest, myRegions[region].size);
+	}
+	return largest;
+}
+
+u32 frostwave::TlsfHeap::GetFreeRegionCount() const
+{
+	return myFreeRegionCount;
+}
+
+bool frostwave::TlsfHeap::IsEmpty() const
+{
+	return myFreeSize == myCapacity;
+}
+
+void frostwave::TlsfHeap::Mapping(u64 aSize, u32& aFirst, u32& aSecond)
+{
+	// Sizes below SecondLevelCount share the first list, one exact size per second level
+	if (aSize < SecondLevelCount)
+	{
+		aFirst = 0;
+		aSecond = (u32)aSize;
+		return;
+	}
+
+	const u32 log = HighestBit(aSize);
+	aFirst = log - SecondLevelLog2 + 1;
+	aSecond = (u32)(aSize >> (log - SecondLevelLog2)) - SecondLevelCount;
+}
+
+u32 frostwave::TlsfHeap::NewRegion()
+{
+	if (!myUnusedRegions.empty())
+	{
+		const u32 region = myUnusedRegions.back();
+		myUnusedRegions.pop_back();
+		return region;
+	}
+	myRegions.push_back({ });
+	return (u32)myRegions.size() - 1;
+}
+
+void frostwave::TlsfHeap::InsertFree(u32 aRegion)
+{
+	Region& region = myRegions[aRegion];
+	u32 first, second;
+	Mapping(region.size, first, second);
+
+	region.free = true;
+	region.prevFree = InvalidRegion;
+	region.nextFree = myHeads[first][second];
+	if (region.nextFree != InvalidRegion)
+	{
+		myRegions[region.nextFree].prevFree = aRegion;
+	}
+	myHeads[first][second] = aRegion;
+
+	myFirstLevel |= 1ull << first;
+	mySecondLevel[first] |= 1u << second;
+
+	myFreeSize += region.size;
+	++myFreeRegionCount;
+}
+
+void frostwave::TlsfHeap::RemoveFree(u32 aRegion)
+{
+	Region& region = myRegions[aRegion];
+	u32 first, second;
+	Mapping(region.size, first, second);
+
+	if (region.prevFree != InvalidRegion)
+	{
+		myRegions[region.prevFree].nextFree = region.nextFree;
+	}
+	if (region.nextFree != InvalidRegion)
+	{
+		myRegions[region.nextFree].prevFree = region.prevFree;
+	}
+
+	if (myHeads[first][second] == aRegion)
+	{
+		myHeads[first][second] = region.nextFree;
+		if (region.nextFree == InvalidRegion)
+		{
+			mySecondLevel[first] &= ~(1u << second);
+			if (mySecondLevel[first] == 0)
+			{
+				myFirstLevel &= ~(1ull << first);
+			}
+		}
+	}
+
+	region.free = false;
+	region.prevFree = InvalidRegion;
+	region.nextFree = InvalidRegion;
+
+	myFreeSize -= region.size;
+	--myFreeRegionCount;
+}
+
+u32 frostwave::TlsfHeap::FindFree(u64 aSize) const
+{
+	// Rounded up to the next size class, so whatever the list holds is large enough
+	u64 size = aSize;
+	if (size >= SecondLevelCount)
+	{
+		size += (1ull << (HighestBit(size) - SecondLevelLog2)) - 1;
+	}
+
+	u32 first, second;
+	Mapping(size, first, second);
+	if (first >= FirstLevelCount)
+	{
+		return InvalidRegion;
+	}
+
+	u32 secondMap = mySecondLevel[first] & (~0u << second);
+	if (secondMap == 0)
+	{
+		const u64 firstMap = first + 1 < FirstLevelCount ? myFirstLevel & (~0ull << (first + 1)) : 0;
+		if (firstMap == 0)
+		{
+			return InvalidRegion;
+		}
+		first = LowestBit(firstMap);
+		secondMap = mySecondLevel[first];
+	}
+
+	return myHeads[first][LowestBit(secondMap)];
+}
+
+const char* frostwave::GetName(MemoryCategory aCategory)
+{
+	switch (aCategory)
+	{
+	case MemoryCategory::Mesh: return "mesh";
+	case MemoryCategory::Texture: return "texture";
+	case MemoryCategory::RenderTarget: return "render target";
+	case MemoryCategory::Staging: return "staging";
+	case MemoryCategory::Uniform: return "uniform";
+	case MemoryCategory::Storage: return "storage";
+	default: return "other";
+	}
+}
+
+frostwave::MemoryAllocator::MemoryAllocator() : myDevice(VK_NULL_HANDLE), myPhysicalDevice(VK_NULL_HANDLE), myGetMemoryProperties2(nullptr), myMemoryProperties({ }), myNonCoherentAtomSize(1),
+	myAllocationCount(0), myDedicatedCount(0), myDedicatedBytes(0), myUsedBytes(0), myNextCallbackId(1)
+{
+}
+
+frostwave::MemoryAllocator::~MemoryAllocator()
+{
+}
+
+void frostwave::MemoryAllocator::Init(VkDevice aDevice, VkPhysicalDevice aPhysicalDevice, PFN_vkGetPhysicalDeviceMemoryProperties2KHR aGetMemoryProperties2)
+{
+	myDevice = aDevice;
+	myPhysicalDevice = aPhysicalDevice;
+	myGetMemoryProperties2 = aGetMemoryProperties2;
+	vkGetPhysicalDeviceMemoryProperties(aPhysicalDevice, &myMemoryProperties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(aPhysicalDevice, &properties);
+	myNonCoherentAtomSize = fw::Max(properties.limits.nonCoherentAtomSize, (VkDeviceSize)1);
+
+	myHeaps.resize(myMemoryProperties.memoryHeapCount);
+	for (u32 i = 0; i < myMemoryProperties.memoryHeapCount; ++i)
+	{
+		HeapBudget& heap = myHeaps[i];
+		heap.heap = i;
+		heap.deviceLocal = (myMemoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+		heap.size = myMemoryProperties.memoryHeaps[i].size;
+		// Without the extension the driver's share is unknown, the OS and other processes usually leave about this much
+		heap.budget = heap.size / 10 * 8;
+	}
+	UpdateBudget(1.0f);
+}
+
+void frostwave::MemoryAllocator::Destroy()
+{
+	if (myAllocationCount > 0)
+	{
+		WARNING_LOG("%u device memory allocations were never freed", myAllocationCount);
+	}
+
+	for (u32 i = 0; i < myBlocks.size(); ++i)
+	{
+		if (myBlocks[i])
+		{
+			DestroyBlock(i);
+		}
+	}
+	myBlocks.clear();
+
+	for (auto* allocation : myDedicatedAllocations)
+	{
+		Account(*allocation, false);
+		FreeMemory(allocation->memory, allocation->size, allocation->memoryType);
+		delete allocation;
+	}
+	myDedicatedAllocations.clear();
+	myDedicatedCount = 0;
+	myDedicatedBytes = 0;
+}
+
+frostwave::MemoryAllocation* frostwave::MemoryAllocator::Allocate(const VkMemoryRequirements& aRequirements, VkMemoryPropertyFlags aRequired, bool aLinear, MemoryCategory aCategory, VkMemoryPropertyFlags aPreferred)
+{
+	const u32 memoryType = FindMemoryType(aRequirements.memoryTypeBits, aRequired, aPreferred);
+	if (memoryType == ~0u)
+	{
+		FATAL_LOG("Failed to find suitable memory type!");
+		return nullptr;
+	}
+
+	VkDeviceSize size = aRequirements.size;
+	VkDeviceSize alignment = aRequirements.alignment;
+	AlignToAtoms(memoryType, size, alignment);
+
+	// Lazily allocated memory is only committed per allocation, sharing a block would defeat it
+	if ((myMemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) || size > GetBlockSize(memoryType) / 2)
+	{
+		return AllocateDedicated(size, memoryType, aCategory);
+	}
+
+	u32 region = TlsfHeap::InvalidRegion;
+	u32 blockIndex = AllocateFromBlocks(size, alignment, memoryType, aLinear, DedicatedBlock, region);
+	if (blockIndex == DedicatedBlock)
+	{
+		blockIndex = CreateBlock(memoryType, aLinear);
+		region = myBlocks[blockIndex]->heap.Allocate(size, alignment);
+		assert(region != TlsfHeap::InvalidRegion);
+	}
+
+	return CreateAllocation(blockIndex, region, size, aCategory);
+}
+
+frostwave::MemoryAllocation* frostwave::MemoryAllocator::AllocateBuffer(VkBuffer aBuffer, VkMemoryPropertyFlags aRequired, MemoryCategory aCategory)
+{
+	VkMemoryRequirements memReqs;
+	vkGetBufferMemoryRequirements(myDevice, aBuffer, &memReqs);
+
+	MemoryAllocation* allocation = Allocate(memReqs, aRequired, true, aCategory);
+	if (vkBindBufferMemory(myDevice, aBuffer, allocation->memory, allocation->offset) != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to bind buffer memory!");
+	}
+	return allocation;
+}
+
+frostwave::MemoryAllocation* frostwave::MemoryAllocator::AllocateImage(VkImage aImage, VkMemoryPropertyFlags aRequired, MemoryCategory aCategory, VkMemoryPropertyFlags aPreferred)
+{
+	VkMemoryRequirements memReqs;
+	vkGetImageMemoryRequirements(myDevice, aImage, &memReqs);
+
+	MemoryAllocation* allocation = Allocate(memReqs, aRequired, false, aCategory, aPreferred);
+	if (vkBindImageMemory(myDevice, aImage, allocation->memory, allocation->offset) != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to bind image memory!");
+	}
+	return allocation;
+}
+
+frostwave::MemoryAllocation* frostwave::MemoryAllocator::AllocateBufferMove(VkBuffer aBuffer, const MemoryAllocation* aCurrent)
+{
+	VkMemoryRequirements memReqs;
+	vkGetBufferMemoryRequirements(myDevice, aBuffer, &memReqs);
+
+	MemoryAllocation* allocation = AllocateMove(memReqs, aCurrent);
+	if (allocation && vkBindBufferMemory(myDevice, aBuffer, allocation->memory, allocation->offset) != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to bind buffer memory!");
+	}
+	return allocation;
+}
+
+frostwave::MemoryAllocation* frostwave::MemoryAllocator::AllocateImageMove(VkImage aImage, const MemoryAllocation* aCurrent)
+{
+	VkMemoryRequirements memReqs;
+	vkGetImageMemoryRequirements(myDevice, aImage, &memReqs);
+
+	MemoryAllocation* allocation = AllocateMove(memReqs, aCurrent);
+	if (allocation && vkBindImageMemory(myDevice, aImage, allocation->memory, allocation->offset) != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to bind image memory!");
+	}
+	return allocation;
+}
+
+void frostwave::MemoryAllocator::Free(MemoryAllocation* aAllocation)
+{
+	if (!aAllocation)
+	{
+		return;
+	}
+
+	Account(*aAllocation, false);
+	if (aAllocation->block == DedicatedBlock)
+	{
+		FreeMemory(aAllocation->memory, aAllocation->size, aAllocation->memoryType);
+		myDedicatedAllocations.erase(std::find(myDedicatedAllocations.begin(), myDedicatedAllocations.end(), aAllocation));
+		--myDedicatedCount;
+		myDedicatedBytes -= aAllocation->size;
+	}
+	else
+	{
+		const u32 blockIndex = aAllocation->block;
+		Block& block = *myBlocks[blockIndex];
+		block.heap.Free(aAllocation->region);
+
+		// An empty block is kept only while it is the last one of its kind, so streaming in and out doesn't thrash
+		if (--block.allocationCount == 0)
+		{
+			for (u32 i = 0; i < myBlocks.size(); ++i)
+			{
+				if (i != blockIndex && myBlocks[i] && myBlocks[i]->memoryType == block.memoryType && myBlocks[i]->linear == block.linear)
+				{
+					DestroyBlock(blockIndex);
+					break;
+				}
+			}
+		}
+	}
+
+	--myAllocationCount;
+	myUsedBytes -= aAllocation->size;
+	delete aAllocation;
+}
+
+frostwave::MemoryAllocator::Stats frostwave::MemoryAllocator::GetStats() const
+{
+	Stats stats;
+	for (const auto& block : myBlocks)
+	{
+		if (block)
+		{
+			++stats.blockCount;
+			stats.reservedBytes += block->heap.GetCapacity();
+		}
+	}
+	stats.dedicatedCount = myDedicatedCount;
+	stats.allocationCount = myAllocationCount;
+	stats.reservedBytes += myDedicatedBytes;
+	stats.usedBytes = myUsedBytes;
+	return stats;
+}
+
+std::vector<frostwave::MemoryAllocator::BlockInfo> frostwave::MemoryAllocator::GetBlocks() const
+{
+	std::vector<BlockInfo> infos;
+	for (u32 i = 0; i < myBlocks.size(); ++i)
+	{
+		if (!myBlocks[i])
+		{
+			continue;
+		}
+
+		const Block& block = *myBlocks[i];
+		BlockInfo info;
+		info.index = i;
+		info.memoryType = block.memoryType;
+		info.linear = block.linear;
+		info.allocationCount = block.allocationCount;
+		info.capacity = block.heap.GetCapacity();
+		info.usedBytes = block.heap.GetCapacity() - block.heap.GetFreeSize();
+		info.largestFreeRegion = block.heap.GetLargestFreeRegion();
+		info.freeRegionCount = block.heap.GetFreeRegionCount();
+		infos.push_back(info);
+	}
+	return infos;
+}
+
+void frostwave::MemoryAllocator::LogStats() const
+{
+	const Stats stats = GetStats();
+	INFO_LOG("Device memory: %u allocations use %.1f MB of %.1f MB in %u blocks and %u dedicated allocations",
+		stats.allocationCount, stats.usedBytes / (1024.0 * 1024.0), stats.reservedBytes / (1024.0 * 1024.0), stats.blockCount, stats.dedicatedCount);
+}
+
+void frostwave::MemoryAllocator::UpdateBudget(f32 aLimit)
+{
+	if (myGetMemoryProperties2)
+	{
+		VkPhysicalDeviceMemoryBudgetPropertiesEXT budget = { };
+		budget.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT;
+
+		VkPhysicalDeviceMemoryProperties2KHR properties = { };
+		properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2_KHR;
+		properties.pNext = &budget;
+		myGetMemoryProperties2(myPhysicalDevice, &properties);
+
+		for (HeapBudget& heap : myHeaps)
+		{
+			heap.budget = budget.heapBudget[heap.heap];
+			heap.usage = budget.heapUsage[heap.heap];
+		}
+	}
+	else
+	{
+		for (HeapBudget& heap : myHeaps)
+		{
+			heap.usage = heap.reservedBytes;
+		}
+	}
+
+	for (HeapBudget& heap : myHeaps)
+	{
+		const bool overBudget = heap.budget > 0 && (f64)heap.usage > (f64)heap.budget * aLimit;
+		if (overBudget != heap.overBudget)
+		{
+			if (overBudget)
+			{
+				WARNING_LOG("Memory heap %u is over budget, %.1f of %.1f MB used", heap.heap, heap.usage / (1024.0 * 1024.0), heap.budget / (1024.0 * 1024.0));
+			}
+			else
+			{
+				INFO_LOG("Memory heap %u is back within budget, %.1f of %.1f MB used", heap.heap, heap.usage / (1024.0 * 1024.0), heap.budget / (1024.0 * 1024.0));
+			}
+			heap.overBudget = overBudget;
+		}
+	}
+
+	// Callbacks evict, which frees memory and may remove callbacks, so they run off a copy
+	const std::vector<std::pair<u32, BudgetCallback>> callbacks = myBudgetCallbacks;
+	for (const HeapBudget& heap : myHeaps)
+	{
+		if (heap.overBudget)
+		{
+			for (const auto& callback : callbacks)
+			{
+				callback.second(heap);
+			}
+		}
+	}
+}
+
+const std::vector<frostwave::MemoryAllocator::HeapBudget>& frostwave::MemoryAllocator::GetBudget() const
+{
+	return myHeaps;
+}
+
+VkDeviceSize frostwave::MemoryAllocator::GetCategoryBytes(MemoryCategory aCategory) const
+{
+	VkDeviceSize bytes = 0;
+	for (const HeapBudget& heap : myHeaps)
+	{
+		bytes += heap.categoryBytes[(u32)aCategory];
+	}
+	return bytes;
+}
+
+bool frostwave::MemoryAllocator::HasMemoryBudget() const
+{
+	return myGetMemoryProperties2 != nullptr;
+}
+
+void frostwave::MemoryAllocator::LogBudget() const
+{
+	INFO_LOG("Device memory budget%s:", myGetMemoryProperties2 ? "" : " (estimated, VK_EXT_memory_budget is not available)");
+	for (const HeapBudget& heap : myHeaps)
+	{
+		INFO_LOG("  heap %u%s: %.1f of %.1f MB budget used, %.1f MB reserved and %.1f MB used by the allocator, %.1f MB heap%s",
+			heap.heap, heap.deviceLocal ? " device local" : "", heap.usage / (1024.0 * 1024.0), heap.budget / (1024.0 * 1024.0),
+			heap.reservedBytes / (1024.0 * 1024.0), heap.usedBytes / (1024.0 * 1024.0), heap.size / (1024.0 * 1024.0), heap.overBudget ? ", over budget" : "");
+
+		for (u32 i = 0; i < (u32)MemoryCategory::Count; ++i)
+		{
+			if (heap.categoryCounts[i] > 0)
+			{
+				INFO_LOG("    %-13s %6u allocations %10.1f MB", GetName((MemoryCategory)i), heap.categoryCounts[i], heap.categoryBytes[i] / (1024.0 * 1024.0));
+			}
+		}
+	}
+}
+
+u32 frostwave::MemoryAllocator::AddBudgetCallback(BudgetCallback aCallback)
+{
+	const u32 id = myNextCallbackId++;
+	myBudgetCallbacks.push_back({ id, std::move(aCallback) });
+	return id;
+}
+
+void frostwave::MemoryAllocator::RemoveBudgetCallback(u32 aId)
+{
+	myBudgetCallbacks.erase(std::remove_if(myBudgetCallbacks.begin(), myBudgetCallbacks.end(),
+		[aId](const std::pair<u32, BudgetCallback>& aCallback) { return aCallback.first == aId; }), myBudgetCallbacks.end());
+}
+
+u32 frostwave::MemoryAllocator::FindMemoryType(u32 aTypeBits, VkMemoryPropertyFlags aRequired, VkMemoryPropertyFlags aPreferred) const
+{
+	if (aPreferred != 0)
+	{
+		const VkMemoryPropertyFlags flags = aRequired | aPreferred;
+		for (u32 i = 0; i < myMemoryProperties.memoryTypeCount; ++i)
+		{
+			if ((aTypeBits & (1 << i)) && (myMemoryProperties.memoryTypes[i].propertyFlags & flags) == flags)
+			{
+				return i;
+			}
+		}
+	}
+
+	for (u32 i = 0; i < myMemoryProperties.memoryTypeCount; ++i)
+	{
+		if ((aTypeBits & (1 << i)) && (myMemoryProperties.memoryTypes[i].propertyFlags & aRequired) == aRequired)
+		{
+			return i;
+		}
+	}
+	return ~0u;
+}
+
+void frostwave::MemoryAllocator::AlignToAtoms(u32 aMemoryType, VkDeviceSize& aSize, VkDeviceSize& aAlignment) const
+{
+	// Flushes and invalidates of non coherent memory cover whole atoms, which must not reach into a neighbour
+	const VkMemoryPropertyFlags flags = myMemoryProperties.memoryTypes[aMemoryType].propertyFlags;
+	if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+	{
+		aAlignment = fw::Max(aAlignment, myNonCoherentAtomSize);
+		aSize = AlignUp(aSize, myNonCoherentAtomSize);
+	}
+}
+
+VkDeviceSize frostwave::MemoryAllocator::GetBlockSize(u32 aMemoryType) const
+{
+	// Small heaps, like the 256 MB host visible device local one, would be used up by a few blocks
+	const VkDeviceSize heapSize = myMemoryProperties.memoryHeaps[myMemoryProperties.memoryTypes[aMemoryType].heapIndex].size;
+	return fw::Min(DefaultBlockSize, heapSize / 8);
+}
+
+VkDeviceMemory frostwave::MemoryAllocator::AllocateMemory(VkDeviceSize aSize, u32 aMemoryType, u8** aMapped)
+{
+	VkMemoryAllocateInfo allocInfo = { };
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = aSize;
+	allocInfo.memoryTypeIndex = aMemoryType;
+
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	if (vkAllocateMemory(myDevice, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to allocate %llu bytes of device memory!", aSize);
+	}
+
+	*aMapped = nullptr;
+	if (myMemoryProperties.memoryTypes[aMemoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		void* data = nullptr;
+		if (vkMapMemory(myDevice, memory, 0, VK_WHOLE_SIZE, 0, &data) != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to map device memory!");
+		}
+		*aMapped = (u8*)data;
+	}
+
+	GetHeap(aMemoryType).reservedBytes += aSize;
+	return memory;
+}
+
+void frostwave::MemoryAllocator::FreeMemory(VkDeviceMemory aMemory, VkDeviceSize aSize, u32 aMemoryType)
+{
+	// Freeing the memory unmaps it
+	vkFreeMemory(myDevice, aMemory, nullptr);
+	GetHeap(aMemoryType).reservedBytes -= aSize;
+}
+
+frostwave::MemoryAllocation* frostwave::MemoryAllocator::AllocateDedicated(VkDeviceSize aSize, u32 aMemoryType, MemoryCategory aCategory)
+{
+	MemoryAllocation* allocation = new MemoryAllocation();
+	allocation->memory = AllocateMemory(aSize, aMemoryType, &allocation->mapped);
+	allocation->size = aSize;
+	allocation->memoryType = aMemoryType;
+	allocation->block = DedicatedBlock;
+	allocation->category = aCategory;
+	Account(*allocation, true);
+
+	myDedicatedAllocations.push_back(allocation);
+	++myDedicatedCount;
+	myDedicatedBytes += aSize;
+	++myAllocationCount;
+	myUsedBytes += aSize;
+	return allocation;
+}
+
+frostwave::MemoryAllocation* frostwave::MemoryAllocator::AllocateMove(const VkMemoryRequirements& aRequirements, const MemoryAllocation* aCurrent)
+{
+	if (aCurrent->block == DedicatedBlock || !(aRequirements.memoryTypeBits & (1 << aCurrent->memoryType)))
+	{
+		return nullptr;
+	}
+
+	VkDeviceSize size = aRequirements.size;
+	VkDeviceSize alignment = aRequirements.alignment;
+	AlignToAtoms(aCurrent->memoryType, size, alignment);
+
+	u32 region = TlsfHeap::InvalidRegion;
+	const u32 blockIndex = AllocateFromBlocks(size, alignment, aCurrent->memoryType, myBlocks[aCurrent->block]->linear, aCurrent->block, region);
+	if (blockIndex == DedicatedBlock)
+	{
+		return nullptr;
+	}
+	return CreateAllocation(blockIndex, region, size, aCurrent->category);
+}
+
+u32 frostwave::MemoryAllocator::AllocateFromBlocks(VkDeviceSize aSize, VkDeviceSize aAlignment, u32 aMemoryType, bool aLinear, u32 aExcludedBlock, u32& aRegion)
+{
+	// Fullest blocks first, so sparse ones drain and can be released
+	std::vector<std::pair<VkDeviceSize, u32>> candidates;
+	for (u32 i = 0; i < myBlocks.size(); ++i)
+	{
+		const Block* block = myBlocks[i].get();
+		if (block && i != aExcludedBlock && block->memoryType == aMemoryType && block->linear == aLinear && block->heap.GetLargestFreeRegion() >= aSize)
+		{
+			candidates.push_back({ block->heap.GetFreeSize(), i });
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+
+	for (const auto& candidate : candidates)
+	{
+		aRegion = myBlocks[candidate.second]->heap.Allocate(aSize, aAlignment);
+		if (aRegion != TlsfHeap::InvalidRegion)
+		{
+			return candidate.second;
+		}
+	}
+	return DedicatedBlock;
+}
+
+frostwave::MemoryAllocation* frostwave::MemoryAllocator::CreateAllocation(u32 aBlock, u32 aRegion, VkDeviceSize aSize, MemoryCategory aCategory)
+{
+	Block& block = *myBlocks[aBlock];
+	++block.allocationCount;
+
+	MemoryAllocation* allocation = new MemoryAllocation();
+	allocation->memory = block.memory;
+	allocation->offset = block.heap.GetOffset(aRegion);
+	allocation->size = aSize;
+	allocation->mapped = block.mapped ? block.mapped + allocation->offset : nullptr;
+	allocation->memoryType = block.memoryType;
+	allocation->block = aBlock;
+	allocation->region = aRegion;
+	allocation->category = aCategory;
+	Account(*allocation, true);
+
+	++myAllocationCount;
+	myUsedBytes += aSize;
+	return allocation;
+}
+
+void frostwave::MemoryAllocator::Account(const MemoryAllocation& aAllocation, bool aAdd)
+{
+	HeapBudget& heap = GetHeap(aAllocation.memoryType);
+	const u32 category = (u32)aAllocation.category;
+	if (aAdd)
+	{
+		heap.usedBytes += aAllocation.size;
+		heap.categoryBytes[category] += aAllocation.size;
+		++heap.categoryCounts[category];
+	}
+	else
+	{
+		heap.usedBytes -= aAllocation.size;
+		heap.categoryBytes[category] -= aAllocation.size;
+		--heap.categoryCounts[category];
+	}
+}
+
+frostwave::MemoryAllocator::HeapBudget& frostwave::MemoryAllocator::GetHeap(u32 aMemoryType)
+{
+	return myHeaps[myMemoryProperties.memoryTypes[aMemoryType].heapIndex];
+}
+
+u32 frostwave::MemoryAllocator::CreateBlock(u32 aMemoryType, bool aLinear)
+{
+	u32 index = (u32)myBlocks.size();
+	for (u32 i = 0; i < myBlocks.size(); ++i)
+	{
+		if (!myBlocks[i])
+		{
+			index = i;
+			break;
+		}
+	}
+	if (index == myBlocks.size())
+	{
+		myBlocks.emplace_back();
+	}
+
+	const VkDeviceSize size = GetBlockSize(aMemoryType);
+	myBlocks[index] = std::make_unique<Block>();
+	Block& block = *myBlocks[index];
+	block.memory = AllocateMemory(size, aMemoryType, &block.mapped);
+	block.memoryType = aMemoryType;
+	block.linear = aLinear;
+	block.heap.Init(size);
+
+	VERBOSE_LOG("Allocated a %llu MB device memory block for memory type %u", size / (1024 * 1024), aMemoryType);
+	return index;
+}
+
+void frostwave::MemoryAllocator::DestroyBlock(u32 aBlock)
+{
+	const Block& block = *myBlocks[aBlock];
+	FreeMemory(block.memory, block.heap.GetCapacity(), block.memoryType);
+	myBlocks[aBlock].reset();
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <Frostwave/Core/Types.h>
+
+#include <vulkan/vulkan.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// The bundled headers predate VK_EXT_memory_budget
+#ifndef VK_EXT_memory_budget
+#define VK_EXT_memory_budget 1
+#define VK_EXT_MEMORY_BUDGET_EXTENSION_NAME "VK_EXT_memory_budget"
+#define VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT ((VkStructureType)1000237000)
+typedef struct VkPhysicalDeviceMemoryBudgetPropertiesEXT
+{
+	VkStructureType sType;
+	void* pNext;
+	VkDeviceSize heapBudget[VK_MAX_MEMORY_HEAPS];
+	VkDeviceSize heapUsage[VK_MAX_MEMORY_HEAPS];
+} VkPhysicalDeviceMemoryBudgetPropertiesEXT;
+#endif
+
+namespace frostwave
+{
+	// Two level segregated fit over a range of offsets, knows nothing about Vulkan.
+	// Free regions are binned by size class, so finding one that fits and freeing with neighbour merging are both constant time
+	class TlsfHeap
+	{
+	public:
+		static constexpr u32 InvalidRegion = ~0u;
+
+		TlsfHeap();
+
+		void Init(u64 aSize);
+
+		// Region of at least aSize bytes starting at a multiple of aAlignment, InvalidRegion when nothing fits
+		u32 Allocate(u64 aSize, u64 aAlignment);
+		void Free(u32 aRegion);
+
+		u64 GetOffset(u32 aRegion) const;
+		u64 GetSize(u32 aRegion) const;
+
+		u64 GetCapacity() const;
+		u64 GetFreeSize() const;
+		u64 GetLargestFreeRegion() const;
+		u32 GetFreeRegionCount() const;
+		bool IsEmpty() const;
+
+	private:
+		static constexpr u32 SecondLevelLog2 = 4;
+		static constexpr u32 SecondLevelCount = 1 << SecondLevelLog2;
+		static constexpr u32 FirstLevelCount = 64;
+
+		struct Region
+		{
+			u64 offset;
+			u64 size;
+			u32 prevPhysical;
+			u32 nextPhysical;
+			u32 prevFree;
+			u32 nextFree;
+			bool free;
+		};
+
+		static void Mapping(u64 aSize, u32& aFirst, u32& aSecond);
+		u32 NewRegion();
+		void InsertFree(u32 aRegion);
+		void RemoveFree(u32 aRegion);
+		u32 FindFree(u64 aSize) const;
+
+		std::vector<Region> myRegions;
+		std::vector<u32> myUnusedRegions;
+
+		u64 myFirstLevel;
+		u32 mySecondLevel[FirstLevelCount];
+		u32 myHeads[FirstLevelCount][SecondLevelCount];
+
+		u64 myCapacity;
+		u64 myFreeSize;
+		u32 myFreeRegionCount;
+	};
+
+	// What an allocation is for, accounted separately per memory heap
+	enum class MemoryCategory : u32
+	{
+		Mesh,
+		Texture,
+		RenderTarget,	// attachments and headless swapchain images
+		Staging,
+		Uniform,		// per frame shader data the CPU writes: uniform, instance, light and cluster buffers
+		Storage,		// device local buffers compute writes, like the light tiles
+		Other,
+		Count
+	};
+
+	const char* GetName(MemoryCategory aCategory);
+
+	// Where a resource's memory lives. Owned by the allocator, resources hold a pointer to it
+	struct MemoryAllocation
+	{
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		u8* mapped = nullptr; // host visible memory stays mapped, this already includes the offset
+		u32 memoryType = 0;
+		u32 block = ~0u; // ~0u for a dedicated allocation with memory of its own
+		u32 region = TlsfHeap::InvalidRegion;
+		MemoryCategory category = MemoryCategory::Other;
+	};
+
+	// Sub-allocates device memory out of large blocks per memory type, so a scene with thousands of resources makes a
+	// handful of vkAllocateMemory calls instead of running into maxMemoryAllocationCount. Buffers and optimal images never
+	// share a block, which keeps bufferImageGranularity out of the picture. Resources too large for a block, and lazily
+	// allocated memory, get a dedicated allocation.
+	class MemoryAllocator
+	{
+	public:
+		struct Stats
+		{
+			u32 blockCount = 0;
+			u32 dedicatedCount = 0;
+			u32 allocationCount = 0;
+			VkDeviceSize reservedBytes = 0;	// everything taken from the driver
+			VkDeviceSize usedBytes = 0;		// what resources actually occupy
+		};
+
+		struct BlockInfo
+		{
+			u32 index;
+			u32 memoryType;
+			bool linear;
+			u32 allocationCount;
+			VkDeviceSize capacity;
+			VkDeviceSize usedBytes;
+			VkDeviceSize largestFreeRegion;
+			u32 freeRegionCount;
+		};
+
+		// One row of the accounting table per memory heap. The category columns are live, budget and usage are
+		// refreshed by UpdateBudget
+		struct HeapBudget
+		{
+			u32 heap = 0;
+			bool deviceLocal = false;
+			VkDeviceSize size = 0;
+			VkDeviceSize budget = 0;		// what the process can use before the driver starts paging
+			VkDeviceSize usage = 0;			// what the process uses, other allocators included when the driver reports it
+			VkDeviceSize reservedBytes = 0;	// taken from the driver by this allocator
+			VkDeviceSize usedBytes = 0;
+			VkDeviceSize categoryBytes[(u32)MemoryCategory::Count] = { };
+			u32 categoryCounts[(u32)MemoryCategory::Count] = { };
+			bool overBudget = false;
+		};
+
+		// Runs every UpdateBudget while a heap is over the limit, the signal to evict
+		using BudgetCallback = std::function<void(const HeapBudget& aHeap)>;
+
+		MemoryAllocator();
+		~MemoryAllocator();
+
+		// aGetMemoryProperties2 is only passed when VK_EXT_memory_budget is enabled, the budget is estimated from the heap
+		// sizes otherwise
+		void Init(VkDevice aDevice, VkPhysicalDevice aPhysicalDevice, PFN_vkGetPhysicalDeviceMemoryProperties2KHR aGetMemoryProperties2 = nullptr);
+		// Frees every block and dedicated allocation, whatever is still allocated is reported as leaked
+		void Destroy();
+
+		// aPreferred is used when a memory type also has it, aRequired always has to be met
+		MemoryAllocation* Allocate(const VkMemoryRequirements& aRequirements, VkMemoryPropertyFlags aRequired, bool aLinear, MemoryCategory aCategory, VkMemoryPropertyFlags aPreferred = 0);
+		// Allocates for the resource and binds it
+		MemoryAllocation* AllocateBuffer(VkBuffer aBuffer, VkMemoryPropertyFlags aRequired, MemoryCategory aCategory);
+		MemoryAllocation* AllocateImage(VkImage aImage, VkMemoryPropertyFlags aRequired, MemoryCategory aCategory, VkMemoryPropertyFlags aPreferred = 0);
+		// Memory of aCurrent's type in one of the other blocks, for moving a resource out of aCurrent's block. Never opens
+		// a block, nullptr when the others have no room. Keeps the category and binds the resource
+		MemoryAllocation* AllocateBufferMove(VkBuffer aBuffer, const MemoryAllocation* aCurrent);
+		MemoryAllocation* AllocateImageMove(VkImage aImage, const MemoryAllocation* aCurrent);
+		// Only once nothing on the GPU uses it anymore, go through the deletion queue otherwise
+		void Free(MemoryAllocation* aAllocation);
+
+		Stats GetStats() const;
+		// Every block that is currently allocated, dedicated allocations aren't included
+		std::vector<BlockInfo> GetBlocks() const;
+		void LogStats() const;
+
+		// Queries the driver's budget, once per frame. Heaps whose usage is over aLimit of their budget run the callbacks
+		void UpdateBudget(f32 aLimit);
+		const std::vector<HeapBudget>& GetBudget() const;
+		// Summed over every heap
+		VkDeviceSize GetCategoryBytes(MemoryCategory aCategory) const;
+		bool HasMemoryBudget() const;
+		void LogBudget() const;
+
+		u32 AddBudgetCallback(BudgetCallback aCallback);
+		void RemoveBudgetCallback(u32 aId);
+
+		static constexpr VkDeviceSize DefaultBlockSize = 64 * 1024 * 1024;
+
+	private:
+		struct Block
+		{
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			u8* mapped = nullptr;
+			u32 memoryType = 0;
+			bool linear = false;
+			u32 allocationCount = 0;
+			TlsfHeap heap;
+		};
+
+		u32 FindMemoryType(u32 aTypeBits, VkMemoryPropertyFlags aRequired, VkMemoryPropertyFlags aPreferred) const;
+		void AlignToAtoms(u32 aMemoryType, VkDeviceSize& aSize, VkDeviceSize& aAlignment) const;
+		VkDeviceSize GetBlockSize(u32 aMemoryType) const;
+		VkDeviceMemory AllocateMemory(VkDeviceSize aSize, u32 aMemoryType, u8** aMapped);
+		void FreeMemory(VkDeviceMemory aMemory, VkDeviceSize aSize, u32 aMemoryType);
+		MemoryAllocation* AllocateDedicated(VkDeviceSize aSize, u32 aMemoryType, MemoryCategory aCategory);
+		MemoryAllocation* AllocateMove(const VkMemoryRequirements& aRequirements, const MemoryAllocation* aCurrent);
+		// Index of the block the region was taken from, ~0u when no block of the kind has room
+		u32 AllocateFromBlocks(VkDeviceSize aSize, VkDeviceSize aAlignment, u32 aMemoryType, bool aLinear, u32 aExcludedBlock, u32& aRegion);
+		MemoryAllocation* CreateAllocation(u32 aBlock, u32 aRegion, VkDeviceSize aSize, MemoryCategory aCategory);
+		// Adds or removes the allocation from its heap's row
+		void Account(const MemoryAllocation& aAllocation, bool aAdd);
+		HeapBudget& GetHeap(u32 aMemoryType);
+		u32 CreateBlock(u32 aMemoryType, bool aLinear);
+		void DestroyBlock(u32 aBlock);
+
+		VkDevice myDevice;
+		VkPhysicalDevice myPhysicalDevice;
+		PFN_vkGetPhysicalDeviceMemoryProperties2KHR myGetMemoryProperties2;
+		VkPhysicalDeviceMemoryProperties myMemoryProperties;
+		VkDeviceSize myNonCoherentAtomSize;
+
+		// Released blocks leave an empty slot, so block indices stay valid
+		std::vector<std::unique_ptr<Block>> myBlocks;
+		// Dedicated allocations own their memory, Destroy frees whatever is left of them
+		std::vector<MemoryAllocation*> myDedicatedAllocations;
+		u32 myAllocationCount;
+		u32 myDedicatedCount;
+		VkDeviceSize myDedicatedBytes;
+		VkDeviceSize myUsedBytes;
+
+		std::vector<HeapBudget> myHeaps;
+		std::vector<std::pair<u32, BudgetCallback>> myBudgetCallbacks;
+		u32 myNextCallbackId;
+	};
+}
+namespace fw = frostwave;
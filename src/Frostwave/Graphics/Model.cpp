@@ -6,6 +6,7 @@
 void frostwave::Mesh::Destroy()
 {
 	myVertexBuffer.Destroy();
+	myPositionBuffer.Destroy();
 	myIndexBuffer.Destroy();
 }
 
@@ -36,16 +37,69 @@ bool frostwave::Mesh::Load(const string& aFilename, VertexLayout aLayout, ModelC
 	myIndexCount = 0;
 	myVertexCount = 0;
 
+	// Counted first so the vertices can be written straight into staging memory
+	u32 triangleCount = 0;
+	for (u32 i = 0; i < scene->mNumMeshes; ++i)
+	{
+		const aiMesh* mesh = scene->mMeshes[i];
+		myVertexCount += mesh->mNumVertices;
+		for (u32 j = 0; j < mesh->mNumFaces; ++j)
+		{
+			if (mesh->mFaces[j].mNumIndices == 3)
+			{
+				++triangleCount;
+			}
+		}
+	}
+
+	const bool hasPosition = std::find(aLayout.components.begin(), aLayout.components.end(), VERTEX_COMPONENT_POSITION) != aLayout.components.end();
+
+	const u32 vBufferSize = myVertexCount * aLayout.Stride();
+	const u32 pBufferSize = hasPosition ? myVertexCount * 3 * sizeof(f32) : 0;
+	const u32 iBufferSize = triangleCount * 3 * sizeof(u32);
+
+	CreateBuffer(aFramework,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		MemoryCategory::Mesh,
+		&myVertexBuffer, vBufferSize
+	);
+
+	// Layouts without positions have nothing for the depth pre-pass, and Vulkan rejects empty buffers
+	if (pBufferSize > 0)
+	{
+		CreateBuffer(aFramework,
+			VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			MemoryCategory::Mesh,
+			&myPositionBuffer, pBufferSize
+		);
+	}
+
+	CreateBuffer(aFramework,
+		VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		MemoryCategory::Mesh,
+		&myIndexBuffer, iBufferSize
+	);
+
+	// Vertices, positions and indices back to back in one staging allocation
+	UploadContext& uploadContext = aFramework->GetUploadContext();
+	StagingAllocation staging = uploadContext.AllocateStaging((VkDeviceSize)vBufferSize + pBufferSize + iBufferSize);
+
+	f32* vertices = (f32*)staging.data;
+	f32* positions = (f32*)((u8*)staging.data + vBufferSize);
+	u32* indices = (u32*)((u8*)staging.data + vBufferSize + pBufferSize);
+
+	u32 vertexBase = 0;
 	for (u32 i = 0; i < scene->mNumMeshes; ++i)
 	{
 		const aiMesh* mesh = scene->mMeshes[i];
 
 		myParts[i] = { };
-		myParts[i].vertexBase = myVertexCount;
+		myParts[i].vertexBase = vertexBase;
 		myParts[i].indexBase = myIndexCount;
 
-		myVertexCount += mesh->mNumVertices;
-
 		aiColor3D color(0.0f, 0.0f, 0.0f);
 		scene->mMaterials[mesh->mMaterialIndex]->Get(AI_MATKEY_COLOR_DIFFUSE, color);
 
@@ -64,33 +118,36 @@ bool frostwave::Mesh::Load(const string& aFilename, VertexLayout aLayout, ModelC
 				switch (c)
 				{
 				case frostwave::VERTEX_COMPONENT_POSITION:
-					myVertices.push_back(pos->x * scale.x + center.x);
-					myVertices.push_back(pos->y * scale.y + center.y);
-					myVertices.push_back(pos->z * scale.z + center.z);
+					*vertices++ = pos->x * scale.x + center.x;
+					*vertices++ = pos->y * scale.y + center.y;
+					*vertices++ = pos->z * scale.z + center.z;
+					*positions++ = pos->x * scale.x + center.x;
+					*positions++ = pos->y * scale.y + center.y;
+					*positions++ = pos->z * scale.z + center.z;
 					break;
 				case frostwave::VERTEX_COMPONENT_NORMAL:
-					myVertices.push_back(normal->x);
-					myVertices.push_back(normal->y);
-					myVertices.push_back(normal->z);
+					*vertices++ = normal->x;
+					*vertices++ = normal->y;
+					*vertices++ = normal->z;
 					break;
 				case frostwave::VERTEX_COMPONENT_UV:
-					myVertices.push_back(texCoord->x * uvscale.x);
-					myVertices.push_back(texCoord->y * uvscale.y);
+					*vertices++ = texCoord->x * uvscale.x;
+					*vertices++ = texCoord->y * uvscale.y;
 					break;
 				case frostwave::VERTEX_COMPONENT_COLOR:
-					myVertices.push_back(color.r);
-					myVertices.push_back(color.g);
-					myVertices.push_back(color.b);
+					*vertices++ = color.r;
+					*vertices++ = color.g;
+					*vertices++ = color.b;
 					break;
 				case frostwave::VERTEX_COMPONENT_TANGENT:
-					myVertices.push_back(tangent->x);
-					myVertices.push_back(tangent->y);
-					myVertices.push_back(tangent->z);
+					*vertices++ = tangent->x;
+					*vertices++ = tangent->y;
+					*vertices++ = tangent->z;
 					break;
 				case frostwave::VERTEX_COMPONENT_BITANGENT:
-					myVertices.push_back(biTangent->x);
-					myVertices.push_back(biTangent->y);
-					myVertices.push_back(biTangent->z);
+					*vertices++ = biTangent->x;
+					*vertices++ = biTangent->y;
+					*vertices++ = biTangent->z;
 					break;
 				}
 			}
@@ -108,7 +165,6 @@ bool frostwave::Mesh::Load(const string& aFilename, VertexLayout aLayout, ModelC
 
 		myParts[i].vertexCount = mesh->mNumVertices;
 
-		u32 indexBase = (u32)myIndices.size();
 		for (u32 j = 0; j < mesh->mNumFaces; ++j)
 		{
 			const aiFace& Face = mesh->mFaces[j];
@@ -116,56 +172,51 @@ bool frostwave::Mesh::Load(const string& aFilename, VertexLayout aLayout, ModelC
 			{
 				continue;
 			}
-			myIndices.push_back(indexBase + Face.mIndices[0]);
-			myIndices.push_back(indexBase + Face.mIndices[1]);
-			myIndices.push_back(indexBase + Face.mIndices[2]);
+			*indices++ = vertexBase + Face.mIndices[0];
+			*indices++ = vertexBase + Face.mIndices[1];
+			*indices++ = vertexBase + Face.mIndices[2];
 			myParts[i].indexCount += 3;
 			myIndexCount += 3;
 		}
-	}
-
-	u32 vBufferSize = (u32)myVertices.size() * sizeof(f32);
-	u32 iBufferSize = (u32)myIndices.size() * sizeof(u32);
-
-	fw::Buffer vertexStaging, indexStaging;
-
-	CreateBuffer(aFramework,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&vertexStaging, vBufferSize, myVertices.data()
-	);
-
-	CreateBuffer(aFramework,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&indexStaging, iBufferSize, myIndices.data()
-	);
-
-	CreateBuffer(aFramework,
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		&myVertexBuffer, vBufferSize
-	);
 
-	CreateBuffer(aFramework,
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-		&myIndexBuffer, iBufferSize
-	);
+		vertexBase += mesh->mNumVertices;
+	}
 
-	VkCommandBuffer copyCmd = BeginSingleTimeCommands(aFramework);
+	// After the allocation, a full ring can submit the batch that was open before it
+	VkCommandBuffer copyCmd = uploadContext.GetTransferCommandBuffer();
 
 	VkBufferCopy copyRegion = {};
-	copyRegion.size = myVertexBuffer.size;
-	vkCmdCopyBuffer(copyCmd, vertexStaging.buffer, myVertexBuffer.buffer, 1, &copyRegion);
+	copyRegion.srcOffset = staging.offset;
+	copyRegion.size = vBufferSize;
+	vkCmdCopyBuffer(copyCmd, staging.buffer, myVertexBuffer.buffer, 1, &copyRegion);
 
-	copyRegion.size = myIndexBuffer.size;
-	vkCmdCopyBuffer(copyCmd, indexStaging.buffer, myIndexBuffer.buffer, 1, &copyRegion);
+	if (pBufferSize > 0)
+	{
+		copyRegion.srcOffset = staging.offset + vBufferSize;
+		copyRegion.size = pBufferSize;
+		vkCmdCopyBuffer(copyCmd, staging.buffer, myPositionBuffer.buffer, 1, &copyRegion);
+	}
 
-	EndSingleTimeCommands(copyCmd, aFramework);
+	copyRegion.srcOffset = staging.offset + vBufferSize + pBufferSize;
+	copyRegion.size = iBufferSize;
+	vkCmdCopyBuffer(copyCmd, staging.buffer, myIndexBuffer.buffer, 1, &copyRegion);
 
-	vertexStaging.Destroy();
-	indexStaging.Destroy();
+	uploadContext.ReleaseToGraphics(myVertexBuffer.buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	if (pBufferSize > 0)
+	{
+		uploadContext.ReleaseToGraphics(myPositionBuffer.buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+	}
+	uploadContext.ReleaseToGraphics(myIndexBuffer.buffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+	myUploadTicket = uploadContext.GetTicket();
+
+	// Draws look the buffers up when recorded, nothing else holds on to them
+	Defragmenter& defragmenter = aFramework->GetDefragmenter();
+	defragmenter.Register(&myVertexBuffer, myUploadTicket);
+	if (pBufferSize > 0)
+	{
+		defragmenter.Register(&myPositionBuffer, myUploadTicket);
+	}
+	defragmenter.Register(&myIndexBuffer, myUploadTicket);
 
 	return true;
 }
@@ -188,27 +239,55 @@ bool frostwave::Model::Load(const string& aFilename, Renderer* aRenderer, Vertex
 	myMaterial = new VulkanImage;
 	myMaterial->Create(myFramework, aImageInfo);
 
-	if (loadedMeshes.find(aFilename) != loadedMeshes.end())
+	// Map nodes never move, so the defragmenter can keep pointers to the mesh's buffers
+	auto found = loadedMeshes.find(aFilename);
+	if (found != loadedMeshes.end())
 	{
-		myMesh = loadedMeshes.at(aFilename);
+		myMesh = &found->second;
 	}
 	else
 	{
-		auto res = myMesh.Load(aFilename, aLayout, aCreateInfo, aFramework, aCopyQueue, aFlags);
-		if (!res) return false;
-		loadedMeshes[aFilename] = myMesh;
+		myMesh = &loadedMeshes[aFilename];
+		auto res = myMesh->Load(aFilename, aLayout, aCreateInfo, aFramework, aCopyQueue, aFlags);
+		if (!res)
+		{
+			loadedMeshes.erase(aFilename);
+			myMesh = &myOwnMesh;
+			return false;
+		}
 	}
 
 	myUBO = aRenderer->GetUBO();
 
 	SetupDescriptorSets();
 
+	// A moved texture has a new view, which the descriptor set names
+	Defragmenter& defragmenter = myFramework->GetDefragmenter();
+	defragmenter.Register(myDiffuse, [this]() { RefreshDescriptorSets(); });
+	defragmenter.Register(myNormalMap, [this]() { RefreshDescriptorSets(); });
+	defragmenter.Register(myMaterial, [this]() { RefreshDescriptorSets(); });
+
 	return true;
 }
 
+frostwave::UploadTicket frostwave::Model::GetUploadTicket() const
+{
+	// Batches complete in order, so the latest ticket covers the others
+	UploadTicket ticket = myMesh->myUploadTicket;
+	if (myDiffuse) ticket = fw::Max(ticket, myDiffuse->GetUploadTicket());
+	if (myNormalMap) ticket = fw::Max(ticket, myNormalMap->GetUploadTicket());
+	if (myMaterial) ticket = fw::Max(ticket, myMaterial->GetUploadTicket());
+	return ticket;
+}
+
 void frostwave::Model::Destroy()
 {
-	myMesh.Destroy();
+	myMesh->Destroy();
+	if (myDescriptorSet != VK_NULL_HANDLE)
+	{
+		myFramework->GetDeletionQueue().Retire(myDescriptorPool, myDescriptorSet);
+		myDescriptorSet = VK_NULL_HANDLE;
+	}
 	if (myDiffuse) myDiffuse->Destroy();
 	if (myNormalMap) myNormalMap->Destroy();
 	if (myMaterial) myMaterial->Destroy();
@@ -216,57 +295,52 @@ void frostwave::Model::Destroy()
 
 const fw::Mesh::Dimensions& frostwave::Model::GetDimensions() const
 {
-	return myMesh.myDimensions;
-}
-
-std::vector<f32>& frostwave::Model::GetVertices()
-{
-	return myMesh.myVertices;
+	return myMesh->myDimensions;
 }
 
-std::vector<u32>& frostwave::Model::GetIndices()
+frostwave::Buffer& frostwave::Model::GetVertexBuffer()
 {
-	return myMesh.myIndices;
+	return myMesh->myVertexBuffer;
 }
 
-frostwave::Buffer& frostwave::Model::GetVertexBuffer()
+const fw::Buffer& frostwave::Model::GetVertexBuffer() const
 {
-	return myMesh.myVertexBuffer;
+	return myMesh->myVertexBuffer;
 }
 
-const fw::Buffer& frostwave::Model::GetVertexBuffer() const
+const fw::Buffer& frostwave::Model::GetPositionBuffer() const
 {
-	return myMesh.myVertexBuffer;
+	return myMesh->myPositionBuffer;
 }
 
 frostwave::Buffer& frostwave::Model::GetIndexBuffer()
 {
-	return myMesh.myIndexBuffer;
+	return myMesh->myIndexBuffer;
 }
 
 const fw::Buffer& frostwave::Model::GetIndexBuffer() const
 {
-	return myMesh.myIndexBuffer;
+	return myMesh->myIndexBuffer;
 }
 
 void frostwave::Model::SetVertexCount(u32 aCount)
 {
-	myMesh.myVertexCount = aCount;
+	myMesh->myVertexCount = aCount;
 }
 
 u32 frostwave::Model::GetVertexCount() const
 {
-	return myMesh.myVertexCount;
+	return myMesh->myVertexCount;
 }
 
 void frostwave::Model::SetIndexCount(u32 aCount)
 {
-	myMesh.myIndexCount = aCount;
+	myMesh->myIndexCount = aCount;
 }
 
 u32 frostwave::Model::GetIndexCount() const
 {
-	return myMesh.myIndexCount;
+	return myMesh->myIndexCount;
 }
 
 const VkDescriptorSet& frostwave::Model::GetDescriptorSet() const
@@ -276,23 +350,24 @@ const VkDescriptorSet& frostwave::Model::GetDescriptorSet() const
 
 void frostwave::Model::SetupDescriptorSets()
 {
-	VkDescriptorSetAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = ((VkFramework*)myFramework)->GetDescriptorPool();
-	allocInfo.descriptorSetCount = 1;
-	allocInfo.pSetLayouts = &myRenderer->GetDescriptorSetLayout();
-
-	VkResult result = vkAllocateDescriptorSets(myFramework->GetDevice(), &allocInfo, &myDescriptorSet);
-	if (result != VK_SUCCESS)
+	if (myDescriptorSet != VK_NULL_HANDLE)
+	{
+		myFramework->GetDeletionQueue().Retire(myDescriptorPool, myDescriptorSet);
+		myDescriptorSet = VK_NULL_HANDLE;
+	}
+
+	myDescriptorSet = ((VkFramework*)myFramework)->AllocateDescriptorSet(myRenderer->GetDescriptorSetLayout(), &myDescriptorPool);
+	if (myDescriptorSet == VK_NULL_HANDLE)
 	{
 		FATAL_LOG("Failed to allocate descriptor sets!");
 		return;
 	}
+	myDescriptorViews = { myDiffuse->GetImageView(), myNormalMap->GetImageView(), myMaterial->GetImageView() };
 
 	VkDescriptorBufferInfo bufferInfo = {};
 	bufferInfo.buffer = myUBO->buffer;
 	bufferInfo.offset = 0;
-	bufferInfo.range = VK_WHOLE_SIZE;
+	bufferInfo.range = myUBO->descriptor.range;
 
 	VkDescriptorImageInfo imageInfo = {};
 	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
@@ -310,11 +385,23 @@ void frostwave::Model::SetupDescriptorSets()
 	material.sampler = myMaterial->GetSampler();
 
 	std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
-		fw::initializers::WriteDescriptorSet(myDescriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &bufferInfo),
+		fw::initializers::WriteDescriptorSet(myDescriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 0, &bufferInfo),
 		fw::initializers::WriteDescriptorSet(myDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &imageInfo),
 		fw::initializers::WriteDescriptorSet(myDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &normalMap),
 		fw::initializers::WriteDescriptorSet(myDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &material)
 	};
 
 	vkUpdateDescriptorSets(myFramework->GetDevice(), (u32)writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
+}
+
+void frostwave::Model::RefreshDescriptorSets()
+{
+	// Called for every texture that moved, the first call already names all of their new views
+	const std::array<VkImageView, 3> views = { myDiffuse->GetImageView(), myNormalMap->GetImageView(), myMaterial->GetImageView() };
+	if (views == myDescriptorViews)
+	{
+		return;
+	}
+
+	SetupDescriptorSets();
 }
\ No newline at end of file
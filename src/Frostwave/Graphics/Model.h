@@ -13,6 +13,7 @@
 #include <Frostwave/Graphics/VulkanImage.h>
 #include <Frostwave/Graphics/VulkanBuffer.h>
 
+#include <array>
 #include <vector>
 
 namespace frostwave
@@ -76,6 +77,7 @@ namespace frostwave
 		};
 
 	public:
+		// Registers the buffers with the defragmenter, the mesh must stay where it is afterwards
 		bool Load(const string& aFilename, VertexLayout aLayout, ModelCreateInfo* aCreateInfo, const VkFramework* aFramework, VkQueue aCopyQueue, const i32 aFlags = DefaultFlags);
 		void Destroy();
 
@@ -84,29 +86,29 @@ namespace frostwave
 		Dimensions myDimensions;
 		std::vector<ModelPart> myParts;
 
-		std::vector<f32> myVertices;
-		std::vector<u32> myIndices;
-
 		Buffer myVertexBuffer;
+		// Positions alone, tightly packed, for passes that only need depth
+		Buffer myPositionBuffer;
 		Buffer myIndexBuffer;
 		u32 myVertexCount = 0;
 		u32 myIndexCount = 0;
+		UploadTicket myUploadTicket = 0;
 	};
 
 	class Model
 	{
 	public:
-		Model() : myDiffuse(nullptr), myNormalMap(nullptr), myMaterial(nullptr) { }
+		Model() : myDescriptorSet(VK_NULL_HANDLE), myDescriptorPool(VK_NULL_HANDLE), myDescriptorViews(), myDiffuse(nullptr), myNormalMap(nullptr), myMaterial(nullptr), myMesh(&myOwnMesh) { }
 		bool Load(const string& aFilename, Renderer* aRenderer, VertexLayout aLayout, ImageCreateInfo& aImageInfo, ModelCreateInfo* aCreateInfo, const VkFramework* aFramework, VkQueue aCopyQueue, const i32 aFlags = DefaultFlags);
 		void Destroy();
 
 		const Mesh::Dimensions& GetDimensions() const;
-
-		std::vector<f32>& GetVertices();
-		std::vector<u32>& GetIndices();
+		// Covers the mesh and texture uploads, the model can be drawn by frames begun after it was submitted
+		UploadTicket GetUploadTicket() const;
 
 		Buffer& GetVertexBuffer();
 		const Buffer& GetVertexBuffer() const;
+		const Buffer& GetPositionBuffer() const;
 		Buffer& GetIndexBuffer();
 		const Buffer& GetIndexBuffer() const;
 
@@ -118,17 +120,26 @@ namespace frostwave
 		const VkDescriptorSet& GetDescriptorSet() const;
 
 	private:
+		// Replaces the set when there already is one, frames in flight may still use it
 		void SetupDescriptorSets();
+		// Replaces the set only when a texture it names has moved since it was written
+		void RefreshDescriptorSets();
 
 		const VkFramework* myFramework;
 		const Renderer* myRenderer;
 
 		VkDescriptorSet myDescriptorSet;
+		// The set has to be freed to the pool it came from
+		VkDescriptorPool myDescriptorPool;
+		// Diffuse, normal map and material views the set was written with
+		std::array<VkImageView, 3> myDescriptorViews;
 		Buffer* myUBO;
 		VulkanImage* myDiffuse;
 		VulkanImage* myNormalMap;
 		VulkanImage* myMaterial;
-		Mesh myMesh;
+		// Loaded meshes are shared between models, the quad and sphere the renderer builds are the model's own
+		Mesh* myMesh;
+		Mesh myOwnMesh;
 	};
 }
 namespace fw = frostwave;
\ No newline at end of file
@@ -5,8 +5,30 @@
 #include <Frostwave/Graphics/Model.h>
 #include <Frostwave/Graphics/ModelInstance.h>
 #include <Frostwave/Graphics/VulkanUtils.h>
+#include <Frostwave/Core/Math/Projection.h>
+
+constexpr u32 InitialInstanceCapacity = 256;
+constexpr u32 InitialIndirectCapacity = 64;
+constexpr u32 InitialLightCapacity = 64;
+// Must match TILE_SIZE and MAX_LIGHTS_PER_TILE in tiled_cull.comp and deferred.frag
+constexpr u32 LightTileSize = 16;
+constexpr u32 MaxLightsPerTile = 256;
+// Must match CLUSTER_COUNT_X/Y/Z in deferred.frag
+constexpr u32 ClusterCountX = 16;
+constexpr u32 ClusterCountY = 9;
+constexpr u32 ClusterCountZ = 24;
+constexpr u32 InitialClusterIndexCapacity = 1024;
+constexpr u32 LightVolumeSegments = 16;
+constexpr u32 LightVolumeRings = 8;
+
+// Must match the push constants in upscale.frag
+struct UpscaleConstants
+{
+	fw::Vec2f uvScale;		// rendered extent over the scene color size
+	fw::Vec2f texelSize;	// one texel of the scene color target in UV
+};
 
-frostwave::Renderer::Renderer() : myCommandPool(VK_NULL_HANDLE)
+frostwave::Renderer::Renderer() : myCommandPool(VK_NULL_HANDLE), myUseIndirectDraw(false), myUseTiledLighting(false), myUseClusteredLighting(false), myUseLightVolumes(false), myUseLightScissors(false), myUseCompactGBuffer(false), myUseSubpasses(false), myUseDepthPrepass(false), myUseDynamicResolution(false), myRenderExtent({ 0, 0 }), myTileCountX(0), myTileCountY(0), myUBOStride(0), myGBufferBinds(0), myDefragmenterMoveCount(0)
 {
 }
 
@@ -18,95 +40,205 @@ void frostwave::Renderer::Init(VkFramework* aFramework)
 {
 	myFramework = aFramework;
 
-	myCommandBuffers.resize(1);
+	myUseIndirectDraw = aFramework->GetSettings().indirectDraw;
+	if (myUseIndirectDraw && !aFramework->GetEnabledFeatures().drawIndirectFirstInstance)
+	{
+		WARNING_LOG("Indirect draw requested but drawIndirectFirstInstance is not supported, falling back to direct draws");
+		myUseIndirectDraw = false;
+	}
+
+	myUseTiledLighting = aFramework->GetSettings().tiledLighting;
+	myUseClusteredLighting = aFramework->GetSettings().clusteredLighting;
+	if (myUseTiledLighting && myUseClusteredLighting)
+	{
+		WARNING_LOG("Both tiled and clustered lighting requested, using tiled lighting");
+		myUseClusteredLighting = false;
+	}
+
+	myUseLightVolumes = aFramework->GetSettings().lightVolumes;
+	if (myUseLightVolumes && (myUseTiledLighting || myUseClusteredLighting))
+	{
+		WARNING_LOG("Light volumes only apply to per light shading, ignoring them for tiled/clustered lighting");
+		myUseLightVolumes = false;
+	}
+
+	myUseCompactGBuffer = aFramework->GetSettings().gBufferLayout == GraphicsSettings::GBufferCompact;
+
+	myUseSubpasses = aFramework->GetSettings().deferredSubpasses;
+	if (myUseSubpasses && myUseTiledLighting)
+	{
+		WARNING_LOG("Deferred subpasses leave no room for the light culling dispatch between G-buffer and lighting, using separate passes");
+		myUseSubpasses = false;
+	}
+
+	myUseDynamicResolution = aFramework->GetSettings().dynamicResolution;
+	if (myUseDynamicResolution && myUseSubpasses)
+	{
+		WARNING_LOG("The merged deferred pass writes lighting straight to the swapchain, dynamic resolution needs separate passes to upscale from");
+		myUseDynamicResolution = false;
+	}
+
+	myUseLightScissors = aFramework->GetSettings().lightScissors;
+	if (myUseLightScissors && (myUseTiledLighting || myUseClusteredLighting || myUseLightVolumes))
+	{
+		WARNING_LOG("Light scissors only apply to fullscreen per light shading, ignoring them");
+		myUseLightScissors = false;
+	}
+
+	myFrames.resize(myFramework->GetFramesInFlight());
+
 	CreatePoolAndBuffers();
+	CreateRecordingThreads();
+
+	myGpuTimer.Init(myFramework, (u32)myFrames.size());
+	if (myGpuTimer.IsSupported())
+	{
+		CreateTimestampCommandBuffers();
+	}
+
+	// The controller steers by GPU frame time, without timestamps there is nothing to measure against
+	if (myUseDynamicResolution && !myGpuTimer.IsSupported())
+	{
+		WARNING_LOG("Dynamic resolution needs GPU timestamps, rendering at full resolution");
+		myUseDynamicResolution = false;
+	}
+	myResolutionController.Init(aFramework->GetSettings().gpuFrameBudget, aFramework->GetSettings().minRenderScale);
 
 	myPipelines.forward = aFramework->GetPipeline();
 	myPipelineLayouts.forward = aFramework->GetPipelineLayout();
 
-	VkSemaphoreCreateInfo info = { };
-	info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-	vkCreateSemaphore(myFramework->GetDevice(), &info, nullptr, &myOffscreenSemaphore);
+	// With subpasses G-buffer and lighting share a submit, so there is nothing to chain
+	if (!myUseSubpasses)
+	{
+		VkSemaphoreCreateInfo info = { };
+		info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		for (auto& frame : myFrames)
+		{
+			vkCreateSemaphore(myFramework->GetDevice(), &info, nullptr, &frame.offscreenSemaphore);
+		}
+	}
 
 	GenerateQuad();
 	PrepareOffscreenFramebuffer();
+	myRenderExtent = { (u32)myOffscreenFramebuffer.width, (u32)myOffscreenFramebuffer.height };
+	if (myUseSubpasses)
+	{
+		PrepareDeferredPass();
+	}
+	if (myUseDynamicResolution)
+	{
+		PrepareUpscalePass();
+	}
+	if (myUseLightVolumes)
+	{
+		GenerateSphere();
+		if (!myUseSubpasses && !myUseDynamicResolution)
+		{
+			PrepareLightVolumes();
+		}
+	}
 	PrepareUniformBuffers();
+	for (auto& frame : myFrames)
+	{
+		ReserveMappedBuffer(frame, frame.instanceBuffer, frame.instanceCapacity, InitialInstanceCapacity, sizeof(fw::Mat4f), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+		ReserveMappedBuffer(frame, frame.indirectBuffer, frame.indirectCapacity, InitialIndirectCapacity, sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+		ReserveMappedBuffer(frame, frame.lightBuffer, frame.lightCapacity, InitialLightCapacity, sizeof(PointLight), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+	}
 	SetupDescriptorSetLayout();
 	PreparePipelines();
 	SetupDescriptorPool();
 	SetupDescriptorSet();
+
+	if (myUseTiledLighting)
+	{
+		PrepareTiledLighting();
+	}
+
+	if (myUseClusteredLighting)
+	{
+		PrepareClusteredLighting();
+	}
+
+	if (myUseDynamicResolution)
+	{
+		PrepareUpscalePipeline();
+	}
 }
 
 void frostwave::Renderer::Render(const std::vector<ModelInstance*>& aModels, const std::vector<PointLight>& aLights, fw::Camera* aCamera)
 {
-	if (aModels.size() > myCommandBuffers.size())
+	u32 idx = myFramework->BeginFrame();
+
+	// The swapchain was out of date and has been recreated, so nothing of this frame can be recorded against it
+	if (idx == (u32)-1)
 	{
-		myCommandBuffers.resize(aModels.size());
-		CreatePoolAndBuffers();
+		Resize();
+		return;
 	}
 
-	u32 idx = myFramework->BeginFrame();
+	// BeginFrame has waited on this frame's fence, so everything in its slot is free to overwrite. The cached command
+	// buffers are owned by their slot and only ever submitted by it, so none of them can still be pending when reused
+	const u32 frameIndex = myFramework->GetCurrentFrame();
+	FrameResources& frame = myFrames[frameIndex];
+	assert(vkGetFenceStatus(myFramework->GetDevice(), myFramework->myInFlightFences[frameIndex]) == VK_SUCCESS);
+
+	// BeginFrame may have moved buffers and textures, every slot's cached command buffers name the old handles
+	const u64 moveCount = myFramework->GetDefragmenter().GetMoveCount();
+	if (moveCount != myDefragmenterMoveCount)
+	{
+		myDefragmenterMoveCount = moveCount;
+		for (auto& cached : myFrames)
+		{
+			cached.commandBuffersDirty = true;
+		}
+	}
+
+	myGpuTimer.Collect(frameIndex);
+
+	// The time just collected is this slot's previous frame, rendered at the scale stored with it
+	if (myUseDynamicResolution)
+	{
+		myResolutionController.Update(myGpuTimer.GetTime(GpuTimer::Frame), frame.renderScale);
+	}
+	UpdateRenderExtent(frame);
 
 	myTimer.Update();
 
 	myUBO = { };
 	myUBO.view = aCamera->GetView();
 	myUBO.projection = aCamera->GetProjection();
-	memcpy(myUniformBuffers.offscreen.mapped, &myUBO, sizeof(myUBO));
+	memcpy((u8*)myUniformBuffers.offscreen.mapped + frameIndex * myUBOStride, &myUBO, sizeof(myUBO));
+
+	// The merged pass has the swapchain image ahead of the G-buffer targets
+	const u32 firstTarget = myUseSubpasses ? 1 : 0;
+	const u32 colorCount = firstTarget + myOffscreenFramebuffer.colorAttachmentCount;
+	std::array<VkClearValue, 6> clearValues = {};
+	for (u32 i = 0; i < colorCount; ++i)
+	{
+		clearValues[i].color = { 0.0f, 0.0f, 0.0f, 1.0f };
+	}
+	clearValues[colorCount].depthStencil = { 1.0f, 0 };
 
 	VkRenderPassBeginInfo renderPassInfo = {};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassInfo.renderPass = myOffscreenFramebuffer.renderPass;
-	renderPassInfo.framebuffer = myOffscreenFramebuffer.frameBuffer;
 	renderPassInfo.renderArea.offset = { 0, 0 };
-	renderPassInfo.renderArea.extent.width = myOffscreenFramebuffer.width;
-	renderPassInfo.renderArea.extent.height = myOffscreenFramebuffer.height;
-
-	std::array<VkClearValue, 5> clearValues = {};
-	clearValues[0].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-	clearValues[1].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-	clearValues[2].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-	clearValues[3].color = { 0.0f, 0.0f, 0.0f, 1.0f };
-	clearValues[4].depthStencil = { 1.0f, 0 };
-
-	renderPassInfo.clearValueCount = (u32)clearValues.size();
+	renderPassInfo.clearValueCount = colorCount + 1;
 	renderPassInfo.pClearValues = clearValues.data();
 
-	auto inheritanceInfo = myFramework->BeginCommandBufferRecording(idx, renderPassInfo);
-
-	for (u32 i = 0; i < (u32)aModels.size(); ++i)
+	if (myUseSubpasses)
 	{
-		ModelInstance* instance = aModels[i];
-		const Model* model = aModels[i]->GetModel();
-
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
-		beginInfo.pInheritanceInfo = &inheritanceInfo;
-
-		vkBeginCommandBuffer(myCommandBuffers[i], &beginInfo);
-
-		vkCmdBindPipeline(myCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelines.offscreen);
-
-		VkViewport viewport = fw::initializers::Viewport((float)myOffscreenFramebuffer.width, (float)myOffscreenFramebuffer.height, 0.0f, 1.0f);
-		vkCmdSetViewport(myCommandBuffers[i], 0, 1, &viewport);
-
-		VkRect2D scissor = fw::initializers::Rect2D(myOffscreenFramebuffer.width, myOffscreenFramebuffer.height, 0, 0);
-		vkCmdSetScissor(myCommandBuffers[i], 0, 1, &scissor);
-
-		VkDeviceSize offsets[] = { 0 };
-
-		vkCmdPushConstants(myCommandBuffers[i], myPipelineLayouts.offscreen, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(fw::Mat4f), &instance->GetTransform());
-
-		vkCmdBindVertexBuffers(myCommandBuffers[i], 0, 1, &model->GetVertexBuffer().buffer, offsets);
-		vkCmdBindIndexBuffer(myCommandBuffers[i], model->GetIndexBuffer().buffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdBindDescriptorSets(myCommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelineLayouts.offscreen, 0, 1, &model->GetDescriptorSet(), 0, nullptr);
-		vkCmdDrawIndexed(myCommandBuffers[i], (u32)model->GetIndexCount(), 1, 0, 0, 0);
-
-		vkEndCommandBuffer(myCommandBuffers[i]);
+		renderPassInfo.renderPass = myDeferredPass.renderPass;
+		renderPassInfo.framebuffer = myDeferredPass.framebuffers[idx];
+		renderPassInfo.renderArea.extent = myDeferredPass.extent;
+	}
+	else
+	{
+		renderPassInfo.renderPass = myOffscreenFramebuffer.renderPass;
+		renderPassInfo.framebuffer = myOffscreenFramebuffer.frameBuffer;
+		renderPassInfo.renderArea.extent = myRenderExtent;
 	}
 
-	myFramework->EndCommandBufferRecording(idx, aModels.size() > 0 ? myCommandBuffers : std::vector<VkCommandBuffer>());
+	BuildInstanceBatches(frame, aModels);
 
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -116,34 +248,113 @@ void frostwave::Renderer::Render(const std::vector<ModelInstance*>& aModels, con
 	submitInfo.waitSemaphoreCount = 1;
 	submitInfo.pWaitSemaphores = waitSemaphores;
 	submitInfo.pWaitDstStageMask = waitStages;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &myFramework->myCommandBuffers[idx];
 
-	VkSemaphore signalSemaphores[] = { myOffscreenSemaphore };
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
+	// The timestamp command buffers bracket everything the frame submits
+	const bool timestamps = myGpuTimer.IsSupported();
+	std::vector<VkCommandBuffer> commandBuffers;
+	if (timestamps)
+	{
+		commandBuffers.push_back(frame.timestampBeginCommandBuffer);
+	}
+	commandBuffers.push_back(myFramework->myCommandBuffers[idx]);
+	if (timestamps && myUseSubpasses)
+	{
+		commandBuffers.push_back(frame.timestampEndCommandBuffer);
+	}
 
-	vkResetFences(myFramework->myDevice, 1, &myFramework->myInFlightFences[myFramework->myCurrentFrame]);
+	submitInfo.commandBufferCount = (u32)commandBuffers.size();
+	submitInfo.pCommandBuffers = commandBuffers.data();
 
-	VkResult result = vkQueueSubmit(myFramework->myGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	if (result != VK_SUCCESS)
+	bool recorded = false;
+	if (myUseSubpasses)
 	{
-		FATAL_LOG("Failed to submit draw command buffer");
-	}
+		// Lighting is recorded into the same command buffer, so its data has to be written before anything is submitted
+		UpdateLightingData(frame, aLights, aCamera);
 
-	BuildDeferredCommandBuffers(myFramework->mySwapChainFramebuffers[idx], aCamera, aLights);
+		VkCommandBuffer commandBuffer = myFramework->myCommandBuffers[idx];
+		auto inheritanceInfo = myFramework->BeginCommandBufferRecording(idx, renderPassInfo);
+		// Cached secondaries get replayed into whichever swapchain framebuffer is acquired, so they can't name one
+		inheritanceInfo.framebuffer = VK_NULL_HANDLE;
 
-	submitInfo.pWaitSemaphores = &myOffscreenSemaphore;
-	submitInfo.pSignalSemaphores = &myFramework->myRenderFinishedSemaphores[myFramework->myCurrentFrame];
-	submitInfo.pCommandBuffers = &myDeferredCommandBuffer;
-	submitInfo.commandBufferCount = (u32)1;
+		recorded = RefreshGBufferCommandBuffers(frameIndex, inheritanceInfo);
+		if (!frame.secondaryCommandBuffers.empty())
+		{
+			vkCmdExecuteCommands(commandBuffer, (u32)frame.secondaryCommandBuffers.size(), frame.secondaryCommandBuffers.data());
+		}
 
-	result = vkQueueSubmit(myFramework->myGraphicsQueue, 1, &submitInfo, myFramework->myInFlightFences[myFramework->myCurrentFrame]);
-	if (result != VK_SUCCESS)
+		vkCmdNextSubpass(commandBuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+		recorded |= RefreshDeferredCommandBuffer(frameIndex, idx, VK_NULL_HANDLE, (u32)aLights.size());
+		frame.commandBuffersDirty = false;
+
+		myFramework->EndCommandBufferRecording(idx, { frame.deferredCommandBuffer });
+		CountFrame(frame, recorded);
+
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &myFramework->myRenderFinishedSemaphores[myFramework->myCurrentFrame];
+
+		vkResetFences(myFramework->myDevice, 1, &myFramework->myInFlightFences[myFramework->myCurrentFrame]);
+
+		VkResult result = vkQueueSubmit(myFramework->myGraphicsQueue, 1, &submitInfo, myFramework->myInFlightFences[myFramework->myCurrentFrame]);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to submit draw command buffer");
+		}
+		++myFramework->GetFrameCounters().submits;
+	}
+	else
 	{
-		FATAL_LOG("Failed to submit draw command buffer");
+		auto inheritanceInfo = myFramework->BeginCommandBufferRecording(idx, renderPassInfo);
+		recorded = RefreshGBufferCommandBuffers(frameIndex, inheritanceInfo);
+		myFramework->EndCommandBufferRecording(idx, frame.secondaryCommandBuffers);
+
+		VkSemaphore signalSemaphores[] = { frame.offscreenSemaphore };
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = signalSemaphores;
+
+		vkResetFences(myFramework->myDevice, 1, &myFramework->myInFlightFences[myFramework->myCurrentFrame]);
+
+		VkResult result = vkQueueSubmit(myFramework->myGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to submit draw command buffer");
+		}
+		++myFramework->GetFrameCounters().submits;
+
+		// The G-buffer is already in flight while the light data is written
+		UpdateLightingData(frame, aLights, aCamera);
+
+		// With dynamic resolution lighting has a target of its own and the swapchain framebuffer is only for the upscale
+		VkFramebuffer framebuffer = myUseLightVolumes && !myUseDynamicResolution ? myLightVolumePass.framebuffers[idx] : myFramework->mySwapChainFramebuffers[idx];
+		recorded |= RefreshDeferredCommandBuffer(frameIndex, idx, framebuffer, (u32)aLights.size());
+		frame.commandBuffersDirty = false;
+		CountFrame(frame, recorded);
+
+		// The lighting pass samples the G-buffer from the fragment shader, the light culling dispatch from compute
+		// and light volumes depth test against the G-buffer depth
+		VkPipelineStageFlags lightingWaitStages[] = { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT };
+		submitInfo.pWaitDstStageMask = lightingWaitStages;
+		submitInfo.pWaitSemaphores = &frame.offscreenSemaphore;
+		submitInfo.pSignalSemaphores = &myFramework->myRenderFinishedSemaphores[myFramework->myCurrentFrame];
+		commandBuffers.clear();
+		commandBuffers.push_back(frame.deferredCommandBuffer);
+		if (timestamps)
+		{
+			commandBuffers.push_back(frame.timestampEndCommandBuffer);
+		}
+		submitInfo.pCommandBuffers = commandBuffers.data();
+		submitInfo.commandBufferCount = (u32)commandBuffers.size();
+
+		result = vkQueueSubmit(myFramework->myGraphicsQueue, 1, &submitInfo, myFramework->myInFlightFences[myFramework->myCurrentFrame]);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to submit draw command buffer");
+		}
+		++myFramework->GetFrameCounters().submits;
 	}
 
+	myGpuTimer.MarkSubmitted(frameIndex);
+
 	bool shouldResize = !myFramework->EndFrame(idx, myFramework->myRenderFinishedSemaphores[myFramework->myCurrentFrame]);
 
 	if (shouldResize)
@@ -155,29 +366,122 @@ void frostwave::Renderer::Render(const std::vector<ModelInstance*>& aModels, con
 void frostwave::Renderer::Destroy()
 {
 	DestroyOffscreenFrameBuffer();
+	vkDestroyRenderPass(myFramework->GetDevice(), myOffscreenFramebuffer.renderPass, nullptr);
 
 	myQuad.Destroy();
 
+	if (myUseSubpasses)
+	{
+		DestroyDeferredPassFramebuffers();
+		vkDestroyRenderPass(myFramework->GetDevice(), myDeferredPass.renderPass, nullptr);
+		vkDestroyDescriptorSetLayout(myFramework->GetDevice(), myDeferredPass.inputSetLayout, nullptr);
+	}
+
+	if (myUseDynamicResolution)
+	{
+		DestroyUpscalePass();
+	}
+
+	if (myUseLightVolumes)
+	{
+		mySphere.Destroy();
+		DestroyLightVolumeFramebuffers();
+		vkDestroyRenderPass(myFramework->GetDevice(), myLightVolumePass.renderPass, nullptr);
+		vkDestroyPipeline(myFramework->GetDevice(), myPipelines.lightVolume, nullptr);
+	}
+
 	myUniformBuffers.offscreen.Destroy();
-	myUniformBuffers.fullscreen.Destroy();
+	myDummyStorageBuffer.Destroy();
+	myGpuTimer.Destroy();
 	if (myCommandPool != VK_NULL_HANDLE)
 	{
 		vkDestroyCommandPool(myFramework->GetDevice(), myCommandPool, nullptr);
 	}
 
+	for (auto& frame : myFrames)
+	{
+		frame.fullscreenUBO.Destroy();
+		frame.instanceBuffer.Destroy();
+		frame.indirectBuffer.Destroy();
+		frame.lightBuffer.Destroy();
+		frame.tileBuffer.Destroy();
+		frame.clusterBuffer.Destroy();
+		frame.clusterIndexBuffer.Destroy();
+
+		for (auto& thread : frame.recordingThreads)
+		{
+			vkDestroyCommandPool(myFramework->GetDevice(), thread.commandPool, nullptr);
+		}
+
+		vkDestroySemaphore(myFramework->GetDevice(), frame.offscreenSemaphore, nullptr);
+	}
+	myFrames.clear();
+
 	vkDestroyDescriptorSetLayout(myFramework->GetDevice(), myDescriptorSetLayout, nullptr);
 
+	if (myUseTiledLighting)
+	{
+		vkDestroyPipeline(myFramework->GetDevice(), myPipelines.tiled, nullptr);
+		vkDestroyPipeline(myFramework->GetDevice(), myPipelines.tileCull, nullptr);
+		vkDestroyPipelineLayout(myFramework->GetDevice(), myPipelineLayouts.tileCull, nullptr);
+		vkDestroyDescriptorSetLayout(myFramework->GetDevice(), myTileCullDescriptorSetLayout, nullptr);
+	}
+
+	if (myUseClusteredLighting)
+	{
+		vkDestroyPipeline(myFramework->GetDevice(), myPipelines.clustered, nullptr);
+	}
+
 	vkDestroyPipeline(myFramework->GetDevice(), myPipelines.deferred, nullptr);
 	vkDestroyPipeline(myFramework->GetDevice(), myPipelines.offscreen, nullptr);
+	vkDestroyPipeline(myFramework->GetDevice(), myPipelines.offscreenEqual, nullptr);
+	vkDestroyPipeline(myFramework->GetDevice(), myPipelines.depthPrepass, nullptr);
 
 	vkDestroyPipelineLayout(myFramework->GetDevice(), myPipelineLayouts.deferred, nullptr);
 	vkDestroyPipelineLayout(myFramework->GetDevice(), myPipelineLayouts.offscreen, nullptr);
 
-	vkDestroySemaphore(myFramework->GetDevice(), myOffscreenSemaphore, nullptr);
 	vkDestroySampler(myFramework->GetDevice(), myColorSampler, nullptr);
+
+	// Sets replaced on resize are freed back to the pool, so they have to go before it does. The device is idle by now
+	myFramework->GetDeletionQueue().Flush();
 	vkDestroyDescriptorPool(myFramework->GetDevice(), myDescriptorPool, nullptr);
 }
 
+const frostwave::Renderer::CommandBufferCacheStats& frostwave::Renderer::GetCommandBufferCacheStats() const
+{
+	return myCacheStats;
+}
+
+const fw::CommandRecorder::Stats& frostwave::Renderer::GetCommandRecorderStats() const
+{
+	return myRecorderStats;
+}
+
+u32 frostwave::Renderer::GetGBufferBinds() const
+{
+	return myGBufferBinds;
+}
+
+const fw::GpuTimer& frostwave::Renderer::GetGpuTimer() const
+{
+	return myGpuTimer;
+}
+
+const fw::FrameCounters& frostwave::Renderer::GetFrameCounters() const
+{
+	return myFramework->GetLastFrameCounters();
+}
+
+f32 frostwave::Renderer::GetRenderScale() const
+{
+	return myUseDynamicResolution ? myResolutionController.GetScale() : 1.0f;
+}
+
+VkExtent2D frostwave::Renderer::GetRenderExtent() const
+{
+	return myRenderExtent;
+}
+
 fw::Buffer* frostwave::Renderer::GetUBO()
 {
 	return &myUniformBuffers.offscreen;
@@ -188,28 +492,98 @@ const VkDescriptorSetLayout& frostwave::Renderer::GetDescriptorSetLayout() const
 	return myDescriptorSetLayout;
 }
 
+fw::ThreadPool* frostwave::Renderer::GetThreadPool()
+{
+	return &myThreadPool;
+}
+
+void frostwave::Renderer::SetDepthPrepass(bool aEnabled)
+{
+	if (aEnabled == myUseDepthPrepass)
+	{
+		return;
+	}
+
+	myUseDepthPrepass = aEnabled;
+	for (auto& frame : myFrames)
+	{
+		frame.commandBuffersDirty = true;
+	}
+}
+
+bool frostwave::Renderer::GetDepthPrepass() const
+{
+	return myUseDepthPrepass;
+}
+
 void frostwave::Renderer::Resize()
 {
-	myFramework->WaitIdle();
+	for (auto& frame : myFrames)
+	{
+		frame.commandBuffersDirty = true;
+	}
+
+	// The G-buffer follows the swapchain. Like the swapchain, the old targets stay alive in the deletion queue
+	// until the frames still in flight are done with them, so nothing waits on the GPU
+	DestroyOffscreenFrameBuffer();
+	CreateGBufferAttachments();
+	if (!myUseSubpasses)
+	{
+		CreateOffscreenFramebuffer();
+	}
+	myRenderExtent = { (u32)myOffscreenFramebuffer.width, (u32)myOffscreenFramebuffer.height };
+
+	if (myUseTiledLighting)
+	{
+		CreateTileBuffers();
+	}
+
+	// Frames in flight may still have the sets naming the old targets bound, so they are replaced instead of updated
+	RetireDescriptorSets();
+	SetupDescriptorSet();
+	if (myUseTiledLighting)
+	{
+		SetupTileCullDescriptorSets();
+	}
+
+	// Scene color is sized like the G-buffer, and its framebuffer shares the G-buffer depth
+	if (myUseDynamicResolution)
+	{
+		DestroyUpscaleTarget();
+		CreateUpscaleTarget();
+		SetupUpscaleDescriptorSet();
+	}
 
-	//PrepareOffscreenFramebuffer();
-	//PreparePipelines();
+	// The volume and merged pass framebuffers reference the recreated swapchain's image views and G-buffer
+	if (myUseSubpasses)
+	{
+		DestroyDeferredPassFramebuffers();
+		CreateDeferredPassFramebuffers();
+	}
+	else if (myUseLightVolumes && !myUseDynamicResolution)
+	{
+		DestroyLightVolumeFramebuffers();
+		CreateLightVolumeFramebuffers();
+	}
 }
 
 void frostwave::Renderer::PrepareOffscreenFramebuffer()
 {
-	myOffscreenFramebuffer.width = myFramework->GetSwapchainExtent().width;
-	myOffscreenFramebuffer.height = myFramework->GetSwapchainExtent().height;
+	myOffscreenFramebuffer.renderPass = VK_NULL_HANDLE;
+	myOffscreenFramebuffer.frameBuffer = VK_NULL_HANDLE;
 
-	CreateAttachment(VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, &myOffscreenFramebuffer.position);
-	CreateAttachment(VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, &myOffscreenFramebuffer.normal);
-	CreateAttachment(VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, &myOffscreenFramebuffer.material);
-	CreateAttachment(VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, &myOffscreenFramebuffer.albedo);
+	CreateGBufferAttachments();
+	CreateSampler();
 
-	VkFormat depthFormat = myFramework->FindDepthFormat();
-	CreateAttachment(depthFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, &myOffscreenFramebuffer.depth);
+	// The merged pass owns the render pass and framebuffers instead, see PrepareDeferredPass
+	if (myUseSubpasses)
+	{
+		return;
+	}
+
+	std::vector<FrameBufferAttachment*> colorAttachments = GetGBufferTargets();
 
-	std::array<VkAttachmentDescription, 5> attachmentDescriptions = { };
+	std::vector<VkAttachmentDescription> attachmentDescriptions(colorAttachments.size() + 1);
 	for (u32 i = 0; i < attachmentDescriptions.size(); ++i)
 	{
 		attachmentDescriptions[i].samples = VK_SAMPLE_COUNT_1_BIT;
@@ -218,32 +592,29 @@ void frostwave::Renderer::PrepareOffscreenFramebuffer()
 		attachmentDescriptions[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 		attachmentDescriptions[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 
+		// Depth ends up read only so the lighting pass can both sample it and depth test against it
 		if (i == attachmentDescriptions.size() - 1)
 		{
+			attachmentDescriptions[i].format = myOffscreenFramebuffer.depth.format;
 			attachmentDescriptions[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-			attachmentDescriptions[i].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+			attachmentDescriptions[i].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 		}
 		else
 		{
+			attachmentDescriptions[i].format = colorAttachments[i]->format;
 			attachmentDescriptions[i].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 			attachmentDescriptions[i].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 		}
 	}
 
-	attachmentDescriptions[0].format = myOffscreenFramebuffer.position.format;
-	attachmentDescriptions[1].format = myOffscreenFramebuffer.normal.format;
-	attachmentDescriptions[2].format = myOffscreenFramebuffer.albedo.format;
-	attachmentDescriptions[3].format = myOffscreenFramebuffer.material.format;
-	attachmentDescriptions[4].format = myOffscreenFramebuffer.depth.format;
-
 	std::vector<VkAttachmentReference> colorReferences;
-	colorReferences.push_back({ 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
-	colorReferences.push_back({ 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
-	colorReferences.push_back({ 2, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
-	colorReferences.push_back({ 3, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+	for (u32 i = 0; i < (u32)colorAttachments.size(); ++i)
+	{
+		colorReferences.push_back({ i, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+	}
 
 	VkAttachmentReference depthReference = {};
-	depthReference.attachment = 4;
+	depthReference.attachment = (u32)colorAttachments.size();
 	depthReference.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 	VkSubpassDescription subpass = { };
@@ -256,16 +627,16 @@ void frostwave::Renderer::PrepareOffscreenFramebuffer()
 	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
 	dependencies[0].dstSubpass = 0;
 	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
 	dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 	dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
 	dependencies[1].srcSubpass = 0;
 	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
 	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 	dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
 	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
 
@@ -284,28 +655,11 @@ void frostwave::Renderer::PrepareOffscreenFramebuffer()
 		FATAL_LOG("Failed to create renderpass for offscreen framebuffer!");
 	}
 
-	std::array<VkImageView, 5> attachments;
-	attachments[0] = myOffscreenFramebuffer.position.view;
-	attachments[1] = myOffscreenFramebuffer.normal.view;
-	attachments[2] = myOffscreenFramebuffer.albedo.view;
-	attachments[3] = myOffscreenFramebuffer.material.view;
-	attachments[4] = myOffscreenFramebuffer.depth.view;
-
-	VkFramebufferCreateInfo frameBufferCreateInfo = { };
-	frameBufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-	frameBufferCreateInfo.pNext = NULL;
-	frameBufferCreateInfo.renderPass = myOffscreenFramebuffer.renderPass;
-	frameBufferCreateInfo.pAttachments = attachments.data();
-	frameBufferCreateInfo.attachmentCount = (u32)attachments.size();
-	frameBufferCreateInfo.width = myOffscreenFramebuffer.width;
-	frameBufferCreateInfo.height = myOffscreenFramebuffer.height;
-	frameBufferCreateInfo.layers = 1;
-	result = vkCreateFramebuffer(myFramework->GetDevice(), &frameBufferCreateInfo, nullptr, &myOffscreenFramebuffer.frameBuffer);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to create offscreen framebuffer!");
-	}
+	CreateOffscreenFramebuffer();
+}
 
+void frostwave::Renderer::CreateSampler()
+{
 	VkSamplerCreateInfo sampler = { };
 	sampler.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 	sampler.magFilter = VK_FILTER_NEAREST;
@@ -319,61 +673,538 @@ void frostwave::Renderer::PrepareOffscreenFramebuffer()
 	sampler.minLod = 0.0f;
 	sampler.maxLod = 1.0f;
 	sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-	result = vkCreateSampler(myFramework->GetDevice(), &sampler, nullptr, &myColorSampler);
+	VkResult result = vkCreateSampler(myFramework->GetDevice(), &sampler, nullptr, &myColorSampler);
 	if (result != VK_SUCCESS)
 	{
 		FATAL_LOG("Failed to create sampler for offscreen framebuffer!");
 	}
 }
 
-void frostwave::Renderer::CreatePoolAndBuffers()
+void frostwave::Renderer::CreateGBufferAttachments()
 {
-	if (myCommandPool != VK_NULL_HANDLE)
+	// Sized to the swapchain, dynamic resolution only ever renders into a corner of it
+	myOffscreenFramebuffer.width = myFramework->GetSwapchainExtent().width;
+	myOffscreenFramebuffer.height = myFramework->GetSwapchainExtent().height;
+
+	// Inside the merged pass the G-buffer is only read as input attachments, so it never needs backing memory outside the pass
+	const VkImageUsageFlags colorUsage = myUseSubpasses ? VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	const VkImageUsageFlags depthUsage = myUseSubpasses ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+
+	// The compact layout has no position target, the lighting pass rebuilds it from depth (28 -> 12 bytes per pixel before depth)
+	if (myUseCompactGBuffer)
 	{
-		vkDestroyCommandPool(myFramework->GetDevice(), myCommandPool, nullptr);
+		myOffscreenFramebuffer.position = { };
+		CreateAttachment(VK_FORMAT_R16G16_SFLOAT, colorUsage, &myOffscreenFramebuffer.normal);
+		CreateAttachment(VK_FORMAT_R8G8B8A8_UNORM, colorUsage, &myOffscreenFramebuffer.material);
+	}
+	else
+	{
+		CreateAttachment(VK_FORMAT_R16G16B16A16_SFLOAT, colorUsage, &myOffscreenFramebuffer.position);
+		CreateAttachment(VK_FORMAT_R16G16B16A16_SFLOAT, colorUsage, &myOffscreenFramebuffer.normal);
+		CreateAttachment(VK_FORMAT_R16G16B16A16_SFLOAT, colorUsage, &myOffscreenFramebuffer.material);
+	}
+	CreateAttachment(VK_FORMAT_R8G8B8A8_UNORM, colorUsage, &myOffscreenFramebuffer.albedo);
+
+	VkFormat depthFormat = myFramework->FindDepthFormat();
+	CreateAttachment(depthFormat, depthUsage, &myOffscreenFramebuffer.depth);
+
+	myOffscreenFramebuffer.colorAttachmentCount = (u32)GetGBufferTargets().size();
+}
+
+void frostwave::Renderer::CreateOffscreenFramebuffer()
+{
+	std::vector<VkImageView> attachments;
+	for (auto attachment : GetGBufferTargets())
+	{
+		attachments.push_back(attachment->view);
+	}
+	attachments.push_back(myOffscreenFramebuffer.depth.view);
+
+	VkFramebufferCreateInfo frameBufferCreateInfo = { };
+	frameBufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	frameBufferCreateInfo.pNext = NULL;
+	frameBufferCreateInfo.renderPass = myOffscreenFramebuffer.renderPass;
+	frameBufferCreateInfo.pAttachments = attachments.data();
+	frameBufferCreateInfo.attachmentCount = (u32)attachments.size();
+	frameBufferCreateInfo.width = myOffscreenFramebuffer.width;
+	frameBufferCreateInfo.height = myOffscreenFramebuffer.height;
+	frameBufferCreateInfo.layers = 1;
+	VkResult result = vkCreateFramebuffer(myFramework->GetDevice(), &frameBufferCreateInfo, nullptr, &myOffscreenFramebuffer.frameBuffer);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create offscreen framebuffer!");
 	}
+}
 
+void frostwave::Renderer::CreatePoolAndBuffers()
+{
 	VkCommandPoolCreateInfo info = { };
 	info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 	info.queueFamilyIndex = myFramework->GetQueueFamilyIndices().graphicsFamily;
 	vkCreateCommandPool(myFramework->GetDevice(), &info, nullptr, &myCommandPool);
 
-	VkCommandBufferAllocateInfo commandBufferAllocateInfo = { };
-	commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	commandBufferAllocateInfo.commandPool = myCommandPool;
-	commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
-	commandBufferAllocateInfo.commandBufferCount = (u32)myCommandBuffers.size();
-	VkResult result = vkAllocateCommandBuffers(myFramework->GetDevice(), &commandBufferAllocateInfo, myCommandBuffers.data());
-
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to allocate command buffers");
-	}
+	// The lighting command buffers are allocated by RefreshDeferredCommandBuffer, as the swapchain images come up
+}
 
-	VkCommandBufferAllocateInfo allocInfo = {};
+void frostwave::Renderer::CreateTimestampCommandBuffers()
+{
+	VkCommandBufferAllocateInfo allocInfo = { };
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = myCommandPool;
 	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = 1;
+	allocInfo.commandBufferCount = 2;
 
-	result = vkAllocateCommandBuffers(myFramework->GetDevice(), &allocInfo, &myDeferredCommandBuffer);
-	if (result != VK_SUCCESS)
+	VkCommandBufferBeginInfo beginInfo = { };
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+
+	// Query indices are fixed per frame in flight, so these never have to be recorded again
+	for (u32 i = 0; i < (u32)myFrames.size(); ++i)
 	{
-		FATAL_LOG("Failed to allocate command buffers!");
+		FrameResources& frame = myFrames[i];
+
+		VkCommandBuffer commandBuffers[2];
+		VkResult result = vkAllocateCommandBuffers(myFramework->GetDevice(), &allocInfo, commandBuffers);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to allocate timestamp command buffers!");
+		}
+		frame.timestampBeginCommandBuffer = commandBuffers[0];
+		frame.timestampEndCommandBuffer = commandBuffers[1];
+
+		vkBeginCommandBuffer(frame.timestampBeginCommandBuffer, &beginInfo);
+		myGpuTimer.RecordReset(frame.timestampBeginCommandBuffer, i);
+		myGpuTimer.WriteBegin(frame.timestampBeginCommandBuffer, i, GpuTimer::Frame);
+		vkEndCommandBuffer(frame.timestampBeginCommandBuffer);
+
+		vkBeginCommandBuffer(frame.timestampEndCommandBuffer, &beginInfo);
+		myGpuTimer.WriteEnd(frame.timestampEndCommandBuffer, i, GpuTimer::Frame);
+		vkEndCommandBuffer(frame.timestampEndCommandBuffer);
+	}
+}
+
+void frostwave::Renderer::CreateRecordingThreads()
+{
+	u32 threadCount = myFramework->GetSettings().recordingThreads;
+	if (threadCount == 0)
+	{
+		threadCount = fw::Max(std::thread::hardware_concurrency(), 1u);
+	}
+
+	myThreadPool.SetThreadCount(threadCount);
+
+	// Command pools are externally synchronized, so every worker records from its own pool, one set per frame in flight
+	for (auto& frame : myFrames)
+	{
+		frame.recordingThreads.resize(threadCount);
+
+		for (auto& thread : frame.recordingThreads)
+		{
+			VkCommandPoolCreateInfo info = { };
+			info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+			info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+			info.queueFamilyIndex = myFramework->GetQueueFamilyIndices().graphicsFamily;
+
+			VkResult result = vkCreateCommandPool(myFramework->GetDevice(), &info, nullptr, &thread.commandPool);
+			if (result != VK_SUCCESS)
+			{
+				FATAL_LOG("Failed to create command pool for recording thread!");
+			}
+
+			// The second buffer holds the worker's share of the depth pre-pass
+			VkCommandBufferAllocateInfo allocInfo = { };
+			allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+			allocInfo.commandPool = thread.commandPool;
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			allocInfo.commandBufferCount = 2;
+
+			VkCommandBuffer commandBuffers[2];
+			result = vkAllocateCommandBuffers(myFramework->GetDevice(), &allocInfo, commandBuffers);
+			if (result != VK_SUCCESS)
+			{
+				FATAL_LOG("Failed to allocate command buffer for recording thread!");
+			}
+			thread.commandBuffer = commandBuffers[0];
+			thread.depthCommandBuffer = commandBuffers[1];
+		}
+	}
+
+	VERBOSE_LOG("Created %u command recording threads for %u frames in flight", threadCount, (u32)myFrames.size());
+}
+
+bool frostwave::Renderer::RefreshGBufferCommandBuffers(u32 aFrameIndex, const VkCommandBufferInheritanceInfo& aInheritanceInfo)
+{
+	FrameResources& frame = myFrames[aFrameIndex];
+	if (frame.commandBuffersDirty || !MatchesCachedBatches(frame))
+	{
+		RecordGBufferCommandBuffers(aFrameIndex, aInheritanceInfo);
+		frame.cachedBatches = myInstanceBatches;
+		return true;
+	}
+	return false;
+}
+
+void frostwave::Renderer::RecordGBufferCommandBuffers(u32 aFrameIndex, const VkCommandBufferInheritanceInfo& aInheritanceInfo)
+{
+	FrameResources& frame = myFrames[aFrameIndex];
+	frame.secondaryCommandBuffers.clear();
+
+	const u32 batchCount = (u32)myInstanceBatches.size();
+	const u32 threadCount = (u32)frame.recordingThreads.size();
+	const u32 batchesPerThread = (batchCount + threadCount - 1) / threadCount;
+
+	// Every worker's share of the pre-pass has to land before any G-buffer draw tests against it, so all depth secondaries go first
+	std::vector<VkCommandBuffer> gBufferCommandBuffers;
+	const bool depthPrepass = myUseDepthPrepass;
+
+	u32 end = 0;
+	for (u32 t = 0; t < threadCount; ++t)
+	{
+		// Each secondary starts with nothing bound, so a share only ends where the sorted batches change state anyway
+		u32 begin = end;
+		end = fw::Min(begin + batchesPerThread, batchCount);
+		while (end < batchCount && SharesState(myInstanceBatches[end - 1], myInstanceBatches[end]))
+		{
+			++end;
+		}
+		if (begin >= end)
+		{
+			break;
+		}
+
+		RecordingThread& thread = frame.recordingThreads[t];
+		if (depthPrepass)
+		{
+			frame.secondaryCommandBuffers.push_back(thread.depthCommandBuffer);
+		}
+		gBufferCommandBuffers.push_back(thread.commandBuffer);
+
+		myThreadPool.GetThreads()[t]->AddJob([this, &thread, aFrameIndex, depthPrepass, begin, end, aInheritanceInfo]()
+		{
+			vkResetCommandPool(myFramework->GetDevice(), thread.commandPool, 0);
+			if (depthPrepass)
+			{
+				RecordBatches(aFrameIndex, thread.depthCommandBuffer, thread.depthRecorder, true, begin, end, aInheritanceInfo);
+			}
+			RecordBatches(aFrameIndex, thread.commandBuffer, thread.recorder, false, begin, end, aInheritanceInfo);
+		});
+	}
+
+	myThreadPool.Wait();
+
+	frame.gBufferStats = { };
+	for (u32 t = 0; t < (u32)gBufferCommandBuffers.size(); ++t)
+	{
+		frame.gBufferStats += frame.recordingThreads[t].recorder.GetStats();
+		if (depthPrepass)
+		{
+			frame.gBufferStats += frame.recordingThreads[t].depthRecorder.GetStats();
+		}
+	}
+	myRecorderStats += frame.gBufferStats;
+	myFramework->GetFrameCounters().commandBuffersRecorded += depthPrepass ? 2 * (u32)gBufferCommandBuffers.size() : (u32)gBufferCommandBuffers.size();
+	frame.secondaryCommandBuffers.insert(frame.secondaryCommandBuffers.end(), gBufferCommandBuffers.begin(), gBufferCommandBuffers.end());
+}
+
+bool frostwave::Renderer::SharesState(const InstanceBatch& aFirst, const InstanceBatch& aSecond) const
+{
+	return aFirst.model->GetDescriptorSet() == aSecond.model->GetDescriptorSet() || aFirst.model->GetVertexBuffer().buffer == aSecond.model->GetVertexBuffer().buffer;
+}
+
+void frostwave::Renderer::CountFrame(const FrameResources& aFrame, bool aRecorded)
+{
+	// One event per submitted frame, a miss when any of its command buffers had to be recorded
+	if (aRecorded)
+	{
+		++myCacheStats.misses;
+	}
+	else
+	{
+		++myCacheStats.hits;
+	}
+
+	myGBufferBinds = (u32)aFrame.gBufferStats.binds;
+
+	CommandRecorder::Stats stats = aFrame.gBufferStats;
+	stats += aFrame.deferredStats;
+
+	FrameCounters& counters = myFramework->GetFrameCounters();
+	counters.draws += (u32)stats.draws;
+	counters.dispatches += (u32)stats.dispatches;
+	counters.indices += stats.indices;
+	counters.binds += (u32)stats.binds;
+	counters.bindsElided += (u32)stats.elided;
+	counters.barriers += (u32)stats.barriers;
+}
+
+bool frostwave::Renderer::MatchesCachedBatches(const FrameResources& aFrame) const
+{
+	if (myInstanceBatches.size() != aFrame.cachedBatches.size())
+	{
+		return false;
+	}
+
+	// In indirect mode the counts live in the indirect buffer, so only the model order is baked into the command buffers
+	for (size_t i = 0; i < myInstanceBatches.size(); ++i)
+	{
+		const InstanceBatch& batch = myInstanceBatches[i];
+		const InstanceBatch& cached = aFrame.cachedBatches[i];
+		if (batch.model != cached.model)
+		{
+			return false;
+		}
+
+		if (!myUseIndirectDraw && (batch.firstInstance != cached.firstInstance || batch.instanceCount != cached.instanceCount))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void frostwave::Renderer::UpdateLightingData(FrameResources& aFrame, const std::vector<PointLight>& aLights, fw::Camera* aCamera)
+{
+	UpdateLights(aFrame, aLights);
+
+	if (myUseClusteredLighting)
+	{
+		UpdateLightClusters(aFrame, aLights, aCamera);
+	}
+
+	myUBOFullscreen.cameraPos = fw::Vec4f(aCamera->GetPosition(), 0.0f);
+	myUBOFullscreen.view = aCamera->GetView();
+	myUBOFullscreen.invViewProjection = fw::Mat4f::Inverse(aCamera->GetView() * aCamera->GetProjection());
+	myUBOFullscreen.clusterParams = fw::Vec4f(myLightClusterer.GetSliceScale(), myLightClusterer.GetSliceBias(), 0.0f, 0.0f);
+	myUBOFullscreen.gBufferSize = fw::Vec4f((f32)myOffscreenFramebuffer.width, (f32)myOffscreenFramebuffer.height, (f32)myRenderExtent.width, (f32)myRenderExtent.height);
+	memcpy(aFrame.fullscreenUBO.mapped, &myUBOFullscreen, sizeof(myUBOFullscreen));
+
+	if (myUseLightScissors)
+	{
+		UpdateLightScissors(aLights, aCamera);
+	}
+}
+
+void frostwave::Renderer::UpdateLights(FrameResources& aFrame, const std::vector<PointLight>& aLights)
+{
+	VkBuffer previous = aFrame.lightBuffer.buffer;
+	ReserveMappedBuffer(aFrame, aFrame.lightBuffer, aFrame.lightCapacity, (u32)aLights.size(), sizeof(PointLight), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+	if (aFrame.lightBuffer.buffer != previous)
+	{
+		VkWriteDescriptorSet write = fw::initializers::WriteDescriptorSet(aFrame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6, &aFrame.lightBuffer.descriptor);
+		vkUpdateDescriptorSets(myFramework->GetDevice(), 1, &write, 0, nullptr);
+		++myFramework->GetFrameCounters().descriptorUpdates;
+
+		if (myUseTiledLighting)
+		{
+			write = fw::initializers::WriteDescriptorSet(aFrame.tileCullDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &aFrame.lightBuffer.descriptor);
+			vkUpdateDescriptorSets(myFramework->GetDevice(), 1, &write, 0, nullptr);
+			++myFramework->GetFrameCounters().descriptorUpdates;
+		}
+	}
+
+	PointLight* lights = (PointLight*)aFrame.lightBuffer.mapped;
+	for (size_t i = 0; i < aLights.size(); ++i)
+	{
+		lights[i] = aLights[i];
+		lights[i].position.y *= -1.0f;
+	}
+}
+
+void frostwave::Renderer::UpdateLightScissors(const std::vector<PointLight>& aLights, fw::Camera* aCamera)
+{
+	const fw::Mat4f& view = aCamera->GetView();
+	const fw::Mat4f& projection = aCamera->GetProjection();
+	const f32 width = (f32)myRenderExtent.width;
+	const f32 height = (f32)myRenderExtent.height;
+
+	myLightScissors.resize(aLights.size());
+	for (size_t i = 0; i < aLights.size(); ++i)
+	{
+		const PointLight& light = aLights[i];
+		VkRect2D& rect = myLightScissors[i];
+		rect = { };
+
+		// Same y flip as the light buffer, which puts the light in the space the camera sees the G-buffer in
+		fw::Vec4f center = fw::Vec4f(light.position.x, -light.position.y, light.position.z, 1.0f) * view;
+
+		// An empty rect marks the light as off screen
+		fw::Vec2f min, max;
+		if (!fw::ProjectSphere(fw::Vec3f(center.x, center.y, center.z), light.radius, projection, min, max))
+		{
+			continue;
+		}
+
+		i32 left = (i32)std::floor((min.x * 0.5f + 0.5f) * width);
+		i32 top = (i32)std::floor((min.y * 0.5f + 0.5f) * height);
+		i32 right = (i32)std::ceil((max.x * 0.5f + 0.5f) * width);
+		i32 bottom = (i32)std::ceil((max.y * 0.5f + 0.5f) * height);
+
+		rect.offset = { left, top };
+		rect.extent = { (u32)(right - left), (u32)(bottom - top) };
+	}
+}
+
+bool frostwave::Renderer::MatchesCachedScissors(const std::vector<VkRect2D>& aCached) const
+{
+	if (aCached.size() != myLightScissors.size())
+	{
+		return false;
+	}
+
+	return myLightScissors.empty() || memcmp(aCached.data(), myLightScissors.data(), myLightScissors.size() * sizeof(VkRect2D)) == 0;
+}
+
+void frostwave::Renderer::RecordBatches(u32 aFrameIndex, VkCommandBuffer aCommandBuffer, CommandRecorder& aRecorder, bool aDepthOnly, u32 aBegin, u32 aEnd, const VkCommandBufferInheritanceInfo& aInheritanceInfo)
+{
+	const FrameResources& frame = myFrames[aFrameIndex];
+	const u32 uboOffset = aFrameIndex * myUBOStride;
+
+	VkCommandBuffer commandBuffer = aCommandBuffer;
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &aInheritanceInfo;
+
+	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+	// The first and last buffer of the pass carry its timestamps, they execute in order within the subpass
+	const GpuTimer::Scope scope = aDepthOnly ? GpuTimer::DepthPrepass : GpuTimer::GBuffer;
+	if (aBegin == 0)
+	{
+		myGpuTimer.WriteBegin(commandBuffer, aFrameIndex, scope);
+	}
+
+	// Batches sharing a mesh or material with the previous one skip those binds
+	CommandRecorder& recorder = aRecorder;
+	recorder.Begin(commandBuffer);
+
+	// After a pre-pass depth is final, so the G-buffer pass only has to shade the fragment that matches it
+	VkPipeline pipeline = aDepthOnly ? myPipelines.depthPrepass : myUseDepthPrepass ? myPipelines.offscreenEqual : myPipelines.offscreen;
+	recorder.BindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+	recorder.SetViewport(fw::initializers::Viewport((float)myRenderExtent.width, (float)myRenderExtent.height, 0.0f, 1.0f));
+	recorder.SetScissor(fw::initializers::Rect2D(myRenderExtent.width, myRenderExtent.height, 0, 0));
+	recorder.BindVertexBuffer(1, frame.instanceBuffer.buffer);
+
+	for (u32 i = aBegin; i < aEnd; ++i)
+	{
+		const InstanceBatch& batch = myInstanceBatches[i];
+		const Model* model = batch.model;
+
+		// Meshes loaded without positions have no position buffer to draw depth from
+		if (aDepthOnly && model->GetPositionBuffer().buffer == VK_NULL_HANDLE)
+		{
+			continue;
+		}
+
+		recorder.BindVertexBuffer(0, aDepthOnly ? model->GetPositionBuffer().buffer : model->GetVertexBuffer().buffer);
+		recorder.BindIndexBuffer(model->GetIndexBuffer().buffer);
+		recorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelineLayouts.offscreen, 0, 1, &model->GetDescriptorSet(), 1, &uboOffset);
+		if (myUseIndirectDraw)
+		{
+			recorder.DrawIndexedIndirect(frame.indirectBuffer.buffer, i * sizeof(VkDrawIndexedIndirectCommand), 1, sizeof(VkDrawIndexedIndirectCommand), (u64)model->GetIndexCount() * batch.instanceCount);
+		}
+		else
+		{
+			recorder.DrawIndexed((u32)model->GetIndexCount(), batch.instanceCount, 0, 0, batch.firstInstance);
+		}
+	}
+
+	if (aEnd == (u32)myInstanceBatches.size())
+	{
+		myGpuTimer.WriteEnd(commandBuffer, aFrameIndex, scope);
+	}
+
+	vkEndCommandBuffer(commandBuffer);
+}
+
+void frostwave::Renderer::BuildInstanceBatches(FrameResources& aFrame, const std::vector<ModelInstance*>& aModels)
+{
+	myInstanceBatches.clear();
+
+	ReserveMappedBuffer(aFrame, aFrame.instanceBuffer, aFrame.instanceCapacity, (u32)aModels.size(), sizeof(fw::Mat4f), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+
+	// Scene hands the instances over sorted by material, mesh and then depth, so every run of one model becomes a batch.
+	// Batches come out in state order, and each keeps its instances front to back
+	u8* transforms = (u8*)aFrame.instanceBuffer.mapped;
+	for (u32 i = 0; i < (u32)aModels.size(); ++i)
+	{
+		const Model* model = aModels[i]->GetModel();
+		if (myInstanceBatches.empty() || myInstanceBatches.back().model != model)
+		{
+			myInstanceBatches.push_back({ model, i, 0 });
+		}
+		++myInstanceBatches.back().instanceCount;
+
+		fw::Mat4f transform = aModels[i]->GetTransform();
+		memcpy(transforms + i * sizeof(fw::Mat4f), &transform, sizeof(fw::Mat4f));
+	}
+
+	if (!myUseIndirectDraw)
+	{
+		return;
+	}
+
+	ReserveMappedBuffer(aFrame, aFrame.indirectBuffer, aFrame.indirectCapacity, (u32)myInstanceBatches.size(), sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+
+	// The model matrix is fetched through firstInstance, so each command only has to point at its slice of the instance buffer
+	VkDrawIndexedIndirectCommand* commands = (VkDrawIndexedIndirectCommand*)aFrame.indirectBuffer.mapped;
+	for (u32 i = 0; i < (u32)myInstanceBatches.size(); ++i)
+	{
+		const InstanceBatch& batch = myInstanceBatches[i];
+		commands[i].indexCount = (u32)batch.model->GetIndexCount();
+		commands[i].instanceCount = batch.instanceCount;
+		commands[i].firstIndex = 0;
+		commands[i].vertexOffset = 0;
+		commands[i].firstInstance = batch.firstInstance;
 	}
 }
 
+void frostwave::Renderer::ReserveMappedBuffer(FrameResources& aFrame, Buffer& aBuffer, u32& aCapacity, u32 aCount, VkDeviceSize aStride, VkBufferUsageFlags aUsage)
+{
+	if (aCount <= aCapacity)
+	{
+		return;
+	}
+
+	// The buffer belongs to a frame whose fence BeginFrame has waited on, so the old one is no longer in use
+	if (aBuffer.buffer != VK_NULL_HANDLE)
+	{
+		aBuffer.Unmap();
+		aBuffer.Destroy();
+	}
+
+	// Recorded command buffers reference the old handle
+	aFrame.commandBuffersDirty = true;
+
+	aCapacity = fw::Max(aCount, aCapacity * 2);
+
+	VkResult result = CreateBuffer(myFramework, aUsage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniform, &aBuffer, aCapacity * aStride);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create mapped buffer!");
+	}
+
+	result = aBuffer.Map();
+	if (result != VK_SUCCESS) FATAL_LOG("Failed to map buffer!");
+}
+
 void frostwave::Renderer::SetupDescriptorSetLayout()
 {
 	std::vector<VkDescriptorSetLayoutBinding> bindings =
 	{
-		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_VERTEX_BIT, 0),
+		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, VK_SHADER_STAGE_VERTEX_BIT, 0),
 		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 1),
 		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 2),
 		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 3),
 		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 4),
-		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 5)
+		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 5),
+		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 6),
+		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 7),
+		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 8),
+		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_FRAGMENT_BIT, 9)
 	};
 
 	VkDescriptorSetLayoutCreateInfo layout = { };
@@ -387,17 +1218,11 @@ void frostwave::Renderer::SetupDescriptorSetLayout()
 		FATAL_LOG("Failed to create descriptor set layout for renderer");
 	}
 
-	VkPushConstantRange pushConstantRange = {};
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	pushConstantRange.size = sizeof(fw::Mat4f);
-	pushConstantRange.offset = 0;
-
+	// The model matrix comes from the instance buffer, so the G-buffer pass pushes nothing
 	VkPipelineLayoutCreateInfo pipelineLayout = { };
 	pipelineLayout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
 	pipelineLayout.pSetLayouts = &myDescriptorSetLayout;
 	pipelineLayout.setLayoutCount = 1;
-	pipelineLayout.pushConstantRangeCount = 1;
-	pipelineLayout.pPushConstantRanges = &pushConstantRange;
 
 	result = vkCreatePipelineLayout(myFramework->GetDevice(), &pipelineLayout, nullptr, &myPipelineLayouts.offscreen);
 	if (result != VK_SUCCESS)
@@ -405,12 +1230,36 @@ void frostwave::Renderer::SetupDescriptorSetLayout()
 		FATAL_LOG("Failed to create pipeline layout for offscreen");
 	}
 
-	pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-	pushConstantRange.size = sizeof(PointLight);
-	pushConstantRange.offset = 0;
+	// Lights are read from the storage buffer at binding 6, so the deferred pass needs no push constants
+	pipelineLayout.pushConstantRangeCount = 0;
+	pipelineLayout.pPushConstantRanges = nullptr;
+
+	// The merged pass reads the G-buffer through a second set of input attachments. Model descriptor sets are allocated
+	// from the first layout, so it keeps its combined image samplers
+	std::array<VkDescriptorSetLayout, 2> deferredSetLayouts = { myDescriptorSetLayout, VK_NULL_HANDLE };
+	if (myUseSubpasses)
+	{
+		std::vector<VkDescriptorSetLayoutBinding> inputBindings =
+		{
+			fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT, 0),
+			fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT, 1),
+			fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT, 2),
+			fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, VK_SHADER_STAGE_FRAGMENT_BIT, 3)
+		};
+
+		layout.pBindings = inputBindings.data();
+		layout.bindingCount = (u32)inputBindings.size();
+
+		result = vkCreateDescriptorSetLayout(myFramework->GetDevice(), &layout, nullptr, &myDeferredPass.inputSetLayout);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to create input attachment descriptor set layout");
+		}
 
-	//pipelineLayout.pushConstantRangeCount = 1;
-	//pipelineLayout.pPushConstantRanges = &pushConstantRange;
+		deferredSetLayouts[1] = myDeferredPass.inputSetLayout;
+		pipelineLayout.pSetLayouts = deferredSetLayouts.data();
+		pipelineLayout.setLayoutCount = (u32)deferredSetLayouts.size();
+	}
 
 	result = vkCreatePipelineLayout(myFramework->GetDevice(), &pipelineLayout, nullptr, &myPipelineLayouts.deferred);
 	if (result != VK_SUCCESS)
@@ -470,7 +1319,8 @@ void frostwave::Renderer::PreparePipelines()
 	multisampleState.flags = 0;
 
 	std::vector<VkVertexInputBindingDescription> bindingDescriptions = {
-	fw::initializers::VertexInputBindingDescription(0, layout.Stride(), VK_VERTEX_INPUT_RATE_VERTEX)
+		fw::initializers::VertexInputBindingDescription(0, layout.Stride(), VK_VERTEX_INPUT_RATE_VERTEX),
+		fw::initializers::VertexInputBindingDescription(1, sizeof(fw::Mat4f), VK_VERTEX_INPUT_RATE_INSTANCE)
 	};
 
 	std::vector<VkVertexInputAttributeDescription> attributeDescriptions = {
@@ -478,6 +1328,10 @@ void frostwave::Renderer::PreparePipelines()
 		fw::initializers::VertexInputAttributeDescription(0, 1, VK_FORMAT_R32G32_SFLOAT, sizeof(f32) * 3),		//texcoord
 		fw::initializers::VertexInputAttributeDescription(0, 2, VK_FORMAT_R32G32B32_SFLOAT, sizeof(f32) * 5),	//normal
 		fw::initializers::VertexInputAttributeDescription(0, 3, VK_FORMAT_R32G32B32_SFLOAT, sizeof(f32) * 8),	//tangent
+		fw::initializers::VertexInputAttributeDescription(1, 4, VK_FORMAT_R32G32B32A32_SFLOAT, 0),				//model matrix
+		fw::initializers::VertexInputAttributeDescription(1, 5, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(f32) * 4),
+		fw::initializers::VertexInputAttributeDescription(1, 6, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(f32) * 8),
+		fw::initializers::VertexInputAttributeDescription(1, 7, VK_FORMAT_R32G32B32A32_SFLOAT, sizeof(f32) * 12),
 	};
 
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
@@ -503,7 +1357,8 @@ void frostwave::Renderer::PreparePipelines()
 	VkGraphicsPipelineCreateInfo pipelineCreateInfo = { };
 	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 	pipelineCreateInfo.layout = myPipelineLayouts.deferred;
-	pipelineCreateInfo.renderPass = myFramework->GetRenderPass();
+	pipelineCreateInfo.renderPass = myUseSubpasses ? myDeferredPass.renderPass : myUseDynamicResolution ? myUpscalePass.renderPass : myFramework->GetRenderPass();
+	pipelineCreateInfo.subpass = myUseSubpasses ? 1 : 0;
 	pipelineCreateInfo.flags = 0;
 	pipelineCreateInfo.basePipelineIndex = -1;
 	pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
@@ -519,7 +1374,32 @@ void frostwave::Renderer::PreparePipelines()
 	pipelineCreateInfo.pStages = shaderStages.data();
 
 	shaderStages[0] = LoadShader("assets/shaders/deferred_vs.spv", VK_SHADER_STAGE_VERTEX_BIT, myFramework);
-	shaderStages[1] = LoadShader("assets/shaders/deferred_fs.spv", VK_SHADER_STAGE_FRAGMENT_BIT, myFramework);
+	// The subpass variant is deferred.frag compiled with SUBPASS_INPUTS, reading subpassInputs instead of samplers
+	shaderStages[1] = LoadShader(myUseSubpasses ? "assets/shaders/deferred_subpass_fs.spv" : "assets/shaders/deferred_fs.spv", VK_SHADER_STAGE_FRAGMENT_BIT, myFramework);
+
+	// Every lighting variant is deferred.frag with a different set of specialization constants
+	struct LightingConstants
+	{
+		VkBool32 tiled;
+		VkBool32 clustered;
+		VkBool32 lightVolumes;
+		VkBool32 compactGBuffer;
+	} lightingConstants = { VK_FALSE, VK_FALSE, VK_FALSE, myUseCompactGBuffer ? VK_TRUE : VK_FALSE };
+
+	std::array<VkSpecializationMapEntry, 4> lightingEntries = { {
+		{ 0, offsetof(LightingConstants, tiled), sizeof(VkBool32) },
+		{ 1, offsetof(LightingConstants, clustered), sizeof(VkBool32) },
+		{ 2, offsetof(LightingConstants, lightVolumes), sizeof(VkBool32) },
+		{ 3, offsetof(LightingConstants, compactGBuffer), sizeof(VkBool32) }
+	} };
+
+	VkSpecializationInfo lightingSpecialization = { };
+	lightingSpecialization.mapEntryCount = (u32)lightingEntries.size();
+	lightingSpecialization.pMapEntries = lightingEntries.data();
+	lightingSpecialization.dataSize = sizeof(LightingConstants);
+	lightingSpecialization.pData = &lightingConstants;
+
+	shaderStages[1].pSpecializationInfo = &lightingSpecialization;
 
 	VkPipelineVertexInputStateCreateInfo emptyInputState = { };
 	emptyInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -532,30 +1412,170 @@ void frostwave::Renderer::PreparePipelines()
 		FATAL_LOG("Failed to create deferred pipeline!");
 	}
 
+	if (myUseTiledLighting)
+	{
+		// Same lighting shader, switched to looping over the tile's light list
+		lightingConstants.tiled = VK_TRUE;
+		result = vkCreateGraphicsPipelines(myFramework->GetDevice(), VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &myPipelines.tiled);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to create tiled deferred pipeline!");
+		}
+		lightingConstants.tiled = VK_FALSE;
+	}
+
+	if (myUseClusteredLighting)
+	{
+		// Same lighting shader, looping over the light list of the fragment's cluster
+		lightingConstants.clustered = VK_TRUE;
+		result = vkCreateGraphicsPipelines(myFramework->GetDevice(), VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &myPipelines.clustered);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to create clustered deferred pipeline!");
+		}
+		lightingConstants.clustered = VK_FALSE;
+	}
+
+	if (myUseLightVolumes)
+	{
+		// Same lighting shader, fed by a sphere instanced per light that reconstructs its G-buffer UV from gl_FragCoord
+		lightingConstants.lightVolumes = VK_TRUE;
+
+		std::array<VkPipelineShaderStageCreateInfo, 2> volumeStages = {
+			LoadShader("assets/shaders/light_volume_vs.spv", VK_SHADER_STAGE_VERTEX_BIT, myFramework),
+			shaderStages[1]
+		};
+
+		VkVertexInputBindingDescription sphereBinding = fw::initializers::VertexInputBindingDescription(0, sizeof(f32) * 3, VK_VERTEX_INPUT_RATE_VERTEX);
+		VkVertexInputAttributeDescription sphereAttribute = fw::initializers::VertexInputAttributeDescription(0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0);
+
+		VkPipelineVertexInputStateCreateInfo sphereInputState = { };
+		sphereInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		sphereInputState.vertexBindingDescriptionCount = 1;
+		sphereInputState.pVertexBindingDescriptions = &sphereBinding;
+		sphereInputState.vertexAttributeDescriptionCount = 1;
+		sphereInputState.pVertexAttributeDescriptions = &sphereAttribute;
+
+		// Only back faces are drawn, and only where the G-buffer surface is in front of them,
+		// which leaves the pixels whose surface can be inside the light's radius
+		VkPipelineRasterizationStateCreateInfo volumeRasterizationState = rasterizationState;
+		volumeRasterizationState.cullMode = VK_CULL_MODE_FRONT_BIT;
+
+		VkPipelineDepthStencilStateCreateInfo volumeDepthStencilState = depthStencilState;
+		volumeDepthStencilState.depthWriteEnable = VK_FALSE;
+		volumeDepthStencilState.depthCompareOp = VK_COMPARE_OP_GREATER_OR_EQUAL;
+
+		VkGraphicsPipelineCreateInfo volumeCreateInfo = pipelineCreateInfo;
+		volumeCreateInfo.stageCount = (u32)volumeStages.size();
+		volumeCreateInfo.pStages = volumeStages.data();
+		volumeCreateInfo.pVertexInputState = &sphereInputState;
+		volumeCreateInfo.pRasterizationState = &volumeRasterizationState;
+		volumeCreateInfo.pDepthStencilState = &volumeDepthStencilState;
+		volumeCreateInfo.renderPass = myUseSubpasses ? myDeferredPass.renderPass : myUseDynamicResolution ? myUpscalePass.renderPass : myLightVolumePass.renderPass;
+
+		result = vkCreateGraphicsPipelines(myFramework->GetDevice(), VK_NULL_HANDLE, 1, &volumeCreateInfo, nullptr, &myPipelines.lightVolume);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to create light volume pipeline!");
+		}
+
+		vkDestroyShaderModule(myFramework->GetDevice(), volumeStages[0].module, nullptr);
+		lightingConstants.lightVolumes = VK_FALSE;
+	}
+
 	vkDestroyShaderModule(myFramework->GetDevice(), shaderStages[0].module, nullptr);
 	vkDestroyShaderModule(myFramework->GetDevice(), shaderStages[1].module, nullptr);
 
 	shaderStages[0] = LoadShader("assets/shaders/mrt_vs.spv", VK_SHADER_STAGE_VERTEX_BIT, myFramework);
 	shaderStages[1] = LoadShader("assets/shaders/mrt_fs.spv", VK_SHADER_STAGE_FRAGMENT_BIT, myFramework);
 
+	// mrt.frag writes the compact encodings to the first three targets when constant 0 is set
+	VkBool32 compactGBuffer = myUseCompactGBuffer ? VK_TRUE : VK_FALSE;
+	VkSpecializationMapEntry gBufferEntry = { 0, 0, sizeof(VkBool32) };
+
+	VkSpecializationInfo gBufferSpecialization = { };
+	gBufferSpecialization.mapEntryCount = 1;
+	gBufferSpecialization.pMapEntries = &gBufferEntry;
+	gBufferSpecialization.dataSize = sizeof(VkBool32);
+	gBufferSpecialization.pData = &compactGBuffer;
+
+	shaderStages[1].pSpecializationInfo = &gBufferSpecialization;
+
 	pipelineCreateInfo.pVertexInputState = &vertexInputInfo;
 	pipelineCreateInfo.layout = myPipelineLayouts.offscreen;
-	pipelineCreateInfo.renderPass = myOffscreenFramebuffer.renderPass;
+	pipelineCreateInfo.renderPass = myUseSubpasses ? myDeferredPass.renderPass : myOffscreenFramebuffer.renderPass;
+	pipelineCreateInfo.subpass = 0;
 
-	std::array<VkPipelineColorBlendAttachmentState, 4> blendAttachmentStates = {
-		fw::initializers::PipelineColorBlendAttachmentState(0xf, VK_FALSE),
-		fw::initializers::PipelineColorBlendAttachmentState(0xf, VK_FALSE),
-		fw::initializers::PipelineColorBlendAttachmentState(0xf, VK_FALSE),
-		fw::initializers::PipelineColorBlendAttachmentState(0xf, VK_FALSE)
-	};
+	std::vector<VkPipelineColorBlendAttachmentState> blendAttachmentStates(myOffscreenFramebuffer.colorAttachmentCount, fw::initializers::PipelineColorBlendAttachmentState(0xf, VK_FALSE));
 
 	colorBlendState.attachmentCount = (u32)blendAttachmentStates.size();
 	colorBlendState.pAttachments = blendAttachmentStates.data();
 
 	result = vkCreateGraphicsPipelines(myFramework->GetDevice(), VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &myPipelines.offscreen);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create G-buffer pipeline!");
+	}
+
+	// The pre-pass can be toggled at runtime, so both of its pipelines always exist.
+	// Depth is already resolved when the G-buffer pass runs, it only tests for the exact value and never writes
+	VkPipelineDepthStencilStateCreateInfo equalDepthStencilState = depthStencilState;
+	equalDepthStencilState.depthWriteEnable = VK_FALSE;
+	equalDepthStencilState.depthCompareOp = VK_COMPARE_OP_EQUAL;
+
+	VkGraphicsPipelineCreateInfo equalCreateInfo = pipelineCreateInfo;
+	equalCreateInfo.pDepthStencilState = &equalDepthStencilState;
+
+	result = vkCreateGraphicsPipelines(myFramework->GetDevice(), VK_NULL_HANDLE, 1, &equalCreateInfo, nullptr, &myPipelines.offscreenEqual);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create depth equal G-buffer pipeline!");
+	}
 
 	vkDestroyShaderModule(myFramework->GetDevice(), shaderStages[0].module, nullptr);
 	vkDestroyShaderModule(myFramework->GetDevice(), shaderStages[1].module, nullptr);
+
+	// Depth pre-pass: tightly packed positions plus the instance matrices, no fragment shader and no color writes
+	VkPipelineShaderStageCreateInfo depthStage = LoadShader("assets/shaders/depth_vs.spv", VK_SHADER_STAGE_VERTEX_BIT, myFramework);
+
+	std::array<VkVertexInputBindingDescription, 2> depthBindings = {
+		fw::initializers::VertexInputBindingDescription(0, sizeof(f32) * 3, VK_VERTEX_INPUT_RATE_VERTEX),
+		bindingDescriptions[1]
+	};
+
+	std::array<VkVertexInputAttributeDescription, 5> depthAttributes = {
+		attributeDescriptions[0],
+		attributeDescriptions[4],
+		attributeDescriptions[5],
+		attributeDescriptions[6],
+		attributeDescriptions[7]
+	};
+
+	VkPipelineVertexInputStateCreateInfo depthInputState = { };
+	depthInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+	depthInputState.vertexBindingDescriptionCount = (u32)depthBindings.size();
+	depthInputState.pVertexBindingDescriptions = depthBindings.data();
+	depthInputState.vertexAttributeDescriptionCount = (u32)depthAttributes.size();
+	depthInputState.pVertexAttributeDescriptions = depthAttributes.data();
+
+	std::vector<VkPipelineColorBlendAttachmentState> depthBlendStates(myOffscreenFramebuffer.colorAttachmentCount, fw::initializers::PipelineColorBlendAttachmentState(0, VK_FALSE));
+
+	VkPipelineColorBlendStateCreateInfo depthColorBlendState = colorBlendState;
+	depthColorBlendState.pAttachments = depthBlendStates.data();
+
+	VkGraphicsPipelineCreateInfo depthCreateInfo = pipelineCreateInfo;
+	depthCreateInfo.stageCount = 1;
+	depthCreateInfo.pStages = &depthStage;
+	depthCreateInfo.pVertexInputState = &depthInputState;
+	depthCreateInfo.pColorBlendState = &depthColorBlendState;
+
+	result = vkCreateGraphicsPipelines(myFramework->GetDevice(), VK_NULL_HANDLE, 1, &depthCreateInfo, nullptr, &myPipelines.depthPrepass);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create depth pre-pass pipeline!");
+	}
+
+	vkDestroyShaderModule(myFramework->GetDevice(), depthStage.module, nullptr);
 }
 
 void frostwave::Renderer::GenerateQuad()
@@ -584,7 +1604,7 @@ void frostwave::Renderer::GenerateQuad()
 		}
 	}
 
-	VkResult result = CreateBuffer(myFramework, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	VkResult result = CreateBuffer(myFramework, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Mesh,
 		&myQuad.GetVertexBuffer(), vertexBuffer.size() * sizeof(Vertex), vertexBuffer.data());
 	if (result != VK_SUCCESS)
 	{
@@ -602,7 +1622,7 @@ void frostwave::Renderer::GenerateQuad()
 	}
 	myQuad.SetIndexCount((u32)indexBuffer.size());
 
-	result = CreateBuffer(myFramework, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+	result = CreateBuffer(myFramework, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Mesh,
 		&myQuad.GetIndexBuffer(), indexBuffer.size() * sizeof(uint32_t), indexBuffer.data());
 	if (result != VK_SUCCESS)
 	{
@@ -610,22 +1630,657 @@ void frostwave::Renderer::GenerateQuad()
 	}
 }
 
-void frostwave::Renderer::SetupDescriptorSet()
+void frostwave::Renderer::GenerateSphere()
 {
-	std::vector<VkWriteDescriptorSet> writeDescriptorSets;
+	// Low poly UV sphere with unit radius, scaled per light in light_volume.vert.
+	// Pushed out so the flat faces circumscribe the unit sphere instead of cutting into it
+	const f32 halfSegment = fw::PI / LightVolumeSegments;
+	const f32 halfRing = fw::PI / (2.0f * LightVolumeRings);
+	const f32 inflate = 1.0f / std::cos(std::sqrt(halfSegment * halfSegment + halfRing * halfRing));
+
+	std::vector<fw::Vec3f> vertexBuffer;
+	for (u32 ring = 0; ring <= LightVolumeRings; ++ring)
+	{
+		f32 theta = fw::PI * ring / LightVolumeRings;
+		for (u32 segment = 0; segment <= LightVolumeSegments; ++segment)
+		{
+			f32 phi = 2.0f * fw::PI * segment / LightVolumeSegments;
+			vertexBuffer.push_back(fw::Vec3f(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)) * inflate);
+		}
+	}
 
-	VkDescriptorSetAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorSetCount = 1;
-	allocInfo.pSetLayouts = &myDescriptorSetLayout;
-	allocInfo.descriptorPool = myDescriptorPool;
+	VkResult result = CreateBuffer(myFramework, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Mesh,
+		&mySphere.GetVertexBuffer(), vertexBuffer.size() * sizeof(fw::Vec3f), vertexBuffer.data());
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create vertex buffer for light volume!");
+	}
 
-	VkResult result = vkAllocateDescriptorSets(myFramework->GetDevice(), &allocInfo, &myDescriptorSet);
+	// Clockwise seen from outside, matching the front face used by every pipeline
+	std::vector<uint32_t> indexBuffer;
+	for (u32 ring = 0; ring < LightVolumeRings; ++ring)
+	{
+		for (u32 segment = 0; segment < LightVolumeSegments; ++segment)
+		{
+			u32 a = ring * (LightVolumeSegments + 1) + segment;
+			u32 b = a + 1;
+			u32 d = a + LightVolumeSegments + 1;
+			u32 c = d + 1;
+
+			u32 indices[6] = { a,b,c, a,c,d };
+			for (auto index : indices)
+			{
+				indexBuffer.push_back(index);
+			}
+		}
+	}
+	mySphere.SetIndexCount((u32)indexBuffer.size());
 
-	VkDescriptorImageInfo texDescriptorPosition = { };
-	texDescriptorPosition.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	texDescriptorPosition.imageView = myOffscreenFramebuffer.position.view;
-	texDescriptorPosition.sampler = myColorSampler;
+	result = CreateBuffer(myFramework, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Mesh,
+		&mySphere.GetIndexBuffer(), indexBuffer.size() * sizeof(uint32_t), indexBuffer.data());
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create index buffer for light volume!");
+	}
+}
+
+void frostwave::Renderer::PrepareLightVolumes()
+{
+	// Same color attachment as the framework's pass, with the G-buffer depth loaded read only for the volume depth test
+	std::array<VkAttachmentDescription, 2> attachmentDescriptions = { };
+	attachmentDescriptions[0].format = myFramework->mySwapChainFormat;
+	attachmentDescriptions[0].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachmentDescriptions[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachmentDescriptions[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachmentDescriptions[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachmentDescriptions[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachmentDescriptions[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachmentDescriptions[0].finalLayout = myFramework->GetPresentLayout();
+
+	attachmentDescriptions[1].format = myOffscreenFramebuffer.depth.format;
+	attachmentDescriptions[1].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachmentDescriptions[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+	attachmentDescriptions[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachmentDescriptions[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachmentDescriptions[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachmentDescriptions[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	attachmentDescriptions[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+	VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+
+	VkSubpassDescription subpass = { };
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorReference;
+	subpass.pDepthStencilAttachment = &depthReference;
+
+	VkSubpassDependency dependency = { };
+	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependency.dstSubpass = 0;
+	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = { };
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = (u32)attachmentDescriptions.size();
+	renderPassInfo.pAttachments = attachmentDescriptions.data();
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = 1;
+	renderPassInfo.pDependencies = &dependency;
+
+	VkResult result = vkCreateRenderPass(myFramework->GetDevice(), &renderPassInfo, nullptr, &myLightVolumePass.renderPass);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create render pass for light volumes!");
+	}
+
+	CreateLightVolumeFramebuffers();
+}
+
+void frostwave::Renderer::CreateLightVolumeFramebuffers()
+{
+	// Resize recreates the G-buffer first, so its depth matches the swapchain images
+	myLightVolumePass.extent = myFramework->GetSwapchainExtent();
+
+	myLightVolumePass.framebuffers.resize(myFramework->mySwapChainImageViews.size());
+	for (size_t i = 0; i < myLightVolumePass.framebuffers.size(); ++i)
+	{
+		std::array<VkImageView, 2> attachments = { myFramework->mySwapChainImageViews[i], myOffscreenFramebuffer.depth.view };
+
+		VkFramebufferCreateInfo frameBufferCreateInfo = { };
+		frameBufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		frameBufferCreateInfo.renderPass = myLightVolumePass.renderPass;
+		frameBufferCreateInfo.attachmentCount = (u32)attachments.size();
+		frameBufferCreateInfo.pAttachments = attachments.data();
+		frameBufferCreateInfo.width = myLightVolumePass.extent.width;
+		frameBufferCreateInfo.height = myLightVolumePass.extent.height;
+		frameBufferCreateInfo.layers = 1;
+
+		VkResult result = vkCreateFramebuffer(myFramework->GetDevice(), &frameBufferCreateInfo, nullptr, &myLightVolumePass.framebuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to create light volume framebuffer!");
+		}
+	}
+}
+
+void frostwave::Renderer::DestroyLightVolumeFramebuffers()
+{
+	for (auto framebuffer : myLightVolumePass.framebuffers)
+	{
+		myFramework->GetDeletionQueue().Retire(framebuffer);
+	}
+	myLightVolumePass.framebuffers.clear();
+}
+
+void frostwave::Renderer::PrepareDeferredPass()
+{
+	// Attachment 0 is the swapchain image, followed by the G-buffer targets and depth. The G-buffer is cleared on load and
+	// dropped on store, so on tiled GPUs it never leaves tile memory
+	std::vector<FrameBufferAttachment*> targets = GetGBufferTargets();
+	const u32 depthIndex = (u32)targets.size() + 1;
+
+	std::vector<VkAttachmentDescription> attachmentDescriptions(targets.size() + 2);
+	for (auto& description : attachmentDescriptions)
+	{
+		description.samples = VK_SAMPLE_COUNT_1_BIT;
+		description.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+		description.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		description.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		description.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		description.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		description.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	}
+
+	attachmentDescriptions[0].format = myFramework->mySwapChainFormat;
+	attachmentDescriptions[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachmentDescriptions[0].finalLayout = myFramework->GetPresentLayout();
+
+	for (u32 i = 0; i < (u32)targets.size(); ++i)
+	{
+		attachmentDescriptions[i + 1].format = targets[i]->format;
+	}
+
+	attachmentDescriptions[depthIndex].format = myOffscreenFramebuffer.depth.format;
+	attachmentDescriptions[depthIndex].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+
+	// Input attachment indices follow the deferred.frag bindings: position (or depth), normal, albedo, material
+	std::vector<VkAttachmentReference> gBufferReferences;
+	std::vector<VkAttachmentReference> inputReferences;
+	if (myUseCompactGBuffer)
+	{
+		inputReferences.push_back({ depthIndex, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL });
+	}
+	for (u32 i = 0; i < (u32)targets.size(); ++i)
+	{
+		gBufferReferences.push_back({ i + 1, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL });
+		inputReferences.push_back({ i + 1, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL });
+	}
+
+	VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference depthReference = { depthIndex, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference depthReadReference = { depthIndex, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+
+	std::array<VkSubpassDescription, 2> subpasses = { };
+	subpasses[0].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[0].colorAttachmentCount = (u32)gBufferReferences.size();
+	subpasses[0].pColorAttachments = gBufferReferences.data();
+	subpasses[0].pDepthStencilAttachment = &depthReference;
+
+	// Only light volumes depth test during lighting, the fullscreen variants run without a depth attachment
+	subpasses[1].pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpasses[1].colorAttachmentCount = 1;
+	subpasses[1].pColorAttachments = &colorReference;
+	subpasses[1].inputAttachmentCount = (u32)inputReferences.size();
+	subpasses[1].pInputAttachments = inputReferences.data();
+	subpasses[1].pDepthStencilAttachment = myUseLightVolumes ? &depthReadReference : nullptr;
+
+	std::array<VkSubpassDependency, 3> dependencies = { };
+
+	// The G-buffer images are shared by every frame in flight, so the previous frame's lighting reads have to finish first
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[0].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+	// Lighting reads only the pixel it shades, so the G-buffer can stay on chip between the subpasses
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = 1;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_INPUT_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+	dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+
+	// Same as the framework's pass, waits for the acquired swapchain image
+	dependencies[2].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[2].dstSubpass = 1;
+	dependencies[2].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[2].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[2].srcAccessMask = 0;
+	dependencies[2].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = { };
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = (u32)attachmentDescriptions.size();
+	renderPassInfo.pAttachments = attachmentDescriptions.data();
+	renderPassInfo.subpassCount = (u32)subpasses.size();
+	renderPassInfo.pSubpasses = subpasses.data();
+	renderPassInfo.dependencyCount = (u32)dependencies.size();
+	renderPassInfo.pDependencies = dependencies.data();
+
+	VkResult result = vkCreateRenderPass(myFramework->GetDevice(), &renderPassInfo, nullptr, &myDeferredPass.renderPass);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create merged deferred render pass!");
+	}
+
+	CreateDeferredPassFramebuffers();
+}
+
+void frostwave::Renderer::CreateDeferredPassFramebuffers()
+{
+	// Resize rebuilds the transient G-buffer attachments at the swapchain extent before this runs
+	myDeferredPass.extent = myFramework->GetSwapchainExtent();
+
+	std::vector<FrameBufferAttachment*> targets = GetGBufferTargets();
+
+	myDeferredPass.framebuffers.resize(myFramework->mySwapChainImageViews.size());
+	for (size_t i = 0; i < myDeferredPass.framebuffers.size(); ++i)
+	{
+		std::vector<VkImageView> attachments = { myFramework->mySwapChainImageViews[i] };
+		for (auto target : targets)
+		{
+			attachments.push_back(target->view);
+		}
+		attachments.push_back(myOffscreenFramebuffer.depth.view);
+
+		VkFramebufferCreateInfo frameBufferCreateInfo = { };
+		frameBufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+		frameBufferCreateInfo.renderPass = myDeferredPass.renderPass;
+		frameBufferCreateInfo.attachmentCount = (u32)attachments.size();
+		frameBufferCreateInfo.pAttachments = attachments.data();
+		frameBufferCreateInfo.width = myDeferredPass.extent.width;
+		frameBufferCreateInfo.height = myDeferredPass.extent.height;
+		frameBufferCreateInfo.layers = 1;
+
+		VkResult result = vkCreateFramebuffer(myFramework->GetDevice(), &frameBufferCreateInfo, nullptr, &myDeferredPass.framebuffers[i]);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to create merged deferred framebuffer!");
+		}
+	}
+}
+
+void frostwave::Renderer::DestroyDeferredPassFramebuffers()
+{
+	for (auto framebuffer : myDeferredPass.framebuffers)
+	{
+		myFramework->GetDeletionQueue().Retire(framebuffer);
+	}
+	myDeferredPass.framebuffers.clear();
+}
+
+void frostwave::Renderer::UpdateRenderExtent(FrameResources& aFrame)
+{
+	aFrame.renderScale = GetRenderScale();
+	if (!myUseDynamicResolution)
+	{
+		return;
+	}
+
+	// Scaled against the swapchain the upscale fills, and never past the G-buffer, which Resize keeps at the swapchain extent
+	const VkExtent2D swapchainExtent = myFramework->GetSwapchainExtent();
+	VkExtent2D extent;
+	extent.width = fw::Clamp((u32)((f32)swapchainExtent.width * aFrame.renderScale + 0.5f), 1u, (u32)myOffscreenFramebuffer.width);
+	extent.height = fw::Clamp((u32)((f32)swapchainExtent.height * aFrame.renderScale + 0.5f), 1u, (u32)myOffscreenFramebuffer.height);
+
+	if (extent.width == myRenderExtent.width && extent.height == myRenderExtent.height)
+	{
+		return;
+	}
+
+	// Viewports and scissors are baked into the cached command buffers, each frame re-records on its next turn
+	myRenderExtent = extent;
+	for (auto& frame : myFrames)
+	{
+		frame.commandBuffersDirty = true;
+	}
+}
+
+void frostwave::Renderer::PrepareUpscalePass()
+{
+	// Swapchain format, so lighting writes exactly what it would have written to the swapchain image
+	myUpscalePass.color.format = myFramework->mySwapChainFormat;
+
+	// Light volumes also need the G-buffer depth to test against, same as their full resolution pass
+	std::vector<VkAttachmentDescription> attachmentDescriptions(myUseLightVolumes ? 2 : 1);
+	attachmentDescriptions[0].format = myUpscalePass.color.format;
+	attachmentDescriptions[0].samples = VK_SAMPLE_COUNT_1_BIT;
+	attachmentDescriptions[0].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+	attachmentDescriptions[0].storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+	attachmentDescriptions[0].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+	attachmentDescriptions[0].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+	attachmentDescriptions[0].initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	attachmentDescriptions[0].finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	if (myUseLightVolumes)
+	{
+		attachmentDescriptions[1].format = myOffscreenFramebuffer.depth.format;
+		attachmentDescriptions[1].samples = VK_SAMPLE_COUNT_1_BIT;
+		attachmentDescriptions[1].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+		attachmentDescriptions[1].storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachmentDescriptions[1].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachmentDescriptions[1].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachmentDescriptions[1].initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+		attachmentDescriptions[1].finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	}
+
+	VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+	VkAttachmentReference depthReference = { 1, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL };
+
+	VkSubpassDescription subpass = { };
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = 1;
+	subpass.pColorAttachments = &colorReference;
+	subpass.pDepthStencilAttachment = myUseLightVolumes ? &depthReference : nullptr;
+
+	std::array<VkSubpassDependency, 2> dependencies = { };
+
+	// The target is shared by every frame in flight, so the previous frame's upscale has to be done reading it
+	dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[0].dstSubpass = 0;
+	dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+	dependencies[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+	dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+	dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+
+	dependencies[1].srcSubpass = 0;
+	dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+	dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	VkRenderPassCreateInfo renderPassInfo = { };
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = (u32)attachmentDescriptions.size();
+	renderPassInfo.pAttachments = attachmentDescriptions.data();
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = (u32)dependencies.size();
+	renderPassInfo.pDependencies = dependencies.data();
+
+	VkResult result = vkCreateRenderPass(myFramework->GetDevice(), &renderPassInfo, nullptr, &myUpscalePass.renderPass);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create render pass for dynamic resolution!");
+	}
+
+	CreateUpscaleTarget();
+}
+
+void frostwave::Renderer::CreateUpscaleTarget()
+{
+	// The size of the G-buffer, which Resize keeps at the swapchain extent, so scale 1 fills all of it
+	CreateAttachment(myUpscalePass.color.format, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, &myUpscalePass.color);
+
+	std::array<VkImageView, 2> attachments = { myUpscalePass.color.view, myOffscreenFramebuffer.depth.view };
+
+	VkFramebufferCreateInfo frameBufferCreateInfo = { };
+	frameBufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+	frameBufferCreateInfo.renderPass = myUpscalePass.renderPass;
+	frameBufferCreateInfo.attachmentCount = myUseLightVolumes ? 2 : 1;
+	frameBufferCreateInfo.pAttachments = attachments.data();
+	frameBufferCreateInfo.width = myOffscreenFramebuffer.width;
+	frameBufferCreateInfo.height = myOffscreenFramebuffer.height;
+	frameBufferCreateInfo.layers = 1;
+
+	VkResult result = vkCreateFramebuffer(myFramework->GetDevice(), &frameBufferCreateInfo, nullptr, &myUpscalePass.framebuffer);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create framebuffer for dynamic resolution!");
+	}
+
+	VERBOSE_LOG("Prepared dynamic resolution targets at %dx%d", myOffscreenFramebuffer.width, myOffscreenFramebuffer.height);
+}
+
+void frostwave::Renderer::DestroyUpscaleTarget()
+{
+	DeletionQueue& deletionQueue = myFramework->GetDeletionQueue();
+	deletionQueue.Retire(myUpscalePass.framebuffer);
+	deletionQueue.Retire(myUpscalePass.color.view);
+	deletionQueue.Retire(myUpscalePass.color.image);
+	deletionQueue.Retire(myUpscalePass.color.allocation);
+
+	myUpscalePass.framebuffer = VK_NULL_HANDLE;
+	myUpscalePass.color = { VK_NULL_HANDLE, nullptr, VK_NULL_HANDLE, myUpscalePass.color.format };
+}
+
+void frostwave::Renderer::PrepareUpscalePipeline()
+{
+	// Bilinear, unlike the G-buffer sampler, since the upscale reads between texels
+	VkSamplerCreateInfo sampler = { };
+	sampler.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sampler.magFilter = VK_FILTER_LINEAR;
+	sampler.minFilter = VK_FILTER_LINEAR;
+	sampler.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	sampler.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sampler.addressModeV = sampler.addressModeU;
+	sampler.addressModeW = sampler.addressModeU;
+	sampler.maxAnisotropy = 1.0f;
+	sampler.maxLod = 0.0f;
+	sampler.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
+	VkResult result = vkCreateSampler(myFramework->GetDevice(), &sampler, nullptr, &myUpscalePass.sampler);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create sampler for the upscale!");
+	}
+
+	VkDescriptorSetLayoutBinding binding = fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_FRAGMENT_BIT, 0);
+
+	VkDescriptorSetLayoutCreateInfo layout = { };
+	layout.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout.pBindings = &binding;
+	layout.bindingCount = 1;
+
+	result = vkCreateDescriptorSetLayout(myFramework->GetDevice(), &layout, nullptr, &myUpscalePass.setLayout);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create descriptor set layout for the upscale");
+	}
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.size = sizeof(UpscaleConstants);
+	pushConstantRange.offset = 0;
+
+	VkPipelineLayoutCreateInfo pipelineLayout = { };
+	pipelineLayout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayout.pSetLayouts = &myUpscalePass.setLayout;
+	pipelineLayout.setLayoutCount = 1;
+	pipelineLayout.pushConstantRangeCount = 1;
+	pipelineLayout.pPushConstantRanges = &pushConstantRange;
+
+	result = vkCreatePipelineLayout(myFramework->GetDevice(), &pipelineLayout, nullptr, &myPipelineLayouts.upscale);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create pipeline layout for the upscale");
+	}
+
+	// A fullscreen quad into the framework's swapchain pass, no blending and no depth
+	VkPipelineInputAssemblyStateCreateInfo inputAssemblyState = { };
+	inputAssemblyState.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+	inputAssemblyState.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+	VkPipelineRasterizationStateCreateInfo rasterizationState = { };
+	rasterizationState.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+	rasterizationState.cullMode = VK_CULL_MODE_NONE;
+	rasterizationState.frontFace = VK_FRONT_FACE_CLOCKWISE;
+	rasterizationState.polygonMode = VK_POLYGON_MODE_FILL;
+	rasterizationState.lineWidth = 1.0f;
+
+	VkPipelineColorBlendAttachmentState blendAttachmentState = fw::initializers::PipelineColorBlendAttachmentState(0xf, VK_FALSE);
+
+	VkPipelineColorBlendStateCreateInfo colorBlendState = { };
+	colorBlendState.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+	colorBlendState.attachmentCount = 1;
+	colorBlendState.pAttachments = &blendAttachmentState;
+
+	VkPipelineDepthStencilStateCreateInfo depthStencilState = { };
+	depthStencilState.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+
+	VkPipelineViewportStateCreateInfo viewportState = { };
+	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+	viewportState.viewportCount = 1;
+	viewportState.scissorCount = 1;
+
+	VkPipelineMultisampleStateCreateInfo multisampleState = { };
+	multisampleState.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+	multisampleState.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+	std::array<VkDynamicState, 2> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+
+	VkPipelineDynamicStateCreateInfo dynamicState = { };
+	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+	dynamicState.pDynamicStates = dynamicStateEnables.data();
+	dynamicState.dynamicStateCount = (u32)dynamicStateEnables.size();
+
+	VkPipelineVertexInputStateCreateInfo emptyInputState = { };
+	emptyInputState.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+	// Constant 0 is the sharpening strength, at 0 the shader is a plain bilinear fetch
+	f32 sharpness = fw::Clamp(myFramework->GetSettings().upscaleSharpness, 0.0f, 1.0f);
+	VkSpecializationMapEntry specializationEntry = { 0, 0, sizeof(f32) };
+	VkSpecializationInfo specializationInfo = { 1, &specializationEntry, sizeof(f32), &sharpness };
+
+	std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages = {
+		LoadShader("assets/shaders/deferred_vs.spv", VK_SHADER_STAGE_VERTEX_BIT, myFramework),
+		LoadShader("assets/shaders/upscale_fs.spv", VK_SHADER_STAGE_FRAGMENT_BIT, myFramework)
+	};
+	shaderStages[1].pSpecializationInfo = &specializationInfo;
+
+	VkGraphicsPipelineCreateInfo pipelineCreateInfo = { };
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.layout = myPipelineLayouts.upscale;
+	pipelineCreateInfo.renderPass = myFramework->GetRenderPass();
+	pipelineCreateInfo.subpass = 0;
+	pipelineCreateInfo.basePipelineIndex = -1;
+	pipelineCreateInfo.pInputAssemblyState = &inputAssemblyState;
+	pipelineCreateInfo.pRasterizationState = &rasterizationState;
+	pipelineCreateInfo.pColorBlendState = &colorBlendState;
+	pipelineCreateInfo.pMultisampleState = &multisampleState;
+	pipelineCreateInfo.pViewportState = &viewportState;
+	pipelineCreateInfo.pDepthStencilState = &depthStencilState;
+	pipelineCreateInfo.pDynamicState = &dynamicState;
+	pipelineCreateInfo.pVertexInputState = &emptyInputState;
+	pipelineCreateInfo.stageCount = (u32)shaderStages.size();
+	pipelineCreateInfo.pStages = shaderStages.data();
+
+	result = vkCreateGraphicsPipelines(myFramework->GetDevice(), VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &myPipelines.upscale);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create upscale pipeline!");
+	}
+
+	vkDestroyShaderModule(myFramework->GetDevice(), shaderStages[0].module, nullptr);
+	vkDestroyShaderModule(myFramework->GetDevice(), shaderStages[1].module, nullptr);
+
+	SetupUpscaleDescriptorSet();
+}
+
+void frostwave::Renderer::SetupUpscaleDescriptorSet()
+{
+	// One set serves every frame in flight, like the target it points at
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &myUpscalePass.setLayout;
+	allocInfo.descriptorPool = myDescriptorPool;
+
+	VkResult result = vkAllocateDescriptorSets(myFramework->GetDevice(), &allocInfo, &myUpscalePass.set);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to allocate descriptor set for the upscale!");
+	}
+
+	VkDescriptorImageInfo sceneDescriptor = { };
+	sceneDescriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	sceneDescriptor.imageView = myUpscalePass.color.view;
+	sceneDescriptor.sampler = myUpscalePass.sampler;
+
+	VkWriteDescriptorSet write = fw::initializers::WriteDescriptorSet(myUpscalePass.set, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &sceneDescriptor);
+	vkUpdateDescriptorSets(myFramework->GetDevice(), 1, &write, 0, nullptr);
+}
+
+void frostwave::Renderer::RecordUpscale(u32 aFrameIndex, CommandRecorder& aRecorder, VkFramebuffer aFramebuffer)
+{
+	VkCommandBuffer commandBuffer = aRecorder.GetCommandBuffer();
+	const VkExtent2D swapchainExtent = myFramework->GetSwapchainExtent();
+
+	VkClearValue clearValues[2];
+	clearValues[0].color = { {0.0f, 0.0f, 0.0f, 0.0f} };
+	clearValues[1].depthStencil = { 1.0f, 0 };
+
+	VkRenderPassBeginInfo renderPassBeginInfo = { };
+	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassBeginInfo.renderPass = myFramework->GetRenderPass();
+	renderPassBeginInfo.framebuffer = aFramebuffer;
+	renderPassBeginInfo.renderArea.extent = swapchainExtent;
+	renderPassBeginInfo.clearValueCount = 2;
+	renderPassBeginInfo.pClearValues = clearValues;
+
+	UpscaleConstants constants;
+	constants.uvScale = fw::Vec2f((f32)myRenderExtent.width / (f32)myOffscreenFramebuffer.width, (f32)myRenderExtent.height / (f32)myOffscreenFramebuffer.height);
+	constants.texelSize = fw::Vec2f(1.0f / (f32)myOffscreenFramebuffer.width, 1.0f / (f32)myOffscreenFramebuffer.height);
+
+	myGpuTimer.WriteBegin(commandBuffer, aFrameIndex, GpuTimer::Upscale);
+	vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+	aRecorder.SetViewport(fw::initializers::Viewport((f32)swapchainExtent.width, (f32)swapchainExtent.height, 0.0f, 1.0f));
+	aRecorder.SetScissor(fw::initializers::Rect2D(swapchainExtent.width, swapchainExtent.height, 0, 0));
+	aRecorder.BindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelines.upscale);
+	aRecorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelineLayouts.upscale, 0, 1, &myUpscalePass.set);
+	aRecorder.PushConstants(myPipelineLayouts.upscale, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(UpscaleConstants), &constants);
+	aRecorder.BindVertexBuffer(0, myQuad.GetVertexBuffer().buffer);
+	aRecorder.BindIndexBuffer(myQuad.GetIndexBuffer().buffer);
+	aRecorder.DrawIndexed(6, 1, 0, 0, 0);
+
+	vkCmdEndRenderPass(commandBuffer);
+	myGpuTimer.WriteEnd(commandBuffer, aFrameIndex, GpuTimer::Upscale);
+}
+
+void frostwave::Renderer::DestroyUpscalePass()
+{
+	vkDestroyPipeline(myFramework->GetDevice(), myPipelines.upscale, nullptr);
+	vkDestroyPipelineLayout(myFramework->GetDevice(), myPipelineLayouts.upscale, nullptr);
+	vkDestroyDescriptorSetLayout(myFramework->GetDevice(), myUpscalePass.setLayout, nullptr);
+	vkDestroySampler(myFramework->GetDevice(), myUpscalePass.sampler, nullptr);
+	DestroyUpscaleTarget();
+	vkDestroyRenderPass(myFramework->GetDevice(), myUpscalePass.renderPass, nullptr);
+}
+
+void frostwave::Renderer::SetupDescriptorSet()
+{
+	std::vector<VkWriteDescriptorSet> writeDescriptorSets;
+
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &myDescriptorSetLayout;
+	allocInfo.descriptorPool = myDescriptorPool;
+
+	// The compact layout has no position target, the shaders reconstruct it from depth bound in its place
+	VkDescriptorImageInfo texDescriptorPosition = { };
+	texDescriptorPosition.imageLayout = myUseCompactGBuffer ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	texDescriptorPosition.imageView = myUseCompactGBuffer ? myOffscreenFramebuffer.depth.view : myOffscreenFramebuffer.position.view;
+	texDescriptorPosition.sampler = myColorSampler;
 
 	VkDescriptorImageInfo texDescriptorNormal = { };
 	texDescriptorNormal.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
@@ -642,39 +2297,199 @@ void frostwave::Renderer::SetupDescriptorSet()
 	texDescriptorMaterial.imageView = myOffscreenFramebuffer.material.view;
 	texDescriptorMaterial.sampler = myColorSampler;
 
-	writeDescriptorSets = {
-		fw::initializers::WriteDescriptorSet(myDescriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 0, &myUniformBuffers.fullscreen.descriptor),
-		fw::initializers::WriteDescriptorSet(myDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &texDescriptorPosition),
-		fw::initializers::WriteDescriptorSet(myDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &texDescriptorNormal),
-		fw::initializers::WriteDescriptorSet(myDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &texDescriptorAlbedo),
-		fw::initializers::WriteDescriptorSet(myDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4, &texDescriptorMaterial),
-		fw::initializers::WriteDescriptorSet(myDescriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 5, &myUniformBuffers.fullscreen.descriptor),
-	};
+	for (auto& frame : myFrames)
+	{
+		VkResult result = vkAllocateDescriptorSets(myFramework->GetDevice(), &allocInfo, &frame.descriptorSet);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to allocate descriptor set for deferred pass!");
+		}
+
+		writeDescriptorSets = {
+			fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 0, &myUniformBuffers.offscreen.descriptor),
+			fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 5, &frame.fullscreenUBO.descriptor),
+			fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 6, &frame.lightBuffer.descriptor),
+		};
+
+		// On the first call the tile and cluster buffers don't exist yet, PrepareTiledLighting and PrepareClusteredLighting
+		// point these at them once they do
+		const bool tiles = frame.tileBuffer.buffer != VK_NULL_HANDLE;
+		const bool clusters = frame.clusterBuffer.buffer != VK_NULL_HANDLE;
+		writeDescriptorSets.push_back(fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7, tiles ? &frame.tileBuffer.descriptor : &myDummyStorageBuffer.descriptor));
+		writeDescriptorSets.push_back(fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8, clusters ? &frame.clusterBuffer.descriptor : &myDummyStorageBuffer.descriptor));
+		writeDescriptorSets.push_back(fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 9, clusters ? &frame.clusterIndexBuffer.descriptor : &myDummyStorageBuffer.descriptor));
+
+		// Transient G-buffer images can't be sampled, the merged pass binds them as input attachments below
+		if (!myUseSubpasses)
+		{
+			writeDescriptorSets.push_back(fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &texDescriptorPosition));
+			writeDescriptorSets.push_back(fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2, &texDescriptorNormal));
+			writeDescriptorSets.push_back(fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3, &texDescriptorAlbedo));
+			writeDescriptorSets.push_back(fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4, &texDescriptorMaterial));
+		}
+
+		vkUpdateDescriptorSets(myFramework->GetDevice(), static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
+	}
+
+	if (myUseSubpasses)
+	{
+		// The G-buffer is shared by every frame in flight, so a single input attachment set serves them all
+		allocInfo.pSetLayouts = &myDeferredPass.inputSetLayout;
+		VkResult result = vkAllocateDescriptorSets(myFramework->GetDevice(), &allocInfo, &myDeferredPass.inputSet);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to allocate input attachment descriptor set!");
+		}
+
+		std::array<VkDescriptorImageInfo, 4> inputDescriptors = { texDescriptorPosition, texDescriptorNormal, texDescriptorAlbedo, texDescriptorMaterial };
+		for (auto& descriptor : inputDescriptors)
+		{
+			descriptor.sampler = VK_NULL_HANDLE;
+		}
+
+		writeDescriptorSets.clear();
+		for (u32 i = 0; i < (u32)inputDescriptors.size(); ++i)
+		{
+			writeDescriptorSets.push_back(fw::initializers::WriteDescriptorSet(myDeferredPass.inputSet, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, i, &inputDescriptors[i]));
+		}
+
+		vkUpdateDescriptorSets(myFramework->GetDevice(), (u32)writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
+	}
+}
+
+void frostwave::Renderer::RetireDescriptorSets()
+{
+	DeletionQueue& deletionQueue = myFramework->GetDeletionQueue();
+	for (auto& frame : myFrames)
+	{
+		deletionQueue.Retire(myDescriptorPool, frame.descriptorSet);
+		frame.descriptorSet = VK_NULL_HANDLE;
+
+		if (frame.tileCullDescriptorSet != VK_NULL_HANDLE)
+		{
+			deletionQueue.Retire(myDescriptorPool, frame.tileCullDescriptorSet);
+			frame.tileCullDescriptorSet = VK_NULL_HANDLE;
+		}
+	}
+
+	if (myDeferredPass.inputSet != VK_NULL_HANDLE)
+	{
+		deletionQueue.Retire(myDescriptorPool, myDeferredPass.inputSet);
+		myDeferredPass.inputSet = VK_NULL_HANDLE;
+	}
 
-	vkUpdateDescriptorSets(myFramework->GetDevice(), static_cast<uint32_t>(writeDescriptorSets.size()), writeDescriptorSets.data(), 0, NULL);
+	if (myUpscalePass.set != VK_NULL_HANDLE)
+	{
+		deletionQueue.Retire(myDescriptorPool, myUpscalePass.set);
+		myUpscalePass.set = VK_NULL_HANDLE;
+	}
 }
 
 void frostwave::Renderer::PrepareUniformBuffers()
 {
-	CreateBuffer(myFramework, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&myUniformBuffers.offscreen, sizeof(myUBO));
-	CreateBuffer(myFramework, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		&myUniformBuffers.fullscreen, sizeof(myUBOFullscreen));
+	// The camera UBO is shared by every model descriptor set, so frames index into it with a dynamic offset instead of owning a buffer each
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(myFramework->GetPhysicalDevice(), &properties);
+	VkDeviceSize alignment = properties.limits.minUniformBufferOffsetAlignment;
+	myUBOStride = (u32)((sizeof(myUBO) + alignment - 1) & ~(alignment - 1));
 
-	VkResult result = myUniformBuffers.fullscreen.Map();
-	if (result != VK_SUCCESS) FATAL_LOG("Failed to map persistant!");
+	CreateBuffer(myFramework, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniform,
+		&myUniformBuffers.offscreen, myUBOStride * myFrames.size());
+	myUniformBuffers.offscreen.SetupDescriptor(sizeof(myUBO));
 
-	result = myUniformBuffers.offscreen.Map();
+	VkResult result = myUniformBuffers.offscreen.Map();
 	if (result != VK_SUCCESS) FATAL_LOG("Failed to map persistant!");
+
+	for (auto& frame : myFrames)
+	{
+		CreateBuffer(myFramework, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniform,
+			&frame.fullscreenUBO, sizeof(myUBOFullscreen));
+
+		result = frame.fullscreenUBO.Map();
+		if (result != VK_SUCCESS) FATAL_LOG("Failed to map persistant!");
+	}
+
+	// Never read, the specialization constants skip the light lists of the modes that are off
+	result = CreateBuffer(myFramework, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Storage, &myDummyStorageBuffer, 16);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create dummy storage buffer!");
+	}
 }
 
-void frostwave::Renderer::BuildDeferredCommandBuffers(VkFramebuffer aFramebuffer, Camera* aCamera, const std::vector<PointLight>& aLights)
+bool frostwave::Renderer::RefreshDeferredCommandBuffer(u32 aFrameIndex, u32 aImageIndex, VkFramebuffer aFramebuffer, u32 aLightCount)
 {
-	myUBOFullscreen.cameraPos = fw::Vec4f(aCamera->GetPosition(), 0.0f);
-	memcpy(myUniformBuffers.fullscreen.mapped, &myUBOFullscreen, sizeof(myUBOFullscreen));
+	FrameResources& frame = myFrames[aFrameIndex];
+	const u32 slot = myUseSubpasses ? 0 : aImageIndex;
+
+	if (slot >= frame.deferredCommands.size())
+	{
+		const u32 first = (u32)frame.deferredCommands.size();
+		frame.deferredCommands.resize(slot + 1);
+
+		VkCommandBufferAllocateInfo allocInfo = { };
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = myCommandPool;
+		// The merged pass executes lighting as a secondary inside the frame's primary
+		allocInfo.level = myUseSubpasses ? VK_COMMAND_BUFFER_LEVEL_SECONDARY : VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		for (u32 i = first; i <= slot; ++i)
+		{
+			VkResult result = vkAllocateCommandBuffers(myFramework->GetDevice(), &allocInfo, &frame.deferredCommands[i].commandBuffer);
+			if (result != VK_SUCCESS)
+			{
+				FATAL_LOG("Failed to allocate command buffers!");
+			}
+		}
+	}
+
+	// Whatever invalidated the frame's command buffers holds for the recordings of the other images too
+	if (frame.commandBuffersDirty)
+	{
+		for (auto& commands : frame.deferredCommands)
+		{
+			commands.dirty = true;
+		}
+	}
+
+	DeferredCommands& cached = frame.deferredCommands[slot];
+	frame.deferredCommandBuffer = cached.commandBuffer;
+
+	const bool record = cached.dirty || aLightCount != cached.lightCount || !MatchesCachedScissors(cached.lightScissors);
+	if (record)
+	{
+		BuildDeferredCommandBuffers(aFrameIndex, aFramebuffer, aLightCount);
+		cached.dirty = false;
+		cached.lightCount = aLightCount;
+		cached.lightScissors = myLightScissors;
+		cached.stats = frame.deferredStats;
+	}
+
+	frame.deferredStats = cached.stats;
+	return record;
+}
+
+void frostwave::Renderer::BuildDeferredCommandBuffers(u32 aFrameIndex, VkFramebuffer aFramebuffer, u32 aLightCount)
+{
+	FrameResources& frame = myFrames[aFrameIndex];
+	const u32 uboOffset = aFrameIndex * myUBOStride;
+	VkCommandBuffer commandBuffer = frame.deferredCommandBuffer;
+
+	VkCommandBufferInheritanceInfo inheritanceInfo = { };
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = myDeferredPass.renderPass;
+	inheritanceInfo.subpass = 1;
+	inheritanceInfo.pipelineStatistics = myFramework->GetPipelineStatisticFlags();
 
 	VkCommandBufferBeginInfo cmdBufInfo = { };
 	cmdBufInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	if (myUseSubpasses)
+	{
+		// Executed by the frame's primary once it has moved on to the lighting subpass
+		cmdBufInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+		cmdBufInfo.pInheritanceInfo = &inheritanceInfo;
+	}
 
 	VkClearValue clearValues[2];
 	clearValues[0].color = { {0.0f, 0.0f, 0.0f, 0.0f} };
@@ -682,75 +2497,371 @@ void frostwave::Renderer::BuildDeferredCommandBuffers(VkFramebuffer aFramebuffer
 
 	VkRenderPassBeginInfo renderPassBeginInfo = { };
 	renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-	renderPassBeginInfo.renderPass = myFramework->GetRenderPass();
+	renderPassBeginInfo.renderPass = myUseLightVolumes ? myLightVolumePass.renderPass : myFramework->GetRenderPass();
 	renderPassBeginInfo.renderArea.offset.x = 0;
 	renderPassBeginInfo.renderArea.offset.y = 0;
-	renderPassBeginInfo.renderArea.extent = myFramework->GetSwapchainExtent();
+	renderPassBeginInfo.renderArea.extent = myUseLightVolumes ? myLightVolumePass.extent : myFramework->GetSwapchainExtent();
 	renderPassBeginInfo.clearValueCount = 2;
 	renderPassBeginInfo.pClearValues = clearValues;
 	renderPassBeginInfo.framebuffer = aFramebuffer;
 
-	VkResult result = vkBeginCommandBuffer(myDeferredCommandBuffer, &cmdBufInfo);
+	// Only the rendered corner of the scene color target is touched, the upscale never samples past it
+	if (myUseDynamicResolution)
+	{
+		renderPassBeginInfo.renderPass = myUpscalePass.renderPass;
+		renderPassBeginInfo.renderArea.extent = myRenderExtent;
+		renderPassBeginInfo.framebuffer = myUpscalePass.framebuffer;
+	}
+
+	VkResult result = vkBeginCommandBuffer(commandBuffer, &cmdBufInfo);
 	if (result != VK_SUCCESS)
 	{
 		FATAL_LOG("Failed to begin command buffer recording!");
 	}
 
+	CommandRecorder& recorder = myDeferredRecorder;
+	recorder.Begin(commandBuffer);
+
 	VkViewport viewport = { };
-	viewport.width = (f32)myOffscreenFramebuffer.width;
-	viewport.height = (f32)myOffscreenFramebuffer.height;
+	viewport.width = (f32)myRenderExtent.width;
+	viewport.height = (f32)myRenderExtent.height;
 
-	vkCmdSetViewport(myDeferredCommandBuffer, 0, 1, &viewport);
+	recorder.SetViewport(viewport);
 
 	VkRect2D scissor = { };
-	scissor.extent.width = myOffscreenFramebuffer.width;
-	scissor.extent.height = myOffscreenFramebuffer.height;
+	scissor.extent = myRenderExtent;
+
+	recorder.SetScissor(scissor);
+
+	// In the merged pass the frame's primary already has a query running around this secondary
+	if (!myUseSubpasses)
+	{
+		myFramework->BeginPipelineStatistics(commandBuffer, aFrameIndex, 1);
+	}
+
+	if (myUseTiledLighting && aLightCount > 0)
+	{
+		myGpuTimer.WriteBegin(commandBuffer, aFrameIndex, GpuTimer::LightCulling);
+		RecordLightCulling(aFrameIndex, recorder, aLightCount);
+		myGpuTimer.WriteEnd(commandBuffer, aFrameIndex, GpuTimer::LightCulling);
+	}
+
+	myGpuTimer.WriteBegin(commandBuffer, aFrameIndex, GpuTimer::Lighting);
+
+	if (!myUseSubpasses)
+	{
+		vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+	}
+
+	// The input attachment set only exists for the merged pass
+	VkDescriptorSet descriptorSets[] = { frame.descriptorSet, myDeferredPass.inputSet };
+	const u32 descriptorSetCount = myUseSubpasses ? 2 : 1;
 
-	vkCmdSetScissor(myDeferredCommandBuffer, 0, 1, &scissor);
+	// Tiled and clustered lighting read the G-buffer once and loop over a light list,
+	// light volumes draw one sphere instance per light covering only its radius,
+	// otherwise every light is an additive fullscreen instance indexed by gl_InstanceIndex
+	if (aLightCount > 0 && myUseLightVolumes)
+	{
+		recorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelineLayouts.deferred, 0, descriptorSetCount, descriptorSets, 1, &uboOffset);
+		recorder.BindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelines.lightVolume);
+		recorder.BindVertexBuffer(0, mySphere.GetVertexBuffer().buffer);
+		recorder.BindIndexBuffer(mySphere.GetIndexBuffer().buffer);
+		recorder.DrawIndexed(mySphere.GetIndexCount(), aLightCount, 0, 0, 0);
+	}
+	else if (aLightCount > 0)
+	{
+		VkPipeline pipeline = myUseTiledLighting ? myPipelines.tiled : myUseClusteredLighting ? myPipelines.clustered : myPipelines.deferred;
+		bool singlePass = myUseTiledLighting || myUseClusteredLighting;
 
-	vkCmdBeginRenderPass(myDeferredCommandBuffer, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		recorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelineLayouts.deferred, 0, descriptorSetCount, descriptorSets, 1, &uboOffset);
+		recorder.BindPipeline(VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		recorder.BindVertexBuffer(0, myQuad.GetVertexBuffer().buffer);
+		recorder.BindIndexBuffer(myQuad.GetIndexBuffer().buffer);
 
-	VkDeviceSize offsets[1] = { 0 };
+		if (myUseLightScissors)
+		{
+			// One draw per on screen light, clipped to its projected bounds. firstInstance keeps gl_InstanceIndex the light index
+			for (u32 i = 0; i < aLightCount; ++i)
+			{
+				const VkRect2D& lightScissor = myLightScissors[i];
+				if (lightScissor.extent.width == 0 || lightScissor.extent.height == 0)
+				{
+					continue;
+				}
+
+				recorder.SetScissor(lightScissor);
+				recorder.DrawIndexed(6, 1, 0, 0, i);
+			}
+		}
+		else
+		{
+			recorder.DrawIndexed(6, singlePass ? 1 : aLightCount, 0, 0, 0);
+		}
+	}
 
-	for (auto light : aLights)
+	if (!myUseSubpasses)
 	{
-		light.position.y *= -1.0f;
-		vkCmdPushConstants(myDeferredCommandBuffer, myPipelineLayouts.deferred, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PointLight), &light);
+		vkCmdEndRenderPass(commandBuffer);
+	}
 
-		vkCmdBindDescriptorSets(myDeferredCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelineLayouts.deferred, 0, 1, &myDescriptorSet, 0, nullptr);
-		vkCmdBindPipeline(myDeferredCommandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, myPipelines.deferred);
-		vkCmdBindVertexBuffers(myDeferredCommandBuffer, 0, 1, &myQuad.GetVertexBuffer().buffer, offsets);
-		vkCmdBindIndexBuffer(myDeferredCommandBuffer, myQuad.GetIndexBuffer().buffer, 0, VK_INDEX_TYPE_UINT32);
-		vkCmdDrawIndexed(myDeferredCommandBuffer, 6, 1, 0, 0, 1);
+	myGpuTimer.WriteEnd(commandBuffer, aFrameIndex, GpuTimer::Lighting);
+
+	if (myUseDynamicResolution)
+	{
+		RecordUpscale(aFrameIndex, recorder, aFramebuffer);
 	}
 
-	vkCmdEndRenderPass(myDeferredCommandBuffer);
+	if (!myUseSubpasses)
+	{
+		myFramework->EndPipelineStatistics(commandBuffer, aFrameIndex, 1);
+	}
 
-	result = vkEndCommandBuffer(myDeferredCommandBuffer);
+	result = vkEndCommandBuffer(commandBuffer);
 	if (result != VK_SUCCESS)
 	{
 		FATAL_LOG("Failed to end command buffer recording!");
 	}
+
+	frame.deferredStats = recorder.GetStats();
+	myRecorderStats += frame.deferredStats;
+	++myFramework->GetFrameCounters().commandBuffersRecorded;
 }
 
 void frostwave::Renderer::SetupDescriptorPool()
 {
+	const u32 frameCount = (u32)myFrames.size();
+	// Every resize replaces the sets, and the replaced ones are only freed once the frames in flight are done with them
+	const u32 generations = frameCount + 1;
+
+	// Each frame has a deferred set, plus a light culling set when tiled lighting is on,
+	// one input attachment set for the merged pass and one scene color set for the upscale
 	std::vector<VkDescriptorPoolSize> poolSizes =
 	{
-		fw::initializers::DescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 8),
-		fw::initializers::DescriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 9)
+		fw::initializers::DescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, generations * frameCount),
+		fw::initializers::DescriptorPoolSize(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, generations * 2 * frameCount),
+		fw::initializers::DescriptorPoolSize(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, generations * (6 * frameCount + 1)),
+		fw::initializers::DescriptorPoolSize(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, generations * 6 * frameCount),
+		fw::initializers::DescriptorPoolSize(VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, generations * 4)
 	};
 
 	VkDescriptorPoolCreateInfo descriptorPoolInfo = { };
 	descriptorPoolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	// Resize retires the sets and allocates new ones
+	descriptorPoolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
 	descriptorPoolInfo.poolSizeCount = (u32)poolSizes.size();
 	descriptorPoolInfo.pPoolSizes = poolSizes.data();
-	descriptorPoolInfo.maxSets = 3;
+	descriptorPoolInfo.maxSets = generations * (2 * frameCount + 2);
 
 	VkResult result = vkCreateDescriptorPool(myFramework->GetDevice(), &descriptorPoolInfo, nullptr, &myDescriptorPool);
 }
 
-void frostwave::Renderer::CreateAttachment(VkFormat aFormat, VkImageUsageFlagBits aUsage, FrameBufferAttachment* aAttachment)
+void frostwave::Renderer::PrepareTiledLighting()
+{
+	CreateTileBuffers();
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings =
+	{
+		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 0),
+		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, VK_SHADER_STAGE_COMPUTE_BIT, 1),
+		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 2),
+		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 3),
+		fw::initializers::DescriptorSetLayoutBinding(VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, VK_SHADER_STAGE_COMPUTE_BIT, 4)
+	};
+
+	VkDescriptorSetLayoutCreateInfo layout = { };
+	layout.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layout.pBindings = bindings.data();
+	layout.bindingCount = (u32)bindings.size();
+
+	VkResult result = vkCreateDescriptorSetLayout(myFramework->GetDevice(), &layout, nullptr, &myTileCullDescriptorSetLayout);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create descriptor set layout for light culling");
+	}
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.size = sizeof(u32);
+	pushConstantRange.offset = 0;
+
+	VkPipelineLayoutCreateInfo pipelineLayout = { };
+	pipelineLayout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayout.pSetLayouts = &myTileCullDescriptorSetLayout;
+	pipelineLayout.setLayoutCount = 1;
+	pipelineLayout.pushConstantRangeCount = 1;
+	pipelineLayout.pPushConstantRanges = &pushConstantRange;
+
+	result = vkCreatePipelineLayout(myFramework->GetDevice(), &pipelineLayout, nullptr, &myPipelineLayouts.tileCull);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create pipeline layout for light culling");
+	}
+
+	VkComputePipelineCreateInfo pipelineCreateInfo = { };
+	pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineCreateInfo.layout = myPipelineLayouts.tileCull;
+	pipelineCreateInfo.stage = LoadShader("assets/shaders/tiled_cull_cs.spv", VK_SHADER_STAGE_COMPUTE_BIT, myFramework);
+
+	VkBool32 compactGBuffer = myUseCompactGBuffer;
+	VkSpecializationMapEntry specializationEntry = { 0, 0, sizeof(VkBool32) };
+	VkSpecializationInfo specializationInfo = { 1, &specializationEntry, sizeof(VkBool32), &compactGBuffer };
+	pipelineCreateInfo.stage.pSpecializationInfo = &specializationInfo;
+
+	result = vkCreateComputePipelines(myFramework->GetDevice(), VK_NULL_HANDLE, 1, &pipelineCreateInfo, nullptr, &myPipelines.tileCull);
+	if (result != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create light culling pipeline!");
+	}
+
+	vkDestroyShaderModule(myFramework->GetDevice(), pipelineCreateInfo.stage.module, nullptr);
+
+	SetupTileCullDescriptorSets();
+
+	VERBOSE_LOG("Prepared tiled lighting with %ux%u tiles", myTileCountX, myTileCountY);
+}
+
+void frostwave::Renderer::CreateTileBuffers()
+{
+	myTileCountX = (myOffscreenFramebuffer.width + LightTileSize - 1) / LightTileSize;
+	myTileCountY = (myOffscreenFramebuffer.height + LightTileSize - 1) / LightTileSize;
+
+	// Per tile: a light count followed by up to MaxLightsPerTile light indices. Only grows, smaller
+	// extents use the rows they need
+	VkDeviceSize tileBufferSize = (VkDeviceSize)myTileCountX * myTileCountY * (1 + MaxLightsPerTile) * sizeof(u32);
+	for (auto& frame : myFrames)
+	{
+		if (frame.tileBuffer.size >= tileBufferSize)
+		{
+			continue;
+		}
+
+		// Destroy goes through the deletion queue, older frames keep culling into the old buffer
+		frame.tileBuffer.Destroy();
+		VkResult result = CreateBuffer(myFramework, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Storage, &frame.tileBuffer, tileBufferSize);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to create light tile buffer!");
+		}
+	}
+}
+
+void frostwave::Renderer::SetupTileCullDescriptorSets()
+{
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &myTileCullDescriptorSetLayout;
+	allocInfo.descriptorPool = myDescriptorPool;
+
+	VkDescriptorImageInfo texDescriptorPosition = { };
+	texDescriptorPosition.imageLayout = myUseCompactGBuffer ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	texDescriptorPosition.imageView = myUseCompactGBuffer ? myOffscreenFramebuffer.depth.view : myOffscreenFramebuffer.position.view;
+	texDescriptorPosition.sampler = myColorSampler;
+
+	VkDescriptorImageInfo texDescriptorNormal = { };
+	texDescriptorNormal.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	texDescriptorNormal.imageView = myOffscreenFramebuffer.normal.view;
+	texDescriptorNormal.sampler = myColorSampler;
+
+	for (auto& frame : myFrames)
+	{
+		VkResult result = vkAllocateDescriptorSets(myFramework->GetDevice(), &allocInfo, &frame.tileCullDescriptorSet);
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to allocate descriptor set for light culling!");
+		}
+
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+			fw::initializers::WriteDescriptorSet(frame.tileCullDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 0, &texDescriptorPosition),
+			fw::initializers::WriteDescriptorSet(frame.tileCullDescriptorSet, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, &texDescriptorNormal),
+			fw::initializers::WriteDescriptorSet(frame.tileCullDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2, &frame.lightBuffer.descriptor),
+			fw::initializers::WriteDescriptorSet(frame.tileCullDescriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3, &frame.tileBuffer.descriptor),
+			fw::initializers::WriteDescriptorSet(frame.tileCullDescriptorSet, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 4, &frame.fullscreenUBO.descriptor),
+			fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 7, &frame.tileBuffer.descriptor)
+		};
+
+		vkUpdateDescriptorSets(myFramework->GetDevice(), (u32)writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
+	}
+}
+
+void frostwave::Renderer::RecordLightCulling(u32 aFrameIndex, CommandRecorder& aRecorder, u32 aLightCount)
+{
+	const FrameResources& frame = myFrames[aFrameIndex];
+
+	aRecorder.BindPipeline(VK_PIPELINE_BIND_POINT_COMPUTE, myPipelines.tileCull);
+	aRecorder.BindDescriptorSets(VK_PIPELINE_BIND_POINT_COMPUTE, myPipelineLayouts.tileCull, 0, 1, &frame.tileCullDescriptorSet);
+	aRecorder.PushConstants(myPipelineLayouts.tileCull, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(u32), &aLightCount);
+	// Only tiles inside the rendered extent, deferred.frag indexes them with the same row stride
+	aRecorder.Dispatch((myRenderExtent.width + LightTileSize - 1) / LightTileSize, (myRenderExtent.height + LightTileSize - 1) / LightTileSize, 1);
+
+	VkBufferMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = frame.tileBuffer.buffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+
+	aRecorder.PipelineBarrier(VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void frostwave::Renderer::PrepareClusteredLighting()
+{
+	myLightClusterer.Init(ClusterCountX, ClusterCountY, ClusterCountZ, &myThreadPool);
+
+	for (auto& frame : myFrames)
+	{
+		VkResult result = CreateBuffer(myFramework, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Uniform,
+			&frame.clusterBuffer, myLightClusterer.GetClusterCount() * sizeof(LightClusterer::Cluster));
+		if (result != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to create light cluster buffer!");
+		}
+
+		result = frame.clusterBuffer.Map();
+		if (result != VK_SUCCESS) FATAL_LOG("Failed to map light cluster buffer!");
+
+		ReserveMappedBuffer(frame, frame.clusterIndexBuffer, frame.clusterIndexCapacity, InitialClusterIndexCapacity, sizeof(u32), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+		std::vector<VkWriteDescriptorSet> writeDescriptorSets = {
+			fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8, &frame.clusterBuffer.descriptor),
+			fw::initializers::WriteDescriptorSet(frame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 9, &frame.clusterIndexBuffer.descriptor)
+		};
+
+		vkUpdateDescriptorSets(myFramework->GetDevice(), (u32)writeDescriptorSets.size(), writeDescriptorSets.data(), 0, nullptr);
+	}
+
+	VERBOSE_LOG("Prepared clustered lighting with %ux%ux%u clusters", ClusterCountX, ClusterCountY, ClusterCountZ);
+}
+
+void frostwave::Renderer::UpdateLightClusters(FrameResources& aFrame, const std::vector<PointLight>& aLights, fw::Camera* aCamera)
+{
+	myLightClusterer.Build(aLights, aCamera->GetView(), aCamera->GetProjection());
+
+	const auto& clusters = myLightClusterer.GetClusters();
+	const auto& indices = myLightClusterer.GetLightIndices();
+
+	VkBuffer previous = aFrame.clusterIndexBuffer.buffer;
+	ReserveMappedBuffer(aFrame, aFrame.clusterIndexBuffer, aFrame.clusterIndexCapacity, (u32)indices.size(), sizeof(u32), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+	if (aFrame.clusterIndexBuffer.buffer != previous)
+	{
+		VkWriteDescriptorSet write = fw::initializers::WriteDescriptorSet(aFrame.descriptorSet, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 9, &aFrame.clusterIndexBuffer.descriptor);
+		vkUpdateDescriptorSets(myFramework->GetDevice(), 1, &write, 0, nullptr);
+		++myFramework->GetFrameCounters().descriptorUpdates;
+	}
+
+	// One upload per frame, straight into this frame's mapped buffers
+	memcpy(aFrame.clusterBuffer.mapped, clusters.data(), clusters.size() * sizeof(LightClusterer::Cluster));
+	if (!indices.empty())
+	{
+		memcpy(aFrame.clusterIndexBuffer.mapped, indices.data(), indices.size() * sizeof(u32));
+	}
+}
+
+void frostwave::Renderer::CreateAttachment(VkFormat aFormat, VkImageUsageFlags aUsage, FrameBufferAttachment* aAttachment)
 {
 	VkImageAspectFlags aspectMask = 0;
 	VkImageLayout imageLayout;
@@ -781,12 +2892,8 @@ void frostwave::Renderer::CreateAttachment(VkFormat aFormat, VkImageUsageFlagBit
 	image.arrayLayers = 1;
 	image.samples = VK_SAMPLE_COUNT_1_BIT;
 	image.tiling = VK_IMAGE_TILING_OPTIMAL;
-	image.usage = aUsage | VK_IMAGE_USAGE_SAMPLED_BIT;
-
-	VkMemoryAllocateInfo memAlloc = { };
-	memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-
-	VkMemoryRequirements memReqs;
+	// Transient attachments may not be sampled, they are read as input attachments instead
+	image.usage = (aUsage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) ? aUsage : aUsage | VK_IMAGE_USAGE_SAMPLED_BIT;
 
 	VkResult result = vkCreateImage(myFramework->GetDevice(), &image, nullptr, &aAttachment->image);
 	if (result != VK_SUCCESS)
@@ -794,20 +2901,10 @@ void frostwave::Renderer::CreateAttachment(VkFormat aFormat, VkImageUsageFlagBit
 		FATAL_LOG("Failed to create image for framebuffer attachment!");
 	}
 
-	vkGetImageMemoryRequirements(myFramework->GetDevice(), aAttachment->image, &memReqs);
-	memAlloc.allocationSize = memReqs.size;
-	memAlloc.memoryTypeIndex = FindMemoryType(myFramework->GetPhysicalDevice(), memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	result = vkAllocateMemory(myFramework->GetDevice(), &memAlloc, nullptr, &aAttachment->memory);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to allocate memory for framebuffer attachment!");
-	}
-
-	result = vkBindImageMemory(myFramework->GetDevice(), aAttachment->image, aAttachment->memory, 0);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to bind image memory for framebuffer attachment!");
-	}
+	// Tiled GPUs expose lazily allocated memory that transient attachments only ever touch in tile memory,
+	// everywhere else they stay in plain device local memory
+	const VkMemoryPropertyFlags preferred = (aUsage & VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT) ? VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT : 0;
+	aAttachment->allocation = myFramework->GetAllocator().AllocateImage(aAttachment->image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::RenderTarget, preferred);
 
 	VkImageViewCreateInfo imageView = { };
 	imageView.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -827,28 +2924,39 @@ void frostwave::Renderer::CreateAttachment(VkFormat aFormat, VkImageUsageFlagBit
 	}
 }
 
-void frostwave::Renderer::DestroyOffscreenFrameBuffer()
+std::vector<frostwave::Renderer::FrameBufferAttachment*> frostwave::Renderer::GetGBufferTargets()
 {
-	vkDestroyFramebuffer(myFramework->GetDevice(), myOffscreenFramebuffer.frameBuffer, nullptr);
-	vkDestroyRenderPass(myFramework->GetDevice(), myOffscreenFramebuffer.renderPass, nullptr);
-
-	vkDestroyImageView(myFramework->GetDevice(), myOffscreenFramebuffer.albedo.view, nullptr);
-	vkFreeMemory(myFramework->GetDevice(), myOffscreenFramebuffer.albedo.memory, nullptr);
-	vkDestroyImage(myFramework->GetDevice(), myOffscreenFramebuffer.albedo.image, nullptr);
-
-	vkDestroyImageView(myFramework->GetDevice(), myOffscreenFramebuffer.normal.view, nullptr);
-	vkFreeMemory(myFramework->GetDevice(), myOffscreenFramebuffer.normal.memory, nullptr);
-	vkDestroyImage(myFramework->GetDevice(), myOffscreenFramebuffer.normal.image, nullptr);
+	std::vector<FrameBufferAttachment*> targets;
+	if (!myUseCompactGBuffer)
+	{
+		targets.push_back(&myOffscreenFramebuffer.position);
+	}
+	targets.push_back(&myOffscreenFramebuffer.normal);
+	targets.push_back(&myOffscreenFramebuffer.albedo);
+	targets.push_back(&myOffscreenFramebuffer.material);
+	return targets;
+}
 
-	vkDestroyImageView(myFramework->GetDevice(), myOffscreenFramebuffer.position.view, nullptr);
-	vkFreeMemory(myFramework->GetDevice(), myOffscreenFramebuffer.position.memory, nullptr);
-	vkDestroyImage(myFramework->GetDevice(), myOffscreenFramebuffer.position.image, nullptr);
+void frostwave::Renderer::DestroyOffscreenFrameBuffer()
+{
+	DeletionQueue& deletionQueue = myFramework->GetDeletionQueue();
+	if (myOffscreenFramebuffer.frameBuffer != VK_NULL_HANDLE)
+	{
+		deletionQueue.Retire(myOffscreenFramebuffer.frameBuffer);
+		myOffscreenFramebuffer.frameBuffer = VK_NULL_HANDLE;
+	}
 
-	vkDestroyImageView(myFramework->GetDevice(), myOffscreenFramebuffer.material.view, nullptr);
-	vkFreeMemory(myFramework->GetDevice(), myOffscreenFramebuffer.material.memory, nullptr);
-	vkDestroyImage(myFramework->GetDevice(), myOffscreenFramebuffer.material.image, nullptr);
+	// The compact layout never creates a position target
+	for (FrameBufferAttachment* attachment : { &myOffscreenFramebuffer.position, &myOffscreenFramebuffer.normal, &myOffscreenFramebuffer.albedo, &myOffscreenFramebuffer.material, &myOffscreenFramebuffer.depth })
+	{
+		if (attachment->image == VK_NULL_HANDLE)
+		{
+			continue;
+		}
 
-	vkDestroyImageView(myFramework->GetDevice(), myOffscreenFramebuffer.depth.view, nullptr);
-	vkFreeMemory(myFramework->GetDevice(), myOffscreenFramebuffer.depth.memory, nullptr);
-	vkDestroyImage(myFramework->GetDevice(), myOffscreenFramebuffer.depth.image, nullptr);
+		deletionQueue.Retire(attachment->view);
+		deletionQueue.Retire(attachment->image);
+		deletionQueue.Retire(attachment->allocation);
+		*attachment = { };
+	}
 }
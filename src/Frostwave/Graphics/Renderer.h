@@ -6,6 +6,12 @@
 #include <Frostwave/Graphics/Model.h>
 #include <Frostwave/Core/Timer.h>
 #include <Frostwave/Graphics/Lights.h>
+#include <Frostwave/Graphics/LightClusterer.h>
+#include <Frostwave/Graphics/CommandRecorder.h>
+#include <Frostwave/Graphics/GpuTimer.h>
+#include <Frostwave/Graphics/FrameCounters.h>
+#include <Frostwave/Graphics/ResolutionController.h>
+#include <Frostwave/ThreadPool.h>
 
 #include <vulkan/vulkan.h>
 #include <vector>
@@ -20,14 +26,93 @@ namespace frostwave
 
 	struct UniformBufferObjectFullscreen
 	{
-		fw::Vec4f cameraPos;
+		alignas(16) fw::Vec4f cameraPos;
+		alignas(16) fw::Mat4f view;
+		alignas(16) fw::Mat4f invViewProjection;
+		alignas(16) fw::Vec4f clusterParams;
+		alignas(16) fw::Vec4f gBufferSize; // xy = attachment size, zw = the part of it rendered this frame
 	};
 
 	class ModelInstance;
 	class VkFramework;
 	class Renderer
 	{
+		struct RecordingThread
+		{
+			VkCommandPool commandPool;
+			VkCommandBuffer commandBuffer;
+			VkCommandBuffer depthCommandBuffer;
+			CommandRecorder recorder;
+			CommandRecorder depthRecorder;
+		};
+
+		struct InstanceBatch
+		{
+			const Model* model;
+			u32 firstInstance;
+			u32 instanceCount;
+		};
+
+		// A recorded lighting pass and what it was recorded for
+		struct DeferredCommands
+		{
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			bool dirty = true;
+			u32 lightCount = 0;
+			std::vector<VkRect2D> lightScissors;
+			CommandRecorder::Stats stats;
+		};
+
+		// Everything the CPU writes while building a frame, one per frame in flight
+		struct FrameResources
+		{
+			std::vector<RecordingThread> recordingThreads;
+			std::vector<VkCommandBuffer> secondaryCommandBuffers;
+			// The lighting pass submitted this frame, one of deferredCommands
+			VkCommandBuffer deferredCommandBuffer = VK_NULL_HANDLE;
+			// Recorded once: query reset plus the frame's first timestamp, and its last timestamp
+			VkCommandBuffer timestampBeginCommandBuffer = VK_NULL_HANDLE;
+			VkCommandBuffer timestampEndCommandBuffer = VK_NULL_HANDLE;
+			VkSemaphore offscreenSemaphore = VK_NULL_HANDLE;
+			VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+
+			Buffer fullscreenUBO;
+			Buffer instanceBuffer;
+			u32 instanceCapacity = 0;
+			Buffer indirectBuffer;
+			u32 indirectCapacity = 0;
+			Buffer lightBuffer;
+			u32 lightCapacity = 0;
+
+			Buffer tileBuffer;
+			VkDescriptorSet tileCullDescriptorSet = VK_NULL_HANDLE;
+
+			Buffer clusterBuffer;
+			Buffer clusterIndexBuffer;
+			u32 clusterIndexCapacity = 0;
+
+			// Recorded command buffers are reused until the submission structure changes
+			bool commandBuffersDirty = true;
+			std::vector<InstanceBatch> cachedBatches;
+			// Lighting begins its pass on the acquired swapchain framebuffer, so every image keeps a recording of its own
+			std::vector<DeferredCommands> deferredCommands;
+			// What the cached command buffers issue, replayed into the frame counters every time they are submitted
+			CommandRecorder::Stats gBufferStats;
+			CommandRecorder::Stats deferredStats;
+			// Scale the frame was last submitted at, to pair with its GPU time once the fence signals
+			f32 renderScale = 0.0f;
+		};
+
 	public:
+		// Per submitted frame, a hit when all of its command buffers were reused
+		struct CommandBufferCacheStats
+		{
+			u64 hits = 0;
+			u64 misses = 0;
+
+			f32 HitRate() const { return hits + misses > 0 ? (f32)hits / (f32)(hits + misses) : 0.0f; }
+		};
+
 		Renderer();
 		~Renderer();
 
@@ -38,39 +123,106 @@ namespace frostwave
 		fw::Buffer* GetUBO();
 
 		const VkDescriptorSetLayout& GetDescriptorSetLayout() const;
+		fw::ThreadPool* GetThreadPool();
+
+		// Lays down depth with a position only pass first, so the G-buffer pass only shades visible fragments
+		void SetDepthPrepass(bool aEnabled);
+		bool GetDepthPrepass() const;
+
+		const CommandBufferCacheStats& GetCommandBufferCacheStats() const;
+		// Bind calls issued versus dropped as redundant, summed over every command buffer recorded so far
+		const CommandRecorder::Stats& GetCommandRecorderStats() const;
+		// Binds the G-buffer pass of the last submitted frame issued, pre-pass included
+		u32 GetGBufferBinds() const;
+		// Per pass GPU milliseconds, trailing the current frame by the number of frames in flight
+		const GpuTimer& GetGpuTimer() const;
+		// Work issued by the last presented frame
+		const FrameCounters& GetFrameCounters() const;
+		// Per axis fraction of the swapchain the G-buffer and lighting render at, always 1 without dynamic resolution
+		f32 GetRenderScale() const;
+		VkExtent2D GetRenderExtent() const;
 
 	private:
 		void Resize();
 		void PrepareOffscreenFramebuffer();
+		void CreateGBufferAttachments();
+		void CreateOffscreenFramebuffer();
+		void CreateSampler();
 		void CreatePoolAndBuffers();
+		void CreateRecordingThreads();
+		void CreateTimestampCommandBuffers();
+		// Both return true when they had to record instead of reusing the cached command buffers
+		bool RefreshGBufferCommandBuffers(u32 aFrameIndex, const VkCommandBufferInheritanceInfo& aInheritanceInfo);
+		void RecordGBufferCommandBuffers(u32 aFrameIndex, const VkCommandBufferInheritanceInfo& aInheritanceInfo);
+		bool MatchesCachedBatches(const FrameResources& aFrame) const;
+		void CountFrame(const FrameResources& aFrame, bool aRecorded);
+		// Consecutive batches sharing a material or a mesh, which a single secondary binds once
+		bool SharesState(const InstanceBatch& aFirst, const InstanceBatch& aSecond) const;
+		void UpdateLightingData(FrameResources& aFrame, const std::vector<PointLight>& aLights, fw::Camera* aCamera);
+		void UpdateLights(FrameResources& aFrame, const std::vector<PointLight>& aLights);
+		void UpdateLightScissors(const std::vector<PointLight>& aLights, fw::Camera* aCamera);
+		bool MatchesCachedScissors(const std::vector<VkRect2D>& aCached) const;
+		void RecordBatches(u32 aFrameIndex, VkCommandBuffer aCommandBuffer, CommandRecorder& aRecorder, bool aDepthOnly, u32 aBegin, u32 aEnd, const VkCommandBufferInheritanceInfo& aInheritanceInfo);
+		void BuildInstanceBatches(FrameResources& aFrame, const std::vector<ModelInstance*>& aModels);
+		void ReserveMappedBuffer(FrameResources& aFrame, Buffer& aBuffer, u32& aCapacity, u32 aCount, VkDeviceSize aStride, VkBufferUsageFlags aUsage);
 		void SetupDescriptorSetLayout();
 		void PreparePipelines();
 		void GenerateQuad();
+		void GenerateSphere();
+		void PrepareLightVolumes();
+		void CreateLightVolumeFramebuffers();
+		void DestroyLightVolumeFramebuffers();
+		void PrepareDeferredPass();
+		void CreateDeferredPassFramebuffers();
+		void DestroyDeferredPassFramebuffers();
 		void SetupDescriptorSet();
+		void RetireDescriptorSets();
 		void PrepareUniformBuffers();
-		void BuildDeferredCommandBuffers(VkFramebuffer aFramebuffer, Camera* aCamera, const std::vector<PointLight>& aLights);
+		bool RefreshDeferredCommandBuffer(u32 aFrameIndex, u32 aImageIndex, VkFramebuffer aFramebuffer, u32 aLightCount);
+		void BuildDeferredCommandBuffers(u32 aFrameIndex, VkFramebuffer aFramebuffer, u32 aLightCount);
+		void PrepareTiledLighting();
+		void CreateTileBuffers();
+		void SetupTileCullDescriptorSets();
+		void RecordLightCulling(u32 aFrameIndex, CommandRecorder& aRecorder, u32 aLightCount);
+		void PrepareClusteredLighting();
+		void UpdateLightClusters(FrameResources& aFrame, const std::vector<PointLight>& aLights, fw::Camera* aCamera);
 		void SetupDescriptorPool();
+		void UpdateRenderExtent(FrameResources& aFrame);
+		void PrepareUpscalePass();
+		void CreateUpscaleTarget();
+		void DestroyUpscaleTarget();
+		void PrepareUpscalePipeline();
+		void SetupUpscaleDescriptorSet();
+		void RecordUpscale(u32 aFrameIndex, CommandRecorder& aRecorder, VkFramebuffer aFramebuffer);
+		void DestroyUpscalePass();
 		
 		struct PipelineLayouts
 		{
-			VkPipelineLayout forward, offscreen, deferred;
+			VkPipelineLayout forward, offscreen, deferred, tileCull, upscale;
 		} myPipelineLayouts;
 
 		struct {
 			VkPipeline forward;
 			VkPipeline deferred;
 			VkPipeline offscreen;
+			VkPipeline offscreenEqual;
+			VkPipeline depthPrepass;
+			VkPipeline tiled;
+			VkPipeline tileCull;
+			VkPipeline clustered;
+			VkPipeline lightVolume;
+			VkPipeline upscale;
 		} myPipelines;
 
 		struct FrameBufferAttachment
 		{
 			VkImage image;
-			VkDeviceMemory memory;
+			MemoryAllocation* allocation;
 			VkImageView view;
 			VkFormat format;
 		};
 
-		void CreateAttachment(VkFormat aFormat, VkImageUsageFlagBits aUsage, FrameBufferAttachment* aAttachment);
+		void CreateAttachment(VkFormat aFormat, VkImageUsageFlags aUsage, FrameBufferAttachment* aAttachment);
 
 		struct FrameBuffer
 		{
@@ -78,30 +230,90 @@ namespace frostwave
 			VkFramebuffer frameBuffer;
 			FrameBufferAttachment position, normal, albedo, material;
 			FrameBufferAttachment depth;
+			u32 colorAttachmentCount;
 			VkRenderPass renderPass;
 		} myOffscreenFramebuffer;
 
+		// Destroys the G-buffer targets and framebuffer, the render pass outlives them
 		void DestroyOffscreenFrameBuffer();
+		// Color targets in mrt.frag output order
+		std::vector<FrameBufferAttachment*> GetGBufferTargets();
 
-		VkDescriptorSet myDescriptorSet;
 		VkDescriptorSetLayout myDescriptorSetLayout;
+		VkDescriptorSetLayout myTileCullDescriptorSetLayout;
 		VkSampler myColorSampler;
 
 		Model myQuad;
+		Model mySphere;
+
+		// Lighting pass that depth tests light volumes against the G-buffer depth, one framebuffer per swapchain image
+		struct
+		{
+			VkRenderPass renderPass = VK_NULL_HANDLE;
+			std::vector<VkFramebuffer> framebuffers;
+			VkExtent2D extent = { };
+		} myLightVolumePass;
+
+		// G-buffer fill as subpass 0 and lighting as subpass 1 reading it through input attachments, one framebuffer per swapchain image
+		struct
+		{
+			VkRenderPass renderPass = VK_NULL_HANDLE;
+			std::vector<VkFramebuffer> framebuffers;
+			VkExtent2D extent = { };
+			VkDescriptorSetLayout inputSetLayout = VK_NULL_HANDLE;
+			VkDescriptorSet inputSet = VK_NULL_HANDLE;
+		} myDeferredPass;
+
+		// Dynamic resolution: lighting renders into a scene color target the size of the G-buffer, through a viewport covering
+		// myRenderExtent of it, and the upscale draw stretches that region over the swapchain image
+		struct
+		{
+			VkRenderPass renderPass = VK_NULL_HANDLE;
+			VkFramebuffer framebuffer = VK_NULL_HANDLE;
+			FrameBufferAttachment color = { };
+			VkSampler sampler = VK_NULL_HANDLE;
+			VkDescriptorSetLayout setLayout = VK_NULL_HANDLE;
+			VkDescriptorSet set = VK_NULL_HANDLE;
+		} myUpscalePass;
 
-		VkSemaphore myOffscreenSemaphore;
 		VkDescriptorPool myDescriptorPool;
 		VkCommandPool myCommandPool;
 		VkFramework* myFramework;
-		std::vector<VkCommandBuffer> myCommandBuffers;
-		VkCommandBuffer myDeferredCommandBuffer;
+		std::vector<FrameResources> myFrames;
+		fw::ThreadPool myThreadPool;
 		fw::Timer myTimer;
 
 		struct
 		{
 			Buffer offscreen;
-			Buffer fullscreen;
 		} myUniformBuffers;
+		u32 myUBOStride;
+		// Bound to the tile and cluster bindings of the deferred set when their lighting mode is off, so every binding is valid
+		Buffer myDummyStorageBuffer;
+
+		std::vector<InstanceBatch> myInstanceBatches;
+		bool myUseIndirectDraw;
+		bool myUseTiledLighting;
+		bool myUseClusteredLighting;
+		bool myUseLightVolumes;
+		bool myUseLightScissors;
+		bool myUseCompactGBuffer;
+		bool myUseSubpasses;
+		bool myUseDepthPrepass;
+		bool myUseDynamicResolution;
+		ResolutionController myResolutionController;
+		VkExtent2D myRenderExtent;
+		std::vector<VkRect2D> myLightScissors;
+		u32 myTileCountX, myTileCountY;
+		LightClusterer myLightClusterer;
+
+		CommandBufferCacheStats myCacheStats;
+		u32 myGBufferBinds;
+		// Defragmenter moves seen so far, cached command buffers name the handles from before the latest one
+		u64 myDefragmenterMoveCount;
+		CommandRecorder::Stats myRecorderStats;
+		CommandRecorder myDeferredRecorder;
+		GpuTimer myGpuTimer;
 
 		UniformBufferObject myUBO;
 		UniformBufferObjectFullscreen myUBOFullscreen;
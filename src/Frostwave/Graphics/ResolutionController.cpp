@@ -0,0 +1,76 @@
+#include "stdafx.h"
+#include "ResolutionController.h"
+
+#include <Frostwave/Core/Common.h>
+
+#include <cmath>
+
+// Weight of a new sample once it is cheaper than the running cost
+constexpr f32 CostSmoothing = 0.1f;
+
+frostwave::ResolutionController::ResolutionController() : myBudget(0.0f), myMinScale(1.0f), myMaxScale(1.0f), myScale(1.0f), myCost(0.0f), myFramesWithHeadroom(0)
+{
+}
+
+frostwave::ResolutionController::~ResolutionController()
+{
+}
+
+void frostwave::ResolutionController::Init(f32 aBudget, f32 aMinScale, f32 aMaxScale)
+{
+	myBudget = fw::Max(aBudget, 0.1f);
+	myMaxScale = fw::Clamp(aMaxScale, ScaleStep, 1.0f);
+	myMinScale = fw::Clamp(aMinScale, ScaleStep, myMaxScale);
+	myScale = myMaxScale;
+	myCost = 0.0f;
+	myFramesWithHeadroom = 0;
+}
+
+void frostwave::ResolutionController::Update(f32 aTime, f32 aScale)
+{
+	// Frames without a timestamp result report zero
+	if (aTime <= 0.0f || aScale <= 0.0f)
+	{
+		return;
+	}
+
+	// Spikes are taken in full so the next frame already drops, improvements have to persist before they count
+	f32 cost = aTime / (aScale * aScale);
+	myCost = (myCost <= 0.0f || cost > myCost) ? cost : fw::Lerp(myCost, cost, CostSmoothing);
+
+	f32 target = Quantize(std::sqrt(myBudget * Headroom / myCost));
+	if (target < myScale)
+	{
+		myScale = target;
+		myFramesWithHeadroom = 0;
+	}
+	else if (target > myScale)
+	{
+		if (++myFramesWithHeadroom >= RaiseDelay)
+		{
+			myScale = Quantize(fw::Min(target, myScale + MaxRaise));
+			myFramesWithHeadroom = 0;
+		}
+	}
+	else
+	{
+		myFramesWithHeadroom = 0;
+	}
+}
+
+f32 frostwave::ResolutionController::GetScale() const
+{
+	return myScale;
+}
+
+f32 frostwave::ResolutionController::GetBudget() const
+{
+	return myBudget;
+}
+
+f32 frostwave::ResolutionController::Quantize(f32 aScale) const
+{
+	// Rounds down so the step never overshoots the budget, and coarse steps keep command buffer re-recording rare
+	f32 steps = std::floor(aScale / ScaleStep + 0.001f);
+	return fw::Clamp(steps * ScaleStep, myMinScale, myMaxScale);
+}
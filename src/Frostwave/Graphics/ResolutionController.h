@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Frostwave/Core/Types.h>
+
+namespace frostwave
+{
+	// Picks the render scale that keeps GPU frame time inside a budget. Cost is assumed to grow with the pixel count,
+	// so a frame at scale s taking t ms predicts t / s^2 at full resolution. Over budget drops straight to the predicted scale,
+	// headroom only raises it after a run of frames and by a bounded step, so it doesn't oscillate.
+	// Has no Vulkan dependency so it can be driven by any timer.
+	class ResolutionController
+	{
+	public:
+		ResolutionController();
+		~ResolutionController();
+
+		void Init(f32 aBudget, f32 aMinScale, f32 aMaxScale = 1.0f);
+
+		// aTime is the GPU milliseconds of a finished frame and aScale the scale that frame was rendered at,
+		// which lags GetScale by the frames in flight
+		void Update(f32 aTime, f32 aScale);
+
+		// Per axis, always a multiple of ScaleStep inside [min, max]
+		f32 GetScale() const;
+		f32 GetBudget() const;
+
+		static constexpr f32 ScaleStep = 0.05f;
+		// Fraction of the budget aimed for, leaving room for frame to frame noise
+		static constexpr f32 Headroom = 0.9f;
+		// Frames with room to spare before the scale goes up
+		static constexpr u32 RaiseDelay = 30;
+		static constexpr f32 MaxRaise = 0.1f;
+
+	private:
+		f32 Quantize(f32 aScale) const;
+
+		f32 myBudget;
+		f32 myMinScale;
+		f32 myMaxScale;
+		f32 myScale;
+		// Smoothed full resolution cost in milliseconds
+		f32 myCost;
+		u32 myFramesWithHeadroom;
+	};
+}
+namespace fw = frostwave;
@@ -5,8 +5,20 @@
 #include "Model.h"
 
 #include <Frostwave/Graphics/Camera.h>
+#include <Frostwave/Graphics/ModelInstance.h>
 
-frostwave::Scene::Scene()
+#include <chrono>
+
+// Draw sort key, most significant first: pipeline (8) | material (16) | mesh (16) | view depth (24).
+// Equal state ends up adjacent, and within it draws go front to back for early depth rejection
+constexpr u32 SortDepthBits = 24;
+constexpr u32 SortMeshShift = 24;
+constexpr u32 SortMaterialShift = 40;
+constexpr u32 SortPipelineShift = 56;
+constexpr u64 SortDepthMask = (1ull << SortDepthBits) - 1;
+constexpr u64 SortIdMask = 0xffff;
+
+frostwave::Scene::Scene() : mySortFrame(0), myUseDepthPrepass(false)
 {
 
 }
@@ -28,12 +40,121 @@ void frostwave::Scene::Submit(PointLight aLight)
 
 void frostwave::Scene::Render(Renderer* aRenderer, fw::Camera* aCamera)
 {
-	aRenderer->Render(myModels, myLights, aCamera);
+	SortModels(aCamera, aRenderer->GetThreadPool());
+	aRenderer->SetDepthPrepass(myUseDepthPrepass);
+	aRenderer->Render(mySortedModels, myLights, aCamera);
+	mySortStats.sortedBinds = aRenderer->GetGBufferBinds();
 	myModels.clear();
 	myLights.clear();
 }
 
+void frostwave::Scene::SortModels(fw::Camera* aCamera, ThreadPool* aThreadPool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+
+	if (!BuildSortKeys(aCamera))
+	{
+		myMaterialIds.clear();
+		myMeshIds.clear();
+		BuildSortKeys(aCamera);
+	}
+
+	// Both passes bind the same state per batch
+	mySortStats.submissions = (u32)mySortItems.size();
+	mySortStats.unsortedBinds = CountBinds() * (myUseDepthPrepass ? 2 : 1);
+
+	RadixSort(mySortItems, mySortScratch, aThreadPool);
+
+	mySortedModels.resize(mySortItems.size());
+	for (u32 i = 0; i < (u32)mySortItems.size(); ++i)
+	{
+		mySortedModels[i] = myModels[mySortItems[i].value];
+	}
+
+	mySortStats.sortTime = std::chrono::duration<f32, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+bool frostwave::Scene::BuildSortKeys(fw::Camera* aCamera)
+{
+	++mySortFrame;
+
+	const fw::Mat4f& view = aCamera->GetView();
+	const f32 nearZ = aCamera->GetNearZ();
+	const f32 depthScale = (f32)SortDepthMask / (aCamera->GetFarZ() - nearZ);
+
+	u32 materialsUsed = 0;
+	u32 meshesUsed = 0;
+
+	mySortItems.resize(myModels.size());
+	for (u32 i = 0; i < (u32)myModels.size(); ++i)
+	{
+		const Model* model = myModels[i]->GetModel();
+
+		// Every submission goes through the G-buffer pipeline for now, so its field is always zero
+		u64 pipeline = 0;
+		u64 material = GetSortId(myMaterialIds, (u64)model->GetDescriptorSet(), materialsUsed);
+		u64 mesh = GetSortId(myMeshIds, (u64)model->GetVertexBuffer().buffer, meshesUsed);
+
+		f32 viewZ = (fw::Vec4f(myModels[i]->GetPosition(), 1.0f) * view).z;
+		u64 depth = (u64)fw::Clamp((viewZ - nearZ) * depthScale, 0.0f, (f32)SortDepthMask);
+
+		mySortItems[i].key = (pipeline << SortPipelineShift) | (material << SortMaterialShift) | (mesh << SortMeshShift) | depth;
+		mySortItems[i].value = i;
+	}
+
+	return materialsUsed == (u32)myMaterialIds.size() && meshesUsed == (u32)myMeshIds.size();
+}
+
+u32 frostwave::Scene::CountBinds() const
+{
+	u32 binds = 0;
+	for (u32 i = 0; i < (u32)mySortItems.size(); ++i)
+	{
+		// The first draw binds everything
+		u64 previous = i > 0 ? mySortItems[i - 1].key : ~mySortItems[i].key;
+		u64 current = mySortItems[i].key;
+
+		binds += ((previous >> SortPipelineShift) != (current >> SortPipelineShift)) ? 1 : 0;
+		binds += (((previous >> SortMaterialShift) ^ (current >> SortMaterialShift)) & SortIdMask) != 0 ? 1 : 0;
+		// Vertex and index buffer
+		binds += (((previous >> SortMeshShift) ^ (current >> SortMeshShift)) & SortIdMask) != 0 ? 2 : 0;
+	}
+	return binds;
+}
+
+u64 frostwave::Scene::GetSortId(std::unordered_map<u64, SortId>& aIds, u64 aHandle, u32& aUsed)
+{
+	// Past 16 bits ids alias, which only costs some grouping
+	auto it = aIds.find(aHandle);
+	if (it == aIds.end())
+	{
+		it = aIds.emplace(aHandle, SortId{ (u64)aIds.size() & SortIdMask, 0 }).first;
+	}
+
+	if (it->second.frame != mySortFrame)
+	{
+		it->second.frame = mySortFrame;
+		++aUsed;
+	}
+	return it->second.id;
+}
+
 const std::vector<fw::ModelInstance*>& frostwave::Scene::GetModels() const
 {
 	return myModels;
 }
+
+const frostwave::Scene::SortStats& frostwave::Scene::GetSortStats() const
+{
+	return mySortStats;
+}
+
+void frostwave::Scene::SetDepthPrepass(bool aEnabled)
+{
+	myUseDepthPrepass = aEnabled;
+}
+
+bool frostwave::Scene::GetDepthPrepass() const
+{
+	return myUseDepthPrepass;
+}
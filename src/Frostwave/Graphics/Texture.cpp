@@ -23,7 +23,7 @@ void frostwave::Texture::Destroy()
 	{
 		vkDestroySampler(myFramework->GetDevice(), mySampler, nullptr);
 	}
-	vkFreeMemory(myFramework->GetDevice(), myDeviceMemory, nullptr);
+	myFramework->GetAllocator().Free(myAllocation);
 }
 
 VkImageView frostwave::Texture::GetView()
@@ -63,51 +63,10 @@ void frostwave::Texture2D::Load(const string& aFilename, VkFormat aFormat, const
 	VkFormatProperties formatProperties;
 	vkGetPhysicalDeviceFormatProperties(myFramework->GetPhysicalDevice(), aFormat, &formatProperties);
 
-	VkMemoryAllocateInfo memAllocInfo = { };
-	memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	VkMemoryRequirements memReqs;
-
-	VkCommandBuffer copyCmd = BeginSingleTimeCommands(myFramework);
-
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingMemory;
-
-	VkBufferCreateInfo bufferCreateInfo = { };
-	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bufferCreateInfo.size = tex2D.size();
-	bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-	VkResult result = vkCreateBuffer(myFramework->GetDevice(), &bufferCreateInfo, nullptr, &stagingBuffer);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to begin command buffer!");
-	}
-
-	vkGetBufferMemoryRequirements(myFramework->GetDevice(), stagingBuffer, &memReqs);
-
-	memAllocInfo.allocationSize = memReqs.size;
-	memAllocInfo.memoryTypeIndex = FindMemoryType(myFramework->GetPhysicalDevice(), memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	result = vkAllocateMemory(myFramework->GetDevice(), &memAllocInfo, nullptr, &stagingMemory);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to allocate memory for staging buffer!");
-	}
-	result = vkBindBufferMemory(myFramework->GetDevice(), stagingBuffer, stagingMemory, 0);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to bind buffer memory");
-	}
-
-	void* data;
-	result = vkMapMemory(myFramework->GetDevice(), stagingMemory, 0, memReqs.size, 0, &data);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to map memory for staging buffer!");
-	}
-	memcpy(data, tex2D.data(), tex2D.size());
-	vkUnmapMemory(myFramework->GetDevice(), stagingMemory);
+	UploadContext& uploadContext = myFramework->GetUploadContext();
+	StagingAllocation staging = uploadContext.AllocateStaging(tex2D.size());
+	memcpy(staging.data, tex2D.data(), tex2D.size());
+	VkCommandBuffer copyCmd = uploadContext.GetTransferCommandBuffer();
 
 	std::vector<VkBufferImageCopy> copyRegions;
 	u32 offset = 0;
@@ -122,7 +81,7 @@ void frostwave::Texture2D::Load(const string& aFilename, VkFormat aFormat, const
 		copyRegion.imageExtent.width = (u32)tex2D[i].extent().x;
 		copyRegion.imageExtent.height = (u32)tex2D[i].extent().y;
 		copyRegion.imageExtent.depth = 1;
-		copyRegion.bufferOffset = offset;
+		copyRegion.bufferOffset = staging.offset + offset;
 
 		copyRegions.push_back(copyRegion);
 
@@ -145,27 +104,13 @@ void frostwave::Texture2D::Load(const string& aFilename, VkFormat aFormat, const
 		imageCreateInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 	}
 
-	result = vkCreateImage(myFramework->GetDevice(), &imageCreateInfo, nullptr, &myImage);
+	VkResult result = vkCreateImage(myFramework->GetDevice(), &imageCreateInfo, nullptr, &myImage);
 	if (result != VK_SUCCESS)
 	{
 		FATAL_LOG("Failed to create image!");
 	}
 
-	vkGetImageMemoryRequirements(myFramework->GetDevice(), myImage, &memReqs);
-
-	memAllocInfo.allocationSize = memReqs.size;
-	memAllocInfo.memoryTypeIndex = FindMemoryType(myFramework->GetPhysicalDevice(), memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	result = vkAllocateMemory(myFramework->GetDevice(), &memAllocInfo, nullptr, &myDeviceMemory);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to allocate memory for buffer!");
-	}
-
-	result = vkBindImageMemory(myFramework->GetDevice(), myImage, myDeviceMemory, 0);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to bind image memory!");
-	}
+	myAllocation = myFramework->GetAllocator().AllocateImage(myImage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Texture);
 
 	VkImageSubresourceRange subresourceRange = { };
 	subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -175,12 +120,8 @@ void frostwave::Texture2D::Load(const string& aFilename, VkFormat aFormat, const
 
 	myImageLayout = aImageLayout;
 	TransitionImageLayout(copyCmd, myImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
-	vkCmdCopyBufferToImage(copyCmd, stagingBuffer, myImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (u32)copyRegions.size(), copyRegions.data());
-	TransitionImageLayout(copyCmd, myImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, myImageLayout, subresourceRange);
-
-	EndSingleTimeCommands(copyCmd, myFramework);
-	vkDestroyBuffer(myFramework->GetDevice(), stagingBuffer, nullptr);
-	vkFreeMemory(myFramework->GetDevice(), stagingMemory, nullptr);
+	vkCmdCopyBufferToImage(copyCmd, staging.buffer, myImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (u32)copyRegions.size(), copyRegions.data());
+	uploadContext.ReleaseToGraphics(myImage, subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, myImageLayout, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_SHADER_READ_BIT);
 
 	VkSamplerCreateInfo samplerCreateInfo = { };
 	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -230,51 +171,10 @@ void frostwave::Texture2D::FromBuffer(void* aBuffer, VkDeviceSize aBufferSize, V
 	myHeight = aTexHeight;
 	myMipLevels = 1;
 
-	VkMemoryAllocateInfo memAllocInfo = { };
-	memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	VkMemoryRequirements memReqs;
-
-	VkCommandBuffer copyCmd = BeginSingleTimeCommands(myFramework);
-
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingMemory;
-
-	VkBufferCreateInfo bufferCreateInfo = { };
-	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bufferCreateInfo.size = aBufferSize;
-	bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-	bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-	VkResult result = vkCreateBuffer(myFramework->GetDevice(), &bufferCreateInfo, nullptr, &stagingBuffer);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to begin command buffer!");
-	}
-
-	vkGetBufferMemoryRequirements(myFramework->GetDevice(), stagingBuffer, &memReqs);
-
-	memAllocInfo.allocationSize = memReqs.size;
-	memAllocInfo.memoryTypeIndex = FindMemoryType(myFramework->GetPhysicalDevice(), memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-	result = vkAllocateMemory(myFramework->GetDevice(), &memAllocInfo, nullptr, &stagingMemory);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to allocate memory for staging buffer!");
-	}
-	result = vkBindBufferMemory(myFramework->GetDevice(), stagingBuffer, stagingMemory, 0);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to bind buffer memory");
-	}
-
-	void* data;
-	result = vkMapMemory(myFramework->GetDevice(), stagingMemory, 0, memReqs.size, 0, &data);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to map memory for staging buffer!");
-	}
-	memcpy(data, aBuffer, aBufferSize);
-	vkUnmapMemory(myFramework->GetDevice(), stagingMemory);
+	UploadContext& uploadContext = myFramework->GetUploadContext();
+	StagingAllocation staging = uploadContext.AllocateStaging(aBufferSize);
+	memcpy(staging.data, aBuffer, aBufferSize);
+	VkCommandBuffer copyCmd = uploadContext.GetTransferCommandBuffer();
 
 	VkBufferImageCopy copyRegion = {};
 	copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -284,7 +184,7 @@ void frostwave::Texture2D::FromBuffer(void* aBuffer, VkDeviceSize aBufferSize, V
 	copyRegion.imageExtent.width = myWidth;
 	copyRegion.imageExtent.height = myHeight;
 	copyRegion.imageExtent.depth = 1;
-	copyRegion.bufferOffset = 0;
+	copyRegion.bufferOffset = staging.offset;
 
 	VkImageCreateInfo imageCreateInfo = { };
 	imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -303,27 +203,13 @@ void frostwave::Texture2D::FromBuffer(void* aBuffer, VkDeviceSize aBufferSize, V
 		imageCreateInfo.usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 	}
 
-	result = vkCreateImage(myFramework->GetDevice(), &imageCreateInfo, nullptr, &myImage);
+	VkResult result = vkCreateImage(myFramework->GetDevice(), &imageCreateInfo, nullptr, &myImage);
 	if (result != VK_SUCCESS)
 	{
 		FATAL_LOG("Failed to create image!");
 	}
 
-	vkGetImageMemoryRequirements(myFramework->GetDevice(), myImage, &memReqs);
-
-	memAllocInfo.allocationSize = memReqs.size;
-	memAllocInfo.memoryTypeIndex = FindMemoryType(myFramework->GetPhysicalDevice(), memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-	result = vkAllocateMemory(myFramework->GetDevice(), &memAllocInfo, nullptr, &myDeviceMemory);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to allocate memory for buffer!");
-	}
-
-	result = vkBindImageMemory(myFramework->GetDevice(), myImage, myDeviceMemory, 0);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to bind image memory!");
-	}
+	myAllocation = myFramework->GetAllocator().AllocateImage(myImage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::Texture);
 
 	VkImageSubresourceRange subresourceRange = {};
 	subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -333,12 +219,8 @@ void frostwave::Texture2D::FromBuffer(void* aBuffer, VkDeviceSize aBufferSize, V
 
 	myImageLayout = aImageLayout;
 	TransitionImageLayout(copyCmd, myImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, subresourceRange);
-	vkCmdCopyBufferToImage(copyCmd, stagingBuffer, myImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-	TransitionImageLayout(copyCmd, myImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, myImageLayout, subresourceRange);
-
-	EndSingleTimeCommands(copyCmd, myFramework);
-	vkDestroyBuffer(myFramework->GetDevice(), stagingBuffer, nullptr);
-	vkFreeMemory(myFramework->GetDevice(), stagingMemory, nullptr);
+	vkCmdCopyBufferToImage(copyCmd, staging.buffer, myImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+	uploadContext.ReleaseToGraphics(myImage, subresourceRange, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, myImageLayout, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_SHADER_READ_BIT);
 
 	VkSamplerCreateInfo samplerCreateInfo = {};
 	samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
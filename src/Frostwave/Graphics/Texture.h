@@ -7,6 +7,7 @@
 namespace frostwave
 {
 	class VkFramework;
+	struct MemoryAllocation;
 	class Texture
 	{
 	public:
@@ -23,7 +24,7 @@ namespace frostwave
 		const VkFramework* myFramework;
 		VkImage myImage;
 		VkImageLayout myImageLayout;
-		VkDeviceMemory myDeviceMemory;
+		MemoryAllocation* myAllocation;
 		VkImageView myView;
 		u32 myWidth, myHeight;
 		u32 myMipLevels;
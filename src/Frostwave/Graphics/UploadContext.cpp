@@ -0,0 +1,507 @@
+#include "stdafx.h"
+#include "UploadContext.h"
+#include "VulkanBuffer.h"
+
+#include <Frostwave/Debug/Logger.h>
+
+frostwave::UploadContext::UploadContext() : myDevice(VK_NULL_HANDLE), myAllocator(nullptr), myQueue(VK_NULL_HANDLE), myTransferQueue(VK_NULL_HANDLE), myQueueFamily(0), myTransferFamily(0),
+	myCommandPool(VK_NULL_HANDLE), myTransferPool(VK_NULL_HANDLE), myIsOpen(false), myNextTicket(1), myCompletedTicket(0),
+	myStagingBuffer(VK_NULL_HANDLE), myStagingAllocation(nullptr), myStagingData(nullptr), myStagingSize(0), myStagingHead(0), myStagingTail(0)
+{
+}
+
+frostwave::UploadContext::~UploadContext()
+{
+}
+
+void frostwave::UploadContext::Init(VkDevice aDevice, VkQueue aGraphicsQueue, u32 aGraphicsFamily, VkQueue aTransferQueue, u32 aTransferFamily)
+{
+	myDevice = aDevice;
+	myQueue = aGraphicsQueue;
+	myQueueFamily = aGraphicsFamily;
+	myTransferQueue = aTransferQueue;
+	myTransferFamily = aTransferFamily;
+
+	myCommandPool = CreatePool(myQueueFamily);
+	if (HasTransferQueue())
+	{
+		myTransferPool = CreatePool(myTransferFamily);
+	}
+}
+
+void frostwave::UploadContext::CreateStagingRing(MemoryAllocator* aAllocator, VkDeviceSize aSize)
+{
+	myAllocator = aAllocator;
+	if (aSize == 0)
+	{
+		return;
+	}
+
+	VkBufferCreateInfo bufferInfo = { };
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = aSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(myDevice, &bufferInfo, nullptr, &myStagingBuffer) != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create staging ring!");
+	}
+
+	// Host visible memory stays mapped by the allocator
+	myStagingAllocation = myAllocator->AllocateBuffer(myStagingBuffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Staging);
+	myStagingData = myStagingAllocation->mapped;
+	myStagingSize = aSize;
+	myStagingHead = 0;
+	myStagingTail = 0;
+}
+
+void frostwave::UploadContext::Destroy()
+{
+	if (myCommandPool == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	if (myIsOpen)
+	{
+		WARNING_LOG("Upload batch %llu was recorded but never submitted", myOpenBatch.ticket);
+		vkEndCommandBuffer(myOpenBatch.commandBuffer);
+		if (myOpenBatch.transferCommandBuffer != VK_NULL_HANDLE)
+		{
+			vkEndCommandBuffer(myOpenBatch.transferCommandBuffer);
+		}
+		Retire(myOpenBatch);
+		myFree.push_back(std::move(myOpenBatch));
+		myIsOpen = false;
+	}
+
+	for (Batch& batch : myPending)
+	{
+		vkWaitForFences(myDevice, 1, &batch.fence, VK_TRUE, std::numeric_limits<u64>::max());
+		Retire(batch);
+		myFree.push_back(std::move(batch));
+	}
+	myPending.clear();
+
+	for (Batch& batch : myFree)
+	{
+		if (batch.fence != VK_NULL_HANDLE)
+		{
+			vkDestroyFence(myDevice, batch.fence, nullptr);
+		}
+		if (batch.transferDone != VK_NULL_HANDLE)
+		{
+			vkDestroySemaphore(myDevice, batch.transferDone, nullptr);
+		}
+	}
+	myFree.clear();
+
+	if (myStagingBuffer != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(myDevice, myStagingBuffer, nullptr);
+		myAllocator->Free(myStagingAllocation);
+		myStagingBuffer = VK_NULL_HANDLE;
+		myStagingAllocation = nullptr;
+		myStagingData = nullptr;
+	}
+
+	// Frees every command buffer allocated from them
+	vkDestroyCommandPool(myDevice, myCommandPool, nullptr);
+	myCommandPool = VK_NULL_HANDLE;
+	if (myTransferPool != VK_NULL_HANDLE)
+	{
+		vkDestroyCommandPool(myDevice, myTransferPool, nullptr);
+		myTransferPool = VK_NULL_HANDLE;
+	}
+}
+
+bool frostwave::UploadContext::HasTransferQueue() const
+{
+	return myTransferFamily != myQueueFamily;
+}
+
+VkCommandBuffer frostwave::UploadContext::GetCommandBuffer()
+{
+	if (!myIsOpen)
+	{
+		Open();
+	}
+	return myOpenBatch.commandBuffer;
+}
+
+VkCommandBuffer frostwave::UploadContext::GetTransferCommandBuffer()
+{
+	if (!myIsOpen)
+	{
+		Open();
+	}
+
+	if (!HasTransferQueue())
+	{
+		return myOpenBatch.commandBuffer;
+	}
+	myOpenBatch.hasTransfer = true;
+	return myOpenBatch.transferCommandBuffer;
+}
+
+frostwave::UploadTicket frostwave::UploadContext::GetTicket()
+{
+	if (!myIsOpen)
+	{
+		Open();
+	}
+	return myOpenBatch.ticket;
+}
+
+void frostwave::UploadContext::ReleaseToGraphics(VkBuffer aBuffer, VkPipelineStageFlags aDstStage, VkAccessFlags aDstAccess)
+{
+	VkBufferMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.buffer = aBuffer;
+	barrier.offset = 0;
+	barrier.size = VK_WHOLE_SIZE;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = aDstAccess;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+	if (!HasTransferQueue())
+	{
+		vkCmdPipelineBarrier(GetCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, aDstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+		return;
+	}
+
+	// The release makes the copies available, the acquire makes them visible. Neither side's access mask applies to the other queue
+	barrier.srcQueueFamilyIndex = myTransferFamily;
+	barrier.dstQueueFamilyIndex = myQueueFamily;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(GetTransferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = aDstAccess;
+	vkCmdPipelineBarrier(GetCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, aDstStage, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void frostwave::UploadContext::ReleaseToGraphics(VkImage aImage, const VkImageSubresourceRange& aRange, VkImageLayout aOldLayout, VkImageLayout aNewLayout, VkPipelineStageFlags aDstStage, VkAccessFlags aDstAccess)
+{
+	VkImageMemoryBarrier barrier = { };
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image = aImage;
+	barrier.subresourceRange = aRange;
+	barrier.oldLayout = aOldLayout;
+	barrier.newLayout = aNewLayout;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = aDstAccess;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+
+	if (!HasTransferQueue())
+	{
+		vkCmdPipelineBarrier(GetCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, aDstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		return;
+	}
+
+	// Both halves carry the same layouts, the transition happens once between them
+	barrier.srcQueueFamilyIndex = myTransferFamily;
+	barrier.dstQueueFamilyIndex = myQueueFamily;
+	barrier.dstAccessMask = 0;
+	vkCmdPipelineBarrier(GetTransferCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = aDstAccess;
+	vkCmdPipelineBarrier(GetCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, aDstStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+frostwave::StagingAllocation frostwave::UploadContext::AllocateStaging(VkDeviceSize aSize, VkDeviceSize aAlignment)
+{
+	// Anything over half the ring would leave it waiting on nearly every older batch
+	if (myStagingSize == 0 || aSize > myStagingSize / 2)
+	{
+		return AllocateDedicatedStaging(aSize);
+	}
+
+	for (;;)
+	{
+		const VkDeviceSize headOffset = myStagingHead % myStagingSize;
+		u64 lapStart = myStagingHead - headOffset;
+		VkDeviceSize offset = (headOffset + aAlignment - 1) / aAlignment * aAlignment;
+		if (offset + aSize > myStagingSize)
+		{
+			// Doesn't fit before the end, the rest of this lap is skipped
+			lapStart += myStagingSize;
+			offset = 0;
+		}
+
+		const u64 end = lapStart + offset + aSize;
+		if (end - myStagingTail <= myStagingSize)
+		{
+			if (!myIsOpen)
+			{
+				Open();
+			}
+			myStagingHead = end;
+			myOpenBatch.stagingEnd = end;
+
+			StagingAllocation allocation;
+			allocation.buffer = myStagingBuffer;
+			allocation.offset = offset;
+			allocation.data = myStagingData + offset;
+			return allocation;
+		}
+
+		// Full, the oldest batch holding ring space has to finish first
+		if (myPending.empty())
+		{
+			assert(myIsOpen && myOpenBatch.stagingEnd != 0);
+			Submit();
+		}
+		VERBOSE_LOG("Staging ring is full, waiting on upload batch %llu", myPending.front().ticket);
+		Wait(myPending.front().ticket);
+	}
+}
+
+void frostwave::UploadContext::ReleaseStaging(VkBuffer aBuffer, MemoryAllocation* aAllocation)
+{
+	if (!myIsOpen)
+	{
+		Open();
+	}
+	myOpenBatch.staging.push_back({ aBuffer, aAllocation });
+}
+
+frostwave::UploadTicket frostwave::UploadContext::Submit()
+{
+	if (!myIsOpen)
+	{
+		return myNextTicket - 1;
+	}
+
+	vkEndCommandBuffer(myOpenBatch.commandBuffer);
+
+	VkSubmitInfo submitInfo = { };
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+	// The copies start right away on the transfer queue, the graphics queue only waits once it reaches the acquires
+	const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+	if (myOpenBatch.transferCommandBuffer != VK_NULL_HANDLE)
+	{
+		vkEndCommandBuffer(myOpenBatch.transferCommandBuffer);
+		if (myOpenBatch.hasTransfer)
+		{
+			submitInfo.commandBufferCount = 1;
+			submitInfo.pCommandBuffers = &myOpenBatch.transferCommandBuffer;
+			submitInfo.signalSemaphoreCount = 1;
+			submitInfo.pSignalSemaphores = &myOpenBatch.transferDone;
+
+			if (vkQueueSubmit(myTransferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+			{
+				FATAL_LOG("Failed to submit upload batch to the transfer queue!");
+			}
+
+			submitInfo.signalSemaphoreCount = 0;
+			submitInfo.pSignalSemaphores = nullptr;
+			submitInfo.waitSemaphoreCount = 1;
+			submitInfo.pWaitSemaphores = &myOpenBatch.transferDone;
+			submitInfo.pWaitDstStageMask = &waitStage;
+		}
+	}
+
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &myOpenBatch.commandBuffer;
+
+	if (vkQueueSubmit(myQueue, 1, &submitInfo, myOpenBatch.fence) != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to submit upload batch!");
+	}
+
+	const UploadTicket ticket = myOpenBatch.ticket;
+	myPending.push_back(std::move(myOpenBatch));
+	myOpenBatch = { };
+	myIsOpen = false;
+	return ticket;
+}
+
+void frostwave::UploadContext::Update()
+{
+	// Fences signal on the graphics queue in submission order, so the first unfinished batch ends the scan
+	while (!myPending.empty() && vkGetFenceStatus(myDevice, myPending.front().fence) == VK_SUCCESS)
+	{
+		Batch& batch = myPending.front();
+		myCompletedTicket = batch.ticket;
+		Retire(batch);
+		myFree.push_back(std::move(batch));
+		myPending.pop_front();
+	}
+}
+
+bool frostwave::UploadContext::IsComplete(UploadTicket aTicket)
+{
+	if (aTicket <= myCompletedTicket)
+	{
+		return true;
+	}
+	Update();
+	return aTicket <= myCompletedTicket;
+}
+
+void frostwave::UploadContext::Wait(UploadTicket aTicket)
+{
+	if (IsComplete(aTicket))
+	{
+		return;
+	}
+
+	if (myIsOpen && aTicket >= myOpenBatch.ticket)
+	{
+		Submit();
+	}
+
+	for (const Batch& batch : myPending)
+	{
+		if (batch.ticket >= aTicket)
+		{
+			vkWaitForFences(myDevice, 1, &batch.fence, VK_TRUE, std::numeric_limits<u64>::max());
+			break;
+		}
+	}
+	Update();
+}
+
+frostwave::UploadTicket frostwave::UploadContext::GetCompletedTicket() const
+{
+	return myCompletedTicket;
+}
+
+u32 frostwave::UploadContext::GetPendingBatchCount() const
+{
+	return (u32)myPending.size() + (myIsOpen ? 1 : 0);
+}
+
+VkDeviceSize frostwave::UploadContext::GetStagingUsage() const
+{
+	return myStagingHead - myStagingTail;
+}
+
+VkDeviceSize frostwave::UploadContext::GetStagingCapacity() const
+{
+	return myStagingSize;
+}
+
+void frostwave::UploadContext::Open()
+{
+	if (!myFree.empty())
+	{
+		myOpenBatch = std::move(myFree.back());
+		myFree.pop_back();
+		vkResetFences(myDevice, 1, &myOpenBatch.fence);
+		vkResetCommandBuffer(myOpenBatch.commandBuffer, 0);
+		if (myOpenBatch.transferCommandBuffer != VK_NULL_HANDLE)
+		{
+			vkResetCommandBuffer(myOpenBatch.transferCommandBuffer, 0);
+		}
+	}
+	else
+	{
+		VkCommandBufferAllocateInfo allocInfo = { };
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = myCommandPool;
+		allocInfo.commandBufferCount = 1;
+
+		VkFenceCreateInfo fenceInfo = { };
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		myOpenBatch = { };
+		if (vkAllocateCommandBuffers(myDevice, &allocInfo, &myOpenBatch.commandBuffer) != VK_SUCCESS ||
+			vkCreateFence(myDevice, &fenceInfo, nullptr, &myOpenBatch.fence) != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to create upload batch!");
+		}
+
+		if (HasTransferQueue())
+		{
+			allocInfo.commandPool = myTransferPool;
+
+			VkSemaphoreCreateInfo semaphoreInfo = { };
+			semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+			if (vkAllocateCommandBuffers(myDevice, &allocInfo, &myOpenBatch.transferCommandBuffer) != VK_SUCCESS ||
+				vkCreateSemaphore(myDevice, &semaphoreInfo, nullptr, &myOpenBatch.transferDone) != VK_SUCCESS)
+			{
+				FATAL_LOG("Failed to create upload batch!");
+			}
+		}
+	}
+
+	myOpenBatch.ticket = myNextTicket++;
+	myOpenBatch.hasTransfer = false;
+	myOpenBatch.stagingEnd = 0;
+	myIsOpen = true;
+
+	VkCommandBufferBeginInfo beginInfo = { };
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	vkBeginCommandBuffer(myOpenBatch.commandBuffer, &beginInfo);
+	if (myOpenBatch.transferCommandBuffer != VK_NULL_HANDLE)
+	{
+		vkBeginCommandBuffer(myOpenBatch.transferCommandBuffer, &beginInfo);
+	}
+}
+
+void frostwave::UploadContext::Retire(Batch& aBatch)
+{
+	// Batches retire in order, so everything the ring handed out before this batch's end is free again
+	if (aBatch.stagingEnd > myStagingTail)
+	{
+		myStagingTail = aBatch.stagingEnd;
+	}
+	aBatch.stagingEnd = 0;
+
+	for (auto& staging : aBatch.staging)
+	{
+		vkDestroyBuffer(myDevice, staging.first, nullptr);
+		myAllocator->Free(staging.second);
+	}
+	aBatch.staging.clear();
+}
+
+VkCommandPool frostwave::UploadContext::CreatePool(u32 aQueueFamily)
+{
+	VkCommandPoolCreateInfo poolInfo = { };
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = aQueueFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	VkCommandPool pool = VK_NULL_HANDLE;
+	if (vkCreateCommandPool(myDevice, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create upload command pool!");
+	}
+	return pool;
+}
+
+frostwave::StagingAllocation frostwave::UploadContext::AllocateDedicatedStaging(VkDeviceSize aSize)
+{
+	VkBufferCreateInfo bufferInfo = { };
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = aSize;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer = VK_NULL_HANDLE;
+	if (vkCreateBuffer(myDevice, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create staging buffer!");
+	}
+
+	MemoryAllocation* memory = myAllocator->AllocateBuffer(buffer, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, MemoryCategory::Staging);
+
+	StagingAllocation allocation;
+	allocation.buffer = buffer;
+	allocation.data = memory->mapped;
+
+	// Freed with the batch
+	ReleaseStaging(buffer, memory);
+	return allocation;
+}
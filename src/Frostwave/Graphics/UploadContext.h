@@ -0,0 +1,127 @@
+#pragma once
+
+#include <Frostwave/Core/Types.h>
+
+#include <vulkan/vulkan.h>
+#include <deque>
+#include <vector>
+
+namespace frostwave
+{
+	class VkFramework;
+	class MemoryAllocator;
+	struct MemoryAllocation;
+
+	// Identifies the batch an upload was recorded into. 0 is never issued and always reads as complete
+	using UploadTicket = u64;
+
+	// Mapped, host coherent staging memory to copy from. Part of the staging ring, or a buffer of its own when too large for it
+	struct StagingAllocation
+	{
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		void* data = nullptr;
+	};
+
+	// Collects copies, layout transitions and mip blits into one command buffer and submits them as a batch with a fence,
+	// instead of a submit and a queue drain per copy. Batches execute in submission order, so a ticket is complete once
+	// every batch up to it has finished. Not thread safe, loaders record from the main thread.
+	//
+	// With a dedicated transfer family a batch is split in two. The copies run on the transfer queue and end in release
+	// barriers, then the graphics half acquires the resources after a semaphore wait and does the rest. Without one both
+	// halves are the same command buffer on the graphics queue.
+	class UploadContext
+	{
+	public:
+		UploadContext();
+		~UploadContext();
+
+		void Init(VkDevice aDevice, VkQueue aGraphicsQueue, u32 aGraphicsFamily, VkQueue aTransferQueue, u32 aTransferFamily);
+		// One persistently mapped buffer every upload stages through, used as a ring. Staging memory comes from aAllocator
+		void CreateStagingRing(MemoryAllocator* aAllocator, VkDeviceSize aSize);
+		// Waits for every batch, the open one is dropped without being submitted
+		void Destroy();
+
+		// True when copies run on their own queue family
+		bool HasTransferQueue() const;
+
+		// Graphics command buffer of the open batch, opened on first use. Runs after the batch's transfer commands
+		VkCommandBuffer GetCommandBuffer();
+		// Command buffer for copies and the layout transitions around them, only transfer commands are allowed in it
+		VkCommandBuffer GetTransferCommandBuffer();
+		// Ticket of the open batch, what anything recorded right now completes with
+		UploadTicket GetTicket();
+
+		// Hands a resource written by transfer commands over to the graphics queue, an ownership transfer with a
+		// dedicated family and a plain barrier otherwise. Has to follow the copies into it
+		void ReleaseToGraphics(VkBuffer aBuffer, VkPipelineStageFlags aDstStage, VkAccessFlags aDstAccess);
+		void ReleaseToGraphics(VkImage aImage, const VkImageSubresourceRange& aRange, VkImageLayout aOldLayout, VkImageLayout aNewLayout, VkPipelineStageFlags aDstStage, VkAccessFlags aDstAccess);
+
+		// Staging space for the open batch, handed back to the ring once the batch has finished. A full ring waits on older
+		// batches and may submit the open one, so get command buffers after allocating and record the copies before the next call
+		StagingAllocation AllocateStaging(VkDeviceSize aSize, VkDeviceSize aAlignment = 16);
+		// Staging memory the open batch reads from, destroyed once the batch has finished
+		void ReleaseStaging(VkBuffer aBuffer, MemoryAllocation* aAllocation);
+
+		// Submits the open batch if anything was recorded into it
+		UploadTicket Submit();
+		// Polls without waiting, and recycles every batch that has finished
+		void Update();
+		bool IsComplete(UploadTicket aTicket);
+		// Submits the ticket's batch first if it is still open
+		void Wait(UploadTicket aTicket);
+
+		// Latest ticket known to be complete
+		UploadTicket GetCompletedTicket() const;
+		u32 GetPendingBatchCount() const;
+		// Bytes of the ring still read by unfinished batches
+		VkDeviceSize GetStagingUsage() const;
+		VkDeviceSize GetStagingCapacity() const;
+
+	private:
+		struct Batch
+		{
+			VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+			VkCommandBuffer transferCommandBuffer = VK_NULL_HANDLE; // only with a dedicated transfer family
+			VkSemaphore transferDone = VK_NULL_HANDLE;
+			bool hasTransfer = false;
+			VkFence fence = VK_NULL_HANDLE;
+			UploadTicket ticket = 0;
+			u64 stagingEnd = 0; // ring position after the batch's last allocation, 0 when it took none
+			std::vector<std::pair<VkBuffer, MemoryAllocation*>> staging;
+		};
+
+		void Open();
+		void Retire(Batch& aBatch);
+		VkCommandPool CreatePool(u32 aQueueFamily);
+		StagingAllocation AllocateDedicatedStaging(VkDeviceSize aSize);
+
+		VkDevice myDevice;
+		MemoryAllocator* myAllocator;
+		VkQueue myQueue;
+		VkQueue myTransferQueue;
+		u32 myQueueFamily;
+		u32 myTransferFamily;
+		VkCommandPool myCommandPool;
+		VkCommandPool myTransferPool;
+
+		Batch myOpenBatch;
+		bool myIsOpen;
+		// Submitted and not yet finished, oldest first
+		std::deque<Batch> myPending;
+		// Finished batches whose command buffer and fence get reused
+		std::vector<Batch> myFree;
+
+		UploadTicket myNextTicket;
+		UploadTicket myCompletedTicket;
+
+		VkBuffer myStagingBuffer;
+		MemoryAllocation* myStagingAllocation;
+		u8* myStagingData;
+		VkDeviceSize myStagingSize;
+		// Positions only ever grow, the offset into the buffer is the position modulo its size
+		u64 myStagingHead;
+		u64 myStagingTail;
+	};
+}
+namespace fw = frostwave;
@@ -14,7 +14,6 @@ constexpr u32 HEIGHT = 600;
 const string MODEL_PATH = "assets/meshes/2b.obj";
 const string TEXTURE_PATH = "assets/textures/2b.png";
 
-constexpr i32 MaxNumBufferedFrames = 1;
 const std::vector<const char*> ValidationLayers = {
 	"VK_LAYER_LUNARG_standard_validation"
 };
@@ -23,6 +22,16 @@ const std::vector<const char*> DeviceExtensions = {
 	VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+// In result order: input assembly vertices and primitives, vertex invocations, clipped primitives, fragment and compute invocations
+constexpr VkQueryPipelineStatisticFlags PipelineStatisticFlags =
+	VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+constexpr u32 PipelineStatisticCount = 6;
+
 VkResult CreateDebugUtilsMessengerEXT(VkInstance aInstance, const VkDebugUtilsMessengerCreateInfoEXT* aCreateInfo,
 	const VkAllocationCallbacks* aAllocator, VkDebugUtilsMessengerEXT* aDebugMessenger)
 {
@@ -37,6 +46,38 @@ VkResult CreateDebugUtilsMessengerEXT(VkInstance aInstance, const VkDebugUtilsMe
 	}
 }
 
+bool IsInstanceExtensionAvailable(const char* aName)
+{
+	u32 extensionCount = 0;
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, extensions.data());
+	for (const auto& extension : extensions)
+	{
+		if (strcmp(extension.extensionName, aName) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+bool IsDeviceExtensionAvailable(VkPhysicalDevice aDevice, const char* aName)
+{
+	u32 extensionCount = 0;
+	vkEnumerateDeviceExtensionProperties(aDevice, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> extensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(aDevice, nullptr, &extensionCount, extensions.data());
+	for (const auto& extension : extensions)
+	{
+		if (strcmp(extension.extensionName, aName) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 void DestroyDebugUtilsMessengerEXT(VkInstance aInstance, VkDebugUtilsMessengerEXT aDebugMessenger, const VkAllocationCallbacks* aAllocator)
 {
 	auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(aInstance, "vkDestroyDebugUtilsMessengerEXT");
@@ -51,12 +92,19 @@ frostwave::VkFramework::~VkFramework()
 	WaitIdle();
 
 	CleanupSwapChain();
+	myDeletionQueue.Flush();
+	myUploadContext.Destroy();
+	myAllocator.Destroy();
 
 	vkDestroyDescriptorPool(myDevice, myDescriptorPool, nullptr);
+	for (auto pool : myFullDescriptorPools)
+	{
+		vkDestroyDescriptorPool(myDevice, pool, nullptr);
+	}
 
 	vkDestroyDescriptorSetLayout(myDevice, myDescriptorSetLayout, nullptr);
 
-	for (size_t i = 0; i < MaxNumBufferedFrames; ++i)
+	for (size_t i = 0; i < myFramesInFlight; ++i)
 	{
 		vkDestroySemaphore(myDevice, myRenderFinishedSemaphores[i], nullptr);
 		vkDestroySemaphore(myDevice, myImageAvailableSemaphores[i], nullptr);
@@ -65,6 +113,11 @@ frostwave::VkFramework::~VkFramework()
 
 	vkDestroyCommandPool(myDevice, myCommandPool, nullptr);
 
+	if (myPipelineStatisticsPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(myDevice, myPipelineStatisticsPool, nullptr);
+	}
+
 	vkDestroyDevice(myDevice, nullptr);
 
 	if (mySettings.validation)
@@ -72,7 +125,10 @@ frostwave::VkFramework::~VkFramework()
 		DestroyDebugUtilsMessengerEXT(myInstance, myDebugMessenger, nullptr);
 	}
 
-	vkDestroySurfaceKHR(myInstance, mySurface, nullptr);
+	if (mySurface != VK_NULL_HANDLE)
+	{
+		vkDestroySurfaceKHR(myInstance, mySurface, nullptr);
+	}
 	vkDestroyInstance(myInstance, nullptr);
 }
 
@@ -80,6 +136,17 @@ void frostwave::VkFramework::Init(GLFWwindow* aWindow, GraphicsSettings aSetting
 {
 	myWindow = aWindow;
 	mySettings = aSettings;
+	myFramesInFlight = fw::Max(aSettings.framesInFlight, 1u);
+	InitVulkan();
+}
+
+void frostwave::VkFramework::InitHeadless(u32 aWidth, u32 aHeight, GraphicsSettings aSettings)
+{
+	myWindow = nullptr;
+	myHeadless = true;
+	myHeadlessExtent = { fw::Max(aWidth, 1u), fw::Max(aHeight, 1u) };
+	mySettings = aSettings;
+	myFramesInFlight = fw::Max(aSettings.framesInFlight, 1u);
 	InitVulkan();
 }
 
@@ -87,12 +154,50 @@ u32 frostwave::VkFramework::BeginFrame()
 {
 	vkWaitForFences(myDevice, 1, &myInFlightFences[myCurrentFrame], VK_TRUE, std::numeric_limits<u64>::max());
 
+	// The slot's previous frame has finished, and every frame before it since they share one queue
+	const u64 completedFrame = mySlotFrameNumbers[myCurrentFrame];
+	myDeletionQueue.Collect(completedFrame);
+	mySlotFrameNumbers[myCurrentFrame] = ++myFrameNumber;
+	myDeletionQueue.SetFrame(myFrameNumber);
+
+	// Uploads recorded since the last frame go ahead of this frame's submits, which can then use what they wrote
+	myUploadContext.Update();
+	// Moves copy through the same batch, the frame then only sees the new handles
+	myDefragmenter.Update(mySettings.defragmentBytesPerFrame);
+	myUploadContext.Submit();
+
+	// Callbacks get to evict before the frame streams anything new in
+	myAllocator.UpdateBudget(mySettings.memoryBudgetLimit);
+
+	myLastFrameCounters = myFrameCounters;
+	myFrameCounters = { };
+	CollectPipelineStatistics((u32)myCurrentFrame);
+
 	u32 imageIndex;
+	if (myHeadless)
+	{
+		// One image per frame in flight, so the slot's fence already covers it. The empty submit stands in for the acquire
+		// and signals the semaphore the frame's first submit waits on
+		imageIndex = (u32)myCurrentFrame;
+
+		VkSubmitInfo submitInfo = { };
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &myImageAvailableSemaphores[myCurrentFrame];
+		if (vkQueueSubmit(myGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to signal headless image!");
+		}
+		return imageIndex;
+	}
+
 	VkResult result = vkAcquireNextImageKHR(myDevice, mySwapChain, std::numeric_limits<u64>::max(), myImageAvailableSemaphores[myCurrentFrame], VK_NULL_HANDLE, &imageIndex);
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR)
 	{
 		RecreateSwapChain();
+		// Nothing gets submitted from the slot, so its fence still only covers the frame it ran before
+		mySlotFrameNumbers[myCurrentFrame] = completedFrame;
 		return -1;
 	}
 	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)
@@ -100,11 +205,36 @@ u32 frostwave::VkFramework::BeginFrame()
 		FATAL_LOG("Failed to acquire swap chain image!");
 	}
 
+	// The image can be handed back while an older frame still renders to it
+	if (myImagesInFlight[imageIndex] != VK_NULL_HANDLE)
+	{
+		vkWaitForFences(myDevice, 1, &myImagesInFlight[imageIndex], VK_TRUE, std::numeric_limits<u64>::max());
+	}
+	myImagesInFlight[imageIndex] = myInFlightFences[myCurrentFrame];
+
 	return imageIndex;
 }
 
 bool frostwave::VkFramework::EndFrame(u32 aIndex, VkSemaphore aSignalSemaphore)
 {
+	if (myHeadless)
+	{
+		// Nothing to present, but the frame's semaphore still has to be waited on before the slot signals it again
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+		VkSubmitInfo submitInfo = { };
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.waitSemaphoreCount = 1;
+		submitInfo.pWaitSemaphores = &aSignalSemaphore;
+		submitInfo.pWaitDstStageMask = &waitStage;
+		if (vkQueueSubmit(myGraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS)
+		{
+			FATAL_LOG("Failed to retire headless image!");
+		}
+
+		myCurrentFrame = (myCurrentFrame + 1) % myFramesInFlight;
+		return true;
+	}
+
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
 	presentInfo.waitSemaphoreCount = 1;
@@ -117,6 +247,7 @@ bool frostwave::VkFramework::EndFrame(u32 aIndex, VkSemaphore aSignalSemaphore)
 	presentInfo.pResults = nullptr;
 
 	VkResult result = vkQueuePresentKHR(myPresentQueue, &presentInfo);
+	++myFrameCounters.presents;
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || myFramebufferResized)
 	{
@@ -129,13 +260,15 @@ bool frostwave::VkFramework::EndFrame(u32 aIndex, VkSemaphore aSignalSemaphore)
 		FATAL_LOG("Failed to present swap chain image!");
 	}
 
-	myCurrentFrame = (myCurrentFrame + 1) % MaxNumBufferedFrames;
+	myCurrentFrame = (myCurrentFrame + 1) % myFramesInFlight;
 	return true;
 }
 
 void frostwave::VkFramework::WaitIdle()
 {
 	vkDeviceWaitIdle(myDevice);
+	myUploadContext.Update();
+	myDeletionQueue.Flush();
 }
 
 void frostwave::VkFramework::SetFramebufferResized(bool aResized)
@@ -143,6 +276,21 @@ void frostwave::VkFramework::SetFramebufferResized(bool aResized)
 	myFramebufferResized = aResized;
 }
 
+const frostwave::GraphicsSettings& frostwave::VkFramework::GetSettings() const
+{
+	return mySettings;
+}
+
+u32 frostwave::VkFramework::GetFramesInFlight() const
+{
+	return myFramesInFlight;
+}
+
+u32 frostwave::VkFramework::GetCurrentFrame() const
+{
+	return (u32)myCurrentFrame;
+}
+
 VkDevice frostwave::VkFramework::GetDevice() const
 {
 	assert(myDevice != VK_NULL_HANDLE);
@@ -182,6 +330,40 @@ VkDescriptorPool& frostwave::VkFramework::GetDescriptorPool()
 	return myDescriptorPool;
 }
 
+VkDescriptorSet frostwave::VkFramework::AllocateDescriptorSet(VkDescriptorSetLayout aLayout, VkDescriptorPool* aPool)
+{
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = myDescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &aLayout;
+
+	VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+	VkResult result = vkAllocateDescriptorSets(myDevice, &allocInfo, &descriptorSet);
+
+	// Replaced sets wait in the deletion queue for a few frames, so a burst of them can use up a pool that fits the live ones
+	if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+	{
+		myFullDescriptorPools.push_back(myDescriptorPool);
+		if (!CreateDescriptorPool())
+		{
+			return VK_NULL_HANDLE;
+		}
+		VERBOSE_LOG("Descriptor pool ran out, opened pool %u", (u32)myFullDescriptorPools.size() + 1);
+
+		allocInfo.descriptorPool = myDescriptorPool;
+		result = vkAllocateDescriptorSets(myDevice, &allocInfo, &descriptorSet);
+	}
+
+	if (result != VK_SUCCESS)
+	{
+		return VK_NULL_HANDLE;
+	}
+
+	*aPool = myDescriptorPool;
+	return descriptorSet;
+}
+
 VkPipeline frostwave::VkFramework::GetPipeline() const
 {
 	return myGraphicsPipeline;
@@ -197,11 +379,36 @@ VkSampleCountFlagBits frostwave::VkFramework::GetMSAASamples() const
 	return myMSAASamples;
 }
 
+const VkPhysicalDeviceFeatures& frostwave::VkFramework::GetEnabledFeatures() const
+{
+	return myEnabledFeatures;
+}
+
 frostwave::QueueFamilyIndices frostwave::VkFramework::GetQueueFamilyIndices() const
 {
 	return FindQueueFamily(myPhysicalDevice);
 }
 
+frostwave::DeletionQueue& frostwave::VkFramework::GetDeletionQueue() const
+{
+	return myDeletionQueue;
+}
+
+frostwave::UploadContext& frostwave::VkFramework::GetUploadContext() const
+{
+	return myUploadContext;
+}
+
+frostwave::MemoryAllocator& frostwave::VkFramework::GetAllocator() const
+{
+	return myAllocator;
+}
+
+frostwave::Defragmenter& frostwave::VkFramework::GetDefragmenter() const
+{
+	return myDefragmenter;
+}
+
 bool frostwave::VkFramework::CreateInstance()
 {
 	if (mySettings.validation && !CheckValidationLayerSupport())
@@ -221,14 +428,6 @@ bool frostwave::VkFramework::CreateInstance()
 	createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
 	createInfo.pApplicationInfo = &appInfo;
 
-	u32 glfwExtensionCount = 0;
-	const char** glfwExtensions;
-
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-
-	createInfo.enabledExtensionCount = glfwExtensionCount;
-	createInfo.ppEnabledExtensionNames = glfwExtensions;
-
 	if (mySettings.validation)
 	{
 		createInfo.enabledLayerCount = (u32)(ValidationLayers.size());
@@ -255,16 +454,29 @@ bool frostwave::VkFramework::CreateInstance()
 
 std::vector<const char*> frostwave::VkFramework::GetRequiredExtensions()
 {
-	u32 glfwExtensionCount = 0;
-	const char** glfwExtensions;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	std::vector<const char*> extensions;
+
+	// Surface extensions are only needed to present, and GLFW isn't initialized without a window
+	if (!myHeadless)
+	{
+		u32 glfwExtensionCount = 0;
+		const char** glfwExtensions;
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
 
 	if (mySettings.validation)
 	{
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 	}
 
+	// A 1.0 instance needs it to query VK_EXT_memory_budget, the device still has to support that too
+	myMemoryBudget = IsInstanceExtensionAvailable(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+	if (myMemoryBudget)
+	{
+		extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+	}
+
 	return extensions;
 }
 
@@ -300,6 +512,17 @@ VkExtent2D frostwave::VkFramework::GetSwapchainExtent() const
 	return mySwapChainExtent;
 }
 
+bool frostwave::VkFramework::IsHeadless() const
+{
+	return myHeadless;
+}
+
+VkImageLayout frostwave::VkFramework::GetPresentLayout() const
+{
+	// PRESENT_SRC needs the swapchain extension, headless images are left ready to be copied out instead
+	return myHeadless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+}
+
 bool frostwave::VkFramework::CheckValidationLayerSupport()
 {
 	u32 layerCount;
@@ -335,13 +558,24 @@ bool frostwave::VkFramework::InitVulkan()
 	VERBOSE_LOG("Created Vulkan Instance");
 	if (!SetupDebugMessenger()) return false;
 	VERBOSE_LOG("Set up debug messenger");
-	if (!CreateSurface()) return false;
-	VERBOSE_LOG("Created window surface");
-	if (!PickPhysicalDevice()) return false;
-	if (!CreateLogicalDevice()) return false;
-	VERBOSE_LOG("Created logical device");
-	if (!CreateSwapChain()) return false;
-	VERBOSE_LOG("Created swapchain");
+	if (myHeadless)
+	{
+		if (!PickPhysicalDevice()) return false;
+		if (!CreateLogicalDevice()) return false;
+		VERBOSE_LOG("Created logical device");
+		if (!CreateHeadlessImages()) return false;
+		VERBOSE_LOG("Created headless images");
+	}
+	else
+	{
+		if (!CreateSurface()) return false;
+		VERBOSE_LOG("Created window surface");
+		if (!PickPhysicalDevice()) return false;
+		if (!CreateLogicalDevice()) return false;
+		VERBOSE_LOG("Created logical device");
+		if (!CreateSwapChain()) return false;
+		VERBOSE_LOG("Created swapchain");
+	}
 	if (!CreateImageViews()) return false;
 	VERBOSE_LOG("Created swapchain image views");
 	if (!CreateRenderPass()) return false;
@@ -368,6 +602,7 @@ bool frostwave::VkFramework::InitVulkan()
 	VERBOSE_LOG("Created command buffers");
 	if (!CreateSyncObjects()) return false;
 	VERBOSE_LOG("Created synchronization objects");
+	if (!CreatePipelineStatisticsQueries()) return false;
 
 	INFO_LOG("Initialized Vulkan");
 	return true;
@@ -375,9 +610,10 @@ bool frostwave::VkFramework::InitVulkan()
 
 bool frostwave::VkFramework::CreateSyncObjects()
 {
-	myImageAvailableSemaphores.resize(MaxNumBufferedFrames);
-	myRenderFinishedSemaphores.resize(MaxNumBufferedFrames);
-	myInFlightFences.resize(MaxNumBufferedFrames);
+	mySlotFrameNumbers.assign(myFramesInFlight, 0);
+	myImageAvailableSemaphores.resize(myFramesInFlight);
+	myRenderFinishedSemaphores.resize(myFramesInFlight);
+	myInFlightFences.resize(myFramesInFlight);
 
 	VkSemaphoreCreateInfo semaphoreInfo = {};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -386,7 +622,7 @@ bool frostwave::VkFramework::CreateSyncObjects()
 	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	for (size_t i = 0; i < MaxNumBufferedFrames; ++i)
+	for (size_t i = 0; i < myFramesInFlight; ++i)
 	{
 		if (vkCreateSemaphore(myDevice, &semaphoreInfo, nullptr, &myImageAvailableSemaphores[i]) ||
 			vkCreateSemaphore(myDevice, &semaphoreInfo, nullptr, &myRenderFinishedSemaphores[i]) ||
@@ -399,6 +635,100 @@ bool frostwave::VkFramework::CreateSyncObjects()
 	return true;
 }
 
+bool frostwave::VkFramework::CreatePipelineStatisticsQueries()
+{
+	// Secondaries execute while the frame's query is active, which needs inheritedQueries on top of the statistics themselves
+	if (!myEnabledFeatures.pipelineStatisticsQuery || !myEnabledFeatures.inheritedQueries)
+	{
+		INFO_LOG("Pipeline statistics queries are not supported, frame counters will not include them");
+		return true;
+	}
+
+	VkQueryPoolCreateInfo info = { };
+	info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	info.queryCount = myFramesInFlight * PipelineStatisticsPasses;
+	info.pipelineStatistics = PipelineStatisticFlags;
+
+	if (vkCreateQueryPool(myDevice, &info, nullptr, &myPipelineStatisticsPool) != VK_SUCCESS)
+	{
+		WARNING_LOG("Failed to create pipeline statistics query pool, frame counters will not include them");
+		myPipelineStatisticsPool = VK_NULL_HANDLE;
+		return true;
+	}
+
+	myPipelineStatisticsPending.assign(myFramesInFlight, false);
+	VERBOSE_LOG("Created pipeline statistics queries");
+	return true;
+}
+
+void frostwave::VkFramework::CollectPipelineStatistics(u32 aFrameIndex)
+{
+	if (!HasPipelineStatistics() || !myPipelineStatisticsPending[aFrameIndex])
+	{
+		return;
+	}
+	myPipelineStatisticsPending[aFrameIndex] = false;
+
+	// The slot's fence has signalled, so nothing to wait for. Passes that didn't run this frame come back unavailable
+	std::array<u64, (PipelineStatisticCount + 1) * PipelineStatisticsPasses> results = { };
+	vkGetQueryPoolResults(myDevice, myPipelineStatisticsPool, aFrameIndex * PipelineStatisticsPasses, PipelineStatisticsPasses,
+		sizeof(results), results.data(), sizeof(u64) * (PipelineStatisticCount + 1), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	myFrameCounters.hasPipelineStatistics = true;
+	for (u32 pass = 0; pass < PipelineStatisticsPasses; ++pass)
+	{
+		const u64* passResults = &results[pass * (PipelineStatisticCount + 1)];
+		if (passResults[PipelineStatisticCount] == 0)
+		{
+			continue;
+		}
+
+		myFrameCounters.inputAssemblyVertices += passResults[0];
+		myFrameCounters.inputAssemblyPrimitives += passResults[1];
+		myFrameCounters.vertexShaderInvocations += passResults[2];
+		myFrameCounters.clippingPrimitives += passResults[3];
+		myFrameCounters.fragmentShaderInvocations += passResults[4];
+		myFrameCounters.computeShaderInvocations += passResults[5];
+	}
+}
+
+frostwave::FrameCounters& frostwave::VkFramework::GetFrameCounters()
+{
+	return myFrameCounters;
+}
+
+const frostwave::FrameCounters& frostwave::VkFramework::GetLastFrameCounters() const
+{
+	return myLastFrameCounters;
+}
+
+bool frostwave::VkFramework::HasPipelineStatistics() const
+{
+	return myPipelineStatisticsPool != VK_NULL_HANDLE;
+}
+
+VkQueryPipelineStatisticFlags frostwave::VkFramework::GetPipelineStatisticFlags() const
+{
+	return HasPipelineStatistics() ? PipelineStatisticFlags : 0;
+}
+
+void frostwave::VkFramework::BeginPipelineStatistics(VkCommandBuffer aCommandBuffer, u32 aFrameIndex, u32 aPass)
+{
+	if (HasPipelineStatistics())
+	{
+		vkCmdBeginQuery(aCommandBuffer, myPipelineStatisticsPool, aFrameIndex * PipelineStatisticsPasses + aPass, 0);
+	}
+}
+
+void frostwave::VkFramework::EndPipelineStatistics(VkCommandBuffer aCommandBuffer, u32 aFrameIndex, u32 aPass)
+{
+	if (HasPipelineStatistics())
+	{
+		vkCmdEndQuery(aCommandBuffer, myPipelineStatisticsPool, aFrameIndex * PipelineStatisticsPasses + aPass);
+	}
+}
+
 VkCommandBufferInheritanceInfo frostwave::VkFramework::BeginCommandBufferRecording(u32 aImageIndex, VkRenderPassBeginInfo aRenderPassInfo)
 {
 	VkCommandBufferBeginInfo beginInfo = {};
@@ -412,12 +742,23 @@ VkCommandBufferInheritanceInfo frostwave::VkFramework::BeginCommandBufferRecordi
 		FATAL_LOG("Failed to begin recording command buffer!");
 	}
 
+	++myFrameCounters.commandBuffersRecorded;
+
+	// Resets every pass of the frame, the primary is always the frame's first submission
+	if (HasPipelineStatistics())
+	{
+		vkCmdResetQueryPool(myCommandBuffers[aImageIndex], myPipelineStatisticsPool, (u32)myCurrentFrame * PipelineStatisticsPasses, PipelineStatisticsPasses);
+		BeginPipelineStatistics(myCommandBuffers[aImageIndex], (u32)myCurrentFrame, 0);
+		myPipelineStatisticsPending[myCurrentFrame] = true;
+	}
+
 	vkCmdBeginRenderPass(myCommandBuffers[aImageIndex], &aRenderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
 	VkCommandBufferInheritanceInfo inheritanceInfo = { };
 	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
 	inheritanceInfo.renderPass = aRenderPassInfo.renderPass;
 	inheritanceInfo.framebuffer = aRenderPassInfo.framebuffer;
+	inheritanceInfo.pipelineStatistics = GetPipelineStatisticFlags();
 
 	return inheritanceInfo;
 }
@@ -430,6 +771,7 @@ bool frostwave::VkFramework::EndCommandBufferRecording(u32 aImageIndex, std::vec
 	}
 
 	vkCmdEndRenderPass(myCommandBuffers[aImageIndex]);
+	EndPipelineStatistics(myCommandBuffers[aImageIndex], (u32)myCurrentFrame, 0);
 
 	VkResult result = vkEndCommandBuffer(myCommandBuffers[aImageIndex]);
 
@@ -445,6 +787,7 @@ bool frostwave::VkFramework::EndCommandBufferRecording(u32 aImageIndex, std::vec
 bool frostwave::VkFramework::CreateCommandBuffers()
 {
 	myCommandBuffers.resize(mySwapChainFramebuffers.size());
+	myImagesInFlight.assign(mySwapChainFramebuffers.size(), VK_NULL_HANDLE);
 	mySecondaryCommandBuffers.resize(mySwapChainFramebuffers.size());
 
 	VkCommandBufferAllocateInfo allocInfo = {};
@@ -542,7 +885,7 @@ bool frostwave::VkFramework::CreateRenderPass()
 	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachment.finalLayout = GetPresentLayout();
 	colorAttachment.samples = myMSAASamples;
 
 	VkAttachmentReference colorAttachmentRef = {};
@@ -557,7 +900,7 @@ bool frostwave::VkFramework::CreateRenderPass()
 	colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachmentResolve.finalLayout = GetPresentLayout();
 
 	VkAttachmentReference colorAttachmentResolveRef = { };
 	colorAttachmentResolveRef.attachment = 2;
@@ -614,17 +957,23 @@ bool frostwave::VkFramework::CreateRenderPass()
 
 bool frostwave::VkFramework::CreateDescriptorPool()
 {
-	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
+	std::array<VkDescriptorPoolSize, 4> poolSizes = {};
 	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	poolSizes[0].descriptorCount = 100;
 	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	poolSizes[1].descriptorCount = 100;
+	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[2].descriptorCount = 100;
+	poolSizes[3].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSizes[3].descriptorCount = 100;
 
 	VkDescriptorPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = (u32)poolSizes.size();
 	poolInfo.pPoolSizes = poolSizes.data();
 	poolInfo.maxSets = 100;
+	// Sets naming moved resources get replaced while frames in flight still use the old ones
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
 
 	VkResult result = vkCreateDescriptorPool(myDevice, &poolInfo, nullptr, &myDescriptorPool);
 	if (result != VK_SUCCESS)
@@ -917,7 +1266,8 @@ bool frostwave::VkFramework::CreateSwapChain()
 	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	createInfo.presentMode = presentMode;
 	createInfo.clipped = VK_TRUE;
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	// A recreated swapchain hands its images over from the retired one, which frames in flight may still present from
+	createInfo.oldSwapchain = mySwapChain;
 
 	VkResult result = vkCreateSwapchainKHR(myDevice, &createInfo, nullptr, &mySwapChain);
 	if (result != VK_SUCCESS)
@@ -934,6 +1284,22 @@ bool frostwave::VkFramework::CreateSwapChain()
 	return true;
 }
 
+bool frostwave::VkFramework::CreateHeadlessImages()
+{
+	// Same format the swapchain would normally pick, so every render pass targeting it stays unchanged
+	mySwapChainFormat = VK_FORMAT_B8G8R8A8_UNORM;
+	mySwapChainExtent = myHeadlessExtent;
+
+	mySwapChainImages.resize(myFramesInFlight);
+	myHeadlessMemory.resize(myFramesInFlight);
+	for (u32 i = 0; i < myFramesInFlight; ++i)
+	{
+		CreateImage(mySwapChainExtent.width, mySwapChainExtent.height, 1, VK_SAMPLE_COUNT_1_BIT, mySwapChainFormat, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemoryCategory::RenderTarget, mySwapChainImages[i], myHeadlessMemory[i]);
+	}
+	return true;
+}
+
 bool frostwave::VkFramework::CreateSurface()
 {
 	VkResult result = glfwCreateWindowSurface(myInstance, myWindow, nullptr, &mySurface);
@@ -950,7 +1316,7 @@ bool frostwave::VkFramework::CreateLogicalDevice()
 	QueueFamilyIndices indices = FindQueueFamily(myPhysicalDevice);
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<u32> uniqueQueueFamilies = { (u32)indices.graphicsFamily, (u32)indices.presentFamily };
+	std::set<u32> uniqueQueueFamilies = { (u32)indices.graphicsFamily, (u32)indices.presentFamily, (u32)indices.transferFamily };
 
 	float queuePriority = 1.0f;
 	for (auto& queueFamily : uniqueQueueFamilies)
@@ -963,9 +1329,17 @@ bool frostwave::VkFramework::CreateLogicalDevice()
 		queueCreateInfos.push_back(queueCreateInfo);
 	}
 
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(myPhysicalDevice, &supportedFeatures);
+
 	VkPhysicalDeviceFeatures deviceFeatures = {};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
 	deviceFeatures.sampleRateShading = VK_TRUE;
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+	deviceFeatures.pipelineStatisticsQuery = supportedFeatures.pipelineStatisticsQuery;
+	deviceFeatures.inheritedQueries = supportedFeatures.inheritedQueries;
+	myEnabledFeatures = deviceFeatures;
 
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -975,8 +1349,14 @@ bool frostwave::VkFramework::CreateLogicalDevice()
 
 	createInfo.pEnabledFeatures = &deviceFeatures;
 
-	createInfo.enabledExtensionCount = (u32)DeviceExtensions.size();
-	createInfo.ppEnabledExtensionNames = DeviceExtensions.data();
+	std::vector<const char*> extensions = GetDeviceExtensions();
+	myMemoryBudget = myMemoryBudget && IsDeviceExtensionAvailable(myPhysicalDevice, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	if (myMemoryBudget)
+	{
+		extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+	}
+	createInfo.enabledExtensionCount = (u32)extensions.size();
+	createInfo.ppEnabledExtensionNames = extensions.data();
 
 	if (mySettings.validation)
 	{
@@ -998,6 +1378,24 @@ bool frostwave::VkFramework::CreateLogicalDevice()
 
 	vkGetDeviceQueue(myDevice, indices.graphicsFamily, 0, &myGraphicsQueue);
 	vkGetDeviceQueue(myDevice, indices.presentFamily, 0, &myPresentQueue);
+	vkGetDeviceQueue(myDevice, indices.transferFamily, 0, &myTransferQueue);
+
+	if (indices.transferFamily != indices.graphicsFamily)
+	{
+		INFO_LOG("Uploads run on dedicated transfer queue family %d", indices.transferFamily);
+	}
+
+	PFN_vkGetPhysicalDeviceMemoryProperties2KHR getMemoryProperties2 = nullptr;
+	if (myMemoryBudget)
+	{
+		getMemoryProperties2 = (PFN_vkGetPhysicalDeviceMemoryProperties2KHR)vkGetInstanceProcAddr(myInstance, "vkGetPhysicalDeviceMemoryProperties2KHR");
+		INFO_LOG("Device memory budget comes from VK_EXT_memory_budget");
+	}
+	myAllocator.Init(myDevice, myPhysicalDevice, getMemoryProperties2);
+	myDeletionQueue.Init(myDevice, &myAllocator);
+	myUploadContext.Init(myDevice, myGraphicsQueue, (u32)indices.graphicsFamily, myTransferQueue, (u32)indices.transferFamily);
+	myUploadContext.CreateStagingRing(&myAllocator, mySettings.stagingRingSize);
+	myDefragmenter.Init(this);
 	return true;
 }
 
@@ -1044,6 +1442,12 @@ bool frostwave::VkFramework::CreateColorResources()
 
 bool frostwave::VkFramework::RecreateSwapChain()
 {
+	// Headless images never go out of date
+	if (myHeadless)
+	{
+		return true;
+	}
+
 	int width = 0, height = 0;
 	while (width == 0 || height == 0)
 	{
@@ -1051,8 +1455,7 @@ bool frostwave::VkFramework::RecreateSwapChain()
 		glfwWaitEvents();
 	}
 
-	vkDeviceWaitIdle(myDevice);
-
+	// Frames in flight keep what they use alive through the deletion queue, so there is nothing to wait for
 	CleanupSwapChain();
 
 	CreateSwapChain();
@@ -1077,28 +1480,46 @@ bool frostwave::VkFramework::CleanupSwapChain()
 
 	for (size_t i = 0; i < mySwapChainFramebuffers.size(); ++i)
 	{
-		vkDestroyFramebuffer(myDevice, mySwapChainFramebuffers[i], nullptr);
+		myDeletionQueue.Retire(mySwapChainFramebuffers[i]);
 	}
 
-	vkFreeCommandBuffers(myDevice, myCommandPool, (u32)myCommandBuffers.size(), myCommandBuffers.data());
+	for (size_t i = 0; i < myCommandBuffers.size(); ++i)
+	{
+		myDeletionQueue.Retire(myCommandPool, myCommandBuffers[i]);
+		myDeletionQueue.Retire(myCommandPool, mySecondaryCommandBuffers[i]);
+	}
 
-	vkDestroyPipeline(myDevice, myGraphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(myDevice, myPipelineLayout, nullptr);
-	vkDestroyRenderPass(myDevice, myRenderPass, nullptr);
+	myDeletionQueue.Retire(myGraphicsPipeline);
+	myDeletionQueue.Retire(myPipelineLayout);
+	myDeletionQueue.Retire(myRenderPass);
 
 	for (size_t i = 0; i < mySwapChainImageViews.size(); ++i)
 	{
-		vkDestroyImageView(myDevice, mySwapChainImageViews[i], nullptr);
+		myDeletionQueue.Retire(mySwapChainImageViews[i]);
 	}
 
-	vkDestroySwapchainKHR(myDevice, mySwapChain, nullptr);
+	if (myHeadless)
+	{
+		for (size_t i = 0; i < mySwapChainImages.size(); ++i)
+		{
+			myDeletionQueue.Retire(mySwapChainImages[i]);
+			myDeletionQueue.Retire(myHeadlessMemory[i]);
+		}
+		mySwapChainImages.clear();
+		myHeadlessMemory.clear();
+	}
+	else
+	{
+		// The handle stays set, CreateSwapChain passes it on as the old swapchain
+		myDeletionQueue.Retire(mySwapChain);
+	}
 
 	VERBOSE_LOG("Cleaned up swapchain");
 
 	return true;
 }
 
-void frostwave::VkFramework::CreateImage(u32 aWidth, u32 aHeight, u32 aMipLevels, VkSampleCountFlagBits aNumSamples, VkFormat aFormat, VkImageTiling aTiling, VkImageUsageFlags aUsage, VkMemoryPropertyFlags aProperties, VkImage& aImage, VkDeviceMemory& aImageMemory)
+void frostwave::VkFramework::CreateImage(u32 aWidth, u32 aHeight, u32 aMipLevels, VkSampleCountFlagBits aNumSamples, VkFormat aFormat, VkImageTiling aTiling, VkImageUsageFlags aUsage, VkMemoryPropertyFlags aProperties, MemoryCategory aCategory, VkImage& aImage, MemoryAllocation*& aAllocation)
 {
 	VkImageCreateInfo imageInfo = {};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1122,22 +1543,7 @@ void frostwave::VkFramework::CreateImage(u32 aWidth, u32 aHeight, u32 aMipLevels
 		FATAL_LOG("Failed to create image!");
 	}
 
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(myDevice, aImage, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = FindMemoryType(myPhysicalDevice, memRequirements.memoryTypeBits, aProperties);
-
-	result = vkAllocateMemory(myDevice, &allocInfo, nullptr, &aImageMemory);
-
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to allocate image memory!");
-	}
-
-	vkBindImageMemory(myDevice, aImage, aImageMemory, 0);
+	aAllocation = myAllocator.AllocateImage(aImage, aProperties, aCategory);
 }
 
 VkImageView frostwave::VkFramework::CreateImageView(VkImage aImage, VkFormat aFormat, VkImageAspectFlags aAspectFlags, u32 aMipLevels)
@@ -1164,7 +1570,7 @@ VkImageView frostwave::VkFramework::CreateImageView(VkImage aImage, VkFormat aFo
 
 void frostwave::VkFramework::TransitionImageLayout(VkImage aImage, VkFormat aFormat, VkImageLayout aOldLayout, VkImageLayout aNewLayout, u32 aMipLevels)
 {
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands(this);
+	VkCommandBuffer commandBuffer = myUploadContext.GetCommandBuffer();
 
 	VkImageMemoryBarrier barrier = {};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1231,8 +1637,6 @@ void frostwave::VkFramework::TransitionImageLayout(VkImage aImage, VkFormat aFor
 	}
 
 	vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-	EndSingleTimeCommands(commandBuffer, this);
 }
 
 VkSampleCountFlagBits frostwave::VkFramework::GetMaxUsableSampleCount()
@@ -1264,7 +1668,8 @@ i32 frostwave::VkFramework::RateDeviceSuitability(VkPhysicalDevice aDevice)
 
 	score += deviceProperties.limits.maxImageDimension2D;
 
-	if (!deviceFeatures.geometryShader)
+	// Nothing draws with geometry shaders, and software rasterizers used for headless runs may not have them
+	if (!deviceFeatures.geometryShader && !myHeadless)
 	{
 		return 0;
 	}
@@ -1310,8 +1715,16 @@ frostwave::QueueFamilyIndices frostwave::VkFramework::FindQueueFamily(VkPhysical
 
 	for (i32 i = 0; i < queueFamilies.size(); ++i)
 	{
+		// Without a surface the graphics queue doubles as the present queue, which then is never presented on
 		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(aDevice, i, mySurface, &presentSupport);
+		if (myHeadless)
+		{
+			presentSupport = (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+		}
+		else
+		{
+			vkGetPhysicalDeviceSurfaceSupportKHR(aDevice, i, mySurface, &presentSupport);
+		}
 
 		if (queueFamilies[i].queueCount > 0 && presentSupport)
 		{
@@ -1329,6 +1742,25 @@ frostwave::QueueFamilyIndices frostwave::VkFramework::FindQueueFamily(VkPhysical
 		}
 	}
 
+	// A family with transfer but no graphics is backed by the copy engines, preferably one without compute as well
+	indices.transferFamily = indices.graphicsFamily;
+	if (mySettings.transferQueue)
+	{
+		for (i32 i = 0; i < queueFamilies.size(); ++i)
+		{
+			const VkQueueFlags flags = queueFamilies[i].queueFlags;
+			if (queueFamilies[i].queueCount == 0 || !(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT))
+			{
+				continue;
+			}
+
+			if (indices.transferFamily == indices.graphicsFamily || !(flags & VK_QUEUE_COMPUTE_BIT))
+			{
+				indices.transferFamily = i;
+			}
+		}
+	}
+
 	return indices;
 }
 
@@ -1337,8 +1769,8 @@ bool frostwave::VkFramework::IsDeviceSuitable(VkPhysicalDevice aDevice)
 	QueueFamilyIndices indices = FindQueueFamily(aDevice);
 	bool extensionsSupported = CheckDeviceExtensionSupport(aDevice);
 
-	bool swapChainAdequate = false;
-	if (extensionsSupported)
+	bool swapChainAdequate = myHeadless;
+	if (extensionsSupported && !myHeadless)
 	{
 		SwapChainSupportDetails swapChainSupport = QuerySwapChainSupport(aDevice);
 		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
@@ -1357,7 +1789,8 @@ bool frostwave::VkFramework::CheckDeviceExtensionSupport(VkPhysicalDevice aDevic
 
 	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
 	vkEnumerateDeviceExtensionProperties(aDevice, nullptr, &extensionCount, availableExtensions.data());
-	std::set<string> requiredExtensions(DeviceExtensions.begin(), DeviceExtensions.end());
+	std::vector<const char*> deviceExtensions = GetDeviceExtensions();
+	std::set<string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
 
 	for (const auto& extension : availableExtensions)
 	{
@@ -1367,6 +1800,15 @@ bool frostwave::VkFramework::CheckDeviceExtensionSupport(VkPhysicalDevice aDevic
 	return requiredExtensions.empty();
 }
 
+std::vector<const char*> frostwave::VkFramework::GetDeviceExtensions() const
+{
+	if (myHeadless)
+	{
+		return { };
+	}
+	return DeviceExtensions;
+}
+
 VkSurfaceFormatKHR frostwave::VkFramework::ChooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& aAvailableFormats)
 {
 	if (aAvailableFormats.size() == 1 && aAvailableFormats[0].format == VK_FORMAT_UNDEFINED)
@@ -14,6 +14,11 @@
 #include "VulkanBuffer.h"
 //#include "Texture.h"
 #include "Model.h"
+#include "FrameCounters.h"
+#include "MemoryAllocator.h"
+#include "DeletionQueue.h"
+#include "UploadContext.h"
+#include "Defragmenter.h"
 
 inline fw::VertexLayout layout = fw::VertexLayout({
 	fw::VERTEX_COMPONENT_POSITION,
@@ -28,6 +33,7 @@ namespace frostwave
 	{
 		i32 graphicsFamily = -1;
 		i32 presentFamily = -1;
+		i32 transferFamily = -1; // the graphics family when there is no dedicated one
 
 		bool IsComplete()
 		{
@@ -45,16 +51,24 @@ namespace frostwave
 	class VkFramework
 	{
 	public:
-		VkFramework() : myPhysicalDevice(VK_NULL_HANDLE), myCurrentFrame(0), myFramebufferResized(false), myMSAASamples(VK_SAMPLE_COUNT_1_BIT) {}
+		VkFramework() : myPhysicalDevice(VK_NULL_HANDLE), mySurface(VK_NULL_HANDLE), mySwapChain(VK_NULL_HANDLE), myCurrentFrame(0), myFrameNumber(0), myFramesInFlight(1), myPipelineStatisticsPool(VK_NULL_HANDLE), myFramebufferResized(false), myMemoryBudget(false), myHeadless(false), myMSAASamples(VK_SAMPLE_COUNT_1_BIT) {}
 		~VkFramework();
 		void Init(GLFWwindow* aWindow, GraphicsSettings aSettings);
+		// No window, surface or swapchain. Frames render into offscreen images that stand in for the swapchain images
+		void InitHeadless(u32 aWidth, u32 aHeight, GraphicsSettings aSettings);
 		u32 BeginFrame();
 		bool EndFrame(u32 aIndex, VkSemaphore aSignalSemaphore);
 
+		// Also destroys everything in the deletion queue, the device has nothing left that could use it
 		void WaitIdle();
 
 		void SetFramebufferResized(bool aResized);
 
+		const GraphicsSettings& GetSettings() const;
+
+		u32 GetFramesInFlight() const;
+		u32 GetCurrentFrame() const;
+
 		VkDevice GetDevice() const;
 		VkPhysicalDevice GetPhysicalDevice() const;
 
@@ -65,17 +79,50 @@ namespace frostwave
 
 		const VkDescriptorSetLayout& GetDescriptorSetLayout() const;
 		VkDescriptorPool& GetDescriptorPool();
+		// From the current pool, or from a new one once it has run out. aPool is where the set has to be freed to
+		VkDescriptorSet AllocateDescriptorSet(VkDescriptorSetLayout aLayout, VkDescriptorPool* aPool);
 
 		VkPipeline GetPipeline() const;
 		VkPipelineLayout GetPipelineLayout() const;
 
 		VkSampleCountFlagBits GetMSAASamples() const;
+		const VkPhysicalDeviceFeatures& GetEnabledFeatures() const;
 
 		QueueFamilyIndices GetQueueFamilyIndices() const;
 
+		// Where objects that frames in flight may still use are released to, instead of destroying them right away.
+		// Retiring doesn't change anything the framework exposes, so it is available through const framework pointers too
+		DeletionQueue& GetDeletionQueue() const;
+		// Where loaders record copies and transitions, same const access as the deletion queue.
+		// The open batch is submitted at the start of every frame, ahead of the frame's own work
+		UploadContext& GetUploadContext() const;
+		// Where buffers and images get their device memory from, same const access as the deletion queue.
+		// Also keeps the per category accounting, and the memory budget refreshed at the start of every frame
+		MemoryAllocator& GetAllocator() const;
+		// Moves registered resources between memory blocks at the start of every frame, same const access
+		Defragmenter& GetDefragmenter() const;
+
 		VkCommandBufferInheritanceInfo BeginCommandBufferRecording(u32 aImageIndex, VkRenderPassBeginInfo aRenderPassInfo);
 		bool EndCommandBufferRecording(u32 aImageIndex, std::vector<VkCommandBuffer> aSecondaryCommands);
 
+		// Counters of the frame being built, anything issuing Vulkan work adds to these
+		FrameCounters& GetFrameCounters();
+		// Counters of the last presented frame
+		const FrameCounters& GetLastFrameCounters() const;
+
+		// One pipeline statistics query per pass and frame in flight. The frame's primary is pass 0, further primaries use their own.
+		// Queries are reset by the frame's primary, so only passes submitted after it in the same frame can use them
+		static constexpr u32 PipelineStatisticsPasses = 2;
+		bool HasPipelineStatistics() const;
+		// Set as VkCommandBufferInheritanceInfo::pipelineStatistics by secondaries that run while a query is active
+		VkQueryPipelineStatisticFlags GetPipelineStatisticFlags() const;
+		void BeginPipelineStatistics(VkCommandBuffer aCommandBuffer, u32 aFrameIndex, u32 aPass);
+		void EndPipelineStatistics(VkCommandBuffer aCommandBuffer, u32 aFrameIndex, u32 aPass);
+
+		bool IsHeadless() const;
+		// Layout the swapchain images are left in at the end of a frame
+		VkImageLayout GetPresentLayout() const;
+
 		u32 GetFrameBufferCount();
 		VkExtent2D GetSwapchainExtent() const;
 		VkFormat FindDepthFormat();
@@ -91,6 +138,8 @@ namespace frostwave
 
 		bool InitVulkan();
 		bool CreateSyncObjects();
+		bool CreatePipelineStatisticsQueries();
+		void CollectPipelineStatistics(u32 aFrameIndex);
 		bool CreateCommandBuffers();
 		bool CreateCommandPool();
 		bool CreateFrameBuffers();
@@ -101,6 +150,8 @@ namespace frostwave
 		bool CreateGraphicsPipeline();
 		bool CreateImageViews();
 		bool CreateSwapChain();
+		bool CreateHeadlessImages();
+		std::vector<const char*> GetDeviceExtensions() const;
 		bool CreateSurface();
 		bool CreateLogicalDevice();
 		bool CreateTexture();
@@ -110,7 +161,7 @@ namespace frostwave
 		bool RecreateSwapChain();
 		bool CleanupSwapChain();
 
-		void CreateImage(u32 aWidth, u32 aHeight, u32 aMipLevels, VkSampleCountFlagBits aNumSamples, VkFormat aFormat, VkImageTiling aTiling, VkImageUsageFlags aUsage, VkMemoryPropertyFlags aProperties, VkImage& aImage, VkDeviceMemory& aImageMemory);
+		void CreateImage(u32 aWidth, u32 aHeight, u32 aMipLevels, VkSampleCountFlagBits aNumSamples, VkFormat aFormat, VkImageTiling aTiling, VkImageUsageFlags aUsage, VkMemoryPropertyFlags aProperties, MemoryCategory aCategory, VkImage& aImage, MemoryAllocation*& aAllocation);
 		VkImageView CreateImageView(VkImage aImage, VkFormat aFormat, VkImageAspectFlags aAspectFlags, u32 aMipLevels);
 
 		void TransitionImageLayout(VkImage aImage, VkFormat aFormat, VkImageLayout aOldLayout, VkImageLayout aNewLayout, u32 aMipLevels);
@@ -140,8 +191,9 @@ namespace frostwave
 		VkInstance myInstance;
 		VkDebugUtilsMessengerEXT myDebugMessenger;
 		VkPhysicalDevice myPhysicalDevice;
+		VkPhysicalDeviceFeatures myEnabledFeatures;
 		VkDevice myDevice;
-		VkQueue myGraphicsQueue, myPresentQueue;
+		VkQueue myGraphicsQueue, myPresentQueue, myTransferQueue;
 		VkSurfaceKHR mySurface;
 
 		VkSwapchainKHR mySwapChain;
@@ -152,6 +204,8 @@ namespace frostwave
 
 		VkRenderPass myRenderPass;
 		VkDescriptorPool myDescriptorPool;
+		// Pools that ran out, sets retired to them are still freed there
+		std::vector<VkDescriptorPool> myFullDescriptorPools;
 		VkDescriptorSetLayout myDescriptorSetLayout;
 		VkPipelineLayout myPipelineLayout;
 		VkPipeline myGraphicsPipeline;
@@ -164,9 +218,29 @@ namespace frostwave
 		std::vector<VkSemaphore> myImageAvailableSemaphores;
 		std::vector<VkSemaphore> myRenderFinishedSemaphores;
 		std::vector<VkFence> myInFlightFences;
+		std::vector<VkFence> myImagesInFlight;
 		size_t myCurrentFrame;
+		u32 myFramesInFlight;
+		// Counts every BeginFrame, and per slot the number of the frame its fence was last submitted with
+		u64 myFrameNumber;
+		std::vector<u64> mySlotFrameNumbers;
+		mutable MemoryAllocator myAllocator;
+		mutable DeletionQueue myDeletionQueue;
+		mutable UploadContext myUploadContext;
+		mutable Defragmenter myDefragmenter;
+
+		FrameCounters myFrameCounters;
+		FrameCounters myLastFrameCounters;
+		VkQueryPool myPipelineStatisticsPool;
+		std::vector<bool> myPipelineStatisticsPending;
 
 		bool myFramebufferResized;
+		// VK_EXT_memory_budget and the instance extension it needs are both enabled
+		bool myMemoryBudget;
+
+		bool myHeadless;
+		VkExtent2D myHeadlessExtent;
+		std::vector<MemoryAllocation*> myHeadlessMemory;
 
 		VulkanImage myDepthImage;
 
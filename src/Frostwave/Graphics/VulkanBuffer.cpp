@@ -3,10 +3,11 @@
 
 #include "VkFramework.h"
 
-VkResult frostwave::CreateBuffer(const VkFramework* aFramework, VkBufferUsageFlags aUsageFlags, VkMemoryPropertyFlags aMemoryPropertyFlags, fw::Buffer * aBuffer, VkDeviceSize aSize, void * data)
+VkResult frostwave::CreateBuffer(const VkFramework* aFramework, VkBufferUsageFlags aUsageFlags, VkMemoryPropertyFlags aMemoryPropertyFlags, MemoryCategory aCategory, fw::Buffer * aBuffer, VkDeviceSize aSize, void * data)
 
 {
 	aBuffer->device = aFramework->GetDevice();
+	aBuffer->framework = aFramework;
 
 	VkBufferCreateInfo bufferCreateInfo{};
 	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -18,20 +19,9 @@ VkResult frostwave::CreateBuffer(const VkFramework* aFramework, VkBufferUsageFla
 		FATAL_LOG("Failed to create buffer");
 	}
 
-	VkMemoryRequirements memReqs;
-	VkMemoryAllocateInfo memAlloc = {};
-	memAlloc.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	vkGetBufferMemoryRequirements(aFramework->GetDevice(), aBuffer->buffer, &memReqs);
-	memAlloc.allocationSize = memReqs.size;
-	memAlloc.memoryTypeIndex = FindMemoryType(aFramework->GetPhysicalDevice(), memReqs.memoryTypeBits, aMemoryPropertyFlags);
-	result = vkAllocateMemory(aFramework->GetDevice(), &memAlloc, nullptr, &aBuffer->memory);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to allocate memory for buffer!");
-	}
+	aBuffer->allocation = aFramework->GetAllocator().AllocateBuffer(aBuffer->buffer, aMemoryPropertyFlags, aCategory);
 
-	aBuffer->alignment = memReqs.alignment;
-	aBuffer->size = memAlloc.allocationSize;
+	aBuffer->size = aSize;
 	aBuffer->usageFlags = aUsageFlags;
 	aBuffer->memoryPropertyFlags = aMemoryPropertyFlags;
 
@@ -51,14 +41,83 @@ VkResult frostwave::CreateBuffer(const VkFramework* aFramework, VkBufferUsageFla
 
 	aBuffer->SetupDescriptor();
 
-	return aBuffer->Bind();
+	return VK_SUCCESS;
+}
+
+void frostwave::Buffer::Destroy()
+{
+	mapped = nullptr;
+
+	if (framework)
+	{
+		framework->GetDefragmenter().Unregister(allocation);
+		framework->GetDeletionQueue().Retire(buffer);
+		framework->GetDeletionQueue().Retire(allocation);
+	}
+	else if (buffer)
+	{
+		// Never got memory, only CreateBuffer sets the framework
+		vkDestroyBuffer(device, buffer, nullptr);
+	}
+
+	buffer = VK_NULL_HANDLE;
+	allocation = nullptr;
+}
+
+bool frostwave::Buffer::Relocate(VkCommandBuffer aCommandBuffer)
+{
+	// A mapped pointer handed out earlier would still point at the old memory
+	assert(framework && !mapped);
+	assert((usageFlags & VK_BUFFER_USAGE_TRANSFER_SRC_BIT) && (usageFlags & VK_BUFFER_USAGE_TRANSFER_DST_BIT));
+
+	VkBufferCreateInfo bufferCreateInfo{};
+	bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferCreateInfo.usage = usageFlags;
+	bufferCreateInfo.size = size;
+	VkBuffer newBuffer;
+	if (vkCreateBuffer(device, &bufferCreateInfo, nullptr, &newBuffer) != VK_SUCCESS)
+	{
+		FATAL_LOG("Failed to create buffer");
+	}
+
+	MemoryAllocation* newAllocation = framework->GetAllocator().AllocateBufferMove(newBuffer, allocation);
+	if (!newAllocation)
+	{
+		vkDestroyBuffer(device, newBuffer, nullptr);
+		return false;
+	}
+
+	VkBufferCopy copy = {};
+	copy.size = size;
+	vkCmdCopyBuffer(aCommandBuffer, buffer, newBuffer, 1, &copy);
+
+	// The copy runs ahead of the frame's submits, which may read the new buffer any way they like
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.buffer = newBuffer;
+	barrier.size = VK_WHOLE_SIZE;
+	vkCmdPipelineBarrier(aCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+	// Frames in flight still read the old buffer
+	framework->GetDeletionQueue().Retire(buffer);
+	framework->GetDeletionQueue().Retire(allocation);
+
+	buffer = newBuffer;
+	allocation = newAllocation;
+	descriptor.buffer = newBuffer;
+	return true;
 }
 
-void frostwave::CopyBuffer(const VkFramework * aFramework, fw::Buffer * aSrc, fw::Buffer * aDst, VkBufferCopy * aCopyRegion)
+frostwave::UploadTicket frostwave::CopyBuffer(const VkFramework * aFramework, fw::Buffer * aSrc, fw::Buffer * aDst, VkBufferCopy * aCopyRegion)
 {
 	assert(aDst->size <= aSrc->size);
 	assert(aSrc->buffer);
-	VkCommandBuffer copyCmd = BeginSingleTimeCommands(aFramework);
+	UploadContext& uploadContext = aFramework->GetUploadContext();
+	VkCommandBuffer copyCmd = uploadContext.GetTransferCommandBuffer();
 	VkBufferCopy bufferCopy{};
 	if (aCopyRegion == nullptr)
 	{
@@ -70,6 +129,8 @@ void frostwave::CopyBuffer(const VkFramework * aFramework, fw::Buffer * aSrc, fw
 	}
 
 	vkCmdCopyBuffer(copyCmd, aSrc->buffer, aDst->buffer, 1, &bufferCopy);
+	// How the destination gets read isn't known here
+	uploadContext.ReleaseToGraphics(aDst->buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_ACCESS_MEMORY_READ_BIT);
 
-	EndSingleTimeCommands(copyCmd, aFramework);
+	return uploadContext.GetTicket();
 }
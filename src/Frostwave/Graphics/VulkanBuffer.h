@@ -2,39 +2,41 @@
 
 #include <vulkan/vulkan.h>
 
+#include "UploadContext.h"
+#include "MemoryAllocator.h"
+
 namespace frostwave
 {
 	class VkFramework;
 	struct Buffer
 	{
 		VkDevice device;
+		const VkFramework* framework = nullptr;
 		VkBuffer buffer = VK_NULL_HANDLE;
-		VkDeviceMemory memory = VK_NULL_HANDLE;
+		MemoryAllocation* allocation = nullptr;
 		VkDescriptorBufferInfo descriptor;
 		VkDeviceSize size = 0;
-		VkDeviceSize alignment = 0;
 		void* mapped = nullptr;
 
 		VkBufferUsageFlags usageFlags;
 		VkMemoryPropertyFlags memoryPropertyFlags;
 
+		// Host visible memory stays mapped by the allocator, this only hands out the pointer
 		VkResult Map(VkDeviceSize aSize = VK_WHOLE_SIZE, VkDeviceSize aOffset = 0)
 		{
-			return vkMapMemory(device, memory, aOffset, aSize, 0, &mapped);
-		}
-
-		void Unmap()
-		{
-			if (mapped)
+			if (!allocation || !allocation->mapped)
 			{
-				vkUnmapMemory(device, memory);
-				mapped = nullptr;
+				return VK_ERROR_MEMORY_MAP_FAILED;
 			}
+			// The whole allocation is already mapped, the range only has to fit in it
+			assert(aSize == VK_WHOLE_SIZE ? aOffset <= allocation->size : aOffset + aSize <= allocation->size);
+			mapped = allocation->mapped + aOffset;
+			return VK_SUCCESS;
 		}
 
-		VkResult Bind(VkDeviceSize aOffset = 0)
+		void Unmap()
 		{
-			return vkBindBufferMemory(device, buffer, memory, aOffset);
+			mapped = nullptr;
 		}
 
 		void SetupDescriptor(VkDeviceSize aSize = VK_WHOLE_SIZE, VkDeviceSize aOffset = 0)
@@ -54,9 +56,9 @@ namespace frostwave
 		{
 			VkMappedMemoryRange mappedRange = {};
 			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-			mappedRange.memory = memory;
-			mappedRange.offset = aOffset;
-			mappedRange.size = aSize;
+			mappedRange.memory = allocation->memory;
+			mappedRange.offset = allocation->offset + aOffset;
+			mappedRange.size = aSize == VK_WHOLE_SIZE ? allocation->size - aOffset : aSize;
 			return vkFlushMappedMemoryRanges(device, 1, &mappedRange);
 		}
 
@@ -64,20 +66,22 @@ namespace frostwave
 		{
 			VkMappedMemoryRange mappedRange = {};
 			mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-			mappedRange.memory = memory;
-			mappedRange.offset = aOffset;
-			mappedRange.size = aSize;
+			mappedRange.memory = allocation->memory;
+			mappedRange.offset = allocation->offset + aOffset;
+			mappedRange.size = aSize == VK_WHOLE_SIZE ? allocation->size - aOffset : aSize;
 			return vkInvalidateMappedMemoryRanges(device, 1, &mappedRange);
 		}
 
-		void Destroy()
-		{
-			if (buffer) vkDestroyBuffer(device, buffer, nullptr);
-			if (memory) vkFreeMemory(device, memory, nullptr);
-		}
+		// Retired to the framework's deletion queue, frames in flight may still read the buffer
+		void Destroy();
+
+		// Copies the contents into a new buffer in another memory block and swaps it in, the old one is retired.
+		// Needs transfer source and destination usage, false when no other block has room
+		bool Relocate(VkCommandBuffer aCommandBuffer);
 	};
 
-	VkResult CreateBuffer(const VkFramework* aFramework, VkBufferUsageFlags aUsageFlags, VkMemoryPropertyFlags aMemoryPropertyFlags, Buffer* aBuffer, VkDeviceSize aSize, void *data = nullptr);
+	VkResult CreateBuffer(const VkFramework* aFramework, VkBufferUsageFlags aUsageFlags, VkMemoryPropertyFlags aMemoryPropertyFlags, MemoryCategory aCategory, Buffer* aBuffer, VkDeviceSize aSize, void *data = nullptr);
 
-	void CopyBuffer(const VkFramework* aFramework, Buffer* aSrc, Buffer* aDst, VkBufferCopy* aCopyRegion = nullptr);
+	// Recorded into the framework's upload batch, aSrc has to stay alive until the returned ticket completes
+	UploadTicket CopyBuffer(const VkFramework* aFramework, Buffer* aSrc, Buffer* aDst, VkBufferCopy* aCopyRegion = nullptr);
 }
\ No newline at end of file
@@ -10,13 +10,13 @@
 
 frostwave::VulkanImage::VulkanImage() :
 	myImage(VK_NULL_HANDLE), myImageView(VK_NULL_HANDLE),
-	myImageMemory(VK_NULL_HANDLE), mySampler(VK_NULL_HANDLE), 
-	myFramework(nullptr), myMipLevels(1)
+	myAllocation(nullptr), mySampler(VK_NULL_HANDLE), 
+	myFramework(nullptr), myMipLevels(1), myUploadTicket(0)
 {
 }
 
 frostwave::VulkanImage::VulkanImage(const VkFramework* aFramework, const ImageCreateInfo& aCreateInfo)
-	: myImage(VK_NULL_HANDLE), myImageView(VK_NULL_HANDLE), myImageMemory(VK_NULL_HANDLE), mySampler(VK_NULL_HANDLE), myMipLevels(1)
+	: myImage(VK_NULL_HANDLE), myImageView(VK_NULL_HANDLE), myAllocation(nullptr), mySampler(VK_NULL_HANDLE), myMipLevels(1), myUploadTicket(0)
 {
 	Create(myFramework, aCreateInfo);
 }
@@ -37,11 +37,12 @@ frostwave::VulkanImage& frostwave::VulkanImage::operator=(const VulkanImage& aOt
 	myFormat = aOther.myFormat;
 	myImage = aOther.myImage;
 	myImageView = aOther.myImageView;
-	myImageMemory = aOther.myImageMemory;
+	myAllocation = aOther.myAllocation;
 	myType = aOther.myType;
 	myFilePath = aOther.myFilePath;
 	mySampler = aOther.mySampler;
 	myFramework = aOther.myFramework;
+	myUploadTicket = aOther.myUploadTicket;
 
 	return *this;
 }
@@ -57,15 +58,16 @@ frostwave::VulkanImage& frostwave::VulkanImage::operator=(VulkanImage&& aOther)
 	myFormat = aOther.myFormat;
 	myImage = aOther.myImage;
 	myImageView = aOther.myImageView;
-	myImageMemory = aOther.myImageMemory;
+	myAllocation = aOther.myAllocation;
 	myType = aOther.myType;
 	myFilePath = aOther.myFilePath;
 	mySampler = aOther.mySampler;
 	myFramework = aOther.myFramework;
+	myUploadTicket = aOther.myUploadTicket;
 
 	aOther.myImageView = VK_NULL_HANDLE;
 	aOther.myImage = VK_NULL_HANDLE;
-	aOther.myImageMemory = VK_NULL_HANDLE;
+	aOther.myAllocation = nullptr;
 	aOther.mySampler = VK_NULL_HANDLE;
 
 	return *this;
@@ -86,9 +88,19 @@ VkSampler frostwave::VulkanImage::GetSampler()
 	return mySampler;
 }
 
+frostwave::UploadTicket frostwave::VulkanImage::GetUploadTicket() const
+{
+	return myUploadTicket;
+}
+
+const frostwave::MemoryAllocation* frostwave::VulkanImage::GetAllocation() const
+{
+	return myAllocation;
+}
+
 void frostwave::VulkanImage::Create(const VkFramework* aFramework, const ImageCreateInfo& aCreateInfo)
 {
-	if (myImage != VK_NULL_HANDLE || myImageView != VK_NULL_HANDLE || myImageMemory != VK_NULL_HANDLE || mySampler != VK_NULL_HANDLE) Destroy();
+	if (myImage != VK_NULL_HANDLE || myImageView != VK_NULL_HANDLE || myAllocation != nullptr || mySampler != VK_NULL_HANDLE) Destroy();
 
 	myFramework = aFramework;
 	myType = aCreateInfo.type;
@@ -108,9 +120,9 @@ void frostwave::VulkanImage::Create(const VkFramework* aFramework, const ImageCr
 		range.baseMipLevel = 0;
 		range.layerCount = 1;
 		range.levelCount = myMipLevels;
-		auto cmd = BeginSingleTimeCommands(myFramework);
-		TransitionImageLayout(cmd, myImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, range);
-		EndSingleTimeCommands(cmd, myFramework);
+		UploadContext& uploadContext = myFramework->GetUploadContext();
+		TransitionImageLayout(uploadContext.GetCommandBuffer(), myImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, range);
+		myUploadTicket = uploadContext.GetTicket();
 	} break;
 	case frostwave::ImageType::Texture:
 	{
@@ -134,15 +146,9 @@ void frostwave::VulkanImage::Create(const VkFramework* aFramework, const ImageCr
 			FATAL_LOG("Failed to load texture image!");
 		}
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingBufferMemory;
-
-		CreateBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-		void* data;
-		vkMapMemory(myFramework->GetDevice(), stagingBufferMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixels, (size_t)imageSize);
-		vkUnmapMemory(myFramework->GetDevice(), stagingBufferMemory);
+		UploadContext& uploadContext = myFramework->GetUploadContext();
+		StagingAllocation staging = uploadContext.AllocateStaging(imageSize);
+		memcpy(staging.data, pixels, (size_t)imageSize);
 
 		stbi_image_free(pixels);
 
@@ -155,10 +161,8 @@ void frostwave::VulkanImage::Create(const VkFramework* aFramework, const ImageCr
 		range.layerCount = 1;
 		range.levelCount = myMipLevels;
 
-		auto cmd = BeginSingleTimeCommands(myFramework);
-		TransitionImageLayout(cmd, myImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range);
-		EndSingleTimeCommands(cmd, myFramework);
-		CopyBufferToImage(stagingBuffer, myImage, (u32)texWidth, (u32)texHeight);
+		TransitionImageLayout(uploadContext.GetTransferCommandBuffer(), myImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range);
+		CopyBufferToImage(staging.buffer, staging.offset, myImage, (u32)texWidth, (u32)texHeight);
 
 		if (!aCreateInfo.generateMips)
 		{
@@ -169,17 +173,16 @@ void frostwave::VulkanImage::Create(const VkFramework* aFramework, const ImageCr
 			range.baseMipLevel = 0;
 			range.layerCount = 1;
 			range.levelCount = myMipLevels;
-			auto cmd = BeginSingleTimeCommands(myFramework);
-			TransitionImageLayout(cmd, myImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range);
-			EndSingleTimeCommands(cmd, myFramework);
+			uploadContext.ReleaseToGraphics(myImage, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
 		}
 		else
 		{
+			// Blits need a graphics queue, so every level moves over still as a transfer destination
+			uploadContext.ReleaseToGraphics(myImage, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT);
 			GenerateMipmaps();
 		}
 
-		vkDestroyBuffer(myFramework->GetDevice(), stagingBuffer, nullptr);
-		vkFreeMemory(myFramework->GetDevice(), stagingBufferMemory, nullptr);
+		myUploadTicket = uploadContext.GetTicket();
 
 		CreateImageView();
 		CreateImageSampler();
@@ -196,35 +199,93 @@ void frostwave::VulkanImage::Create(const VkFramework* aFramework, const ImageCr
 
 void frostwave::VulkanImage::Destroy()
 {
-	VkDevice device = myFramework->GetDevice();
+	// Frames in flight may still sample or render to the image
+	DeletionQueue& deletionQueue = myFramework->GetDeletionQueue();
+	myFramework->GetDefragmenter().Unregister(myAllocation);
+
+	if (mySampler != VK_NULL_HANDLE) { deletionQueue.Retire(mySampler); mySampler = VK_NULL_HANDLE; }
+	if (myImageView != VK_NULL_HANDLE) { deletionQueue.Retire(myImageView); myImageView = VK_NULL_HANDLE; }
+	if (myImage != VK_NULL_HANDLE) { deletionQueue.Retire(myImage); myImage = VK_NULL_HANDLE; }
+	if (myAllocation != nullptr) { deletionQueue.Retire(myAllocation); myAllocation = nullptr; }
+}
+
+bool frostwave::VulkanImage::Relocate(VkCommandBuffer aCommandBuffer)
+{
+	// Attachments are in whatever layout the last frame left them, only uploaded textures have a known one
+	assert(myType == ImageType::Texture);
 
-	if (mySampler != VK_NULL_HANDLE) { vkDestroySampler(device, mySampler, nullptr); mySampler = VK_NULL_HANDLE; }
-	if (myImageView != VK_NULL_HANDLE) { vkDestroyImageView(device, myImageView, nullptr); myImageView = VK_NULL_HANDLE; }
-	if (myImage != VK_NULL_HANDLE) { vkDestroyImage(device, myImage, nullptr); myImage = VK_NULL_HANDLE; }
-	if (myImageMemory != VK_NULL_HANDLE) { vkFreeMemory(device, myImageMemory, nullptr); myImageMemory = VK_NULL_HANDLE; }
+	VkMemoryPropertyFlags properties;
+	VkImage newImage = CreateImageHandle(properties);
+	MemoryAllocation* newAllocation = myFramework->GetAllocator().AllocateImageMove(newImage, myAllocation);
+	if (!newAllocation)
+	{
+		vkDestroyImage(myFramework->GetDevice(), newImage, nullptr);
+		return false;
+	}
+
+	VkImageSubresourceRange range = { };
+	range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	range.baseMipLevel = 0;
+	range.levelCount = myMipLevels;
+	range.baseArrayLayer = 0;
+	range.layerCount = 1;
+
+	TransitionImageLayout(aCommandBuffer, myImage, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, range);
+	TransitionImageLayout(aCommandBuffer, newImage, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, range);
+
+	std::vector<VkImageCopy> regions(myMipLevels);
+	for (u32 i = 0; i < myMipLevels; ++i)
+	{
+		VkImageCopy& region = regions[i];
+		region = { };
+		region.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1 };
+		region.dstSubresource = region.srcSubresource;
+		region.extent = { fw::Max(myExtent.width >> i, 1u), fw::Max(myExtent.height >> i, 1u), 1 };
+	}
+	vkCmdCopyImage(aCommandBuffer, myImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (u32)regions.size(), regions.data());
+
+	TransitionImageLayout(aCommandBuffer, newImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, range);
+
+	// Frames in flight still sample the old image through the old view
+	DeletionQueue& deletionQueue = myFramework->GetDeletionQueue();
+	deletionQueue.Retire(myImageView);
+	deletionQueue.Retire(myImage);
+	deletionQueue.Retire(myAllocation);
+
+	myImage = newImage;
+	myAllocation = newAllocation;
+	CreateImageView();
+	return true;
 }
 
 void frostwave::VulkanImage::CreateImage()
+{
+	VkMemoryPropertyFlags properties;
+	myImage = CreateImageHandle(properties);
+	const MemoryCategory category = myType == ImageType::Texture ? MemoryCategory::Texture : MemoryCategory::RenderTarget;
+	myAllocation = myFramework->GetAllocator().AllocateImage(myImage, properties, category);
+}
+
+VkImage frostwave::VulkanImage::CreateImageHandle(VkMemoryPropertyFlags& aProperties) const
 {
 	VkImageTiling tiling;
 	VkImageUsageFlags usage;
-	VkMemoryPropertyFlags properties;
 	switch (myType)
 	{
 	case frostwave::ImageType::Depth:
 		tiling = VK_IMAGE_TILING_OPTIMAL;
 		usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-		properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		aProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 		break;
 	case frostwave::ImageType::Texture:
 		tiling = VK_IMAGE_TILING_OPTIMAL;
 		usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-		properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		aProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 		break;
 	case frostwave::ImageType::ColorAttachment:
 		tiling = VK_IMAGE_TILING_OPTIMAL;
 		usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-		properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		aProperties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
 		break;
 	}
 
@@ -245,28 +306,13 @@ void frostwave::VulkanImage::CreateImage()
 
 	VkDevice device = myFramework->GetDevice();
 
-	VkResult result = vkCreateImage(device, &imageInfo, nullptr, &myImage);
+	VkImage image;
+	VkResult result = vkCreateImage(device, &imageInfo, nullptr, &image);
 	if (result != VK_SUCCESS)
 	{
 		FATAL_LOG("Failed to create image!");
 	}
-
-	VkMemoryRequirements memRequirements;
-	vkGetImageMemoryRequirements(device, myImage, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = FindMemoryType(myFramework->GetPhysicalDevice(), memRequirements.memoryTypeBits, properties);
-
-	result = vkAllocateMemory(device, &allocInfo, nullptr, &myImageMemory);
-
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to allocate image memory!");
-	}
-
-	vkBindImageMemory(device, myImage, myImageMemory, 0);
+	return image;
 }
 
 void frostwave::VulkanImage::CreateImageView()
@@ -359,7 +405,7 @@ void frostwave::VulkanImage::GenerateMipmaps()
 		FATAL_LOG("Texture image does not support linear blitting!");
 	}
 
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands(myFramework);
+	VkCommandBuffer commandBuffer = myFramework->GetUploadContext().GetCommandBuffer();
 
 	VkImageMemoryBarrier barrier = {};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -418,16 +464,14 @@ void frostwave::VulkanImage::GenerateMipmaps()
 	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 
 	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-	EndSingleTimeCommands(commandBuffer, myFramework);
 }
 
-void frostwave::VulkanImage::CopyBufferToImage(VkBuffer aBuffer, VkImage aImage, u32 aWidth, u32 aHeight)
+void frostwave::VulkanImage::CopyBufferToImage(VkBuffer aBuffer, VkDeviceSize aOffset, VkImage aImage, u32 aWidth, u32 aHeight)
 {
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands(myFramework);
+	VkCommandBuffer commandBuffer = myFramework->GetUploadContext().GetTransferCommandBuffer();
 
 	VkBufferImageCopy region = {};
-	region.bufferOffset = 0;
+	region.bufferOffset = aOffset;
 	region.bufferRowLength = 0;
 	region.bufferImageHeight = 0;
 
@@ -440,52 +484,5 @@ void frostwave::VulkanImage::CopyBufferToImage(VkBuffer aBuffer, VkImage aImage,
 	region.imageExtent = { aWidth, aHeight, 1 };
 
 	vkCmdCopyBufferToImage(commandBuffer, aBuffer, aImage, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-	EndSingleTimeCommands(commandBuffer, myFramework);
-}
-
-void frostwave::VulkanImage::CopyBuffer(VkBuffer aSourceBuffer, VkBuffer aDestinationBuffer, VkDeviceSize aSize)
-{
-	VkCommandBuffer commandBuffer = BeginSingleTimeCommands(myFramework);
-
-	VkBufferCopy copyRegion = {};
-	copyRegion.srcOffset = 0;
-	copyRegion.dstOffset = 0;
-	copyRegion.size = aSize;
-	vkCmdCopyBuffer(commandBuffer, aSourceBuffer, aDestinationBuffer, 1, &copyRegion);
-
-	EndSingleTimeCommands(commandBuffer, myFramework);
-}
-
-void frostwave::VulkanImage::CreateBuffer(VkDeviceSize aSize, VkBufferUsageFlags aUsage, VkMemoryPropertyFlags aProperties, VkBuffer& aBuffer, VkDeviceMemory& aBufferMemory)
-{
-	VkBufferCreateInfo bufferInfo = {};
-	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-	bufferInfo.size = aSize;
-	bufferInfo.usage = aUsage;
-	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-
-	VkResult result = vkCreateBuffer(myFramework->GetDevice(), &bufferInfo, nullptr, &aBuffer);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to create buffer!");
-	}
-
-	VkMemoryRequirements memRequirements;
-	vkGetBufferMemoryRequirements(myFramework->GetDevice(), aBuffer, &memRequirements);
-
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = FindMemoryType(myFramework->GetPhysicalDevice(), memRequirements.memoryTypeBits, aProperties);
-
-	result = vkAllocateMemory(myFramework->GetDevice(), &allocInfo, nullptr, &aBufferMemory);
-	if (result != VK_SUCCESS)
-	{
-		FATAL_LOG("Failed to allocate vertex buffer memory!");
-	}
-
-	vkBindBufferMemory(myFramework->GetDevice(), aBuffer, aBufferMemory, 0);
-
 }
 
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <Frostwave/Core/Types.h>
+#include <Frostwave/Graphics/UploadContext.h>
+#include <Frostwave/Graphics/MemoryAllocator.h>
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -44,26 +46,32 @@ namespace frostwave
 		VkImage GetImage();
 		VkImageView GetImageView();
 		VkSampler GetSampler();
+		// Batch that writes the image's contents and initial layout, usable by frames begun after it was submitted
+		UploadTicket GetUploadTicket() const;
+		const MemoryAllocation* GetAllocation() const;
 
 		void Create(const VkFramework* aFramework, const ImageCreateInfo& aCreateInfo);
 		void Destroy();
 
+		// Copies a texture into a new image in another memory block and swaps it and its view in, the old ones are retired.
+		// The upload has to be complete, false when no other block has room
+		bool Relocate(VkCommandBuffer aCommandBuffer);
+
 	private:
 		void CreateImage();
+		VkImage CreateImageHandle(VkMemoryPropertyFlags& aProperties) const;
 		void CreateImageView();
 		void CreateImageSampler();
 
 		void GenerateMipmaps();
 
-		void CopyBufferToImage(VkBuffer aBuffer, VkImage aImage, u32 aWidth, u32 aHeight);
-		void CopyBuffer(VkBuffer aSourceBuffer, VkBuffer aDestinationBuffer, VkDeviceSize aSize);
-		void CreateBuffer(VkDeviceSize aSize, VkBufferUsageFlags aUsage, VkMemoryPropertyFlags aProperties, VkBuffer& aBuffer, VkDeviceMemory& aBufferMemory);
+		void CopyBufferToImage(VkBuffer aBuffer, VkDeviceSize aOffset, VkImage aImage, u32 aWidth, u32 aHeight);
 
 		VkExtent2D myExtent;
 		VkFormat myFormat;
 		VkImage myImage;
 		VkImageView myImageView;
-		VkDeviceMemory myImageMemory;
+		MemoryAllocation* myAllocation;
 		ImageType myType;
 
 		string myFilePath;
@@ -74,6 +82,7 @@ namespace frostwave
 		VkSampleCountFlagBits myMSAASamples;
 
 		u32 myMipLevels;
+		UploadTicket myUploadTicket;
 	};
 }
 namespace fw = frostwave;
\ No newline at end of file
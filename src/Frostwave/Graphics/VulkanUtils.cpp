@@ -24,41 +24,6 @@ bool frostwave::HasStencilComponent(VkFormat aFormat)
 	return aFormat == VK_FORMAT_D32_SFLOAT_S8_UINT || aFormat == VK_FORMAT_D24_UNORM_S8_UINT;
 }
 
-VkCommandBuffer frostwave::BeginSingleTimeCommands(const VkFramework* aFramework)
-{
-	VkCommandBufferAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = aFramework->GetCommandPool();
-	allocInfo.commandBufferCount = 1;
-
-	VkCommandBuffer commandBuffer;
-	vkAllocateCommandBuffers(aFramework->GetDevice(), &allocInfo, &commandBuffer);
-
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-	vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-	return commandBuffer;
-}
-
-void frostwave::EndSingleTimeCommands(VkCommandBuffer aCommandBuffer, const VkFramework* aFramework)
-{
-	vkEndCommandBuffer(aCommandBuffer);
-
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &aCommandBuffer;
-
-	vkQueueSubmit(aFramework->GetGraphicsQueue(), 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(aFramework->GetGraphicsQueue());
-
-	vkFreeCommandBuffers(aFramework->GetDevice(), aFramework->GetCommandPool(), 1, &aCommandBuffer);
-}
-
 void frostwave::TransitionImageLayout(VkCommandBuffer aBuffer, VkImage aImage, VkImageLayout aOldLayout, VkImageLayout aNewLayout, 
 	VkImageSubresourceRange aSubresourceRange, VkPipelineStageFlags aSrcFlags, VkPipelineStageFlags aDstFlags)
 
@@ -14,10 +14,6 @@ namespace frostwave
 
 	bool HasStencilComponent(VkFormat aFormat);
 
-	VkCommandBuffer BeginSingleTimeCommands(const VkFramework* aFramework);
-
-	void EndSingleTimeCommands(VkCommandBuffer aCommandBuffer, const VkFramework* aFramework);
-
 	void TransitionImageLayout(VkCommandBuffer aBuffer, VkImage aImage, VkImageLayout aOldLayout, VkImageLayout aNewLayout, VkImageSubresourceRange aSubresourceRange, 
 		VkPipelineStageFlags aSrcFlags = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VkPipelineStageFlags aDstFlags = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
 
@@ -18,6 +18,7 @@ namespace frostwave
 		u32 width = 800;
 		u32 height = 600;
 		bool focusFreeze = true;
+		bool headless = false; // no window or swapchain, frames render offscreen at width x height
 	};
 
 	struct GraphicsSettings
@@ -39,6 +40,12 @@ namespace frostwave
 			Performance = (1 << 4)
 		};
 
+		enum GBufferLayout
+		{
+			GBufferStandard,	// RGBA16F position, normal and material, RGBA8 albedo
+			GBufferCompact		// position from depth, octahedral RG16F normal, RGBA8 albedo and material
+		};
+
 #ifdef _RETAIL
 		i32 validation = Off;
 		i32 validationType = None;
@@ -47,6 +54,23 @@ namespace frostwave
 		i32 validation = Verbose | Info | Warning | Error;
 #endif
 		bool vsync = false;
+		u32 recordingThreads = 0; // 0 = one per hardware thread
+		bool indirectDraw = false;
+		bool transferQueue = true; // uploads copy on a dedicated transfer queue family when the device has one
+		u32 stagingRingSize = 64 * 1024 * 1024; // bytes of persistently mapped staging memory every upload goes through
+		u32 defragmentBytesPerFrame = 4 * 1024 * 1024; // device memory the defragmenter may copy per frame, 0 turns it off
+		f32 memoryBudgetLimit = 0.9f; // share of a memory heap's budget past which the allocator's budget callbacks run
+		u32 framesInFlight = 2;
+		bool tiledLighting = false;
+		bool clusteredLighting = false;
+		bool lightVolumes = false;
+		bool lightScissors = false;
+		i32 gBufferLayout = GBufferStandard;
+		bool deferredSubpasses = false; // G-buffer and lighting as two subpasses of one render pass, not available with tiled lighting
+		bool dynamicResolution = false; // G-buffer and lighting render at a per frame scale that holds gpuFrameBudget, then get upscaled. Needs separate passes
+		f32 gpuFrameBudget = 16.0f; // milliseconds
+		f32 minRenderScale = 0.5f;
+		f32 upscaleSharpness = 0.0f; // 0 is plain bilinear, up to 1 for a sharpened upscale
 	};
 
 	struct Settings
@@ -72,7 +72,12 @@ void frostwave::ThreadPool::SetThreadCount(u32 aCount)
 	}
 }
 
-auto& frostwave::ThreadPool::GetThreads()
+u32 frostwave::ThreadPool::GetThreadCount() const
+{
+	return (u32)myThreads.size();
+}
+
+std::vector<std::unique_ptr<frostwave::Thread>>& frostwave::ThreadPool::GetThreads()
 {
 	return myThreads;
 }
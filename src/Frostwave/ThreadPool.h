@@ -33,7 +33,8 @@ namespace frostwave
 		~ThreadPool();
 
 		void SetThreadCount(u32 aCount);
-		auto& GetThreads();
+		u32 GetThreadCount() const;
+		std::vector<std::unique_ptr<Thread>>& GetThreads();
 		void Wait();
 
 	private:
@@ -1,11 +1,75 @@
 #include <Frostwave/Engine.h>
 #include <Frostwave/Graphics/VkFramework.h>
+#include <Frostwave/Graphics/LightClusterer.h>
+#include <Frostwave/Core/Random.h>
+
+// Times CPU light clustering on its own, no window or device needed
+void BenchmarkLightClustering(u32 aLightCount, u32 aIterations)
+{
+	fw::ThreadPool threadPool;
+	threadPool.SetThreadCount(fw::Max(std::thread::hardware_concurrency(), 1u));
+
+	fw::LightClusterer clusterer;
+	clusterer.Init(16, 9, 24, &threadPool);
+
+	fw::Camera camera;
+	camera.Init(90.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+	camera.SetPosition({ 0.0f, 2.0f, -10.0f });
+	camera.Update();
+
+	std::vector<PointLight> lights(aLightCount);
+	for (auto& light : lights)
+	{
+		light.position = { fw::RandomRange(-100.0f, 100.0f), fw::RandomRange(0.0f, 10.0f), fw::RandomRange(0.0f, 200.0f), 0.0f };
+		light.color = { 1.0f, 1.0f, 1.0f };
+		light.radius = fw::RandomRange(1.0f, 10.0f);
+	}
+
+	f32 total = 0.0f, best = FLT_MAX;
+	for (u32 i = 0; i < aIterations; ++i)
+	{
+		clusterer.Build(lights, camera.GetView(), camera.GetProjection());
+		total += clusterer.GetBuildTime();
+		best = fw::Min(best, clusterer.GetBuildTime());
+	}
+
+	INFO_LOG("Light clustering: %u lights, %u clusters, %u threads, %u indices | avg %.3fms, best %.3fms over %u runs",
+		aLightCount, clusterer.GetClusterCount(), threadPool.GetThreadCount(), (u32)clusterer.GetLightIndices().size(), total / aIterations, best, aIterations);
+}
+
+// True when aArg is a whole number, so optional numeric arguments aren't mistaken for the next flag
+bool ParseNumber(const char* aArg, u32& aOut)
+{
+	char* end = nullptr;
+	unsigned long value = strtoul(aArg, &end, 10);
+	if (end == aArg || *end != '\0' || aArg[0] == '-')
+	{
+		return false;
+	}
+
+	aOut = (u32)value;
+	return true;
+}
 
 int main(int argc, char** argv)
 {
 	fw::Logger::Create();
 	fw::Logger::SetLogLevel(fw::Logger::Level::All);
-	argc; argv;
+
+	// -benchlights <count> [iterations]
+	for (i32 i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-benchlights") == 0 && i + 1 < argc)
+		{
+			u32 iterations = 100;
+			if (i + 2 < argc)
+			{
+				ParseNumber(argv[i + 2], iterations);
+			}
+			BenchmarkLightClustering((u32)atoi(argv[i + 1]), fw::Max(iterations, 1u));
+			return 0;
+		}
+	}
 
 	fw::Settings settings;
 	settings.graphics.vsync = true;
@@ -18,6 +82,26 @@ int main(int argc, char** argv)
 	settings.window.title = "Frostwave";
 	settings.window.focusFreeze = false;
 
+	// -headless <frames> [width height], renders offscreen and logs timings, e.g. on lavapipe or SwiftShader in CI
+	for (i32 i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "-headless") == 0 && i + 1 < argc)
+		{
+			u32 width, height;
+			if (i + 3 < argc && ParseNumber(argv[i + 2], width) && ParseNumber(argv[i + 3], height))
+			{
+				settings.window.width = width;
+				settings.window.height = height;
+			}
+			settings.window.headless = true;
+
+			fw::Engine engine;
+			engine.Init(settings);
+			engine.RunFrames(fw::Max((u32)atoi(argv[i + 1]), 1u));
+			return 0;
+		}
+	}
+
 	fw::Engine engine;
 	engine.Init(settings);
 	engine.Run();